@@ -0,0 +1,327 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <functional>
+#include <memory>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include "textbuffer/piece_tree_base.h"
+#include "textbuffer/piece_tree_builder.h"
+#include "textbuffer/btree_piece_tree.h"
+
+using namespace textbuffer;
+
+// 红黑树与B+树两种后端的对比测试
+// 用法: backend_benchmark [最大piece数量]，默认测到一百万，传入10000000可测到一千万
+
+namespace {
+
+struct BackendResult {
+    double buildSeconds = 0;
+    double lineContentUs = 0;
+    double offsetAtUs = 0;
+    double charCodeUs = 0;
+    double getValueMs = 0;
+    double pieceWalkMs = 0;
+    double editUs = 0;
+    int64_t pieces = 0;
+    size_t contentHash = 0;
+};
+
+template <typename F>
+double measureUs(int count, F&& body) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < count; ++i) {
+        body();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / count;
+}
+
+int64_t countPieces(PieceTreeBase& buffer) {
+    return std::distance(buffer.pieceBegin(), buffer.pieceEnd());
+}
+
+// 正向、反向遍历以及从任意偏移开始的迭代器都应与forEachPiece给出相同的piece序列
+void checkPieceIterator(PieceTreeBase& buffer, std::mt19937& random) {
+    std::vector<Piece> expected;
+    std::vector<Offset> starts;
+    Offset offset = 0;
+    buffer.forEachPiece([&](const Piece& piece) {
+        expected.push_back(piece);
+        starts.push_back(offset);
+        offset += piece.length;
+        return true;
+    });
+
+    auto samePiece = [](const Piece& a, const Piece& b) {
+        return a.bufferIndex == b.bufferIndex && a.start == b.start && a.length == b.length;
+    };
+    size_t index = 0;
+    for (auto it = buffer.pieceBegin(); it != buffer.pieceEnd(); ++it, ++index) {
+        if (index >= expected.size() || !samePiece(*it, expected[index]) || it.offset() != starts[index]) {
+            throw std::runtime_error("forward piece iteration differs from forEachPiece");
+        }
+    }
+    for (auto it = buffer.pieceEnd(); it != buffer.pieceBegin();) {
+        --it;
+        --index;
+        if (!samePiece(*it, expected[index]) || it.offset() != starts[index]) {
+            throw std::runtime_error("backward piece iteration differs from forEachPiece");
+        }
+    }
+    for (int i = 0; i < 1000; ++i) {
+        Offset target = random() % buffer.getLength();
+        auto it = buffer.pieceAt(target);
+        if (it == buffer.pieceEnd() || it.offset() > target || it.offset() + it->length <= target) {
+            throw std::runtime_error("pieceAt returned a piece not holding the offset");
+        }
+    }
+}
+
+// 按行读取原始内容：与getValue中对应的一段一致，含行尾，endOffset去掉行尾
+void checkRawLines(PieceTreeBase& buffer, std::mt19937& random) {
+    std::string value = buffer.getValue();
+    if (buffer.getLinesRawContent() != value) {
+        throw std::runtime_error("getLinesRawContent differs from getValue");
+    }
+    for (int i = 0; i < 1000; ++i) {
+        Offset line = random() % buffer.getLineCount();
+        Offset start = buffer.getOffsetAt(line, 0);
+        Offset end = line + 1 < buffer.getLineCount() ? buffer.getOffsetAt(line + 1, 0) : buffer.getLength();
+        Offset contentEnd = start + buffer.getLineLength(line);
+        if (buffer.getLineRawContent(line + 1) != value.substr(start, end - start) ||
+            buffer.getLineRawContent(line + 1, end - contentEnd) != value.substr(start, contentEnd - start)) {
+            throw std::runtime_error("getLineRawContent differs from getValue");
+        }
+    }
+}
+
+std::string makeBaseText() {
+    std::string text;
+    for (int i = 0; i < 2000; ++i) {
+        text += "line " + std::to_string(i) + " of the base document\n";
+    }
+    return text;
+}
+
+BackendResult runBackend(PieceTreeBackend backend, int64_t targetPieces) {
+    BackendResult result;
+    std::mt19937 random(7);
+    const int lookups = 20000;
+    const int edits = 100000;
+
+    PieceTreeTextBufferBuilder builder;
+    builder.acceptChunk(makeBaseText());
+    auto buffer = builder.finish().create(DefaultEndOfLine::LF, backend);
+
+    // 在随机位置插入短文本来拆分piece，每次插入约增加1.5个piece
+    // 两种后端执行完全相同的编辑序列，最终文档应一致
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int64_t i = 0; i < targetPieces * 2 / 3; ++i) {
+        int32_t pos = random() % (buffer->getLength() + 1);
+        buffer->insert(pos, (i & 7) == 0 ? "a\n" : "ab", false);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    result.buildSeconds = std::chrono::duration<double>(end - start).count();
+    result.pieces = countPieces(*buffer);
+    checkPieceIterator(*buffer, random);
+    checkRawLines(*buffer, random);
+
+    // 随机访问
+    int32_t lineCount = buffer->getLineCount();
+    int32_t length = buffer->getLength();
+    volatile size_t sink = 0;
+    result.lineContentUs = measureUs(lookups, [&]() {
+        sink += buffer->getLineContent(random() % lineCount).size();
+    });
+    result.offsetAtUs = measureUs(lookups, [&]() {
+        sink += buffer->getOffsetAt(random() % lineCount, 0);
+    });
+    result.charCodeUs = measureUs(lookups, [&]() {
+        sink += buffer->getCharCode(random() % length);
+    });
+
+    // 顺序读取
+    std::string value;
+    result.getValueMs = measureUs(3, [&]() {
+        value = buffer->getValue();
+    }) / 1000;
+    result.pieceWalkMs = measureUs(3, [&]() {
+        for (const Piece& piece : buffer->pieces()) {
+            sink += piece.length;
+        }
+    }) / 1000;
+
+    // 随机编辑，插入与删除数量相同以保持piece数量稳定
+    result.editUs = measureUs(edits, [&]() {
+        buffer->insert(random() % (buffer->getLength() + 1), "x", false);
+        buffer->deleteText(random() % buffer->getLength(), 1);
+    }) / 2;
+
+    result.contentHash = std::hash<std::string>()(buffer->getValue());
+    return result;
+}
+
+struct TraceEdit {
+    bool insert;
+    int64_t offset;
+    std::string text;  // inserted text
+    int64_t count;     // deleted length
+};
+
+// 模拟一段编辑会话：在光标处连续输入和退格、跳到别处输入后撤销、剪切一段再粘贴
+std::vector<TraceEdit> makeEditingTrace(int64_t documentLength, int edits) {
+    std::mt19937 random(11);
+    std::vector<TraceEdit> trace;
+    int64_t length = documentLength;
+    int64_t cursor = 0;
+    while (static_cast<int>(trace.size()) < edits) {
+        int action = random() % 10;
+        if (action < 6) {
+            // 输入一个词，偶尔退格
+            int words = 1 + random() % 8;
+            for (int i = 0; i < words; i++) {
+                trace.push_back({true, cursor, (i & 3) == 3 ? "\n" : "w", 0});
+                cursor++;
+                length++;
+                if (random() % 5 == 0) {
+                    trace.push_back({false, cursor - 1, "", 1});
+                    cursor--;
+                    length--;
+                }
+            }
+        } else if (action < 8) {
+            // 跳到别处输入一段后撤销
+            cursor = random() % (length + 1);
+            std::string word = "tmp" + std::to_string(random() % 1000);
+            trace.push_back({true, cursor, word, 0});
+            trace.push_back({false, cursor, "", static_cast<int64_t>(word.length())});
+        } else if (length > 200) {
+            // 剪切一段文本并粘贴到别处
+            int64_t count = 1 + random() % 100;
+            int64_t from = random() % (length - count);
+            trace.push_back({false, from, "", count});
+            length -= count;
+            cursor = random() % (length + 1);
+            trace.push_back({true, cursor, std::string(count, 'p'), 0});
+            length += count;
+        }
+    }
+    return trace;
+}
+
+// 回放编辑序列，报告合并相邻piece前后的piece数量和树高
+void runTraceReplay(PieceTreeBackend backend, const char* name, const std::vector<TraceEdit>& trace) {
+    int64_t pieces[4] = {};
+    int32_t heights[4] = {};
+    double seconds[4] = {};
+    size_t hashes[2] = {};
+    for (int merging = 0; merging < 2; merging++) {
+        PieceTreeTextBufferBuilder builder;
+        builder.acceptChunk(makeBaseText());
+        auto buffer = builder.finish().create(DefaultEndOfLine::LF, backend);
+        buffer->setPieceMerging(merging == 1);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const TraceEdit& edit : trace) {
+            if (edit.insert) {
+                buffer->insert(edit.offset, edit.text, false);
+            } else {
+                buffer->deleteText(edit.offset, edit.count);
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        seconds[merging] = std::chrono::duration<double>(end - start).count();
+        pieces[merging] = buffer->getPieceCount();
+        heights[merging] = buffer->getHeight();
+        hashes[merging] = std::hash<std::string>()(buffer->getValue());
+
+        if (merging == 1) {
+            start = std::chrono::high_resolution_clock::now();
+            buffer->defragment();
+            end = std::chrono::high_resolution_clock::now();
+            seconds[2] = std::chrono::duration<double>(end - start).count();
+            pieces[2] = buffer->getPieceCount();
+            heights[2] = buffer->getHeight();
+            // 压缩后相邻的编辑文本在新缓冲区中连续，可以继续合并
+            start = std::chrono::high_resolution_clock::now();
+            buffer->compactBuffers();
+            end = std::chrono::high_resolution_clock::now();
+            seconds[3] = std::chrono::duration<double>(end - start).count();
+            pieces[3] = buffer->getPieceCount();
+            heights[3] = buffer->getHeight();
+            if (std::hash<std::string>()(buffer->getValue()) != hashes[1]) {
+                throw std::runtime_error("defragment or compaction changed the document");
+            }
+        }
+    }
+    if (hashes[0] != hashes[1]) {
+        throw std::runtime_error("piece merging changed the document");
+    }
+
+    std::cout << "  " << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(2)
+              << " no merging: " << std::setw(7) << pieces[0] << " pieces, height " << std::setw(2) << heights[0]
+              << ", " << seconds[0] << " s"
+              << " | online merging: " << std::setw(7) << pieces[1] << " pieces, height " << std::setw(2) << heights[1]
+              << ", " << seconds[1] << " s"
+              << " | + defragment: " << std::setw(7) << pieces[2] << " pieces, height " << std::setw(2) << heights[2]
+              << ", " << seconds[2] * 1000 << " ms"
+              << " | + compaction: " << std::setw(7) << pieces[3] << " pieces, height " << std::setw(2) << heights[3]
+              << ", " << seconds[3] * 1000 << " ms" << std::endl;
+}
+
+void printRow(const char* name, const BackendResult& r) {
+    std::cout << "  " << std::left << std::setw(8) << name << std::right << std::fixed
+              << std::setprecision(2)
+              << " build=" << std::setw(7) << r.buildSeconds << " s"
+              << "  getLineContent=" << std::setw(6) << r.lineContentUs << " us"
+              << "  getOffsetAt=" << std::setw(6) << r.offsetAtUs << " us"
+              << "  getCharCode=" << std::setw(6) << r.charCodeUs << " us"
+              << "  getValue=" << std::setw(8) << r.getValueMs << " ms"
+              << "  pieceWalk=" << std::setw(8) << r.pieceWalkMs << " ms"
+              << "  edit=" << std::setw(6) << r.editUs << " us" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int64_t maxPieces = argc > 1 ? std::atoll(argv[1]) : 1000000;
+    const int traceEdits = 200000;
+
+    try {
+        std::cout << "=== Red-black tree vs B+-tree piece tree ===\n";
+        for (int64_t target = 10000; target <= maxPieces; target *= 10) {
+            BackendResult rb = runBackend(PieceTreeBackend::RedBlackTree, target);
+            BackendResult bt = runBackend(PieceTreeBackend::BTree, target);
+
+            std::cout << "\npieces ~" << target << " (rb " << rb.pieces << ", btree " << bt.pieces << ")\n";
+            printRow("rbtree", rb);
+            printRow("btree", bt);
+            std::cout << "  btree speedup: getLineContent x" << std::setprecision(2)
+                      << rb.lineContentUs / bt.lineContentUs
+                      << "  getOffsetAt x" << rb.offsetAtUs / bt.offsetAtUs
+                      << "  getCharCode x" << rb.charCodeUs / bt.charCodeUs
+                      << "  getValue x" << rb.getValueMs / bt.getValueMs
+                      << "  edit x" << rb.editUs / bt.editUs << std::endl;
+
+            if (rb.contentHash != bt.contentHash) {
+                throw std::runtime_error("backends produced different documents");
+            }
+        }
+
+        std::cout << "\n=== Replayed editing trace (" << traceEdits << " edits) ===\n";
+        std::vector<TraceEdit> trace = makeEditingTrace(makeBaseText().length(), traceEdits);
+        runTraceReplay(PieceTreeBackend::RedBlackTree, "rbtree", trace);
+        runTraceReplay(PieceTreeBackend::BTree, "btree", trace);
+
+        std::cout << "\n=== Backend benchmark completed ===\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed with exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,109 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include "textbuffer/piece_tree_builder.h"
+
+using namespace textbuffer;
+
+// 全部替换的测试：逐个调用deleteText/insert与一次applyEdits的对比
+// 用法: batch_edit_benchmark [匹配数]，默认十万处
+
+namespace {
+
+std::string makeDocument(int64_t matches) {
+    std::string text;
+    for (int64_t i = 0; i < matches; i++) {
+        text += "call oldName(" + std::to_string(i) + ");\n";
+        if (i % 4 == 0) {
+            text += "    // nothing to replace on this line\n";
+        }
+    }
+    return text;
+}
+
+std::vector<TextEdit> findAll(PieceTreeBase& tree, const std::string& needle, const std::string& replacement) {
+    std::vector<TextEdit> edits;
+    std::string text = tree.getValue();
+    for (size_t pos = text.find(needle); pos != std::string::npos; pos = text.find(needle, pos + needle.size())) {
+        edits.emplace_back(pos, needle.size(), replacement);
+    }
+    return edits;
+}
+
+std::unique_ptr<PieceTreeBase> createTree(const std::string& text, PieceTreeBackend backend) {
+    PieceTreeTextBufferBuilder builder;
+    builder.acceptChunk(text);
+    return builder.finish().create(DefaultEndOfLine::LF, backend);
+}
+
+template <typename F>
+double measureMs(F&& body) {
+    auto start = std::chrono::high_resolution_clock::now();
+    body();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int64_t maxMatches = argc > 1 ? std::atoll(argv[1]) : 100000;
+
+    try {
+        std::cout << "=== Replace all: one edit at a time vs applyEdits ===\n";
+        for (PieceTreeBackend backend : {PieceTreeBackend::RedBlackTree, PieceTreeBackend::BTree}) {
+            for (int64_t matches = 1000; matches <= maxMatches; matches *= 10) {
+                std::string text = makeDocument(matches);
+                std::string expected = text;
+                for (size_t pos = expected.find("oldName"); pos != std::string::npos;
+                     pos = expected.find("oldName", pos + 7)) {
+                    expected.replace(pos, 7, "renamedFunction");
+                }
+
+                // 从后往前替换，前面的偏移不受影响
+                auto single = createTree(text, backend);
+                std::vector<TextEdit> edits = findAll(*single, "oldName", "renamedFunction");
+                double singleMs = measureMs([&]() {
+                    for (auto edit = edits.rbegin(); edit != edits.rend(); ++edit) {
+                        single->deleteText(edit->offset, edit->length);
+                        single->insert(edit->offset, edit->text, false);
+                    }
+                });
+
+                auto batch = createTree(text, backend);
+                std::vector<TextEdit> inverse;
+                double batchMs = measureMs([&]() {
+                    inverse = batch->applyEdits(edits);
+                });
+
+                if (single->getValue() != expected || batch->getValue() != expected ||
+                    batch->getLineCount() != single->getLineCount()) {
+                    throw std::runtime_error("replace all produced a different document");
+                }
+
+                double undoMs = measureMs([&]() {
+                    batch->applyEdits(inverse);
+                });
+                if (batch->getValue() != text) {
+                    throw std::runtime_error("inverse edits did not restore the document");
+                }
+
+                std::cout << (backend == PieceTreeBackend::RedBlackTree ? "  rb-tree " : "  b-tree  ") << std::setw(7)
+                          << edits.size() << " matches" << std::fixed << std::setprecision(2)
+                          << "  one by one=" << std::setw(9) << singleMs << " ms"
+                          << "  applyEdits=" << std::setw(8) << batchMs << " ms"
+                          << "  undo=" << std::setw(8) << undoMs << " ms"
+                          << "  speedup x" << singleMs / batchMs << std::endl;
+            }
+        }
+        std::cout << "\n=== Batch edit benchmark completed ===\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed with exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,265 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include <random>
+#include <regex>
+#include "textbuffer/piece_tree_builder.h"
+
+using namespace textbuffer;
+
+// 行尾规范化测试：单遍的EOLNormalizer须与原来的正则替换结果一致（包括跨块的\r\n），
+// 并比较正则替换、单遍规范化和以LF规范化打开CRLF文档的吞吐量
+// 用法: eol_normalize_benchmark [文本大小MB]，默认256MB
+
+namespace {
+
+// 原来工厂中使用的正则替换，作为对照
+std::string regexNormalize(const std::string& text, const std::string& eol) {
+    std::regex newlinePattern("\r\n|\r|\n");
+    return std::regex_replace(text, newlinePattern, eol);
+}
+
+const char* kernelName(LineScanKernel kernel) {
+    switch (kernel) {
+    case LineScanKernel::SSE2:
+        return "sse2  ";
+    case LineScanKernel::AVX2:
+        return "avx2  ";
+    default:
+        return "scalar";
+    }
+}
+
+std::vector<LineScanKernel> supportedKernels() {
+    std::vector<LineScanKernel> kernels;
+    for (LineScanKernel kernel : {LineScanKernel::Scalar, LineScanKernel::SSE2, LineScanKernel::AVX2}) {
+        if (isLineScanKernelSupported(kernel)) {
+            kernels.push_back(kernel);
+        }
+    }
+    return kernels;
+}
+
+void expect(bool condition, const std::string& what) {
+    if (!condition) {
+        throw std::runtime_error(what);
+    }
+}
+
+std::string makeRandomText(std::mt19937& random, size_t length) {
+    const char alphabet[] = {'a', 'b', '\r', '\n', '\r', '\n', ' ', '\xc3', '\xa9'};
+    std::string text;
+    for (size_t i = 0; i < length; i++) {
+        text += alphabet[random() % sizeof(alphabet)];
+    }
+    return text;
+}
+
+// 随机切成若干块喂给规范化器，块的边界经常落在\r和\n之间
+void runCorrectnessTests() {
+    std::mt19937 random(3);
+    int checks = 0;
+    for (int round = 0; round < 2000; round++) {
+        std::string text = makeRandomText(random, random() % 300);
+        for (const std::string eol : {"\n", "\r\n", "\r"}) {
+            std::string want = regexNormalize(text, eol);
+            std::vector<Offset> wantStarts = createLineStartsFast(want);
+            for (LineScanKernel kernel : supportedKernels()) {
+                setLineScanKernel(kernel);
+                std::string where = std::string(kernelName(kernel)) + " round " + std::to_string(round);
+                expect(normalizeEOL(text, eol) == want, where + ": normalizeEOL differs");
+
+                EOLNormalizer normalizer(eol);
+                std::string got;
+                std::vector<Offset> starts = {0};
+                size_t pos = 0;
+                while (pos < text.size()) {
+                    size_t length = std::min<size_t>(text.size() - pos, random() % 40);
+                    normalizer.append(std::string_view(text).substr(pos, length), got, &starts);
+                    pos += length;
+                }
+                normalizer.finish(got, &starts);
+                expect(got == want, where + ": pieces normalize differently");
+                // 同时记录的行首须与扫描规范化结果得到的一致
+                expect(starts == wantStarts, where + ": line starts differ");
+                checks++;
+            }
+        }
+    }
+    std::cout << "  " << checks << " normalizations match the regex replacement" << std::endl;
+}
+
+// 工厂打开时的规范化：块边界上的\r\n、只需部分改写的块、末尾的\r
+void runFactoryTests() {
+    std::mt19937 random(5);
+    int checks = 0;
+    for (int round = 0; round < 300; round++) {
+        std::string text = makeRandomText(random, random() % 2000);
+        for (DefaultEndOfLine defaultEOL : {DefaultEndOfLine::LF, DefaultEndOfLine::CRLF}) {
+            PieceTreeTextBufferBuilder builder;
+            size_t pos = 0;
+            size_t firstChunk = 0;
+            while (pos < text.size()) {
+                size_t length = std::min<size_t>(text.size() - pos, 1 + random() % 100);
+                builder.acceptChunk(text.substr(pos, length));
+                pos += length;
+                firstChunk = firstChunk > 0 ? firstChunk : length;
+            }
+            PieceTreeTextBufferFactory factory = builder.finish(true);
+            std::string eol = factory.getEOL(defaultEOL);
+            auto tree = factory.create(defaultEOL);
+            std::string want = regexNormalize(text, eol);
+            expect(tree->getValue() == want, "factory normalization differs in round " + std::to_string(round));
+            expect(tree->getLineCount() == static_cast<Offset>(createLineStartsFast(want).size()),
+                   "line count differs in round " + std::to_string(round));
+
+            // 首行只在第一个块中找
+            std::string firstLine = text.substr(0, std::min<size_t>(firstChunk, 100));
+            firstLine = firstLine.substr(0, firstLine.find_first_of("\r\n"));
+            expect(factory.getFirstLineText(100) == firstLine, "first line differs");
+
+            // 读取时转换为另一种EOL
+            std::string other = eol == "\n" ? "\r\n" : "\n";
+            Offset lastLine = tree->getLineCount() - 1;
+            common::Range all(0, 0, lastLine, tree->getLineLength(lastLine));
+            expect(tree->getValueInRange(all, other) == regexNormalize(tree->getValueInRange(all), other),
+                   "getValueInRange differs");
+            checks++;
+        }
+    }
+    std::cout << "  " << checks << " factory loads match the regex replacement" << std::endl;
+}
+
+// setEOL改写未规范化打开的文档：混合换行、插入造成的跨片\r\n，两种后端
+void runSetEOLTests() {
+    std::mt19937 random(11);
+    int checks = 0;
+    for (int round = 0; round < 300; round++) {
+        std::string text = makeRandomText(random, random() % 2000);
+        for (PieceTreeBackend backend : {PieceTreeBackend::RedBlackTree, PieceTreeBackend::BTree}) {
+            PieceTreeTextBufferBuilder builder;
+            builder.acceptChunk(text);
+            auto tree = builder.finish(false).create(DefaultEndOfLine::LF, backend);
+            for (int edit = 0; edit < 5; edit++) {
+                std::string value = makeRandomText(random, random() % 10);
+                tree->insert(static_cast<Offset>(random() % (tree->getLength() + 1)), value, false);
+            }
+            for (const std::string eol : {"\n", "\r\n"}) {
+                std::string want = regexNormalize(tree->getValue(), eol);
+                tree->setEOL(eol);
+                std::string where = " in round " + std::to_string(round);
+                expect(tree->getValue() == want, "setEOL result differs" + where);
+                expect(tree->getLineCount() == static_cast<Offset>(createLineStartsFast(want).size()),
+                       "line count after setEOL differs" + where);
+                checks++;
+            }
+        }
+    }
+    std::cout << "  " << checks << " setEOL rewrites match the regex replacement" << std::endl;
+}
+
+// 各行轮流使用eols中的行尾
+std::string makeDocument(size_t bytes, const std::vector<std::string>& eols) {
+    std::mt19937 random(7);
+    std::string text;
+    text.reserve(bytes + 200);
+    for (size_t line = 0; text.size() < bytes; line++) {
+        size_t length = random() % 80;
+        for (size_t i = 0; i < length; i++) {
+            text += static_cast<char>('a' + (i * 7 + text.size()) % 26);
+        }
+        text += eols[line % eols.size()];
+    }
+    return text;
+}
+
+template <typename F>
+double measureGBs(size_t bytes, F&& body) {
+    double best = 1e100;
+    for (int run = 0; run < 3; run++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        body();
+        auto end = std::chrono::high_resolution_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    return bytes / best / 1e9;
+}
+
+void runThroughputBenchmark(size_t megabytes) {
+    volatile size_t sink = 0;
+    std::cout << std::fixed << std::setprecision(2);
+
+    // 正则太慢，只用16MB测
+    std::string small = makeDocument(16 * 1024 * 1024, {"\r\n"});
+    double regex = measureGBs(small.size(), [&]() {
+        sink += regexNormalize(small, "\n").size();
+    });
+    std::cout << "  regex_replace CRLF -> LF         " << std::setw(6) << regex << " GB/s (16 MB)" << std::endl;
+
+    std::string text = makeDocument(megabytes * 1024 * 1024, {"\r\n"});
+    for (LineScanKernel kernel : supportedKernels()) {
+        setLineScanKernel(kernel);
+        double toLF = measureGBs(text.size(), [&]() {
+            sink += normalizeEOL(text, "\n").size();
+        });
+        double toCRLF = measureGBs(text.size(), [&]() {
+            sink += normalizeEOL(text, "\r\n").size();
+        });
+        std::cout << "  " << kernelName(kernel) << " normalizeEOL CRLF -> LF   " << std::setw(6) << toLF
+                  << " GB/s   CRLF -> CRLF " << std::setw(6) << toCRLF << " GB/s  (" << std::setprecision(1)
+                  << toLF / regex << "x regex)" << std::setprecision(2) << std::endl;
+    }
+    double copy = measureGBs(text.size(), [&]() {
+        std::string copied = text;
+        sink += copied.size();
+    });
+    std::cout << "  plain copy                       " << std::setw(6) << copy << " GB/s" << std::endl;
+
+    // 三分之一的行是CRLF、其余是LF的文档，多数决定以LF打开，每个块都要改写
+    text = makeDocument(megabytes * 1024 * 1024, {"\n", "\r\n", "\n"});
+    PieceTreeTextBufferBuilder builder;
+    const size_t chunkSize = 64 * 1024 * 1024;
+    for (size_t pos = 0; pos < text.size(); pos += chunkSize) {
+        builder.acceptChunk(text.substr(pos, chunkSize));
+    }
+    PieceTreeTextBufferFactory factory = builder.finish(true);
+    expect(factory.getEOL(DefaultEndOfLine::CRLF) == "\n", "the document should open with LF");
+    for (LineScanKernel kernel : supportedKernels()) {
+        setLineScanKernel(kernel);
+        double open = measureGBs(text.size(), [&]() {
+            sink += factory.create(DefaultEndOfLine::LF)->getLength();
+        });
+        std::cout << "  " << kernelName(kernel) << " factory create, CRLF -> LF     " << std::setw(6) << open
+                  << " GB/s" << std::endl;
+    }
+    std::cout << std::defaultfloat;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t megabytes = argc > 1 ? std::atoll(argv[1]) : 256;
+    LineScanKernel detected = getLineScanKernel();
+
+    try {
+        std::cout << "=== EOL normalization ===\n";
+        runCorrectnessTests();
+        runFactoryTests();
+        runSetEOLTests();
+        setLineScanKernel(detected);
+
+        std::cout << "\n=== Throughput (" << megabytes << " MB) ===\n";
+        runThroughputBenchmark(megabytes);
+
+        setLineScanKernel(detected);
+        std::cout << "\n=== EOL normalization benchmark completed ===\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed with exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -10,8 +10,11 @@
 #include <memory>
 #include <fstream>
 #include <iomanip>
+#include <stdexcept>
+#include <thread>
 #include "textbuffer/piece_tree_base.h"
 #include "textbuffer/piece_tree_builder.h"
+#include "textbuffer/btree_piece_tree.h"
 
 using namespace textbuffer;
 
@@ -140,6 +143,57 @@ void test_large_file_loading(const std::string& large_text) {
     }
 }
 
+// 测试并行扫描行首的加载吞吐量：从1个线程到全部硬件线程
+void test_parallel_loading_scaling(const std::string& large_text) {
+    std::cout << "\n=== Testing Parallel Load Scaling ===\n";
+
+    // 和上面一样按50MB分块，分块在计时之外完成
+    const size_t chunk_size = 50 * 1024 * 1024;
+    std::vector<std::string> pieces;
+    for (size_t offset = 0; offset < large_text.size(); offset += chunk_size) {
+        pieces.push_back(large_text.substr(offset, chunk_size));
+    }
+
+    unsigned hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> thread_counts;
+    for (unsigned n = 1; n < hardware_threads; n *= 2) {
+        thread_counts.push_back(n);
+    }
+    thread_counts.push_back(hardware_threads);
+    std::cout << "Hardware threads: " << hardware_threads << std::endl;
+
+    double serial_ms = 0;
+    int64_t serial_lines = -1;
+    std::string serial_middle;
+    for (unsigned threads : thread_counts) {
+        auto start = std::chrono::high_resolution_clock::now();
+        PieceTreeTextBufferBuilder builder(threads);
+        for (const std::string& piece : pieces) {
+            builder.acceptChunk(piece);
+        }
+        auto factory = builder.finish();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        auto buffer = factory.create(DefaultEndOfLine::LF);
+        int64_t lines = buffer->getLineCount();
+        std::string middle = buffer->getLineContent(lines / 2);
+        if (serial_lines < 0) {
+            serial_ms = ms;
+            serial_lines = lines;
+            serial_middle = middle;
+        }
+        // 并行构建的结果须与串行构建一致
+        assert(lines == serial_lines && buffer->getLength() == static_cast<int64_t>(large_text.size()));
+        if (lines != serial_lines || middle != serial_middle) {
+            throw std::runtime_error("parallel build differs from the serial one");
+        }
+        std::cout << std::setw(3) << threads << " threads: " << std::fixed << std::setprecision(1) << std::setw(8)
+                  << ms << " ms, " << std::setw(7) << large_text.size() / (1024.0 * 1024.0) / (ms / 1000.0)
+                  << " MB/s, speedup " << std::setprecision(2) << serial_ms / ms << "x" << std::endl;
+        std::cout << std::defaultfloat;
+    }
+}
+
 // 测试大文件的读取性能
 void test_large_file_reading(std::unique_ptr<PieceTreeBase>& buffer) {
     std::cout << "\n=== Testing Large File Reading ===\n";
@@ -291,24 +345,269 @@ void test_large_file_snapshot(std::unique_ptr<PieceTreeBase>& buffer) {
     std::cout << "Snapshot content length verified: " << snapshotContent.length() << " characters" << std::endl;
 }
 
+void print_buffer_memory(const std::string& label, const BufferMemoryStats& stats) {
+    std::cout << label << ": " << stats.totalBytes / (1024 * 1024) << " MB in buffers, "
+              << stats.editBytes / 1024 << " KB of edits, " << stats.deadBytes / 1024 << " KB dead ("
+              << std::fixed << std::setprecision(1) << stats.deadRatio() * 100 << "%)" << std::endl;
+}
+
+// 测试变更缓冲区的垃圾回收：长时间的宏编辑会把删除掉的文本留在变更缓冲区中
+void test_change_buffer_compaction(std::unique_ptr<PieceTreeBase>& buffer) {
+    std::cout << "\n=== Testing Change Buffer Compaction ===\n";
+    RandomGenerator random(7);
+    const int macro_edits = 100000;
+
+    // 每次在随机位置输入一行再删掉其中大部分，只留下开头几个字符
+    auto run_macro_edits = [&]() {
+        for (int i = 0; i < macro_edits; i++) {
+            int64_t pos = random.random_number(0, buffer->getLength() - 1);
+            std::string text = "macro_edit_" + std::to_string(i) + "\n";
+            buffer->insert(pos, text, false);
+            buffer->deleteText(pos + 2, text.length() - 2);
+        }
+    };
+
+    {
+        Timer timer("Macro edits (" + std::to_string(macro_edits) + " insert/delete pairs)");
+        run_macro_edits();
+    }
+    size_t hash_before = std::hash<std::string>()(buffer->getValue());
+    BufferMemoryStats before = buffer->getBufferMemoryStats();
+    print_buffer_memory("Before compaction", before);
+
+    size_t reclaimed;
+    {
+        Timer timer("Compacting buffers");
+        reclaimed = buffer->compactBuffers();
+    }
+    BufferMemoryStats after = buffer->getBufferMemoryStats();
+    print_buffer_memory("After compaction", after);
+    std::cout << "Reclaimed " << reclaimed / 1024 << " KB" << std::endl;
+
+    assert(std::hash<std::string>()(buffer->getValue()) == hash_before);
+    if (std::hash<std::string>()(buffer->getValue()) != hash_before || after.deadBytes >= before.deadBytes) {
+        throw std::runtime_error("compaction changed the document or freed nothing");
+    }
+
+    // 设置阈值后，编辑过程中自动回收
+    buffer->setCompactionThreshold(0.1, 64 * 1024);
+    {
+        Timer timer("Macro edits with a 10% compaction threshold");
+        run_macro_edits();
+    }
+    BufferMemoryStats bounded = buffer->getBufferMemoryStats();
+    print_buffer_memory("With threshold", bounded);
+    std::cout << "Reclaimed in total " << buffer->getReclaimedBytes() / 1024 << " KB" << std::endl;
+    buffer->setCompactionThreshold(0);
+}
+
+// 读取/proc中以kB为单位的字段，不可用时返回-1
+int64_t read_proc_kb(const std::string& path, const std::string& key) {
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, key.size(), key) == 0) {
+            return std::stoll(line.substr(key.size()));
+        }
+    }
+    return -1;
+}
+
 // 测试程序内存使用情况
 void report_memory_usage() {
     std::cout << "\n=== Memory Usage Report ===\n";
-    
-    // 在此处输出当前内存使用的简单指示 - 使用内存分配器统计
-    size_t currently_allocated = 0;
-    
-    // 记录当前已分配内存的近似值
-    try {
-        // 尝试分配10MB内存来测试可用内存（不精确但简单）
-        std::vector<char> test_allocation(10 * 1024 * 1024);
-        std::cout << "Memory allocation test: Successfully allocated 10MB" << std::endl;
+
+    int64_t rss_kb = read_proc_kb("/proc/self/status", "VmRSS:");
+    if (rss_kb >= 0) {
+        std::cout << "Resident memory: " << rss_kb / 1024 << "MB" << std::endl;
+    } else {
+        std::cout << "Note: For precise memory usage monitoring, please use an external tool." << std::endl;
     }
-    catch (const std::bad_alloc&) {
-        std::cout << "Memory allocation test: Failed to allocate 10MB" << std::endl;
+}
+
+// 与TreeNode布局相同的结构，用于比较32位与64位偏移量下的元数据大小
+template <typename T>
+struct TreeNodeLayout {
+    void* parent;
+    void* left;
+    void* right;
+    NodeColor color;
+    struct {
+        int32_t bufferIndex;
+        T startLine, startColumn, endLine, endColumn;
+        T length, lineFeedCnt;
+    } piece;
+    T sizeLeft, lfLeft;
+};
+static_assert(sizeof(TreeNodeLayout<Offset>) == sizeof(TreeNode), "TreeNodeLayout must mirror TreeNode");
+
+// 报告当前偏移量宽度下的元数据开销，并与32位模式对比
+void report_offset_overhead(PieceTreeBase& buffer) {
+    std::cout << "\n=== Offset Width Overhead Report ===\n";
+
+    int64_t pieces = 0;
+    buffer.forEachPiece([&](const Piece&) {
+        pieces++;
+        return true;
+    });
+    // 行首已按紧凑编码存放，这里仍按普通数组比较两种宽度
+    BufferMemoryStats stats = buffer.getBufferMemoryStats();
+    int64_t line_starts = stats.lineStarts;
+
+    double mb = 1024.0 * 1024.0;
+    double nodes_now = pieces * sizeof(TreeNodeLayout<Offset>) / mb;
+    double nodes_32 = pieces * sizeof(TreeNodeLayout<int32_t>) / mb;
+    double starts_now = line_starts * sizeof(Offset) / mb;
+    double starts_32 = line_starts * sizeof(int32_t) / mb;
+
+    std::cout << "Offset width: " << sizeof(Offset) * 8 << "-bit" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Tree node: " << sizeof(TreeNodeLayout<Offset>) << " bytes (32-bit mode: "
+              << sizeof(TreeNodeLayout<int32_t>) << " bytes), " << pieces << " pieces = " << nodes_now
+              << "MB (32-bit mode: " << nodes_32 << "MB)" << std::endl;
+    std::cout << "Line starts: " << line_starts << " entries = " << starts_now << "MB as plain arrays (32-bit mode: "
+              << starts_32 << "MB), " << stats.lineStartBytes / mb << "MB compact" << std::endl;
+    std::cout << "Metadata overhead versus 32-bit mode: +" << (nodes_now + starts_now - nodes_32 - starts_32)
+              << "MB for " << buffer.getLength() / mb << "MB of text" << std::endl;
+    std::cout << std::defaultfloat;
+}
+
+// 报告行首占用的内存：紧凑编码与每个行首一个Offset的普通数组相比
+void report_line_start_memory(const std::string& label, PieceTreeBase& buffer) {
+    BufferMemoryStats stats = buffer.getBufferMemoryStats();
+    double mb = 1024.0 * 1024.0;
+    double plain = stats.lineStarts * sizeof(Offset) / mb;
+    double compact = stats.lineStartBytes / mb;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << label << ": " << stats.lineStarts << " line starts in " << compact << "MB ("
+              << static_cast<double>(stats.lineStartBytes) / stats.lineStarts << " bytes each), plain "
+              << sizeof(Offset) * 8 << "-bit arrays " << plain << "MB, saved " << plain - compact << "MB ("
+              << std::setprecision(1) << (1 - compact / plain) * 100 << "%)" << std::endl;
+    std::cout << std::defaultfloat;
+}
+
+// 测试行首的紧凑存放：64KB以下的块存为uint16_t，大块按块存差值，两种加载方式的内容须一致
+void test_line_start_memory() {
+    std::cout << "\n=== Testing Line Start Memory ===\n";
+    std::string text = create_large_text(256);
+
+    PieceTreeTextBufferBuilder whole_builder;
+    whole_builder.acceptChunk(text);
+    auto whole = whole_builder.finish().create(DefaultEndOfLine::LF);
+
+    PieceTreeTextBufferBuilder small_builder;
+    for (size_t offset = 0; offset < text.size(); offset += AverageBufferSize) {
+        small_builder.acceptChunk(text.substr(offset, AverageBufferSize));
     }
-    
-    std::cout << "Note: For precise memory usage monitoring, please use an external tool." << std::endl;
+    auto small = small_builder.finish().create(DefaultEndOfLine::LF);
+    text.clear();
+    text.shrink_to_fit();
+
+    report_line_start_memory("One 256MB chunk", *whole);
+    report_line_start_memory("64KB chunks", *small);
+
+    RandomGenerator random(11);
+    int64_t lines = whole->getLineCount();
+    bool same = small->getLineCount() == lines;
+    for (int i = 0; i < 10000 && same; i++) {
+        int64_t line = random.random_number(0, lines - 1);
+        same = whole->getLineContent(line) == small->getLineContent(line) &&
+               whole->getOffsetAt(line, 3) == small->getOffsetAt(line, 3);
+    }
+    assert(same);
+    if (!same) {
+        throw std::runtime_error("compact line starts read differently");
+    }
+    std::cout << "10000 random lines read the same from both" << std::endl;
+}
+
+// 测试超过4GB的文档，仅在64位偏移量模式下运行
+void test_over_4gb_buffer(PieceTreeBackend backend) {
+    const char* name = backend == PieceTreeBackend::BTree ? "B+-tree" : "red-black tree";
+    std::cout << "\n=== Testing >4GB Buffer (" << name << ") ===\n";
+    if (sizeof(Offset) < 8) {
+        std::cout << "Skipped: offsets are 32-bit, configure with -DTEXTBUFFER_64BIT_OFFSETS=ON" << std::endl;
+        return;
+    }
+
+    const int64_t chunk_size = 64LL * 1024 * 1024;
+    const int64_t total_size = 4LL * 1024 * 1024 * 1024 + 256LL * 1024 * 1024;
+    const int64_t line_length = 1000;
+    int64_t available_kb = read_proc_kb("/proc/meminfo", "MemAvailable:");
+    if (available_kb >= 0 && available_kb / 1024 < total_size / (1024 * 1024) + 512) {
+        std::cout << "Skipped: needs about " << total_size / (1024 * 1024) + 512 << "MB of free memory, "
+                  << available_kb / 1024 << "MB available" << std::endl;
+        return;
+    }
+
+    auto check = [](bool condition, const std::string& what) {
+        assert(condition);
+        if (!condition) {
+            throw std::runtime_error(">4GB buffer check failed: " + what);
+        }
+    };
+
+    Timer timer(">4GB buffer test");
+
+    // 按块直接生成文本并移入树中，避免整份文本的额外拷贝
+    std::vector<StringBuffer> chunks;
+    int64_t line_count = 0;
+    int64_t generated = 0;
+    while (generated < total_size) {
+        std::string text;
+        text.reserve(chunk_size);
+        while (static_cast<int64_t>(text.size()) + line_length <= chunk_size && generated < total_size) {
+            std::string line = "Line " + std::to_string(line_count++) + ": ";
+            line.resize(line_length - 1, 'x');
+            text += line;
+            text += '\n';
+            generated += line_length;
+        }
+        std::vector<Offset> line_starts = createLineStartsFast(text);
+        chunks.push_back(StringBuffer(std::move(text), std::move(line_starts)));
+    }
+
+    std::unique_ptr<PieceTreeBase> buffer;
+    if (backend == PieceTreeBackend::BTree) {
+        buffer = std::make_unique<BTreePieceTree>();
+    } else {
+        buffer = std::make_unique<PieceTreeBase>();
+    }
+    buffer->create(std::move(chunks), "\n", true);
+    report_memory_usage();
+
+    check(buffer->getLength() == generated, "length");
+    check(buffer->getLineCount() == line_count + 1, "line count");
+
+    // 4GB之后的行
+    int64_t last_line = line_count - 1;
+    int64_t last_line_offset = last_line * line_length;
+    check(last_line_offset > (1LL << 32), "test line beyond 4GB");
+    check(buffer->getOffsetAt(last_line, 0) == last_line_offset, "getOffsetAt beyond 4GB");
+    check(buffer->getLineContent(last_line).compare(0, 5 + std::to_string(last_line).size(),
+                                                    "Line " + std::to_string(last_line)) == 0,
+          "getLineContent beyond 4GB");
+    check(buffer->getLineLength(last_line) == line_length - 1, "getLineLength beyond 4GB");
+    check(buffer->getCharCode(last_line_offset) == 'L', "getCharCode beyond 4GB");
+    if (backend == PieceTreeBackend::BTree) {
+        // 红黑树的getPositionAt仍返回1起始的行列，这里只检查B+树
+        common::Position pos = buffer->getPositionAt(last_line_offset + 7);
+        check(pos.lineNumber() == last_line && pos.column() == 7, "getPositionAt beyond 4GB");
+    }
+
+    // 在4GB之后插入和删除
+    int64_t edit_offset = last_line_offset + 5;
+    buffer->insert(edit_offset, "EDIT\n", false);
+    check(buffer->getLength() == generated + 5, "length after insert");
+    check(buffer->getLineCount() == line_count + 2, "line count after insert");
+    check(buffer->getValueInRange(common::Range(last_line, 0, last_line + 1, 0)) == "Line EDIT\n",
+          "getValueInRange beyond 4GB");
+    buffer->deleteText(edit_offset, 5);
+    check(buffer->getLength() == generated, "length after delete");
+    check(buffer->getOffsetAt(last_line, 0) == last_line_offset, "getOffsetAt after delete");
+
+    report_offset_overhead(*buffer);
+    report_line_start_memory("Lines beyond 4GB", *buffer);
 }
 
 // 主测试函数
@@ -322,11 +621,14 @@ void test_very_large_file() {
         
         // 测试加载性能
         test_large_file_loading(large_text);
+        test_parallel_loading_scaling(large_text);
         
         // 清除不需要的文本数据以释放内存
         large_text.clear();
         large_text.shrink_to_fit();
         report_memory_usage();
+
+        test_line_start_memory();
         
         // 重新构建缓冲区以进行后续测试
         std::cout << "\n=== Preparing TextBuffer for Subsequent Tests ===\n";
@@ -353,6 +655,12 @@ void test_very_large_file() {
         
         // 测试快照功能
         test_large_file_snapshot(buffer);
+
+        // 测试变更缓冲区的回收
+        test_change_buffer_compaction(buffer);
+        report_memory_usage();
+
+        report_offset_overhead(*buffer);
         
         std::cout << "\n=== All Large File Tests Completed Successfully ===\n";
     } catch (const std::exception& e) {
@@ -364,6 +672,8 @@ void test_very_large_file() {
 int main() {
     try {
         test_very_large_file();
+        test_over_4gb_buffer(PieceTreeBackend::RedBlackTree);
+        test_over_4gb_buffer(PieceTreeBackend::BTree);
         return 0;
     } catch (const std::exception& e) {
         std::cerr << "Fatal error: " << e.what() << std::endl;
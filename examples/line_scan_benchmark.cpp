@@ -0,0 +1,190 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include <random>
+#include "textbuffer/piece_tree_base.h"
+
+using namespace textbuffer;
+
+// 行首扫描内核测试：标量、SSE2、AVX2内核的结果须与逐字节的原实现一致，
+// 并比较它们的吞吐量（GB/s）
+// 用法: line_scan_benchmark [文本大小MB]，默认256MB
+
+namespace {
+
+// 原来逐字节扫描、逐个push_back的实现，作为对照
+LineStarts referenceLineStarts(const std::string& str) {
+    std::vector<Offset> r = {0};
+    Offset cr = 0, lf = 0, crlf = 0;
+    bool isBasicASCII = true;
+    for (size_t i = 0, len = str.length(); i < len; i++) {
+        const auto chr = static_cast<uint8_t>(str[i]);
+        if (chr == '\r') {
+            if (i + 1 < len && str[i + 1] == '\n') {
+                crlf++;
+                r.push_back(static_cast<Offset>(i + 2));
+                i++;
+            } else {
+                cr++;
+                r.push_back(static_cast<Offset>(i + 1));
+            }
+        } else if (chr == '\n') {
+            lf++;
+            r.push_back(static_cast<Offset>(i + 1));
+        } else if (isBasicASCII && chr != '\t' && (chr < 32 || chr > 126)) {
+            isBasicASCII = false;
+        }
+    }
+    return LineStarts(r, cr, lf, crlf, isBasicASCII);
+}
+
+const char* kernelName(LineScanKernel kernel) {
+    switch (kernel) {
+    case LineScanKernel::SSE2:
+        return "sse2  ";
+    case LineScanKernel::AVX2:
+        return "avx2  ";
+    default:
+        return "scalar";
+    }
+}
+
+std::vector<LineScanKernel> supportedKernels() {
+    std::vector<LineScanKernel> kernels;
+    for (LineScanKernel kernel : {LineScanKernel::Scalar, LineScanKernel::SSE2, LineScanKernel::AVX2}) {
+        if (isLineScanKernelSupported(kernel)) {
+            kernels.push_back(kernel);
+        }
+    }
+    return kernels;
+}
+
+void expect(bool condition, const std::string& what) {
+    if (!condition) {
+        throw std::runtime_error(what);
+    }
+}
+
+// 随机文本：大量\r、\n、\r\n，偶尔有制表符、控制字符和非ASCII字节
+std::string makeRandomText(std::mt19937& random, size_t length) {
+    const char alphabet[] = {'a', 'b', '\r', '\n', '\r', '\n', ' ', '\t', '\x01', '\x7f', '\xc3', '\xa9'};
+    std::string text;
+    bool ascii = random() % 2 == 0;
+    for (size_t i = 0; i < length; i++) {
+        text += alphabet[random() % (ascii ? 8 : sizeof(alphabet))];
+    }
+    return text;
+}
+
+void runCorrectnessTests() {
+    std::mt19937 random(11);
+    int checks = 0;
+    for (int round = 0; round < 3000; round++) {
+        std::string text = makeRandomText(random, random() % 200);
+        // 在各种对齐位置上放一个跨块的\r\n
+        if (text.size() > 40 && round % 3 == 0) {
+            size_t at = 31 + random() % 2;
+            text[at - 1] = '\r';
+            text[at] = '\n';
+        }
+        for (LineScanKernel kernel : supportedKernels()) {
+            setLineScanKernel(kernel);
+            for (size_t offset = 0; offset < 3 && offset <= text.size(); offset++) {
+                std::string_view view = std::string_view(text).substr(offset);
+                LineStarts want = referenceLineStarts(std::string(view));
+                LineStarts got = createLineStarts(view);
+                std::string where = std::string(kernelName(kernel)) + " round " + std::to_string(round);
+                expect(got.lineStarts == want.lineStarts, where + ": line starts differ");
+                expect(got.cr == want.cr && got.lf == want.lf && got.crlf == want.crlf, where + ": counts differ");
+                expect(got.isBasicASCII == want.isBasicASCII, where + ": isBasicASCII differs");
+                expect(createLineStartsFast(view) == want.lineStarts, where + ": fast line starts differ");
+                LineStarts counts = countLineBreaks(view);
+                expect(counts.cr == want.cr && counts.lf == want.lf && counts.crlf == want.crlf, where + ": count only differs");
+                checks++;
+            }
+        }
+    }
+    std::cout << "  " << checks << " scans match the byte by byte reference" << std::endl;
+}
+
+std::string makeDocument(size_t bytes, size_t averageLine, const char* eol) {
+    std::mt19937 random(7);
+    std::string text;
+    text.reserve(bytes + averageLine * 2);
+    while (text.size() < bytes) {
+        size_t length = random() % (averageLine * 2);
+        for (size_t i = 0; i < length; i++) {
+            text += static_cast<char>('a' + (i * 7 + text.size()) % 26);
+        }
+        text += eol;
+    }
+    return text;
+}
+
+template <typename F>
+double measureGBs(const std::string& text, F&& body) {
+    // 取三次中最快的一次
+    double best = 1e100;
+    for (int run = 0; run < 3; run++) {
+        auto start = std::chrono::high_resolution_clock::now();
+        body();
+        auto end = std::chrono::high_resolution_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+    }
+    return text.size() / best / 1e9;
+}
+
+void runThroughputBenchmark(const std::string& name, const std::string& text) {
+    std::cout << "\n  " << name << " (" << text.size() / (1024 * 1024) << " MB)" << std::endl;
+    volatile size_t sink = 0;
+    double reference = measureGBs(text, [&]() {
+        sink += referenceLineStarts(text).lineStarts.size();
+    });
+    std::cout << "    reference   createLineStarts " << std::fixed << std::setprecision(2) << std::setw(6)
+              << reference << " GB/s" << std::endl;
+    for (LineScanKernel kernel : supportedKernels()) {
+        setLineScanKernel(kernel);
+        double full = measureGBs(text, [&]() {
+            sink += createLineStarts(text).lineStarts.size();
+        });
+        double fast = measureGBs(text, [&]() {
+            sink += createLineStartsFast(text).size();
+        });
+        double counts = measureGBs(text, [&]() {
+            sink += countLineBreaks(text).lf;
+        });
+        std::cout << "    " << kernelName(kernel) << "      createLineStarts " << std::setw(6) << full << " GB/s"
+                  << "  createLineStartsFast " << std::setw(6) << fast << " GB/s"
+                  << "  countLineBreaks " << std::setw(6) << counts << " GB/s"
+                  << "  (" << std::setprecision(1) << full / reference << "x)" << std::setprecision(2) << std::endl;
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t megabytes = argc > 1 ? std::atoll(argv[1]) : 256;
+    LineScanKernel detected = getLineScanKernel();
+
+    try {
+        std::cout << "=== Line start scanning kernels (detected: " << kernelName(detected) << ") ===\n";
+        runCorrectnessTests();
+
+        std::cout << "\n=== Throughput ===";
+        size_t bytes = megabytes * 1024 * 1024;
+        runThroughputBenchmark("source code, 40 byte lines, LF", makeDocument(bytes, 40, "\n"));
+        runThroughputBenchmark("prose, 200 byte lines, CRLF", makeDocument(bytes, 200, "\r\n"));
+        runThroughputBenchmark("short lines, 4 bytes, LF", makeDocument(bytes / 4, 4, "\n"));
+
+        setLineScanKernel(detected);
+        std::cout << "\n=== Line scan benchmark completed ===\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed with exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
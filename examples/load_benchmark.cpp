@@ -0,0 +1,120 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <memory>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include <random>
+#include "textbuffer/piece_tree_base.h"
+#include "textbuffer/piece_tree_builder.h"
+
+using namespace textbuffer;
+
+// 树构建的加载时间测试：逐块插入红黑树与一次性平衡构建的对比
+// 用法: load_benchmark [最大块数]，默认测到两百万块
+
+namespace {
+
+// 按原来的方式逐块调用rbInsertRight建树，每次插入都要做一次fixInsert
+class IncrementalLoadTree : public PieceTreeBase {
+public:
+    void createIncrementally(std::vector<StringBuffer> chunks) {
+        _buffers = {std::make_shared<StringBuffer>("", std::vector<Offset>{0})};
+        deleteTree(root);
+
+        TreeNode* lastNode = nullptr;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            StringBuffer& chunk = chunks[i];
+            Piece piece(
+                _buffers.size(),
+                {0, 0},
+                {static_cast<Offset>(chunk.lineStarts.size() - 1),
+                 static_cast<Offset>(chunk.buffer.length() - chunk.lineStarts.back())},
+                chunk.lineStarts.size() - 1,
+                chunk.buffer.length()
+            );
+            _buffers.push_back(std::make_shared<StringBuffer>(std::move(chunk)));
+            lastNode = rbInsertRight(lastNode, piece);
+        }
+        computeBufferMetadata();
+    }
+};
+
+std::vector<StringBuffer> makeChunks(int64_t count) {
+    std::vector<StringBuffer> chunks;
+    chunks.reserve(count);
+    for (int64_t i = 0; i < count; i++) {
+        std::string text = "chunk " + std::to_string(i) + "\n";
+        std::vector<Offset> lineStarts = createLineStartsFast(text);
+        chunks.push_back(StringBuffer(std::move(text), std::move(lineStarts)));
+    }
+    return chunks;
+}
+
+// 随机按行号定位，树越矮越快
+double measureLookupUs(PieceTreeBase& tree) {
+    std::mt19937 random(3);
+    const int lookups = 200000;
+    volatile Offset sink = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < lookups; i++) {
+        sink += tree.getOffsetAt(random() % tree.getLineCount(), 0);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / lookups;
+}
+
+template <typename F>
+double measureMs(F&& body) {
+    auto start = std::chrono::high_resolution_clock::now();
+    body();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int64_t maxChunks = argc > 1 ? std::atoll(argv[1]) : 2 * 1024 * 1024;
+
+    try {
+        std::cout << "=== Piece tree load: incremental inserts vs bulk build ===\n";
+        // 32768块相当于按64KB分块的2GB文件
+        for (int64_t count = 32768; count <= maxChunks; count *= 4) {
+            IncrementalLoadTree incremental;
+            std::vector<StringBuffer> chunks = makeChunks(count);
+            double incrementalMs = measureMs([&]() {
+                incremental.createIncrementally(std::move(chunks));
+            });
+
+            PieceTreeBase bulk;
+            chunks = makeChunks(count);
+            double bulkMs = measureMs([&]() {
+                bulk.create(std::move(chunks), "\n", true);
+            });
+
+            if (bulk.getLength() != incremental.getLength() || bulk.getLineCount() != incremental.getLineCount() ||
+                bulk.getLineContent(bulk.getLineCount() / 2) != incremental.getLineContent(bulk.getLineCount() / 2)) {
+                throw std::runtime_error("bulk build produced a different document");
+            }
+
+            double incrementalLookupUs = measureLookupUs(incremental);
+            double bulkLookupUs = measureLookupUs(bulk);
+
+            std::cout << std::setw(8) << count << " chunks" << std::fixed << std::setprecision(2)
+                      << "  incremental=" << std::setw(8) << incrementalMs << " ms (height " << incremental.getHeight()
+                      << ", lookup " << incrementalLookupUs << " us)"
+                      << "  bulk=" << std::setw(8) << bulkMs << " ms (height " << bulk.getHeight()
+                      << ", lookup " << bulkLookupUs << " us)"
+                      << "  load speedup x" << incrementalMs / bulkMs
+                      << "  lookup speedup x" << incrementalLookupUs / bulkLookupUs << std::endl;
+        }
+        std::cout << "\n=== Load benchmark completed ===\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed with exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,203 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <filesystem>
+#include "textbuffer/piece_tree_loader.h"
+
+using namespace textbuffer;
+
+// 后台加载测试：读文件、多线程扫描行首、建树在后台流水进行，
+// 主线程在等待期间保持响应；与同步读入加acceptChunk的做法对比
+// 用法: loader_benchmark [文件大小MB]，默认512MB
+
+namespace {
+
+void writeText(const std::string& path, const std::string& text) {
+    std::ofstream file(path, std::ios::binary);
+    file << text;
+}
+
+// 混合\n、\r\n和单独\r的随机文本，很多\r\n会跨过块的边界
+std::string makeMixedText(size_t bytes, unsigned seed) {
+    std::mt19937 random(seed);
+    const char* endings[] = {"\n", "\r\n", "\r"};
+    std::string text;
+    while (text.size() < bytes) {
+        text.append(random() % 80, 'a' + random() % 26);
+        text += endings[random() % 3];
+    }
+    return text;
+}
+
+std::unique_ptr<PieceTreeBase> loadSynchronously(const std::string& path, const LoadOptions& options) {
+    PieceTreeTextBufferBuilder builder;
+    std::ifstream file(path, std::ios::binary);
+    std::string chunk(64 * 1024, '\0');
+    while (file.read(&chunk[0], chunk.size()) || file.gcount() > 0) {
+        builder.acceptChunk(chunk.substr(0, file.gcount()));
+    }
+    return builder.finish(options.normalizeEOL).create(options.defaultEOL, options.backend);
+}
+
+template <typename F>
+double measureMs(F&& body) {
+    auto start = std::chrono::high_resolution_clock::now();
+    body();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void expect(bool condition, const std::string& what) {
+    if (!condition) {
+        throw std::runtime_error(what);
+    }
+}
+
+// 小块、多线程下结果须与同步加载一致
+void runCorrectnessTests(const std::string& path) {
+    std::vector<std::string> texts = {
+        "",
+        "\xEF\xBB\xBFwith bom\r\nline\n",
+        "ends with cr\r",
+        makeMixedText(300 * 1024, 1),
+        "\xEF\xBB\xBF" + makeMixedText(100 * 1024, 2),
+    };
+    int cases = 0;
+    for (const std::string& text : texts) {
+        writeText(path, text);
+        for (bool normalize : {false, true}) {
+            for (PieceTreeBackend backend : {PieceTreeBackend::RedBlackTree, PieceTreeBackend::BTree}) {
+                for (unsigned workers : {1u, 3u}) {
+                    LoadOptions options;
+                    options.chunkSize = 1024;
+                    options.workers = workers;
+                    options.normalizeEOL = normalize;
+                    options.backend = backend;
+                    PieceTreeLoader loader(options);
+                    auto tree = loader.load(path).get();
+                    auto reference = loadSynchronously(path, options);
+                    expect(tree->getValue() == reference->getValue(), "content differs");
+                    expect(tree->getLineCount() == reference->getLineCount(), "line count differs");
+                    expect(tree->getEOL() == reference->getEOL(), "EOL differs");
+                    LoadProgress progress = loader.progress();
+                    expect(progress.bytesRead == text.size() && progress.totalBytes == text.size(), "bytes read wrong");
+                    cases++;
+                }
+            }
+        }
+    }
+    std::cout << "  " << cases << " loads match the synchronous builder" << std::endl;
+}
+
+// 取消和打不开的文件都通过future报告
+void runErrorTests(const std::string& path, const std::string& missing) {
+    PieceTreeLoader loader;
+    auto future = loader.load(path);
+    loader.cancel();
+    try {
+        future.get();
+        std::cout << "  cancel came too late, the load had finished" << std::endl;
+    } catch (const std::runtime_error& e) {
+        std::cout << "  cancelled: " << e.what() << std::endl;
+    }
+
+    bool failed = false;
+    loader.load(missing, [&](std::unique_ptr<PieceTreeBase> tree, std::exception_ptr error) {
+        failed = tree == nullptr && error != nullptr;
+    }, nullptr);
+    loader.wait();
+    expect(failed, "a missing file did not report an error");
+    std::cout << "  missing file reported through the callback" << std::endl;
+}
+
+void runLoadBenchmark(const std::string& path, size_t bytes) {
+    LoadOptions options;
+    options.normalizeEOL = false;
+
+    std::unique_ptr<PieceTreeBase> reference;
+    double syncMs = measureMs([&]() {
+        reference = loadSynchronously(path, options);
+    });
+    std::cout << "  synchronous builder      " << std::fixed << std::setprecision(1) << std::setw(8) << syncMs
+              << " ms  (caller blocked the whole time)" << std::endl;
+    Offset lineCount = reference->getLineCount();
+    reference.reset();
+
+    unsigned hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned> workerCounts;
+    for (unsigned n = 1; n < hardwareThreads; n *= 2) {
+        workerCounts.push_back(n);
+    }
+    workerCounts.push_back(hardwareThreads);
+    std::cout << "  hardware threads: " << hardwareThreads << std::endl;
+    for (unsigned workers : workerCounts) {
+        options.workers = workers;
+        PieceTreeLoader loader(options);
+        int progressCalls = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        auto future = loader.load(path, [&](const LoadProgress&) { progressCalls++; });
+
+        // 主线程每毫秒轮询一次，记录最长的一次停顿
+        double longestGapMs = 0;
+        int polls = 0;
+        auto last = std::chrono::high_resolution_clock::now();
+        while (future.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready) {
+            auto now = std::chrono::high_resolution_clock::now();
+            longestGapMs = std::max(longestGapMs, std::chrono::duration<double, std::milli>(now - last).count());
+            last = now;
+            LoadProgress progress = loader.progress();
+            expect(progress.bytesScanned <= progress.bytesRead && progress.bytesRead <= progress.totalBytes,
+                   "inconsistent progress");
+            polls++;
+        }
+        auto tree = future.get();
+        double loadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        expect(tree->getLineCount() == lineCount, "background load has the wrong line count");
+        expect(loader.progress().bytesScanned == bytes, "not every byte was scanned");
+
+        std::cout << "  loader, " << std::setw(2) << workers << " workers     " << std::setw(8) << loadMs << " ms"
+                  << "  polls=" << std::setw(5) << polls << "  longest gap=" << std::setw(5) << longestGapMs << " ms"
+                  << "  progress calls=" << progressCalls << "  lines=" << loader.progress().linesFound << std::endl;
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t megabytes = argc > 1 ? std::atoll(argv[1]) : 512;
+    std::string dir = std::filesystem::temp_directory_path().string();
+    std::string path = dir + "/textbuffer_loader_benchmark.txt";
+
+    try {
+        std::cout << "=== Background loader vs synchronous builder ===\n";
+        runCorrectnessTests(path);
+
+        std::cout << "\n=== Errors ===\n";
+        writeText(path, makeMixedText(16 * 1024 * 1024, 3));
+        runErrorTests(path, dir + "/textbuffer_loader_missing.txt");
+
+        std::cout << "\n=== Loading a " << megabytes << " MB file ===\n";
+        std::string text = makeMixedText(megabytes * 1024 * 1024, 4);
+        writeText(path, text);
+        size_t bytes = text.size();
+        text.clear();
+        text.shrink_to_fit();
+        runLoadBenchmark(path, bytes);
+
+        std::remove(path.c_str());
+        std::cout << "\n=== Loader benchmark completed ===\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::remove(path.c_str());
+        std::cerr << "Benchmark failed with exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,275 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdio>
+#include <random>
+#include <filesystem>
+#include "textbuffer/piece_tree_builder.h"
+
+using namespace textbuffer;
+
+// 内存映射加载测试：acceptFile直接在映射的文件上建立片段，
+// 与读入内存后acceptChunk的做法比较打开时间和常驻内存
+// 用法: mapped_file_benchmark [文件大小MB]，默认256MB
+
+namespace {
+
+const Offset LineLength = 64;
+
+// 每行64字节，以\r\n结尾
+std::string lineText(int64_t index) {
+    char head[32];
+    std::snprintf(head, sizeof(head), "line %010lld ", static_cast<long long>(index));
+    std::string line = head;
+    line.resize(LineLength - 2, '.');
+    return line;
+}
+
+// 文件以一个"\n"开头，这样第一个64MB窗口恰好切在一个\r\n中间
+int64_t writeFile(const std::string& path, size_t bytes) {
+    std::ofstream file(path, std::ios::binary);
+    file << '\n';
+    int64_t lines = bytes / LineLength;
+    std::string block;
+    for (int64_t i = 0; i < lines; i++) {
+        block += lineText(i);
+        block += "\r\n";
+        if (block.size() >= 1024 * 1024) {
+            file << block;
+            block.clear();
+        }
+    }
+    file << block;
+    if (!file) {
+        throw std::runtime_error("cannot write " + path);
+    }
+    return lines;
+}
+
+void writeText(const std::string& path, const std::string& text) {
+    std::ofstream file(path, std::ios::binary);
+    file << text;
+}
+
+template <typename F>
+double measureMs(F&& body) {
+    auto start = std::chrono::high_resolution_clock::now();
+    body();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void expect(bool condition, const std::string& what) {
+    if (!condition) {
+        throw std::runtime_error(what);
+    }
+}
+
+// 读取/proc中以kB为单位的字段，不可用时返回-1
+int64_t read_proc_kb(const std::string& path, const std::string& key) {
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, key.size(), key) == 0) {
+            return std::stoll(line.substr(key.size()));
+        }
+    }
+    return -1;
+}
+
+int64_t rssMB() {
+    int64_t kb = read_proc_kb("/proc/self/status", "VmRSS:");
+    return kb < 0 ? -1 : kb / 1024;
+}
+
+const char* backendName(PieceTreeBackend backend) {
+    return backend == PieceTreeBackend::RedBlackTree ? "rb-tree" : "b-tree ";
+}
+
+// 边界情况：BOM、结尾的\r与后续块、映射文件之间的\r\n、空文件
+void runEdgeCaseTests(const std::string& dir) {
+    std::string first = dir + "/textbuffer_mapped_a.txt";
+    std::string second = dir + "/textbuffer_mapped_b.txt";
+    std::string empty = dir + "/textbuffer_mapped_empty.txt";
+
+    struct Case {
+        std::string name;
+        std::vector<std::string> parts;  // 以"@"开头的部分写成文件，其余用acceptChunk送入
+    };
+    std::vector<Case> cases = {
+        {"bom", {"@\xEF\xBB\xBFhello\r\nworld\n"}},
+        {"trailing cr + chunk", {"@one\rtwo\r", "\nthree"}},
+        {"chunk cr + file", {"one\r", "@\nrest\r\n"}},
+        {"file cr + file", {"@abc\r", "@\ndef"}},
+        {"file cr at end", {"@abc\r"}},
+        {"empty file", {"@", "text"}},
+    };
+
+    for (const Case& c : cases) {
+        for (int variant = 0; variant < 4; variant++) {
+            PieceTreeBackend backend = variant % 2 == 0 ? PieceTreeBackend::RedBlackTree : PieceTreeBackend::BTree;
+            PieceTreeTextBufferBuilder mapped;
+            // 后两种推迟行首扫描，只在首次访问时建立
+            mapped.setDeferLineStarts(variant >= 2);
+            std::string joined;
+            int files = 0;
+            for (const std::string& part : c.parts) {
+                if (!part.empty() && part[0] == '@') {
+                    std::string path = part.size() == 1 ? empty : (files++ == 0 ? first : second);
+                    writeText(path, part.substr(1));
+                    mapped.acceptFile(path);
+                    joined += part.substr(1);
+                } else {
+                    mapped.acceptChunk(part);
+                    joined += part;
+                }
+            }
+            // 对照：整段文本作为一个块送入
+            PieceTreeTextBufferBuilder copied;
+            copied.acceptChunk(joined);
+            auto tree = mapped.finish(false).create(DefaultEndOfLine::LF, backend);
+            auto reference = copied.finish(false).create(DefaultEndOfLine::LF, backend);
+            expect(tree->getValue() == reference->getValue(), c.name + ": content differs");
+            expect(tree->getLineCount() == reference->getLineCount(), c.name + ": line count differs");
+            for (Offset line = 0; line < tree->getLineCount(); line++) {
+                expect(tree->getLineContent(line) == reference->getLineContent(line), c.name + ": line differs");
+            }
+            tree->insert(1, "\n", false);
+            reference->insert(1, "\n", false);
+            expect(tree->getValue() == reference->getValue(), c.name + ": edit differs");
+        }
+        std::cout << "  " << std::left << std::setw(22) << c.name << " ok" << std::endl;
+    }
+    std::remove(first.c_str());
+    std::remove(second.c_str());
+    std::remove(empty.c_str());
+}
+
+// 像编辑器翻页一样，随机跳到若干位置各读取100行并核对内容
+void checkScreens(PieceTreeBase& tree, int64_t lines, int screens) {
+    std::mt19937 random(5);
+    for (int i = 0; i < screens; i++) {
+        int64_t top = random() % (lines - 100);
+        for (int64_t index = top; index < top + 100; index++) {
+            expect(tree.getLineContent(index + 1) == lineText(index), "wrong line " + std::to_string(index));
+        }
+    }
+}
+
+void runMappedLoad(const std::string& path, int64_t lines, PieceTreeBackend backend, bool deferLineStarts) {
+    int64_t rssBefore = rssMB();
+    std::unique_ptr<PieceTreeBase> tree;
+    double openMs = measureMs([&]() {
+        PieceTreeTextBufferBuilder builder;
+        builder.setDeferLineStarts(deferLineStarts);
+        builder.acceptFile(path);
+        tree = builder.finish(false).create(DefaultEndOfLine::CRLF, backend);
+    });
+    int64_t rssOpen = rssMB();
+    expect(tree->getLineCount() == lines + 2, "wrong line count");
+
+    // 第一屏：推迟时只需扫描第一个缓冲区的行首
+    double firstScreenMs = measureMs([&]() {
+        for (int64_t index = 0; index < 100; index++) {
+            expect(tree->getLineContent(index + 1) == lineText(index), "wrong line " + std::to_string(index));
+        }
+    });
+    BufferMemoryStats firstScreen = tree->getBufferMemoryStats();
+
+    // 读取20屏只会调入这些行所在的页
+    double readMs = measureMs([&]() {
+        checkScreens(*tree, lines, 20);
+    });
+    int64_t rssRead = rssMB();
+
+    // 推迟的行首在后台线程中补齐
+    double indexMs = 0;
+    if (deferLineStarts) {
+        indexMs = measureMs([&]() {
+            tree->indexLineStartsInBackground().get();
+        });
+        expect(tree->getBufferMemoryStats().unindexedBuffers == 0, "background indexing left buffers");
+    }
+
+    // 编辑只写入修改缓冲区，原文件不变
+    tree->insert(0, "head\r\n", false);
+    tree->insert(tree->getLength() / 2, "middle", false);
+    tree->deleteText(100, 1000);
+    Offset at = tree->getOffsetAt(lines / 2, 0);
+    tree->insert(at, "x", false);
+    expect(tree->getLineContent(0) == "head", "insert at start lost");
+    BufferMemoryStats stats = tree->getBufferMemoryStats();
+
+    std::cout << "  " << backendName(backend) << (deferLineStarts ? " deferred" : "         ") << std::fixed
+              << std::setprecision(1) << "  open=" << std::setw(8) << openMs << " ms"
+              << "  rss after open=+" << std::setw(4) << rssOpen - rssBefore << " MB"
+              << "  first screen=" << std::setw(5) << firstScreenMs << " ms, line starts "
+              << std::setw(5) << firstScreen.lineStartBytes / 1024 << " KB (" << firstScreen.unindexedBuffers
+              << " buffers unindexed)"
+              << "  after 20 screens=+" << std::setw(4) << rssRead - rssBefore << " MB (" << readMs << " ms)";
+    if (deferLineStarts) {
+        std::cout << "  background index=" << indexMs << " ms";
+    }
+    std::cout << "  mapped=" << stats.mappedBytes / (1024 * 1024) << " MB"
+              << "  edit=" << stats.editBytes << " B" << std::endl;
+}
+
+void runCopyingLoad(const std::string& path, int64_t lines) {
+    int64_t rssBefore = rssMB();
+    std::unique_ptr<PieceTreeBase> tree;
+    double openMs = measureMs([&]() {
+        PieceTreeTextBufferBuilder builder;
+        std::ifstream file(path, std::ios::binary);
+        std::string chunk(64 * 1024, '\0');
+        while (file.read(&chunk[0], chunk.size()) || file.gcount() > 0) {
+            builder.acceptChunk(chunk.substr(0, file.gcount()));
+        }
+        tree = builder.finish(false).create(DefaultEndOfLine::CRLF);
+    });
+    int64_t rssOpen = rssMB();
+    expect(tree->getLineCount() == lines + 2, "wrong line count");
+    checkScreens(*tree, lines, 20);
+
+    std::cout << "  rb-tree" << std::fixed << std::setprecision(1)
+              << "  open=" << std::setw(8) << openMs << " ms"
+              << "  rss after open=+" << std::setw(4) << rssOpen - rssBefore << " MB" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t megabytes = argc > 1 ? std::atoll(argv[1]) : 256;
+    std::string dir = std::filesystem::temp_directory_path().string();
+    std::string path = dir + "/textbuffer_mapped_benchmark.txt";
+
+    try {
+        std::cout << "=== Edge cases: acceptFile vs acceptChunk ===\n";
+        runEdgeCaseTests(dir);
+
+        int64_t lines = writeFile(path, megabytes * 1024 * 1024);
+        // 释放的堆内存不一定还给系统，所以只测一次，且放在前面
+        std::cout << "\n=== Opening a " << megabytes << " MB file with acceptChunk (read into memory) ===\n";
+        runCopyingLoad(path, lines);
+
+        std::cout << "\n=== Opening it with acceptFile (mapped) ===\n";
+        for (PieceTreeBackend backend : {PieceTreeBackend::RedBlackTree, PieceTreeBackend::BTree}) {
+            runMappedLoad(path, lines, backend, false);
+        }
+        std::cout << "\n=== Opening it with acceptFile, line starts deferred ===\n";
+        for (PieceTreeBackend backend : {PieceTreeBackend::RedBlackTree, PieceTreeBackend::BTree}) {
+            runMappedLoad(path, lines, backend, true);
+        }
+        std::remove(path.c_str());
+        std::cout << "\n=== Mapped file benchmark completed ===\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::remove(path.c_str());
+        std::cerr << "Benchmark failed with exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,329 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include <random>
+#include "textbuffer/textbuffer.h"
+#include "textbuffer/piece_tree_builder.h"
+#include "textbuffer/text_cursor.h"
+
+using namespace textbuffer;
+
+// 单块大文件的按行读取测试：读一行的开销应只与行长有关，与文件大小无关
+// 用法: read_benchmark [最大MB数]，默认测到512MB
+
+namespace {
+
+std::string makeDocument(size_t bytes) {
+    std::string text;
+    text.reserve(bytes + 128);
+    for (int64_t i = 0; text.size() < bytes; i++) {
+        text += "line " + std::to_string(i) + " of a large single chunk document\n";
+    }
+    return text;
+}
+
+template <typename F>
+double measureUs(int count, F&& body) {
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < count; ++i) {
+        body();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / count;
+}
+
+std::string join(const std::vector<std::string_view>& views) {
+    std::string text;
+    for (std::string_view view : views) {
+        text.append(view.data(), view.size());
+    }
+    return text;
+}
+
+// 模拟渲染：每帧读取可见的80行，帧之间在可见区域内输入一个字符，偶尔滚动
+double renderFrames(PieceTreeBase& tree, int frames, size_t& checksum) {
+    std::mt19937 random(9);
+    const Offset visibleLines = 80;
+    Offset top = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        if (frame % 100 == 0) {
+            top = random() % (tree.getLineCount() - visibleLines);
+        }
+        Offset editLine = top + random() % visibleLines;
+        tree.insert(tree.getOffsetAt(editLine, 0), "x", false);
+        for (Offset line = top; line < top + visibleLines; line++) {
+            checksum += tree.getLineContent(line).size();
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / frames;
+}
+
+void runRenderBenchmark() {
+    std::cout << "\n=== Rendering 80 visible lines per frame with edits in between ===\n";
+    std::string text = makeDocument(16 * 1024 * 1024);
+    for (size_t cacheSize : {size_t(0), size_t(64), size_t(256)}) {
+        PieceTreeTextBufferBuilder builder;
+        builder.acceptChunk(text);
+        auto tree = builder.finish().create(DefaultEndOfLine::LF);
+        tree->setLineCacheSize(cacheSize);
+        size_t checksum = 0;
+        double frameUs = renderFrames(*tree, 2000, checksum);
+        LineCacheStats stats = tree->getLineCacheStats();
+        std::cout << "  cache " << std::setw(4) << cacheSize << " lines" << std::fixed << std::setprecision(2)
+                  << "  frame=" << std::setw(7) << frameUs << " us"
+                  << "  hits=" << std::setw(7) << stats.hits << "  misses=" << std::setw(7) << stats.misses
+                  << "  hit ratio=" << std::setprecision(3) << stats.hitRatio() << "  checksum=" << checksum
+                  << std::endl;
+    }
+}
+
+// 搜索缓存：顺序滚动与随机跳转两种访问模式下按行、按偏移定位的开销
+void runSearchCacheBenchmark() {
+    std::cout << "\n=== Node search cache: sequential scroll vs random jumps ===\n";
+    std::string text = makeDocument(16 * 1024 * 1024);
+    for (int32_t cacheSize : {0, 16, 64}) {
+        PieceTreeTextBufferBuilder builder;
+        builder.acceptChunk(text);
+        auto tree = builder.finish().create(DefaultEndOfLine::LF);
+        tree->setSearchCacheSize(cacheSize);
+
+        // 随机编辑把文档切成许多piece
+        std::mt19937 random(13);
+        for (int i = 0; i < 50000; i++) {
+            tree->insert(random() % tree->getLength(), (i & 3) == 0 ? "a\n" : "b", false);
+        }
+
+        const Offset lookups = 200000;
+        Offset lineCount = tree->getLineCount();
+        volatile size_t sink = 0;
+        for (bool sequential : {true, false}) {
+            tree->resetSearchCacheStats();
+            Offset line = random() % (lineCount - lookups);
+            auto start = std::chrono::high_resolution_clock::now();
+            for (Offset i = 0; i < lookups; i++) {
+                line = sequential ? line + 1 : random() % lineCount;
+                Offset offset = tree->getOffsetAt(line, 0);
+                sink += tree->getPositionAt(offset + 1).column();
+                sink += tree->getLineCharCode(line, 0);
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            double lookupNs = std::chrono::duration<double, std::nano>(end - start).count() / lookups;
+            SearchCacheStats stats = tree->getSearchCacheStats();
+            std::cout << "  cache " << std::setw(2) << cacheSize << (sequential ? "  sequential" : "  random    ")
+                      << std::fixed << std::setprecision(1) << "  " << std::setw(6) << lookupNs << " ns per line"
+                      << "  hits=" << std::setw(7) << stats.hits << "  misses=" << std::setw(7) << stats.misses
+                      << "  evictions=" << std::setw(7) << stats.evictions << "  hit ratio=" << std::setprecision(3)
+                      << stats.hitRatio() << std::endl;
+        }
+    }
+}
+
+// 全文按行扫描：每行都从根节点查找，与游标逐行前进的对比
+void runCursorScanBenchmark() {
+    std::cout << "\n=== Full document line scan: getLineContent vs cursor ===\n";
+    std::string text = makeDocument(16 * 1024 * 1024);
+    for (PieceTreeBackend backend : {PieceTreeBackend::RedBlackTree, PieceTreeBackend::BTree}) {
+        for (int edits : {0, 50000}) {
+            PieceTreeTextBufferBuilder builder;
+            builder.acceptChunk(text);
+            auto tree = builder.finish().create(DefaultEndOfLine::LF, backend);
+            std::mt19937 random(17);
+            for (int i = 0; i < edits; i++) {
+                tree->insert(random() % tree->getLength(), (i & 3) == 0 ? "a\n" : "b", false);
+            }
+            Offset lineCount = tree->getLineCount();
+
+            size_t lookupSum = 0;
+            double lookupMs = measureUs(1, [&]() {
+                for (Offset line = 0; line < lineCount; line++) {
+                    lookupSum += tree->getLineContent(line).size();
+                }
+            }) / 1000;
+
+            size_t cursorSum = 0;
+            double cursorMs = measureUs(1, [&]() {
+                TextCursor cursor(*tree);
+                do {
+                    cursorSum += cursor.lineContent().size();
+                } while (cursor.nextLine());
+            }) / 1000;
+
+            size_t viewSum = 0;
+            double viewMs = measureUs(1, [&]() {
+                TextCursor cursor(*tree);
+                do {
+                    for (std::string_view view : cursor.lineViews()) {
+                        viewSum += view.size();
+                    }
+                } while (cursor.nextLine());
+            }) / 1000;
+
+            if (cursorSum != lookupSum || viewSum != lookupSum) {
+                throw std::runtime_error("cursor scan read different lines");
+            }
+            std::cout << (backend == PieceTreeBackend::RedBlackTree ? "  rb-tree" : "  b-tree ") << std::setw(7)
+                      << tree->getPieceCount() << " pieces" << std::fixed << std::setprecision(1)
+                      << "  getLineContent=" << std::setw(7) << lookupMs << " ms"
+                      << "  cursor=" << std::setw(7) << cursorMs << " ms"
+                      << "  cursor views=" << std::setw(7) << viewMs << " ms"
+                      << "  speedup x" << std::setprecision(2) << lookupMs / cursorMs << std::endl;
+        }
+    }
+}
+
+// 游标跨编辑保持位置：删除区域之后的游标左移删除的长度，大段删除按块进行时也只移一次
+void runCursorEditTests() {
+    std::cout << "\n=== Cursor offsets carried over edits ===\n";
+    std::string text = makeDocument(1024 * 1024);
+    for (PieceTreeBackend backend : {PieceTreeBackend::RedBlackTree, PieceTreeBackend::BTree}) {
+        PieceTreeTextBufferBuilder builder;
+        builder.acceptChunk(text);
+        auto tree = builder.finish().create(DefaultEndOfLine::LF, backend);
+        Offset length = tree->getLength();
+        Offset deleteStart = length / 3;
+        Offset deleteLength = length / 5;  // 超过全文的1/10，分块删除
+        TextCursor before(*tree, deleteStart - 100);
+        TextCursor after(*tree, deleteStart + deleteLength + 500);
+        tree->deleteText(deleteStart, deleteLength);
+        tree->insert(0, "inserted\n", false);
+        if (before.offset() != deleteStart - 100 + 9 || after.offset() != deleteStart + 500 + 9) {
+            throw std::runtime_error("cursor offset was not carried over a large delete");
+        }
+        std::cout << (backend == PieceTreeBackend::RedBlackTree ? "  rb-tree" : "  b-tree ")
+                  << "  cursors kept their text across a " << deleteLength << " byte delete" << std::endl;
+    }
+}
+
+// FNV-1a，按块累加，与一次性哈希整段文本结果相同
+uint64_t hashChunk(uint64_t hash, std::string_view chunk) {
+    for (char c : chunk) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// 全文导出：先拼出整个字符串再处理，与按块直接交给哈希或写入预分配缓冲区的对比
+void runStreamingBenchmark() {
+    std::cout << "\n=== Whole document export: getValue vs forEachChunk vs copyRange ===\n";
+    std::string text = makeDocument(64 * 1024 * 1024);
+    const uint64_t seed = 14695981039346656037ull;
+    for (PieceTreeBackend backend : {PieceTreeBackend::RedBlackTree, PieceTreeBackend::BTree}) {
+        PieceTreeTextBufferBuilder builder;
+        builder.acceptChunk(text);
+        auto tree = builder.finish().create(DefaultEndOfLine::LF, backend);
+        std::mt19937 random(23);
+        for (int i = 0; i < 50000; i++) {
+            tree->insert(random() % tree->getLength(), (i & 3) == 0 ? "a\n" : "b", false);
+        }
+        Offset length = tree->getLength();
+
+        std::string value;
+        double valueMs = measureUs(1, [&]() {
+            value = tree->getValue();
+        }) / 1000;
+        uint64_t valueHash = 0;
+        double valueHashMs = measureUs(1, [&]() {
+            valueHash = hashChunk(seed, tree->getValue());
+        }) / 1000;
+
+        uint64_t chunkHash = seed;
+        double chunkHashMs = measureUs(1, [&]() {
+            tree->forEachChunk(0, length, [&](std::string_view chunk) {
+                chunkHash = hashChunk(chunkHash, chunk);
+                return true;
+            });
+        }) / 1000;
+
+        std::vector<char> target(length);
+        size_t copied = 0;
+        double copyMs = measureUs(1, [&]() {
+            copied = tree->copyRange(0, length, target.data(), target.size());
+        }) / 1000;
+
+        if (chunkHash != valueHash || copied != value.size() ||
+            std::string_view(target.data(), copied) != value) {
+            throw std::runtime_error("streamed text differs from getValue");
+        }
+        // 容量不足时只复制容量内的部分，回调返回false时停止
+        int chunks = 0;
+        if (tree->copyRange(10, length, target.data(), 100) != 100 ||
+            std::string_view(target.data(), 100) != std::string_view(value).substr(10, 100) ||
+            tree->forEachChunk(0, length, [&](std::string_view) { return ++chunks < 3; }) || chunks != 3) {
+            throw std::runtime_error("copyRange or forEachChunk ignored its bounds");
+        }
+
+        std::cout << (backend == PieceTreeBackend::RedBlackTree ? "  rb-tree" : "  b-tree ") << std::setw(7)
+                  << tree->getPieceCount() << " pieces" << std::fixed << std::setprecision(1)
+                  << "  getValue=" << std::setw(6) << valueMs << " ms"
+                  << "  getValue+hash=" << std::setw(6) << valueHashMs << " ms"
+                  << "  forEachChunk hash=" << std::setw(6) << chunkHashMs << " ms"
+                  << "  copyRange=" << std::setw(6) << copyMs << " ms"
+                  << "  (" << std::setprecision(2) << length / copyMs / 1e6 << " GB/s)" << std::endl;
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t maxMb = argc > 1 ? std::atoll(argv[1]) : 512;
+
+    try {
+        std::cout << "=== Line reads from a single chunk document ===\n";
+        for (size_t mb = 1; mb <= maxMb; mb *= 8) {
+            std::unique_ptr<TextBuffer> buffer;
+            {
+                std::string text = makeDocument(mb * 1024 * 1024);
+                buffer = std::make_unique<TextBuffer>(text);
+            }
+            Offset lineCount = buffer->getLineCount();
+            std::mt19937 random(5);
+            const int reads = 20000;
+
+            // 先校验视图与复制出来的行内容一致
+            for (int i = 0; i < 100; i++) {
+                Offset line = random() % lineCount;
+                if (join(buffer->getLineViews(line)) != buffer->getLineContent(line)) {
+                    throw std::runtime_error("line views differ from getLineContent");
+                }
+            }
+
+            volatile size_t sink = 0;
+            double contentUs = measureUs(reads, [&]() {
+                sink += buffer->getLineContent(random() % lineCount).size();
+            });
+            double viewsUs = measureUs(reads, [&]() {
+                for (std::string_view view : buffer->getLineViews(random() % lineCount)) {
+                    sink += view.size();
+                }
+            });
+            double rangeUs = measureUs(reads, [&]() {
+                Offset line = random() % lineCount;
+                Offset lineStart = buffer->getOffsetAt(line, 0);
+                sink += buffer->getValueInRange(common::Range(line, 0, line, 10)).size();
+                sink += buffer->getRangeViews(lineStart, lineStart + 10).size();
+            });
+
+            std::cout << std::setw(5) << mb << " MB, " << std::setw(9) << lineCount << " lines" << std::fixed
+                      << std::setprecision(2) << "  getLineContent=" << std::setw(6) << contentUs << " us"
+                      << "  getLineViews=" << std::setw(6) << viewsUs << " us"
+                      << "  range read=" << std::setw(6) << rangeUs << " us" << std::endl;
+        }
+        runRenderBenchmark();
+        runSearchCacheBenchmark();
+        runCursorScanBenchmark();
+        runCursorEditTests();
+        runStreamingBenchmark();
+        std::cout << "\n=== Read benchmark completed ===\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed with exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -29,7 +29,7 @@ public:
         // Update cache line number
         lastLineNumber = lineNumber;
 
-        if (root == SENTINEL) {
+        if (root == sentinel()) {
             lastLineContent = "";
             return "";
         }
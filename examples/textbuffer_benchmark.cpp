@@ -10,8 +10,12 @@
 #include <memory>
 #include <fstream>
 #include <iomanip>
+#include <thread>
+#include <atomic>
+#include <stdexcept>
 #include "textbuffer/piece_tree_base.h"
 #include "textbuffer/piece_tree_builder.h"
+#include "textbuffer/piece_tree_snapshot.h"
 
 using namespace textbuffer;
 using namespace common;
@@ -656,6 +660,335 @@ void testChunkBehavior() {
     std::cout << "Chunk behavior tests passed.\n";
 }
 
+// 统计树中的piece数量
+int64_t countPieces(PieceTreeBase& buffer) {
+    return std::distance(buffer.pieceBegin(), buffer.pieceEnd());
+}
+
+// 测试单次编辑开销随piece数量的变化（应保持O(log n)）
+void testEditCostScaling() {
+    std::cout << "\n=== Testing Edit Cost Scaling ===\n";
+    Timer timer("Edit cost scaling");
+
+    RandomDataGenerator random;
+    const int editCount = 2000;
+    const std::vector<int64_t> targetPieceCounts = {1000, 10000, 100000, 200000};
+
+    std::string baseText = random.randomMultilineString(2000, 80);
+    auto buffer = createTestBuffer(baseText);
+
+    for (int64_t target : targetPieceCounts) {
+        // 在随机位置插入以拆分节点，直到达到目标piece数量
+        int64_t pieces = countPieces(*buffer);
+        while (pieces < target) {
+            int64_t batch = std::max<int64_t>(1, (target - pieces) / 2);
+            for (int64_t i = 0; i < batch; ++i) {
+                int64_t pos = random.randomNumber(0, buffer->getLength());
+                buffer->insert(pos, "ab", false);
+            }
+            pieces = countPieces(*buffer);
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < editCount; ++i) {
+            int64_t insertPos = random.randomNumber(0, buffer->getLength());
+            buffer->insert(insertPos, "x", false);
+            int64_t deletePos = random.randomNumber(0, buffer->getLength() - 1);
+            buffer->deleteText(deletePos, 1);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double perEditUs = std::chrono::duration<double, std::micro>(end - start).count() / (editCount * 2);
+
+        std::cout << "  pieces=" << std::setw(7) << countPieces(*buffer)
+                  << "  length=" << std::setw(9) << buffer->getLength()
+                  << "  per-edit=" << std::fixed << std::setprecision(2) << perEditUs << " us" << std::endl;
+    }
+
+    std::cout << "Edit cost scaling tests passed.\n";
+}
+
+// 测试节点分配器：稳态编辑不再分配堆内存，整树释放为批量操作
+void testNodeAllocator() {
+    std::cout << "\n=== Testing Node Allocator ===\n";
+    Timer timer("Node allocator");
+
+    RandomDataGenerator random;
+    auto buffer = createTestBuffer(random.randomMultilineString(2000, 80));
+
+    // 先增长到较多节点，再删除一半内容，把节点归还到空闲链表
+    for (int i = 0; i < 100000; ++i) {
+        buffer->insert(random.randomNumber(0, buffer->getLength()), "ab", false);
+    }
+    buffer->deleteText(0, buffer->getLength() / 2);
+
+    const TreeNodeAllocator& allocator = buffer->getNodeAllocator();
+    size_t blocksBefore = allocator.blockAllocations();
+    size_t liveBefore = allocator.liveCount();
+
+    const int steadyEdits = 20000;
+    for (int i = 0; i < steadyEdits; ++i) {
+        buffer->insert(random.randomNumber(0, buffer->getLength()), "x", false);
+    }
+
+    std::cout << "  live nodes " << liveBefore << " -> " << allocator.liveCount()
+              << ", node block allocations during " << steadyEdits << " edits: "
+              << (allocator.blockAllocations() - blocksBefore) << std::endl;
+
+    // 构建约一百万节点的树并测量释放耗时
+    auto bigBuffer = createTestBuffer(random.randomMultilineString(2000, 80));
+    while (bigBuffer->getNodeAllocator().liveCount() < 1000000) {
+        bigBuffer->insert(random.randomNumber(0, bigBuffer->getLength()), "ab", false);
+    }
+    size_t nodes = bigBuffer->getNodeAllocator().liveCount();
+    size_t blocks = bigBuffer->getNodeAllocator().blockCount();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    bigBuffer.reset();
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "  teardown of " << nodes << " nodes (" << blocks << " blocks) took "
+              << std::chrono::duration<double, std::milli>(end - start).count() << " ms" << std::endl;
+
+    std::cout << "Node allocator tests passed.\n";
+}
+
+// 多线程压力测试：每个线程独立编辑自己的文档，树之间不共享任何可变状态
+void testMultiThreadedScaling() {
+    std::cout << "\n=== Testing Multi-Threaded Scaling ===\n";
+    Timer timer("Multi-threaded scaling");
+
+    const int editsPerThread = 200000;
+    unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int n = 1; n <= std::max(4u, hardwareThreads); n *= 2) {
+        threadCounts.push_back(n);
+    }
+    std::cout << "  hardware threads: " << hardwareThreads << std::endl;
+
+    double singleThreadRate = 0;
+    for (unsigned int threadCount : threadCounts) {
+        std::atomic<int> failures(0);
+        std::vector<std::thread> threads;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (unsigned int t = 0; t < threadCount; ++t) {
+            threads.emplace_back([t, editsPerThread, &failures]() {
+                RandomDataGenerator random(1000 + t);
+                auto buffer = createTestBuffer(random.randomMultilineString(1000, 80));
+                int64_t expectedLength = buffer->getLength();
+
+                for (int i = 0; i < editsPerThread; ++i) {
+                    if (i % 3 == 2 && expectedLength > 0) {
+                        int64_t pos = random.randomNumber(0, expectedLength - 1);
+                        int64_t len = std::min<int64_t>(random.randomNumber(1, 4), expectedLength - pos);
+                        buffer->deleteText(pos, len);
+                        expectedLength -= len;
+                    } else {
+                        buffer->insert(random.randomNumber(0, expectedLength), "ab\n", false);
+                        expectedLength += 3;
+                    }
+                    if (i % 64 == 0) {
+                        buffer->getLineContent(random.randomNumber(0, buffer->getLineCount() - 1));
+                    }
+                }
+
+                if (buffer->getLength() != expectedLength ||
+                    static_cast<int64_t>(buffer->getValue().size()) != expectedLength) {
+                    failures++;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        double rate = threadCount * editsPerThread / seconds;
+        if (threadCount == 1) {
+            singleThreadRate = rate;
+        }
+        double speedup = rate / singleThreadRate;
+        std::cout << "  threads=" << std::setw(2) << threadCount
+                  << "  time=" << std::fixed << std::setprecision(1) << seconds * 1000 << " ms"
+                  << "  edits/s=" << std::setprecision(0) << rate
+                  << "  speedup=" << std::setprecision(2) << speedup
+                  << "  efficiency=" << std::setprecision(0)
+                  << 100.0 * speedup / std::min(threadCount, hardwareThreads) << "%" << std::endl;
+        assert(failures == 0);
+        if (failures != 0) {
+            throw std::runtime_error("concurrent documents diverged");
+        }
+    }
+
+    std::cout << "Multi-threaded scaling tests passed.\n";
+}
+
+// 测试持久化快照：O(1)创建，编辑继续进行时可在其他线程读取
+void testPersistentSnapshots() {
+    std::cout << "\n=== Testing Persistent Snapshots ===\n";
+    Timer timer("Persistent snapshots");
+
+    RandomDataGenerator random;
+    const int snapshotCount = 100;
+    const int editCount = 20000;
+
+    for (int64_t targetPieces : {10000, 100000}) {
+        auto buffer = createTestBuffer(random.randomMultilineString(2000, 80));
+        while (countPieces(*buffer) < targetPieces) {
+            for (int i = 0; i < 1000; ++i) {
+                buffer->insert(random.randomNumber(0, buffer->getLength()), "ab", false);
+            }
+        }
+
+        // 普通快照需要复制所有piece
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < snapshotCount; ++i) {
+            buffer->createSnapshot("");
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double copyUs = std::chrono::duration<double, std::micro>(end - start).count() / snapshotCount;
+
+        // 编辑开销：关闭与开启持久化模式
+        start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < editCount; ++i) {
+            buffer->insert(random.randomNumber(0, buffer->getLength()), "x", false);
+            buffer->deleteText(random.randomNumber(0, buffer->getLength() - 1), 1);
+        }
+        end = std::chrono::high_resolution_clock::now();
+        double plainEditUs = std::chrono::duration<double, std::micro>(end - start).count() / (editCount * 2);
+
+        buffer->setPersistentSnapshots(true);
+        start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < editCount; ++i) {
+            buffer->insert(random.randomNumber(0, buffer->getLength()), "x", false);
+            buffer->deleteText(random.randomNumber(0, buffer->getLength() - 1), 1);
+        }
+        end = std::chrono::high_resolution_clock::now();
+        double persistentEditUs = std::chrono::duration<double, std::micro>(end - start).count() / (editCount * 2);
+
+        start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < snapshotCount; ++i) {
+            buffer->createSnapshot("");
+        }
+        end = std::chrono::high_resolution_clock::now();
+        double persistentUs = std::chrono::duration<double, std::micro>(end - start).count() / snapshotCount;
+
+        std::cout << "  pieces=" << std::setw(7) << countPieces(*buffer)
+                  << "  snapshot copy=" << std::fixed << std::setprecision(2) << copyUs << " us"
+                  << "  persistent=" << persistentUs << " us"
+                  << "  per-edit " << plainEditUs << " -> " << persistentEditUs << " us" << std::endl;
+
+        // 在另一个线程中读取快照，同时主线程继续编辑
+        std::string expected = buffer->getValue();
+        auto snapshot = buffer->createSnapshot("");
+        std::string seen;
+        std::thread reader([&snapshot, &seen]() {
+            for (std::string chunk = snapshot->read(); !chunk.empty(); chunk = snapshot->read()) {
+                seen += chunk;
+            }
+        });
+        for (int i = 0; i < editCount; ++i) {
+            buffer->insert(random.randomNumber(0, buffer->getLength()), "y\n", false);
+            buffer->deleteText(random.randomNumber(0, buffer->getLength() - 1), 2);
+        }
+        reader.join();
+
+        assert(seen == expected);
+        if (seen != expected) {
+            throw std::runtime_error("snapshot changed while the buffer was edited");
+        }
+    }
+
+    // 大段删除按块进行，各块的编辑只是整个删除的一部分，快照仍须与文档一致
+    auto buffer = createTestBuffer(random.randomMultilineString(20000, 80));
+    buffer->setPersistentSnapshots(true);
+    buffer->deleteText(buffer->getLength() / 3, buffer->getLength() / 5);
+    auto snapshot = buffer->createSnapshot("");
+    std::string seen;
+    for (std::string chunk = snapshot->read(); !chunk.empty(); chunk = snapshot->read()) {
+        seen += chunk;
+    }
+    assert(seen == buffer->getValue());
+    if (seen != buffer->getValue()) {
+        throw std::runtime_error("snapshot differs from the buffer after a large delete");
+    }
+
+    std::cout << "Persistent snapshot tests passed.\n";
+}
+
+// 测试普通快照：快照引用的变更缓冲区被冻结，编辑、回收和行尾规范化继续进行时可在其他线程读取
+void testSnapshotsAcrossThreads() {
+    std::cout << "\n=== Testing Snapshots Across Threads ===\n";
+    Timer timer("Snapshots across threads");
+
+    RandomDataGenerator random;
+    const int editCount = 20000;
+    const int readerCount = 4;
+
+    auto buffer = createTestBuffer(random.randomMultilineString(2000, 80));
+    // 先编辑一些，让快照的piece落在变更缓冲区中
+    for (int i = 0; i < 1000; ++i) {
+        buffer->insert(random.randomNumber(0, buffer->getLength()), "ab\n", false);
+    }
+    std::string expected = buffer->getValue();
+    auto snapshot = buffer->createSnapshot("");
+    auto* shared = dynamic_cast<PieceTreeSnapshot*>(snapshot.get());
+    assert(shared != nullptr);
+
+    // 编辑期间每个读者反复复制快照读取，副本共享同一组piece
+    std::atomic<bool> editing(true);
+    std::atomic<int> mismatches(0);
+    std::atomic<int> reads(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < readerCount; ++t) {
+        readers.emplace_back([shared, &expected, &editing, &mismatches, &reads]() {
+            do {
+                PieceTreeSnapshot copy(*shared);
+                std::string seen;
+                for (std::string chunk = copy.read(); !chunk.empty(); chunk = copy.read()) {
+                    seen += chunk;
+                }
+                if (seen != expected) {
+                    mismatches++;
+                }
+                reads++;
+            } while (editing);
+        });
+    }
+
+    // 主线程继续编辑：追加会让变更缓冲区重新分配，大段插入会新建缓冲区
+    std::string large(70000, 'z');
+    for (int i = 0; i < editCount; ++i) {
+        buffer->insert(random.randomNumber(0, buffer->getLength()), i % 5000 == 0 ? large : "y\n", false);
+        buffer->deleteText(random.randomNumber(0, buffer->getLength() - 1), 2);
+        if (i % 5000 == 4999) {
+            buffer->compactBuffers();
+        }
+    }
+    buffer->setEOL("\r\n");
+    editing = false;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+
+    std::cout << "  " << reads.load() << " reads on " << readerCount << " threads while editing" << std::endl;
+    assert(mismatches == 0);
+    if (mismatches != 0) {
+        throw std::runtime_error("snapshot changed while the buffer was edited");
+    }
+    // 原快照本身仍从头读取
+    std::string original;
+    for (std::string chunk = snapshot->read(); !chunk.empty(); chunk = snapshot->read()) {
+        original += chunk;
+    }
+    assert(original == expected);
+    if (original != expected) {
+        throw std::runtime_error("snapshot changed after the readers finished");
+    }
+
+    std::cout << "Snapshots across threads tests passed.\n";
+}
+
 // 运行所有测试
 int main() {
     try {
@@ -675,6 +1008,11 @@ int main() {
         
         // 性能和稳定性测试
         testPerformanceStability();
+        testEditCostScaling();
+        testNodeAllocator();
+        testMultiThreadedScaling();
+        testPersistentSnapshots();
+        testSnapshotsAcrossThreads();
         testExtremeEdgeCases();
         testChunkBehavior();
         
@@ -0,0 +1,197 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include "textbuffer/piece_tree_builder.h"
+
+using namespace textbuffer;
+
+// 撤销/重做测试：删除一个大文档的几乎全部内容后撤销，
+// 片段级的历史只需重新链接原有缓冲区，与先复制被删文本的做法对比
+// 用法: undo_benchmark [文档大小MB]，默认100MB
+
+namespace {
+
+std::string makeDocument(size_t bytes) {
+    std::string line = "The quick brown fox jumps over the lazy dog, again and again.\n";
+    std::string text;
+    text.reserve(bytes + line.size());
+    while (text.size() < bytes) {
+        text += line;
+    }
+    return text;
+}
+
+std::unique_ptr<PieceTreeBase> createTree(const std::string& text, PieceTreeBackend backend) {
+    PieceTreeTextBufferBuilder builder;
+    // 按64KB分块送入，与读文件时一样
+    const size_t chunkSize = 64 * 1024;
+    for (size_t pos = 0; pos < text.size(); pos += chunkSize) {
+        builder.acceptChunk(text.substr(pos, chunkSize));
+    }
+    return builder.finish().create(DefaultEndOfLine::LF, backend);
+}
+
+template <typename F>
+double measureMs(F&& body) {
+    auto start = std::chrono::high_resolution_clock::now();
+    body();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void expect(bool condition, const std::string& what) {
+    if (!condition) {
+        throw std::runtime_error(what);
+    }
+}
+
+const char* backendName(PieceTreeBackend backend) {
+    return backend == PieceTreeBackend::RedBlackTree ? "rb-tree" : "b-tree ";
+}
+
+// 删除几乎全部内容，然后撤销、重做
+void runLargeDeleteBenchmark(const std::string& text, PieceTreeBackend backend) {
+    Offset start = 10;
+    Offset count = static_cast<Offset>(text.size()) - 20;
+
+    // 先复制被删文本再删除的做法
+    auto copying = createTree(text, backend);
+    std::string removed;
+    double copyDeleteMs = measureMs([&]() {
+        common::Position from = copying->getPositionAt(start);
+        common::Position to = copying->getPositionAt(start + count);
+        removed = copying->getValueInRange(common::Range(from.lineNumber(), from.column(), to.lineNumber(), to.column()));
+        copying->deleteText(start, count);
+    });
+    expect(removed.size() == static_cast<size_t>(count), "copied the wrong range");
+    // 按64KB分段插回，整段插入时每段都要复制剩余文本
+    double copyUndoMs = measureMs([&]() {
+        const size_t sliceSize = 64 * 1024;
+        for (size_t end = removed.size(); end > 0;) {
+            size_t begin = end > sliceSize ? end - sliceSize : 0;
+            copying->insert(start, removed.substr(begin, end - begin), true);
+            end = begin;
+        }
+    });
+    expect(copying->getValue() == text, "copy-based undo did not restore the document");
+
+    auto tree = createTree(text, backend);
+    tree->setUndoHistory(true);
+    double deleteMs = measureMs([&]() {
+        tree->deleteText(start, count);
+    });
+    expect(tree->getLength() == static_cast<Offset>(text.size()) - count, "delete removed the wrong amount");
+    size_t bytesAfterDelete = tree->getBufferMemoryStats().totalBytes;
+
+    double undoMs = measureMs([&]() {
+        expect(tree->undo(), "nothing to undo");
+    });
+    expect(tree->getValue() == text, "undo did not restore the document");
+    expect(tree->getBufferMemoryStats().totalBytes == bytesAfterDelete, "undo copied text into the buffers");
+
+    double redoMs = measureMs([&]() {
+        expect(tree->redo(), "nothing to redo");
+    });
+    expect(tree->getLength() == static_cast<Offset>(text.size()) - count, "redo did not delete again");
+    expect(tree->undo() && tree->getLength() == static_cast<Offset>(text.size()), "second undo failed");
+
+    std::cout << "  " << backendName(backend) << std::fixed << std::setprecision(3)
+              << "  delete=" << std::setw(8) << deleteMs << " ms"
+              << "  undo=" << std::setw(8) << undoMs << " ms"
+              << "  redo=" << std::setw(8) << redoMs << " ms"
+              << "  | copy+delete=" << std::setw(9) << copyDeleteMs << " ms"
+              << "  reinsert=" << std::setw(9) << copyUndoMs << " ms"
+              << "  pieces=" << tree->getPieceCount() << std::endl;
+}
+
+// 事务内的编辑作为一步撤销
+void runTransactionTest(PieceTreeBackend backend) {
+    std::string text = makeDocument(64 * 1024);
+    auto tree = createTree(text, backend);
+    tree->setUndoHistory(true);
+
+    tree->beginTransaction();
+    for (int i = 0; i < 1000; i++) {
+        tree->insert(100 + i, "x", false);
+    }
+    tree->deleteText(0, 50);
+    tree->endTransaction();
+    tree->insert(0, "after", false);
+
+    EditHistoryStats stats = tree->getUndoHistoryStats();
+    expect(stats.undoSteps == 2, "a transaction did not become one step");
+    expect(tree->undo() && tree->undo(), "undo of the transaction failed");
+    expect(tree->getValue() == text, "undoing the transaction did not restore the document");
+    expect(!tree->canUndo() && tree->canRedo(), "history left in a wrong state");
+    expect(tree->redo() && tree->redo() && tree->getValue().compare(0, 5, "after") == 0, "redo of the transaction failed");
+
+    // 新的编辑丢弃可重做的步骤
+    tree->undo();
+    tree->insert(0, "new", false);
+    expect(!tree->canRedo(), "an edit kept the redo steps");
+
+    std::cout << "  " << backendName(backend) << "  1001 edits in a transaction undone as one step" << std::endl;
+}
+
+// 历史按步数和引用的字节数限制
+void runLimitTest(PieceTreeBackend backend) {
+    std::string text = makeDocument(1024 * 1024);
+    auto tree = createTree(text, backend);
+    tree->setUndoHistory(true);
+    tree->setUndoLimits(10, EditHistory::DefaultMaxBytes);
+    for (int i = 0; i < 100; i++) {
+        tree->insert(i * 7, "edit", false);
+    }
+    expect(tree->getUndoHistoryStats().undoSteps == 10, "step limit not kept");
+
+    // 每步引用约100KB，限制为250KB时最多保留两步
+    tree->clearUndoHistory();
+    tree->setUndoLimits(100, 250 * 1024);
+    for (int i = 0; i < 5; i++) {
+        tree->deleteText(i * 100, 100 * 1024);
+    }
+    EditHistoryStats stats = tree->getUndoHistoryStats();
+    expect(stats.undoSteps <= 2 && stats.bytes <= stats.maxBytes, "byte limit not kept");
+
+    // 最新的一步总是保留，无论多大
+    tree->deleteText(0, 512 * 1024);
+    expect(tree->getUndoHistoryStats().undoSteps == 1, "the newest step was dropped");
+    Offset length = tree->getLength();
+    expect(tree->undo() && tree->getLength() == length + 512 * 1024, "undo of an oversized step failed");
+
+    std::cout << "  " << backendName(backend) << "  steps=" << stats.undoSteps << " bytes=" << stats.bytes
+              << " within maxBytes=" << stats.maxBytes << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t megabytes = argc > 1 ? std::atoll(argv[1]) : 100;
+
+    try {
+        std::string text = makeDocument(megabytes * 1024 * 1024);
+        std::cout << "=== Undo of a " << megabytes << " MB delete: piece history vs copying the text ===\n";
+        for (PieceTreeBackend backend : {PieceTreeBackend::RedBlackTree, PieceTreeBackend::BTree}) {
+            runLargeDeleteBenchmark(text, backend);
+        }
+
+        std::cout << "\n=== Transactions ===\n";
+        for (PieceTreeBackend backend : {PieceTreeBackend::RedBlackTree, PieceTreeBackend::BTree}) {
+            runTransactionTest(backend);
+        }
+
+        std::cout << "\n=== History limits ===\n";
+        for (PieceTreeBackend backend : {PieceTreeBackend::RedBlackTree, PieceTreeBackend::BTree}) {
+            runLimitTest(backend);
+        }
+        std::cout << "\n=== Undo benchmark completed ===\n";
+        return 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Benchmark failed with exception: " << e.what() << std::endl;
+        return 1;
+    }
+}
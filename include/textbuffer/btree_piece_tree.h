@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "piece_tree_base.h"
+
+namespace textbuffer {
+
+/**
+ * Piece tree backed by a B+-tree instead of the red-black tree.
+ * Pieces are stored in the leaves, and every inner node keeps the length and
+ * line feed count of each child in small arrays, so a lookup scans one or two
+ * cache lines per level over roughly log16(n) levels instead of chasing log2(n)
+ * binary nodes. Leaves are chained for sequential reads.
+ * Lines and columns are 0-based, as everywhere in the piece tree API.
+ */
+class BTreePieceTree : public PieceTreeBase {
+public:
+    // 16 Offset sums fill one 64-byte cache line with 32-bit offsets, two with
+    // TEXTBUFFER_64BIT_OFFSETS
+    static constexpr int32_t MaxChildren = 16;
+    static constexpr int32_t MaxPieces = 16;
+
+    BTreePieceTree();
+    ~BTreePieceTree() override;
+    BTreePieceTree(const BTreePieceTree&) = delete;
+    BTreePieceTree& operator=(const BTreePieceTree&) = delete;
+
+    void create(std::vector<StringBuffer> chunks, const std::string& eol, bool eolNormalized) override;
+
+    Offset getOffsetAt(Offset lineNumber, Offset column) override;
+    common::Position getPositionAt(Offset offset) override;
+    std::string getValueInRange(const common::Range& range, const std::string& eol = "") override;
+    uint32_t getLineCharCode(Offset lineNumber, Offset index) override;
+    Offset getLineLength(Offset lineNumber) override;
+    uint32_t getCharCode(Offset offset) override;
+    PieceIterator pieceBegin() const override;
+    PieceIterator pieceAt(Offset offset) const override;
+    std::string getValue() override;
+    std::string getLinesRawContent() override;
+    std::string getLineRawContent(Offset lineNumber, Offset endOffset = 0) override;
+
+    void insert(Offset offset, const std::string& value, bool eolNormalized = false) override;
+    void delete_(Offset offset, Offset count) override;
+    void deleteText(Offset offset, Offset count) override;
+
+    Offset getPieceCount() const override { return _pieceCount; }
+
+    /**
+     * Number of levels, the leaf level included
+     */
+    int32_t getHeight() const override { return _height; }
+
+protected:
+    std::vector<SharedPiece> collectPieces(Offset start, Offset end) override;
+    void remapPieces(const std::function<void(Piece&)>& callback) override;
+    void stepPiece(PieceIterator& it, bool forward) const override;
+    void replacePieces(const std::vector<Piece>& pieces) override;
+    void insertPieces(Offset offset, const std::vector<Piece>& pieces) override;
+    bool mergePiecesAt(Offset offset) override;
+
+private:
+    static constexpr int32_t MaxDepth = 32;
+
+    struct Node {
+        bool isLeaf;
+        int32_t count;
+    };
+
+    struct Inner : Node {
+        Offset lengths[MaxChildren];
+        Offset lineFeeds[MaxChildren];
+        Node* children[MaxChildren];
+    };
+
+    struct Leaf : Node {
+        Piece pieces[MaxPieces];
+        Leaf* prev;
+        Leaf* next;
+    };
+
+    struct PathEntry {
+        Inner* node;
+        int32_t index;
+    };
+
+    /**
+     * Result of a descent: the inner nodes passed, and where it ended in the leaf
+     */
+    struct Location {
+        PathEntry path[MaxDepth];
+        int32_t depth;
+        Leaf* leaf;
+        int32_t index;            // piece index in the leaf
+        Offset remainder;        // offset inside that piece
+        Offset pieceStart;       // document offset of that piece
+        Offset lineFeedsBefore;  // line feeds before that piece
+    };
+
+    Node* _root;
+    Leaf* _firstLeaf;
+    int32_t _height;
+    Offset _pieceCount;
+
+    static Leaf* newLeaf();
+    static Inner* newInner();
+    static void freeNode(Node* node);
+    static void nodeSums(const Node* node, Offset& length, Offset& lineFeeds);
+
+    /**
+     * Descend to the piece holding offset. At a piece border the earlier piece
+     * is chosen, unless preferNext is set.
+     */
+    void locate(Offset offset, bool preferNext, Location& loc) const;
+
+    /**
+     * Document offset where the given line starts
+     */
+    Offset lineStartOffset(Offset lineNumber) const;
+
+    void addToPath(Location& loc, Offset lengthDelta, Offset lineFeedsDelta);
+    void insertIntoLeaf(Location& loc, int32_t index, const Piece& piece);
+    void insertSibling(Location& loc, int32_t level, Node* left, Node* right);
+    void replacePiece(Location& loc, const Piece& piece);
+    void removeFromLeaf(Location& loc, int32_t index, int32_t count);
+    void rebalance(Location& loc, int32_t level);
+
+    /**
+     * Body of insert, run inside the edit scope it opens
+     */
+    void insertValue(Offset offset, const std::string& value, bool eolNormalized);
+
+    std::pair<Piece, Piece> splitPiece(const Piece& piece, Offset remainder) const;
+    void splitAt(Offset offset);
+    void insertPieceAt(Offset offset, const Piece& piece);
+    void removeRange(Offset start, Offset end);
+    void validateCRLF(Offset offset);
+    std::string getText(Offset start, Offset end) const;
+};
+
+} // namespace textbuffer
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+namespace textbuffer {
+
+/**
+ * Integer type for text offsets, lengths, line numbers and line starts.
+ * 32-bit by default; configure with TEXTBUFFER_64BIT_OFFSETS=ON to open
+ * documents larger than 2 GB.
+ */
+#if TEXTBUFFER_64BIT_OFFSETS
+using Offset = int64_t;
+#else
+using Offset = int32_t;
+#endif
+
+} // namespace textbuffer
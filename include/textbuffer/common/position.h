@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <string>
+#include "offset.h"
 
 namespace textbuffer {
 namespace common {
@@ -16,12 +17,12 @@ public:
     /**
      * line number (starts at 1)
      */
-    virtual int32_t lineNumber() const = 0;
+    virtual Offset lineNumber() const = 0;
 
     /**
      * column (the first character in a line is between column 1 and column 2)
      */
-    virtual int32_t column() const = 0;
+    virtual Offset column() const = 0;
 };
 
 /**
@@ -29,8 +30,8 @@ public:
  */
 class Position : public IPosition {
 private:
-    int32_t _lineNumber;
-    int32_t _column;
+    Offset _lineNumber;
+    Offset _column;
 
 public:
     /**
@@ -39,20 +40,20 @@ public:
      * @param lineNumber line number (starts at 1)
      * @param column column (starts at 1)
      */
-    Position(int32_t lineNumber, int32_t column) 
+    Position(Offset lineNumber, Offset column) 
         : _lineNumber(lineNumber), _column(column) {}
 
     /**
      * line number (starts at 1)
      */
-    int32_t lineNumber() const override {
+    Offset lineNumber() const override {
         return _lineNumber;
     }
 
     /**
      * column (the first character in a line is between column 1 and column 2)
      */
-    int32_t column() const override {
+    Offset column() const override {
         return _column;
     }
 
@@ -62,7 +63,7 @@ public:
      * @param newLineNumber new line number
      * @param newColumn new column
      */
-    Position with(int32_t newLineNumber = -1, int32_t newColumn = -1) const {
+    Position with(Offset newLineNumber = -1, Offset newColumn = -1) const {
         if (newLineNumber == -1) {
             newLineNumber = _lineNumber;
         }
@@ -83,7 +84,7 @@ public:
      * @param deltaLineNumber line number delta
      * @param deltaColumn column delta
      */
-    Position delta(int32_t deltaLineNumber = 0, int32_t deltaColumn = 0) const {
+    Position delta(Offset deltaLineNumber = 0, Offset deltaColumn = 0) const {
         return with(_lineNumber + deltaLineNumber, _column + deltaColumn);
     }
 
@@ -149,12 +150,12 @@ public:
      * A function that compares positions, useful for sorting
      */
     static int compare(const IPosition& a, const IPosition& b) {
-        int32_t aLineNumber = a.lineNumber();
-        int32_t bLineNumber = b.lineNumber();
+        Offset aLineNumber = a.lineNumber();
+        Offset bLineNumber = b.lineNumber();
 
         if (aLineNumber == bLineNumber) {
-            int32_t aColumn = a.column();
-            int32_t bColumn = b.column();
+            Offset aColumn = a.column();
+            Offset bColumn = b.column();
             return aColumn - bColumn;
         }
 
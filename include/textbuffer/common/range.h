@@ -18,22 +18,22 @@ public:
     /**
      * Line number on which the range starts (starts at 1).
      */
-    virtual int32_t startLineNumber() const = 0;
+    virtual Offset startLineNumber() const = 0;
 
     /**
      * Column on which the range starts in line `startLineNumber` (starts at 1).
      */
-    virtual int32_t startColumn() const = 0;
+    virtual Offset startColumn() const = 0;
 
     /**
      * Line number on which the range ends.
      */
-    virtual int32_t endLineNumber() const = 0;
+    virtual Offset endLineNumber() const = 0;
 
     /**
      * Column on which the range ends in line `endLineNumber`.
      */
-    virtual int32_t endColumn() const = 0;
+    virtual Offset endColumn() const = 0;
 };
 
 /**
@@ -41,13 +41,13 @@ public:
  */
 class Range : public IRange {
 private:
-    int32_t _startLineNumber;
-    int32_t _startColumn;
-    int32_t _endLineNumber;
-    int32_t _endColumn;
+    Offset _startLineNumber;
+    Offset _startColumn;
+    Offset _endLineNumber;
+    Offset _endColumn;
 
 public:
-    Range(int32_t startLineNumber, int32_t startColumn, int32_t endLineNumber, int32_t endColumn) {
+    Range(Offset startLineNumber, Offset startColumn, Offset endLineNumber, Offset endColumn) {
         if ((startLineNumber > endLineNumber) || (startLineNumber == endLineNumber && startColumn > endColumn)) {
             _startLineNumber = endLineNumber;
             _startColumn = endColumn;
@@ -64,28 +64,28 @@ public:
     /**
      * Line number on which the range starts (starts at 1).
      */
-    int32_t startLineNumber() const override {
+    Offset startLineNumber() const override {
         return _startLineNumber;
     }
 
     /**
      * Column on which the range starts in line `startLineNumber` (starts at 1).
      */
-    int32_t startColumn() const override {
+    Offset startColumn() const override {
         return _startColumn;
     }
 
     /**
      * Line number on which the range ends.
      */
-    int32_t endLineNumber() const override {
+    Offset endLineNumber() const override {
         return _endLineNumber;
     }
 
     /**
      * Column on which the range ends in line `endLineNumber`.
      */
-    int32_t endColumn() const override {
+    Offset endColumn() const override {
         return _endColumn;
     }
 
@@ -165,10 +165,10 @@ public:
      * The smallest position will be used as the start point, and the largest position as the end point.
      */
     static Range plusRange(const IRange& a, const IRange& b) {
-        int32_t startLineNumber = 0;
-        int32_t startColumn = 0;
-        int32_t endLineNumber = 0;
-        int32_t endColumn = 0;
+        Offset startLineNumber = 0;
+        Offset startColumn = 0;
+        Offset endLineNumber = 0;
+        Offset endColumn = 0;
 
         if (a.startLineNumber() < b.startLineNumber()) {
             startLineNumber = a.startLineNumber();
@@ -208,16 +208,16 @@ public:
      * If there is no intersection, returns null.
      */
     static std::unique_ptr<Range> intersectRanges(const IRange& a, const IRange& b) {
-        int32_t resultStartLineNumber = std::max(a.startLineNumber(), b.startLineNumber());
-        int32_t resultEndLineNumber = std::min(a.endLineNumber(), b.endLineNumber());
+        Offset resultStartLineNumber = std::max(a.startLineNumber(), b.startLineNumber());
+        Offset resultEndLineNumber = std::min(a.endLineNumber(), b.endLineNumber());
 
         if (resultStartLineNumber > resultEndLineNumber) {
             // There is no intersection
             return nullptr;
         }
 
-        int32_t resultStartColumn = 0;
-        int32_t resultEndColumn = 0;
+        Offset resultStartColumn = 0;
+        Offset resultEndColumn = 0;
 
         if (a.startLineNumber() == b.startLineNumber()) {
             resultStartColumn = std::max(a.startColumn(), b.startColumn());
@@ -289,14 +289,14 @@ public:
     /**
      * Create a new range using this range's start position, and using endLineNumber and endColumn as the end position.
      */
-    Range setEndPosition(int32_t endLineNumber, int32_t endColumn) const {
+    Range setEndPosition(Offset endLineNumber, Offset endColumn) const {
         return Range(_startLineNumber, _startColumn, endLineNumber, endColumn);
     }
 
     /**
      * Create a new range using this range's end position, and using startLineNumber and startColumn as the start position.
      */
-    Range setStartPosition(int32_t startLineNumber, int32_t startColumn) const {
+    Range setStartPosition(Offset startLineNumber, Offset startColumn) const {
         return Range(startLineNumber, startColumn, _endLineNumber, _endColumn);
     }
 
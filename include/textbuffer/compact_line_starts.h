@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "textbuffer/common/offset.h"
+
+namespace textbuffer {
+
+/**
+ * Line starts of a buffer that no longer changes, stored in fewer bytes than
+ * a std::vector<Offset>. Starts that all fit in 16 bits, as those of a buffer
+ * under 64 KB do, are kept as uint16_t. Longer buffers split the starts into
+ * blocks of BlockSize, each holding its first start and the distance of the
+ * others to it in 16 bits; a block spanning 64 KB or more keeps its starts
+ * whole. Every start is read in O(1).
+ */
+class CompactLineStarts {
+public:
+    static constexpr size_t BlockShift = 6;
+    static constexpr size_t BlockSize = size_t(1) << BlockShift;
+
+    CompactLineStarts() : _size(0) {}
+    explicit CompactLineStarts(const std::vector<Offset>& lineStarts);
+
+    size_t size() const { return _size; }
+
+    /**
+     * Whether the starts are kept as uint16_t, without blocks
+     */
+    bool isNarrow() const { return _narrow != nullptr; }
+
+    const uint16_t* narrow() const { return _narrow.get(); }
+
+    Offset operator[](size_t i) const {
+        if (_narrow) {
+            return _narrow[i];
+        }
+        const Block& block = _blocks[i >> BlockShift];
+        size_t index = block.index + (i & (BlockSize - 1));
+        return block.wide ? _wide[index] : block.base + _deltas[index];
+    }
+
+    /**
+     * Index of the first start in [first, last) greater than value, last if
+     * none. Searches the block bases first, then a single block.
+     */
+    size_t upperBound(size_t first, size_t last, Offset value) const;
+
+    /**
+     * Bytes held by the encoded starts
+     */
+    size_t memoryBytes() const;
+
+private:
+    struct Block {
+        Offset base;     // first start of the block
+        uint32_t index;  // of the first start in _deltas, or in _wide if wide
+        bool wide;
+    };
+
+    size_t _size;
+    std::unique_ptr<uint16_t[]> _narrow;
+    std::vector<Block> _blocks;
+    std::vector<uint16_t> _deltas;
+    std::vector<Offset> _wide;
+};
+
+/**
+ * Read-only view of the line starts of a buffer, either a plain vector, as
+ * change buffers keep, or compact ones. Only valid while the buffer is.
+ */
+class LineStartsView {
+public:
+    LineStartsView(const std::vector<Offset>& lineStarts)
+        : _plain(lineStarts.data()), _narrow(nullptr), _compact(nullptr), _size(lineStarts.size()) {}
+    LineStartsView(const CompactLineStarts& lineStarts)
+        : _plain(nullptr), _narrow(lineStarts.narrow()), _compact(&lineStarts), _size(lineStarts.size()) {}
+
+    Offset operator[](size_t i) const {
+        if (_plain) {
+            return _plain[i];
+        }
+        if (_narrow) {
+            return _narrow[i];
+        }
+        return (*_compact)[i];
+    }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    Offset back() const { return (*this)[_size - 1]; }
+
+    /**
+     * Index of the first start in [first, last) greater than value, last if none
+     */
+    size_t upperBound(size_t first, size_t last, Offset value) const {
+        if (_plain) {
+            return std::upper_bound(_plain + first, _plain + last, value) - _plain;
+        }
+        return _compact->upperBound(first, last, value);
+    }
+
+private:
+    const Offset* _plain;
+    const uint16_t* _narrow;
+    const CompactLineStarts* _compact;
+    size_t _size;
+};
+
+} // namespace textbuffer
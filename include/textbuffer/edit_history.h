@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "persistent_piece_tree.h"
+
+namespace textbuffer {
+
+/**
+ * One undoable change of a piece tree: at offset, the text of removed was
+ * replaced by that of inserted. The pieces hold on to their buffers, so the
+ * text is never copied out and stays readable after compaction.
+ */
+struct HistoryEdit {
+    Offset offset = 0;
+    Offset removedLength = 0;
+    Offset insertedLength = 0;
+    std::vector<SharedPiece> removed;
+    std::vector<SharedPiece> inserted;
+};
+
+/**
+ * Edits undone and redone together, in the order they were made
+ */
+struct HistoryStep {
+    std::vector<HistoryEdit> edits;
+    size_t bytes = 0;  // text referenced by the edits plus their bookkeeping
+};
+
+struct EditHistoryStats {
+    size_t undoSteps = 0;
+    size_t redoSteps = 0;
+    size_t bytes = 0;     // text referenced by all steps plus their bookkeeping
+    size_t maxSteps = 0;
+    size_t maxBytes = 0;
+};
+
+/**
+ * Undo and redo stacks of piece-level edits.
+ * Edits made inside a transaction form a single step. Most of the text the
+ * steps reference is shared with the document or its buffers, but after
+ * compaction the history alone keeps it alive, so the oldest steps are
+ * dropped once there are more than maxSteps or they reference more than
+ * maxBytes. The newest step is always kept, however large.
+ */
+class EditHistory {
+public:
+    static constexpr size_t DefaultMaxSteps = 1000;
+    static constexpr size_t DefaultMaxBytes = 256 * 1024 * 1024;
+
+    explicit EditHistory(size_t maxSteps = DefaultMaxSteps, size_t maxBytes = DefaultMaxBytes);
+
+    /**
+     * Group the following edits into one step until the matching endTransaction.
+     * Transactions nest; only the outermost one ends the step.
+     */
+    void beginTransaction();
+    void endTransaction();
+
+    /**
+     * Add a new edit. The redo stack is dropped.
+     */
+    void record(HistoryEdit edit);
+
+    bool canUndo() const { return !_undo.empty(); }
+    bool canRedo() const { return !_redo.empty(); }
+
+    /**
+     * Remove the newest step from the undo stack, closing it to further edits
+     */
+    HistoryStep takeUndo();
+
+    /**
+     * Remove the newest step from the redo stack
+     */
+    HistoryStep takeRedo();
+
+    /**
+     * Put back a step that was undone or redone
+     */
+    void pushUndo(HistoryStep step);
+    void pushRedo(HistoryStep step);
+
+    void clear();
+    void setLimits(size_t maxSteps, size_t maxBytes);
+    EditHistoryStats stats() const;
+
+private:
+    std::deque<HistoryStep> _undo;
+    std::vector<HistoryStep> _redo;
+    size_t _bytes;
+    size_t _maxSteps;
+    size_t _maxBytes;
+    int32_t _transactionDepth;
+    bool _stepOpen;  // whether the newest undo step still takes edits
+
+    static size_t editBytes(const HistoryEdit& edit);
+
+    /**
+     * Drop the oldest undo steps until the limits hold again
+     */
+    void trim();
+};
+
+} // namespace textbuffer
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace textbuffer {
+
+/**
+ * Read-only mapping of a whole file.
+ * The kernel reads pages in on first access and may drop them again under
+ * memory pressure, so only the touched part of the file counts against the
+ * resident set. The file must not be truncated while it is mapped.
+ * Where mmap is not available the file is read into memory instead.
+ */
+class MappedFile {
+public:
+    /**
+     * Map the file at path. Throws std::runtime_error if it cannot be opened.
+     */
+    static std::shared_ptr<MappedFile> open(const std::string& path);
+
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+    std::string_view text() const { return std::string_view(_data, _size); }
+
+    /**
+     * Let the kernel take the pages of [offset, offset + length) out of the
+     * resident set. They are read in again on the next access.
+     */
+    void release(size_t offset, size_t length) const;
+
+private:
+    MappedFile(const char* data, size_t size, bool mapped);
+
+    const char* _data;
+    size_t _size;
+    bool _mapped;         // false when the text was read into _contents
+    std::string _contents;
+};
+
+} // namespace textbuffer
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "piece.h"
+
+namespace textbuffer {
+
+class StringBuffer;
+
+/**
+ * Immutable node of a persistent piece tree.
+ * A node is never modified once built; edits copy the path from the root
+ * and share every untouched subtree with the previous version.
+ */
+struct PersistentNode {
+    Piece piece;
+    std::shared_ptr<const StringBuffer> buffer;  // buffer the piece points into
+    std::shared_ptr<const PersistentNode> left;
+    std::shared_ptr<const PersistentNode> right;
+    uint64_t priority;       // treap priority, a parent never has a lower one
+    Offset totalLength;     // length of the whole subtree
+    Offset totalLineFeeds;  // line feeds in the whole subtree
+};
+
+using PersistentNodePtr = std::shared_ptr<const PersistentNode>;
+
+/**
+ * Piece descriptor together with the buffer that owns its text
+ */
+struct SharedPiece {
+    Piece piece;
+    std::shared_ptr<const StringBuffer> buffer;
+};
+
+/**
+ * One version of a persistent (path-copying) piece tree.
+ * Copying a version is O(1) and versions stay readable from any thread as
+ * long as the buffers they reference are no longer appended to.
+ */
+class PersistentPieceTree {
+public:
+    PersistentPieceTree() = default;
+    explicit PersistentPieceTree(PersistentNodePtr root) : _root(std::move(root)) {}
+
+    /**
+     * Build a balanced version holding the given pieces in order, in linear time
+     */
+    static PersistentPieceTree build(const std::vector<SharedPiece>& pieces);
+
+    /**
+     * New version where the text in [start, end) is replaced by the text of another version
+     */
+    PersistentPieceTree replaceRange(Offset start, Offset end, const PersistentPieceTree& replacement) const;
+
+    /**
+     * Root node, null for an empty document
+     */
+    const PersistentNodePtr& root() const { return _root; }
+
+    /**
+     * Total text length
+     */
+    Offset getLength() const { return _root ? _root->totalLength : 0; }
+
+    /**
+     * Number of lines
+     */
+    Offset getLineCount() const { return (_root ? _root->totalLineFeeds : 0) + 1; }
+
+    /**
+     * Number of pieces
+     */
+    Offset getPieceCount() const;
+
+    /**
+     * Whole text of this version
+     */
+    std::string getValue() const;
+
+    /**
+     * Text of a single piece
+     */
+    static std::string getPieceContent(const PersistentNode& node);
+
+    /**
+     * Split a piece so that the first part holds `remainder` characters
+     */
+    static std::pair<Piece, Piece> splitPiece(const StringBuffer& buffer, const Piece& piece, Offset remainder);
+
+private:
+    PersistentNodePtr _root;
+};
+
+} // namespace textbuffer
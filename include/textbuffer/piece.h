@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include "textbuffer/common/position.h"
+
+namespace textbuffer {
+
+/**
+ * Buffer cursor position (line and column)
+ */
+struct BufferCursor {
+    Offset line;
+    Offset column;
+
+    BufferCursor() : line(0), column(0) {}
+    
+    BufferCursor(Offset line, Offset column)
+        : line(line), column(column) {}
+    
+    bool operator==(const BufferCursor& other) const {
+        return line == other.line && column == other.column;
+    }
+    
+    operator common::Position() const {
+        return common::Position(line, column);
+    }
+};
+
+/**
+ * Piece of text in the buffer
+ */
+class Piece {
+public:
+    int32_t bufferIndex;
+    BufferCursor start;
+    BufferCursor end;
+    Offset length;
+    Offset lineFeedCnt;
+
+    Piece() : bufferIndex(0), length(0), lineFeedCnt(0) {}
+
+    Piece(int32_t bufferIndex, const BufferCursor& start, const BufferCursor& end, Offset lineFeedCnt, Offset length)
+        : bufferIndex(bufferIndex), start(start), end(end), length(length), lineFeedCnt(lineFeedCnt) {}
+};
+
+} // namespace textbuffer
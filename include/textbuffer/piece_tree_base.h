@@ -1,16 +1,29 @@
 #pragma once
 
 #include <cstdint>
+#include <algorithm>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <array>
 #include <unordered_map>
+#include <list>
 #include <functional>
+#include <iterator>
+#include <cstddef>
 #include <utility>
 #include "textbuffer/common/position.h"
 #include "textbuffer/common/range.h"
 #include "textbuffer/common/char_code.h"
 #include "rb_tree_base.h"
+#include "persistent_piece_tree.h"
+#include "edit_history.h"
+#include "mapped_file.h"
+#include "compact_line_starts.h"
 
 namespace textbuffer {
 
@@ -26,13 +39,13 @@ public:
 };
 
 // Average buffer size for chunking
-constexpr int32_t AverageBufferSize = 65535;
+constexpr Offset AverageBufferSize = 65535;
 
 /**
  * Utility function to create an appropriate sized uint array
  */
 template <typename T>
-std::unique_ptr<T[]> createUintArray(const std::vector<int32_t>& arr) {
+std::unique_ptr<T[]> createUintArray(const std::vector<Offset>& arr) {
     auto result = std::make_unique<T[]>(arr.size());
     for (size_t i = 0; i < arr.size(); i++) {
         result[i] = static_cast<T>(arr[i]);
@@ -45,74 +58,96 @@ std::unique_ptr<T[]> createUintArray(const std::vector<int32_t>& arr) {
  */
 class LineStarts {
 public:
-    std::vector<int32_t> lineStarts;
-    int32_t cr;
-    int32_t lf;
-    int32_t crlf;
+    std::vector<Offset> lineStarts;
+    Offset cr;
+    Offset lf;
+    Offset crlf;
     bool isBasicASCII;
 
-    LineStarts(std::vector<int32_t> lineStarts, int32_t cr, int32_t lf, int32_t crlf, bool isBasicASCII)
+    LineStarts(std::vector<Offset> lineStarts, Offset cr, Offset lf, Offset crlf, bool isBasicASCII)
         : lineStarts(std::move(lineStarts)), cr(cr), lf(lf), crlf(crlf), isBasicASCII(isBasicASCII) {}
 };
 
 /**
  * Create line starts array quickly (just detects line breaks)
  */
-std::vector<int32_t> createLineStartsFast(const std::string& str);
+std::vector<Offset> createLineStartsFast(std::string_view str);
 
 /**
  * Create full line starts information including CR, LF and CRLF counts
  */
-LineStarts createLineStarts(const std::string& str);
+LineStarts createLineStarts(std::string_view str);
 
 /**
- * Node position in the piece tree
+ * CR, LF and CRLF counts of a text, without its line starts
  */
-struct NodePosition {
-    TreeNode* node;
-    int32_t remainder;
-    int32_t nodeStartOffset;
+LineStarts countLineBreaks(std::string_view str);
 
-    NodePosition() : node(nullptr), remainder(0), nodeStartOffset(0) {}
-    
-    NodePosition(TreeNode* node, int32_t remainder, int32_t nodeStartOffset)
-        : node(node), remainder(remainder), nodeStartOffset(nodeStartOffset) {}
+/**
+ * Implementation of the line start scans. The widest one the CPU supports is
+ * picked at startup; the SIMD kernels test 16 or 32 bytes at a time for line
+ * breaks and non-ASCII bytes.
+ */
+enum class LineScanKernel {
+    Scalar,
+    SSE2,
+    AVX2
 };
 
+bool isLineScanKernelSupported(LineScanKernel kernel);
+LineScanKernel getLineScanKernel();
+
 /**
- * Buffer cursor position (line and column)
+ * Use another kernel, for comparing them. Returns false if the CPU lacks it.
  */
-struct BufferCursor {
-    int32_t line;
-    int32_t column;
+bool setLineScanKernel(LineScanKernel kernel);
 
-    BufferCursor() : line(0), column(0) {}
-    
-    BufferCursor(int32_t line, int32_t column)
-        : line(line), column(column) {}
-    
-    bool operator==(const BufferCursor& other) const {
-        return line == other.line && column == other.column;
-    }
-    
-    operator common::Position() const {
-        return common::Position(line, column);
-    }
+/**
+ * Rewrites every \r\n, \r and \n to one end of line sequence in a single
+ * pass, using the line scan kernel to find the line breaks and copying the
+ * text between them in runs. Text may come in pieces: a \r at the end of one
+ * piece waits for the next, so a \r\n split between two pieces stays one
+ * line break.
+ */
+class EOLNormalizer {
+public:
+    explicit EOLNormalizer(std::string eol) : _eol(std::move(eol)), _pendingCR(false) {}
+
+    /**
+     * Append the normalized text to out. If lineStarts is given, the offset
+     * in out after every line break written is appended to it.
+     */
+    void append(std::string_view text, std::string& out, std::vector<Offset>* lineStarts = nullptr);
+
+    /**
+     * Write the line break of a \r held back from the last piece
+     */
+    void finish(std::string& out, std::vector<Offset>* lineStarts = nullptr);
+
+    bool hasPendingCR() const { return _pendingCR; }
+
+private:
+    std::string _eol;
+    bool _pendingCR;
 };
 
 /**
- * Piece of text in the buffer
+ * text with every line break replaced by eol
  */
-class Piece {
-public:
-    int32_t bufferIndex;
-    BufferCursor start;
-    BufferCursor end;
-    int32_t length;
-    int32_t lineFeedCnt;
-
-    Piece(int32_t bufferIndex, const BufferCursor& start, const BufferCursor& end, int32_t lineFeedCnt, int32_t length)
-        : bufferIndex(bufferIndex), start(start), end(end), length(length), lineFeedCnt(lineFeedCnt) {}
+std::string normalizeEOL(std::string_view text, const std::string& eol);
+
+/**
+ * Node position in the piece tree
+ */
+struct NodePosition {
+    TreeNode* node;
+    Offset remainder;
+    Offset nodeStartOffset;
+
+    NodePosition() : node(nullptr), remainder(0), nodeStartOffset(0) {}
+    
+    NodePosition(TreeNode* node, Offset remainder, Offset nodeStartOffset)
+        : node(node), remainder(remainder), nodeStartOffset(nodeStartOffset) {}
 };
 
 /**
@@ -120,41 +155,121 @@ public:
  */
 class StringBuffer {
 public:
-    std::string buffer;
-    std::vector<int32_t> lineStarts;
-    int32_t cr;
-    int32_t lf;
-    int32_t crlf;
+    std::string buffer;             // owned text, empty when the text is mapped
+    std::vector<Offset> lineStarts;
+    Offset cr;
+    Offset lf;
+    Offset crlf;
     bool isBasicASCII;
+    std::shared_ptr<const MappedFile> mapping;  // keeps the mapped text alive
+    std::string_view mapped;                    // read-only text inside mapping
 
     StringBuffer() : cr(0), lf(0), crlf(0), isBasicASCII(true) {}
-    StringBuffer(std::string buffer, std::vector<int32_t> lineStarts)
+    StringBuffer(std::string buffer, std::vector<Offset> lineStarts)
         : buffer(std::move(buffer)), lineStarts(std::move(lineStarts)), cr(0), lf(0), crlf(0), isBasicASCII(true) {
         computeLineBreakCounts();
     }
 
+    /**
+     * Buffer over text whose line starts were scanned already
+     */
+    StringBuffer(std::string buffer, LineStarts info)
+        : buffer(std::move(buffer)), lineStarts(std::move(info.lineStarts)), cr(info.cr), lf(info.lf), crlf(info.crlf),
+          isBasicASCII(info.isBasicASCII) {}
+
+    /**
+     * Buffer over a region of a mapped file, without copying it.
+     * The counts come from the line starts scan of the region.
+     */
+    StringBuffer(std::shared_ptr<const MappedFile> mapping, std::string_view text, LineStarts info)
+        : lineStarts(std::move(info.lineStarts)), cr(info.cr), lf(info.lf), crlf(info.crlf),
+          isBasicASCII(info.isBasicASCII), mapping(std::move(mapping)), mapped(text) {}
+
+    /**
+     * Text of the buffer, wherever it lives. Appends go to buffer and are only
+     * made to change buffers, which are never mapped.
+     */
+    std::string_view text() const { return mapping ? mapped : std::string_view(buffer); }
+
+    bool isMapped() const { return mapping != nullptr; }
+
+    /**
+     * Line starts of the buffer. Those of a buffer with deferred indexing are
+     * scanned on first use, once, by whichever thread asks first; other
+     * threads asking meanwhile wait for that scan.
+     */
+    LineStartsView getLineStarts() const {
+        if (_compact) {
+            return *_compact;
+        }
+        if (!_deferred) {
+            return lineStarts;
+        }
+        if (!_deferred->ready.load(std::memory_order_acquire)) {
+            indexLineStarts();
+        }
+        return _deferred->lineStarts;
+    }
+
+    /**
+     * Move the line starts into a compact encoding. Only for buffers that no
+     * longer change; a deferred buffer is encoded when it is scanned.
+     */
+    void compactLineStarts();
+
+    /**
+     * Bytes held by the line starts, 0 until a deferred scan ran
+     */
+    size_t getLineStartBytes() const;
+
+    /**
+     * Drop the line starts and scan them again on first use. Only for buffers
+     * that no longer change, with cr, lf and crlf counted.
+     */
+    void deferLineStarts();
+
+    bool isLineIndexDeferred() const { return _deferred != nullptr; }
+
+    /**
+     * Whether the line starts were moved into a compact encoding
+     */
+    bool isLineIndexCompact() const { return _compact != nullptr; }
+
+    /**
+     * Whether the line starts are in memory, false until a deferred scan ran
+     */
+    bool hasLineStarts() const { return !_deferred || _deferred->ready.load(std::memory_order_acquire); }
+
+    /**
+     * Number of line breaks, known without the line starts
+     */
+    Offset getLineBreakCount() const {
+        return hasLineStarts() ? static_cast<Offset>(getLineStarts().size() - 1) : cr + lf + crlf;
+    }
+
+    /**
+     * Offset of the start of the last line, found without the line starts
+     */
+    Offset getLastLineStart() const;
+
 private:
+    // Shared by the copies of a buffer, which all have the same text
+    struct DeferredLineStarts {
+        std::mutex mutex;
+        std::atomic<bool> ready{false};
+        CompactLineStarts lineStarts;
+    };
+    std::shared_ptr<DeferredLineStarts> _deferred;
+    std::shared_ptr<const CompactLineStarts> _compact;  // shared by the copies, like _deferred
+
+    void indexLineStarts() const;
+
     void computeLineBreakCounts() {
-        cr = 0;
-        lf = 0;
-        crlf = 0;
-        isBasicASCII = true;
-
-        for (size_t i = 0; i < buffer.length(); i++) {
-            char c = buffer[i];
-            if (c == '\r') {
-                if (i + 1 < buffer.length() && buffer[i + 1] == '\n') {
-                    crlf++;
-                    i++; // Skip the next LF
-                } else {
-                    cr++;
-                }
-            } else if (c == '\n') {
-                lf++;
-            } else if (static_cast<unsigned char>(c) >= 128) {
-                isBasicASCII = false;
-            }
-        }
+        LineStarts counts = countLineBreaks(buffer);
+        cr = counts.cr;
+        lf = counts.lf;
+        crlf = counts.crlf;
+        isBasicASCII = counts.isBasicASCII;
     }
 };
 
@@ -163,73 +278,416 @@ private:
  */
 struct CacheEntry {
     TreeNode* node;
-    int32_t nodeStartOffset;
-    int32_t nodeStartLineNumber;
+    Offset nodeStartOffset;
+    Offset nodeStartLineNumber;  // line feeds before the node, the 0-based line it starts on
 
-    CacheEntry(TreeNode* node, int32_t nodeStartOffset, int32_t nodeStartLineNumber = 1)
+    CacheEntry() : node(nullptr), nodeStartOffset(0), nodeStartLineNumber(0) {}
+    CacheEntry(TreeNode* node, Offset nodeStartOffset, Offset nodeStartLineNumber)
         : node(node), nodeStartOffset(nodeStartOffset), nodeStartLineNumber(nodeStartLineNumber) {}
 };
 
 /**
- * Search cache for the piece tree
+ * Counters of the node search cache
+ */
+struct SearchCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;  // live entries overwritten to make room
+    size_t size = 0;         // live entries
+    size_t capacity = 0;
+
+    double hitRatio() const {
+        return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses);
+    }
+};
+
+/**
+ * Search cache for the piece tree: the last nodes found by offset and line
+ * lookups, with their document offset and line.
+ * Entries sit in a fixed ring, so adding one overwrites the oldest in O(1).
+ * Dropped entries leave an empty slot behind instead of shifting the others.
+ * An entry stays valid while nothing before its node changes. Rotations keep
+ * nodes and their order, so only edits at or before the node and removing
+ * the node itself invalidate it.
  */
 class PieceTreeSearchCache {
 private:
-    int32_t _limit;
-    std::vector<CacheEntry> _cache;
+    std::vector<CacheEntry> _ring;
+    size_t _next;  // slot written next, holding the oldest entry
+    size_t _size;
+    uint64_t _hits;
+    uint64_t _misses;
+    uint64_t _evictions;
+
+    template <typename Match>
+    CacheEntry* find(Match&& match) {
+        // newest first
+        for (size_t i = 1; i <= _ring.size(); i++) {
+            CacheEntry& entry = _ring[(_next + _ring.size() - i) % _ring.size()];
+            if (entry.node && match(entry)) {
+                _hits++;
+                return &entry;
+            }
+        }
+        _misses++;
+        return nullptr;
+    }
+
+    template <typename Match>
+    void drop(Match&& match) {
+        for (CacheEntry& entry : _ring) {
+            if (entry.node && match(entry)) {
+                entry.node = nullptr;
+                _size--;
+            }
+        }
+    }
 
 public:
-    PieceTreeSearchCache(int32_t limit) : _limit(limit) {}
-    
+    explicit PieceTreeSearchCache(int32_t limit)
+        : _ring(std::max<int32_t>(limit, 0)), _next(0), _size(0), _hits(0), _misses(0), _evictions(0) {}
+
     /**
-     * Get a cache entry for the given offset
+     * Entry whose node spans offset, its ends included. With strict, offset
+     * must lie inside the node.
      */
-    CacheEntry* get(int32_t offset) {
-        for (auto& entry : _cache) {
-            if (entry.nodeStartOffset <= offset && 
-                entry.nodeStartOffset + entry.node->piece->length >= offset) {
-                return &entry;
+    CacheEntry* get(Offset offset, bool strict = false) {
+        // the stored start is checked first so that most entries are skipped
+        // without touching their node
+        return find([&](const CacheEntry& entry) {
+            if (strict ? entry.nodeStartOffset >= offset : entry.nodeStartOffset > offset) {
+                return false;
             }
-        }
-        return nullptr;
+            Offset end = entry.nodeStartOffset + entry.node->piece.length;
+            return strict ? offset < end : offset <= end;
+        });
     }
-    
+
     /**
-     * Get a cache entry for the given line number
+     * Entry whose node holds the line break in front of the given 0-based
+     * line, that is where the line starts. With strict, the line must also
+     * end inside the node.
      */
-    CacheEntry* get2(int32_t lineNumber) {
-        for (auto& entry : _cache) {
-            if (entry.nodeStartLineNumber <= lineNumber && 
-                entry.nodeStartLineNumber + entry.node->piece->lineFeedCnt >= lineNumber) {
-                return &entry;
+    CacheEntry* getByLine(Offset lineNumber, bool strict = false) {
+        return find([&](const CacheEntry& entry) {
+            if (entry.nodeStartLineNumber >= lineNumber) {
+                return false;
             }
-        }
-        return nullptr;
+            Offset lastLine = entry.nodeStartLineNumber + entry.node->piece.lineFeedCnt;
+            return strict ? lineNumber < lastLine : lineNumber <= lastLine;
+        });
     }
-    
+
     /**
      * Set a cache entry
      */
     void set(const CacheEntry& entry) {
-        _cache.push_back(entry);
-        if (_cache.size() > _limit) {
-            _cache.erase(_cache.begin());
+        if (_ring.empty()) {
+            return;
+        }
+        for (CacheEntry& cached : _ring) {
+            if (cached.node == entry.node) {
+                cached = entry;
+                return;
+            }
+        }
+        CacheEntry& slot = _ring[_next];
+        if (slot.node) {
+            _evictions++;
+        } else {
+            _size++;
         }
+        slot = entry;
+        _next = (_next + 1) % _ring.size();
     }
-    
+
+    /**
+     * Drop every cache entry whose node starts at or after the given offset,
+     * as those start offsets are no longer reliable after an edit at offset
+     */
+    void validate(Offset offset) {
+        drop([&](const CacheEntry& entry) { return entry.nodeStartOffset >= offset; });
+    }
+
+    /**
+     * Drop every cache entry referring to a node that is being removed
+     */
+    void remove(TreeNode* node) {
+        drop([&](const CacheEntry& entry) { return entry.node == node; });
+    }
+
+    void clear() {
+        drop([](const CacheEntry&) { return true; });
+    }
+
+    /**
+     * Change the number of entries, dropping the cached ones
+     */
+    void setCapacity(int32_t limit) {
+        _ring.assign(std::max<int32_t>(limit, 0), CacheEntry());
+        _next = 0;
+        _size = 0;
+    }
+
+    SearchCacheStats stats() const {
+        SearchCacheStats stats;
+        stats.hits = _hits;
+        stats.misses = _misses;
+        stats.evictions = _evictions;
+        stats.size = _size;
+        stats.capacity = _ring.size();
+        return stats;
+    }
+
+    void resetStats() {
+        _hits = 0;
+        _misses = 0;
+        _evictions = 0;
+    }
+};
+
+/**
+ * Counters of the line content cache
+ */
+struct LineCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t size = 0;      // lines held
+    size_t capacity = 0;  // most lines held at once
+
+    double hitRatio() const {
+        return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / (hits + misses);
+    }
+};
+
+/**
+ * Least recently used cache of line contents keyed by line number.
+ * Each entry remembers the offsets the line spans, break included, so an
+ * edit drops only the lines it touches and renumbers the lines below it.
+ */
+class LineContentCache {
+private:
+    struct Entry {
+        Offset lineNumber;
+        Offset start;  // offset of the first char of the line
+        Offset end;    // offset past its line break
+        std::string content;
+    };
+
+    size_t _capacity;
+    std::list<Entry> _entries;  // most recently used first
+    std::unordered_map<Offset, std::list<Entry>::iterator> _index;
+    uint64_t _hits;
+    uint64_t _misses;
+
+public:
+    explicit LineContentCache(size_t capacity) : _capacity(capacity), _hits(0), _misses(0) {}
+
     /**
-     * Validate a cache entry at the given offset
+     * Cached content of a line, or null
      */
-    void validate(int32_t offset) {
-        for (auto it = _cache.begin(); it != _cache.end();) {
-            if (it->nodeStartOffset <= offset && 
-                it->nodeStartOffset + it->node->piece->length >= offset) {
-                ++it;
+    const std::string* get(Offset lineNumber) {
+        auto found = _index.find(lineNumber);
+        if (found == _index.end()) {
+            _misses++;
+            return nullptr;
+        }
+        _hits++;
+        _entries.splice(_entries.begin(), _entries, found->second);
+        return &found->second->content;
+    }
+
+    /**
+     * Remember a line spanning [start, end)
+     */
+    void set(Offset lineNumber, Offset start, Offset end, const std::string& content) {
+        if (_capacity == 0) {
+            return;
+        }
+        auto found = _index.find(lineNumber);
+        if (found != _index.end()) {
+            _entries.erase(found->second);
+        } else if (_entries.size() >= _capacity) {
+            _index.erase(_entries.back().lineNumber);
+            _entries.pop_back();
+        }
+        _entries.push_front({lineNumber, start, end, content});
+        _index[lineNumber] = _entries.begin();
+    }
+
+    /**
+     * Account for an edit at offset that removed removedLength chars and
+     * changed the document by lengthDelta chars and lineDelta lines.
+     * Lines ending before the edit are kept, lines starting after it move.
+     */
+    void edit(Offset offset, Offset removedLength, Offset lengthDelta, Offset lineDelta) {
+        if (lineDelta != 0) {
+            _index.clear();
+        }
+        for (auto it = _entries.begin(); it != _entries.end();) {
+            // the last line has no break, text inserted right after it extends it
+            bool hasBreak = it->end - it->start > static_cast<Offset>(it->content.size());
+            if (it->end < offset || (it->end == offset && hasBreak)) {
+                // before the edit, unchanged
+            } else if (it->start > offset + removedLength) {
+                it->lineNumber += lineDelta;
+                it->start += lengthDelta;
+                it->end += lengthDelta;
             } else {
-                it = _cache.erase(it);
+                if (lineDelta == 0) {
+                    _index.erase(it->lineNumber);
+                }
+                it = _entries.erase(it);
+                continue;
+            }
+            if (lineDelta != 0) {
+                _index[it->lineNumber] = it;
             }
+            ++it;
         }
     }
+
+    void clear() {
+        _entries.clear();
+        _index.clear();
+    }
+
+    void setCapacity(size_t capacity) {
+        _capacity = capacity;
+        while (_entries.size() > _capacity) {
+            _index.erase(_entries.back().lineNumber);
+            _entries.pop_back();
+        }
+    }
+
+    size_t capacity() const { return _capacity; }
+
+    LineCacheStats stats() const {
+        LineCacheStats stats;
+        stats.hits = _hits;
+        stats.misses = _misses;
+        stats.size = _entries.size();
+        stats.capacity = _capacity;
+        return stats;
+    }
+
+    void resetStats() {
+        _hits = 0;
+        _misses = 0;
+    }
+};
+
+/**
+ * Memory held by the text buffers of a piece tree
+ */
+struct BufferMemoryStats {
+    size_t totalBytes = 0;  // text held by all buffers
+    size_t editBytes = 0;   // part of it appended by edits
+    size_t deadBytes = 0;   // part of the edit text no piece refers to any more
+    size_t mappedBytes = 0; // part of it read from mapped files rather than held in memory
+    size_t lineStartBytes = 0;    // line start arrays in memory
+    size_t lineStarts = 0;        // line starts they hold, sizeof(Offset) each in a plain array
+    size_t unindexedBuffers = 0;  // buffers whose deferred line starts are not scanned yet
+
+    /**
+     * Share of the edit text that compaction would drop
+     */
+    double deadRatio() const {
+        return editBytes == 0 ? 0.0 : static_cast<double>(deadBytes) / editBytes;
+    }
+};
+
+/**
+ * One edit of a batch: length bytes at offset are replaced by text
+ */
+struct TextEdit {
+    Offset offset;
+    Offset length;
+    std::string text;
+
+    TextEdit() : offset(0), length(0) {}
+    TextEdit(Offset offset, Offset length, std::string text)
+        : offset(offset), length(length), text(std::move(text)) {}
+};
+
+class PieceTreeBase;
+
+/**
+ * Bidirectional iterator over the pieces of a tree in document order.
+ * Steps follow parent links or the chain of leaves, so iterating never
+ * allocates and needs no stack however the tree is shaped.
+ * Any edit of the tree invalidates it.
+ */
+class PieceIterator {
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = Piece;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const Piece*;
+    using reference = const Piece&;
+
+    PieceIterator() : _tree(nullptr), _node(nullptr), _index(0), _piece(nullptr), _offset(0), _lineNumber(0) {}
+
+    reference operator*() const { return *_piece; }
+    pointer operator->() const { return _piece; }
+
+    /**
+     * Document offset where the current piece starts, the length at the end
+     */
+    Offset offset() const { return _offset; }
+
+    /**
+     * 0-based line the current piece starts on, the last line at the end
+     */
+    Offset lineNumber() const { return _lineNumber; }
+
+    PieceIterator& operator++();
+    PieceIterator& operator--();
+
+    PieceIterator operator++(int) {
+        PieceIterator it = *this;
+        ++*this;
+        return it;
+    }
+
+    PieceIterator operator--(int) {
+        PieceIterator it = *this;
+        --*this;
+        return it;
+    }
+
+    bool operator==(const PieceIterator& other) const { return _piece == other._piece; }
+    bool operator!=(const PieceIterator& other) const { return _piece != other._piece; }
+
+private:
+    friend class PieceTreeBase;
+    friend class BTreePieceTree;
+
+    PieceIterator(const PieceTreeBase* tree, void* node, int32_t index, const Piece* piece, Offset offset,
+                  Offset lineNumber)
+        : _tree(tree), _node(node), _index(index), _piece(piece), _offset(offset), _lineNumber(lineNumber) {}
+
+    const PieceTreeBase* _tree;
+    void* _node;          // tree node, or leaf of a B+-tree
+    int32_t _index;       // piece index inside a B+-tree leaf
+    const Piece* _piece;  // null at the end
+    Offset _offset;
+    Offset _lineNumber;   // line feeds before the current piece
+};
+
+/**
+ * Pair of piece iterators for range-for loops
+ */
+class PieceRange {
+public:
+    PieceRange(PieceIterator first, PieceIterator last) : _first(first), _last(last) {}
+
+    PieceIterator begin() const { return _first; }
+    PieceIterator end() const { return _last; }
+
+private:
+    PieceIterator _first;
+    PieceIterator _last;
 };
 
 /**
@@ -240,28 +698,168 @@ public:
     TreeNode* root;
 
 protected:
-    std::vector<StringBuffer> _buffers; // 0 is change buffer, others are readonly original buffer.
-    int32_t _lineCnt;
-    int32_t _length;
+    // Shared so that snapshots can keep reading a buffer after the tree drops it.
+    // The change buffer is the only one appended to; once a snapshot has seen it
+    // it is frozen and the next edit appends to a copy of it, or to a fresh
+    // change buffer once it is too large to copy.
+    std::vector<std::shared_ptr<StringBuffer>> _buffers;
+    int32_t _changeBufferIndex;
+    mutable bool _changeBufferFrozen;
+    Offset _lineCnt;
+    Offset _length;
     std::string _EOL;
-    int32_t _EOLLength;
+    Offset _EOLLength;
     bool _EOLNormalized;
     BufferCursor _lastChangeBufferPos;
     std::unique_ptr<PieceTreeSearchCache> _searchCache;
-    std::pair<int32_t, std::string> _lastVisitedLine;
+    LineContentCache _lineCache;
+    TreeNodeAllocator _nodeAllocator;
+    // Null node of this tree. Kept on the heap so that moving the tree does not
+    // invalidate the links of its nodes; no state is shared between trees.
+    std::unique_ptr<TreeNode> _sentinelNode;
+    TreeNode* _sentinel;
+    // Structurally shared mirror of the document, kept only in persistent snapshot mode
+    bool _persistentSnapshots;
+    PersistentPieceTree _persistentTree;
+    // Buffers [1, _originalBufferEnd) hold the text the tree was created from;
+    // the others were filled by edits and get rewritten by compaction
+    int32_t _originalBufferEnd;
+    double _compactionThreshold;
+    size_t _compactionMinBytes;
+    int64_t _editsUntilCompactionCheck;
+    size_t _reclaimedBytes;
+    bool _pieceMerging;
     static const int AverageBufferSize = 65535;
+    // about the lines of a few screens
+    static constexpr int32_t DefaultLineCacheSize = 256;
+    static constexpr int32_t DefaultSearchCacheSize = 16;
+    // applyEdits goes one edit at a time below one edit per this many pieces
+    static constexpr size_t BatchRebuildRatio = 64;
+
+    // One edit as seen from outside: [offset, offset + removedLength) was
+    // replaced by insertedLength bytes
+    struct EditRecord {
+        Offset offset = 0;
+        Offset removedLength = 0;
+        Offset insertedLength = 0;
+    };
+    static constexpr int32_t EditLogSize = 64;
+    // The latest edits, the one that produced version v at index (v - 1) % EditLogSize
+    std::array<EditRecord, EditLogSize> _editLog;
+    uint64_t _version;
+    // Piece-level undo and redo stacks, only while the undo history is on
+    std::unique_ptr<EditHistory> _history;
+    // Set while edits must not reach the history: during undo and redo, and
+    // inside an edit that is recorded as a whole
+    bool _historyPaused;
+    // Edits in progress: the chunks of a large delete are edits nested in it
+    int32_t _editDepth;
 
 public:
-    PieceTreeBase() : root(SENTINEL), _lineCnt(1), _length(0), _EOLNormalized(false), _lastChangeBufferPos(1, 1) {
-        _buffers.emplace_back();
-        _searchCache = std::make_unique<PieceTreeSearchCache>(10);
-        _lastVisitedLine = std::make_pair(0, "");
+    PieceTreeBase()
+        : _changeBufferIndex(0), _changeBufferFrozen(false), _lineCnt(1), _length(0), _EOLNormalized(false),
+          _lastChangeBufferPos(1, 1), _lineCache(DefaultLineCacheSize), _persistentSnapshots(false),
+          _originalBufferEnd(1), _compactionThreshold(0), _compactionMinBytes(0), _editsUntilCompactionCheck(0),
+          _reclaimedBytes(0), _pieceMerging(true), _version(0), _historyPaused(false), _editDepth(0) {
+        _sentinelNode = std::make_unique<TreeNode>(Piece(), NodeColor::Black);
+        _sentinel = _sentinelNode.get();
+        initializeSentinel();
+        root = _sentinel;
+        _buffers.push_back(std::make_shared<StringBuffer>());
+        _searchCache = std::make_unique<PieceTreeSearchCache>(DefaultSearchCacheSize);
     }
 
+    virtual ~PieceTreeBase() = default;
+    PieceTreeBase(PieceTreeBase&&) = default;
+    PieceTreeBase& operator=(PieceTreeBase&&) = default;
+
+    /**
+     * Get the null node terminating every path of this tree
+     */
+    TreeNode* sentinel() const { return _sentinel; }
+
+    /**
+     * Get the allocator owning this tree's nodes
+     */
+    const TreeNodeAllocator& getNodeAllocator() const { return _nodeAllocator; }
+
+    /**
+     * Switch persistent snapshots on or off. While on, every edit also updates an
+     * immutable, structurally shared copy of the tree, which makes createSnapshot
+     * O(1) and lets snapshots be read from other threads while editing goes on.
+     */
+    void setPersistentSnapshots(bool enabled);
+
+    /**
+     * Whether persistent snapshots are on
+     */
+    bool usesPersistentSnapshots() const { return _persistentSnapshots; }
+
+    /**
+     * Current version of the persistent tree (empty unless persistent snapshots are on)
+     */
+    const PersistentPieceTree& getPersistentTree() const { return _persistentTree; }
+
+    /**
+     * How much of the edit buffers is dead. Walks every piece.
+     */
+    BufferMemoryStats getBufferMemoryStats() const;
+
     /**
-     * Create a piece tree from chunks
+     * Scan the deferred line starts of the original buffers on a background
+     * thread, in document order. Reads meanwhile scan the buffer they need
+     * themselves or wait for the one being scanned. The task holds on to the
+     * buffers, not to the tree; destroying the future waits for it.
      */
-    void create(const std::vector<StringBuffer>& chunks, const std::string& eol, bool eolNormalized);
+    std::future<void> indexLineStartsInBackground() const;
+
+    /**
+     * Rewrite the live text of the edit buffers into one fresh change buffer,
+     * remap the pieces onto it and release every buffer no piece refers to,
+     * loaded ones included.
+     * Snapshots keep reading the buffers they were taken from.
+     * Returns the number of bytes released.
+     */
+    size_t compactBuffers();
+
+    /**
+     * Compact automatically after edits once at least minDeadBytes of edit text
+     * are dead and they make up more than deadRatio of it. 0 turns it off.
+     */
+    void setCompactionThreshold(double deadRatio, size_t minDeadBytes = 1 << 20);
+
+    /**
+     * Total number of bytes released by compaction so far
+     */
+    size_t getReclaimedBytes() const { return _reclaimedBytes; }
+
+    /**
+     * Merge every pair of neighbouring pieces that cover adjacent ranges of the
+     * same buffer, in O(log n) per merge. Returns the number of pieces removed.
+     */
+    size_t defragment();
+
+    /**
+     * Switch merging of contiguous pieces at the borders of each edit on or off.
+     * It is on by default.
+     */
+    void setPieceMerging(bool enabled) { _pieceMerging = enabled; }
+
+    /**
+     * Number of pieces in the tree
+     */
+    virtual Offset getPieceCount() const;
+
+    /**
+     * Number of levels of the tree. Walks every node of the red-black tree.
+     */
+    virtual int32_t getHeight() const;
+
+    /**
+     * Create a piece tree from chunks. Chunks passed as an rvalue are moved
+     * into the tree without copying their text.
+     */
+    virtual void create(std::vector<StringBuffer> chunks, const std::string& eol, bool eolNormalized);
 
     /**
      * Normalize EOL in the buffer
@@ -279,7 +877,9 @@ public:
     void setEOL(const std::string& newEOL);
 
     /**
-     * Create a snapshot of the buffer
+     * Create a snapshot of the buffer. It copies the pieces unless persistent
+     * snapshots are on; either way it can be read from another thread while
+     * the buffer keeps being edited.
      */
     std::unique_ptr<ITextSnapshot> createSnapshot(const std::string& BOM) const;
 
@@ -291,22 +891,17 @@ public:
     /**
      * Get the offset at the given line and column
      */
-    int32_t getOffsetAt(int32_t lineNumber, int32_t column);
+    virtual Offset getOffsetAt(Offset lineNumber, Offset column);
 
     /**
      * Get the position at the given offset
      */
-    common::Position getPositionAt(int32_t offset);
+    virtual common::Position getPositionAt(Offset offset);
 
     /**
      * Get the value in the given range
      */
-    std::string getValueInRange(const common::Range& range, const std::string& eol = "");
-
-    /**
-     * Get the value between two node positions
-     */
-    std::string getValueInRange2(const NodePosition& startPosition, const NodePosition& endPosition);
+    virtual std::string getValueInRange(const common::Range& range, const std::string& eol = "");
 
     /**
      * Get the content of all lines
@@ -316,42 +911,212 @@ public:
     /**
      * Get the buffer length
      */
-    int32_t getLength() const;
+    Offset getLength() const;
 
     /**
      * Get the line count
      */
-    int32_t getLineCount() const;
+    Offset getLineCount() const;
+
+    /**
+     * Get the content of a line, from the line cache when it holds it
+     */
+    std::string getLineContent(Offset lineNumber);
+
+    /**
+     * Set how many lines the line cache holds. 0 turns it off.
+     */
+    void setLineCacheSize(size_t lines) { _lineCache.setCapacity(lines); }
+
+    /**
+     * Hits, misses and size of the line cache
+     */
+    LineCacheStats getLineCacheStats() const { return _lineCache.stats(); }
+
+    /**
+     * Zero the hit and miss counters of the line cache
+     */
+    void resetLineCacheStats() { _lineCache.resetStats(); }
+
+    /**
+     * Set how many nodes the search cache of the red-black tree remembers.
+     * 0 turns it off.
+     */
+    void setSearchCacheSize(int32_t entries) { _searchCache->setCapacity(entries); }
+
+    /**
+     * Hits, misses and evictions of the search cache
+     */
+    SearchCacheStats getSearchCacheStats() const { return _searchCache->stats(); }
+
+    /**
+     * Zero the counters of the search cache
+     */
+    void resetSearchCacheStats() { _searchCache->resetStats(); }
+
+    /**
+     * Apply a batch of non-overlapping edits, all given in offsets of the
+     * current text. Inserts at the same offset are applied in the given order,
+     * ahead of an edit removing text from there.
+     * Large batches are spliced into the piece list in one left-to-right pass
+     * and the tree is rebuilt once, with CRLF fix-ups only where an edit was
+     * made; small ones go through insert and deleteText.
+     * Returns the edits undoing the batch, in offsets of the new text.
+     */
+    std::vector<TextEdit> applyEdits(std::vector<TextEdit> edits, bool eolNormalized = false);
+
+    /**
+     * Turn the undo history on or off. Turning it off drops it, and so does
+     * loading a new document.
+     * The history keeps the pieces an edit removed and inserted, never their
+     * text: undoing a delete links the removed buffer ranges back in, in
+     * O(k log n) for k pieces however many bytes they hold.
+     */
+    void setUndoHistory(bool enabled);
+    bool hasUndoHistory() const { return _history != nullptr; }
+
+    /**
+     * Bound the undo history by its number of steps and by the bytes its steps
+     * reference. The oldest steps are dropped first; the newest one is always kept.
+     */
+    void setUndoLimits(size_t maxSteps, size_t maxBytes);
+
+    /**
+     * Undo the following edits as one step, up to the matching endTransaction.
+     * Transactions nest; only the outermost one closes the step.
+     */
+    void beginTransaction();
+    void endTransaction();
+
+    /**
+     * Revert the latest step. False if there was none.
+     */
+    bool undo();
+
+    /**
+     * Make the latest undone step again. False if there was none; any new
+     * edit drops the steps that could be redone.
+     */
+    bool redo();
+
+    bool canUndo() const { return _history && _history->canUndo(); }
+    bool canRedo() const { return _history && _history->canRedo(); }
+    void clearUndoHistory();
+
+    /**
+     * Steps, referenced bytes and limits of the undo history
+     */
+    EditHistoryStats getUndoHistoryStats() const;
+
+    /**
+     * Number of changes made to the tree. Every edit, rebuild and compaction
+     * bumps it, and with it invalidates all piece iterators.
+     */
+    uint64_t getVersion() const { return _version; }
+
+    /**
+     * Carry an offset taken at an older version over the edits made since.
+     * Text inserted at the offset pushes it forward, an offset inside removed
+     * text moves to where the text was. Returns false, leaving the offset as
+     * it was, if that version is too old to be mapped.
+     */
+    bool mapOffset(uint64_t version, Offset& offset) const;
+
+    /**
+     * Text in [start, end) as views into the buffers, one per piece it covers.
+     * Nothing is copied; the views stay valid until the next edit.
+     */
+    std::vector<std::string_view> getRangeViews(Offset start, Offset end) const;
+
+    /**
+     * Pass the text in [start, end) to the callback, one view into the buffers
+     * per piece, until it returns false. Nothing is copied, so the text can be
+     * streamed into a socket or a hash as it is. Returns false if the callback
+     * stopped early.
+     */
+    bool forEachChunk(Offset start, Offset end, const std::function<bool(std::string_view)>& callback) const;
+    bool forEachChunk(const common::Range& range, const std::function<bool(std::string_view)>& callback);
+
+    /**
+     * Copy the text in [start, end) into dst, at most capacity bytes of it.
+     * Returns the number of bytes copied.
+     */
+    size_t copyRange(Offset start, Offset end, char* dst, size_t capacity) const;
+    size_t copyRange(const common::Range& range, char* dst, size_t capacity);
 
     /**
-     * Get the content of a line
+     * Content of a line without its line break, as views into the buffers.
+     * The cost depends only on the line length and the tree height.
      */
-    std::string getLineContent(int32_t lineNumber);
+    std::vector<std::string_view> getLineViews(Offset lineNumber);
 
     /**
      * Get the char code at the given line and index
      */
-    uint32_t getLineCharCode(int32_t lineNumber, int32_t index);
+    virtual uint32_t getLineCharCode(Offset lineNumber, Offset index);
 
     /**
      * Get the length of a line
      */
-    int32_t getLineLength(int32_t lineNumber);
+    virtual Offset getLineLength(Offset lineNumber);
+
+    /**
+     * Get the char code at the given offset, 0 past the end
+     */
+    virtual uint32_t getCharCode(Offset offset);
+
+    /**
+     * Visit the pieces of the document in order until the callback returns false
+     */
+    virtual bool forEachPiece(const std::function<bool(const Piece&)>& callback) const;
+
+    /**
+     * Iterator at the first piece
+     */
+    virtual PieceIterator pieceBegin() const;
+
+    /**
+     * Iterator past the last piece
+     */
+    PieceIterator pieceEnd() const {
+        return PieceIterator(this, nullptr, 0, nullptr, getLength(), getLineCount() - 1);
+    }
+
+    /**
+     * Iterator at the piece holding offset; at a piece border that is the piece
+     * starting there. The end iterator for offsets past the text.
+     */
+    virtual PieceIterator pieceAt(Offset offset) const;
+
+    /**
+     * Iterator at the piece holding the start of a line
+     */
+    PieceIterator pieceAtLine(Offset lineNumber) { return pieceAt(getOffsetAt(lineNumber, 0)); }
+
+    /**
+     * All pieces, for use in range-for
+     */
+    PieceRange pieces() const { return PieceRange(pieceBegin(), pieceEnd()); }
+
+    /**
+     * Pieces from the one holding offset up to the end
+     */
+    PieceRange pieces(Offset offset) const { return PieceRange(pieceAt(offset), pieceEnd()); }
 
     /**
      * Get the entire text content
      */
-    std::string getValue();
+    virtual std::string getValue();
 
     /**
      * Insert text at the given offset
      */
-    void insert(int offset, const std::string& value, bool eolNormalized = false);
+    virtual void insert(Offset offset, const std::string& value, bool eolNormalized = false);
 
     /**
      * Delete text at the given offset
      */
-    void delete_(int offset, int count);
+    virtual void delete_(Offset offset, Offset count);
     
     /**
      * Insert content to the left of a node
@@ -366,17 +1131,22 @@ public:
     /**
      * Get the position in a buffer at the given remainder
      */
-    BufferCursor positionInBuffer(TreeNode* node, int32_t remainder);
+    BufferCursor positionInBuffer(TreeNode* node, Offset remainder);
+
+    /**
+     * Get the position in a buffer at the given remainder of a piece
+     */
+    BufferCursor positionInBuffer(const Piece& piece, Offset remainder) const;
 
     /**
      * Get the line feed count in a buffer range
      */
-    int32_t getLineFeedCnt(int32_t bufferIndex, const BufferCursor& start, const BufferCursor& end);
+    Offset getLineFeedCnt(int32_t bufferIndex, const BufferCursor& start, const BufferCursor& end);
 
     /**
      * Get the offset in a buffer at the given cursor
      */
-    int32_t offsetInBuffer(int32_t bufferIndex, const BufferCursor& cursor) const;
+    Offset offsetInBuffer(int32_t bufferIndex, const BufferCursor& cursor) const;
 
     /**
      * Delete the given nodes
@@ -386,42 +1156,44 @@ public:
     /**
      * Create new pieces from the given text
      */
-    std::vector<Piece*> createNewPieces(const std::string& text);
+    std::vector<Piece> createNewPieces(const std::string& text);
 
     /**
      * Insert a node with the given piece to the left of the given node
      */
-    TreeNode* rbInsertLeft(TreeNode* node, Piece* piece);
+    TreeNode* rbInsertLeft(TreeNode* node, const Piece& piece);
 
     /**
      * Insert a node with the given piece to the right of the given node
      */
-    TreeNode* rbInsertRight(TreeNode* node, Piece* piece);
+    TreeNode* rbInsertRight(TreeNode* node, const Piece& piece);
 
     /**
      * Get the raw content of all lines
      */
-    std::string getLinesRawContent();
+    virtual std::string getLinesRawContent();
 
     /**
-     * Get the raw content of a line
+     * Get the raw content of a 1-based line, its line break included unless
+     * endOffset drops it
      */
-    std::string getLineRawContent(int32_t lineNumber, int32_t endOffset = 0);
+    virtual std::string getLineRawContent(Offset lineNumber, Offset endOffset = 0);
 
     /**
-     * Compute buffer metadata
+     * Compute buffer metadata (total length and line count) in O(log n)
+     * from the size_left/lf_left augmentation along the right spine
      */
     void computeBufferMetadata();
 
     /**
      * Get the index of a node with the given accumulated value
      */
-    std::pair<int32_t, int32_t> getIndexOf(TreeNode* node, int32_t accumulatedValue);
+    std::pair<Offset, Offset> getIndexOf(TreeNode* node, Offset accumulatedValue);
 
     /**
      * Get the accumulated value at the given index
      */
-    int32_t getAccumulatedValue(TreeNode* node, int32_t index);
+    Offset getAccumulatedValue(TreeNode* node, Offset index);
 
     /**
      * Delete the tail of a node
@@ -443,25 +1215,15 @@ public:
      */
     void appendToNode(TreeNode* node, const std::string& value);
 
-    /**
-     * Get the node at the given offset
-     */
-    NodePosition nodeAt(int offset);
-
-    /**
-     * Get the node at the given line and column
-     */
-    NodePosition nodeAt2(int lineNumber, int column);
-
     /**
      * Get the char code at the given offset in a node
      */
-    uint32_t nodeCharCodeAt(TreeNode* node, int32_t offset);
+    uint32_t nodeCharCodeAt(TreeNode* node, Offset offset);
 
     /**
      * Get the offset of a node
      */
-    int32_t offsetOfNode(TreeNode* node);
+    Offset offsetOfNode(TreeNode* node);
 
     /**
      * Check if CRLF should be checked
@@ -500,11 +1262,6 @@ public:
      */
     bool adjustCarriageReturnFromNext(const std::string& value, TreeNode* node);
 
-    /**
-     * Iterate over the tree
-     */
-    bool iterate(TreeNode* node, const std::function<bool(TreeNode*)>& callback) const;
-
     /**
      * Get the content of a node
      */
@@ -513,27 +1270,27 @@ public:
     /**
      * Get the content of a piece
      */
-    std::string getPieceContent(Piece* piece) const;
+    std::string getPieceContent(const Piece& piece) const;
 
     /**
      * Count line feeds in a node between start and end offsets
      */
-    int32_t countLineFeedsInNode(TreeNode* node, int32_t startOffset, int32_t endOffset);
+    Offset countLineFeedsInNode(TreeNode* node, Offset startOffset, Offset endOffset);
     
     /**
      * Delete a range of text in a node
      */
-    void deleteNodeRange(TreeNode* node, int32_t startOffset, int32_t endOffset);
+    void deleteNodeRange(TreeNode* node, Offset startOffset, Offset endOffset);
     
     /**
      * Get the leftmost node
      */
-    TreeNode* leftest(TreeNode* node);
+    TreeNode* leftest(TreeNode* node) const;
     
     /**
      * Get the rightmost node
      */
-    TreeNode* rightest(TreeNode* node);
+    TreeNode* rightest(TreeNode* node) const;
 
     /**
      * Get the content of a subtree
@@ -541,11 +1298,11 @@ public:
     std::string getContentOfSubTree(TreeNode* node);
 
     /**
-     * Initialize sentinel node
+     * Reset this tree's sentinel to an empty black node linked to itself
      */
     void initializeSentinel();
 
-    void deleteText(int32_t offset, int32_t cnt);
+    virtual void deleteText(Offset offset, Offset cnt);
 
     void deleteTree(TreeNode* node);
 
@@ -553,22 +1310,245 @@ public:
     void handleCRLFJoin(TreeNode* prevNode, TreeNode* nextNode);
 
     // 创建新片段
-    std::vector<Piece*> createNewPieces(int32_t bufferIndex, const std::string& value, bool eol_normalization = true);
+    std::vector<Piece> createNewPieces(int32_t bufferIndex, const std::string& value, bool eol_normalization = true);
+
+protected:
+    friend class PersistentEditScope;
+    friend class PieceTreeSnapshot;
+    friend class PieceIterator;
+    friend class TextCursor;
+
+    /**
+     * Log a change of the document and bump the version
+     */
+    void recordEdit(Offset offset, Offset removedLength, Offset insertedLength);
+
+    /**
+     * Node of the red-black tree at the given offset. Only for that backend,
+     * other ones leave root as the sentinel.
+     */
+    NodePosition nodeAt(Offset offset);
+
+    /**
+     * Node of the red-black tree at the given line and column, likewise
+     */
+    NodePosition nodeAt2(Offset lineNumber, Offset column);
+
+    /**
+     * Text between two node positions of the red-black tree
+     */
+    std::string getValueInRange2(const NodePosition& startPosition, const NodePosition& endPosition);
+
+    /**
+     * Pieces covering [start, end) of the document, cut at both ends
+     */
+    virtual std::vector<SharedPiece> collectPieces(Offset start, Offset end);
+
+    /**
+     * Visit every piece in document order for an in-place update that keeps
+     * its length and line feed count
+     */
+    virtual void remapPieces(const std::function<void(Piece&)>& callback);
+
+    /**
+     * Move a piece iterator by one piece. Stepping back from the end lands on
+     * the last piece.
+     */
+    virtual void stepPiece(PieceIterator& it, bool forward) const;
+
+    /**
+     * Replace the whole tree by one holding the given pieces in order and bring
+     * the totals up to date, in time linear in the number of pieces
+     */
+    virtual void replacePieces(const std::vector<Piece>& pieces);
+
+    /**
+     * Link existing pieces in at offset, as one edit
+     */
+    virtual void insertPieces(Offset offset, const std::vector<Piece>& pieces);
+
+    /**
+     * Add an edit to the undo history unless it is off or paused
+     */
+    void recordHistory(HistoryEdit edit);
+
+    /**
+     * Merge the two pieces meeting at offset if the second one continues the
+     * first in the same buffer
+     */
+    virtual bool mergePiecesAt(Offset offset);
+
+    /**
+     * Piece covering left followed by right, if they are contiguous in one
+     * buffer and joining them keeps the line feed count
+     */
+    bool mergePieces(const Piece& left, const Piece& right, Piece& merged);
+
+    /**
+     * Rebuild the persistent tree from the live tree
+     */
+    void rebuildPersistentTree();
 
 private:
-    // Helper methods for piece tree operations
-    void fixInsert(PieceTreeBase* tree, TreeNode* node);
-    void fixDelete(PieceTreeBase* tree, TreeNode* node);
-    void rotateLeft(PieceTreeBase* tree, TreeNode* node);
-    void rotateRight(PieceTreeBase* tree, TreeNode* node);
-    void rbDelete(PieceTreeBase* tree, TreeNode* node);
-    TreeNode* minimum(TreeNode* node);
-    void transplant(PieceTreeBase* tree, TreeNode* u, TreeNode* v);
-    void updateMetadata(TreeNode* node);
-    void updateTreeMetadata(PieceTreeBase* tree, TreeNode* x, int32_t lengthDeltaLeft, int32_t lfDeltaLeft);
+
+    /**
+     * Replace the tree by a balanced one holding the given pieces in order.
+     * Built bottom-up in O(n), without any rotation.
+     */
+    void buildBalancedTree(const std::vector<Piece>& pieces);
+
+    /**
+     * Join a "\r" and a "\n" of two pieces meeting at offset into one line break
+     */
+    void validateCRLFAt(Offset offset);
+
+    /**
+     * Pieces of the history as pieces of this tree. A buffer the tree has
+     * dropped since, by compaction, is taken back as an edit buffer.
+     */
+    std::vector<Piece> adoptPieces(const std::vector<SharedPiece>& pieces);
+
+    /**
+     * Replace the inserted text of each edit by its removed pieces, or the
+     * other way round, going through the edits in the given direction
+     */
+    void replayStep(const HistoryStep& step, bool undo);
+
+    TreeNode* buildSubtree(const std::vector<Piece>& pieces, size_t begin, size_t end, int32_t depth,
+                           int32_t redDepth, TreeNode* parent, Offset& length, Offset& lineFeeds);
+
+    /**
+     * Unlink a node from the tree and release it together with its piece
+     */
+    void removeNode(TreeNode* node);
+
+    /**
+     * Give the tree a change buffer of its own if a snapshot still references
+     * the current one: a copy of it while it is small, a new one otherwise
+     */
+    void thawChangeBuffer();
+
+    /**
+     * Bring the persistent tree up to date after an edit at offset
+     */
+    void syncPersistentTree(Offset offset, Offset oldLength);
+
+    /**
+     * Whether a buffer was filled by edits rather than loaded
+     */
+    bool isEditBuffer(int32_t bufferIndex) const {
+        return bufferIndex == 0 || bufferIndex >= _originalBufferEnd;
+    }
+
+    /**
+     * Sum the piece lengths per buffer, returning the number of pieces
+     */
+    size_t collectLiveBytes(std::vector<size_t>& liveBytes) const;
+    BufferMemoryStats bufferMemoryStats(const std::vector<size_t>& liveBytes) const;
+
+    /**
+     * Run compaction if the threshold is set and has been crossed
+     */
+    void compactIfNeeded();
+
+    /**
+     * Bodies of insert, insertPieces, delete_ and deleteText, run inside the
+     * edit scope those open and commit once the body returned
+     */
+    void insertValue(Offset offset, const std::string& value, bool eolNormalized);
+    void insertPiecesAt(Offset offset, const std::vector<Piece>& pieces);
+    void deleteRange(Offset offset, Offset count);
+    void deleteTextRange(Offset offset, Offset count);
 
     // Helper methods
     int countLineFeeds(const std::string& content);
 };
 
+inline PieceIterator& PieceIterator::operator++() {
+    _tree->stepPiece(*this, true);
+    return *this;
+}
+
+inline PieceIterator& PieceIterator::operator--() {
+    _tree->stepPiece(*this, false);
+    return *this;
+}
+
+/**
+ * Brackets one public edit of a piece tree: the change buffer is thawed before
+ * the edit can append to it, and the pieces it is going to remove are kept for
+ * the undo history. commit() finishes a completed edit: pieces left contiguous
+ * at the borders of the edit are merged, the persistent tree is patched, the
+ * edit goes into the undo history and the buffers are compacted if enough of
+ * them is dead. An edit left by an exception is not recorded.
+ */
+class PersistentEditScope {
+public:
+    PersistentEditScope(PieceTreeBase* tree, Offset offset, Offset removedLength = 0)
+        : _tree(tree), _offset(offset), _oldLength(tree->getLength()), _oldLineCount(tree->getLineCount()),
+          _outermost(tree->_editDepth == 0) {
+        _tree->thawChangeBuffer();
+        // edits nested in this one are part of it
+        _recording = _tree->_history && !_tree->_historyPaused;
+        if (_recording) {
+            _tree->_historyPaused = true;
+            _edit.offset = std::max<Offset>(0, std::min(offset, _oldLength));
+            _edit.removedLength = std::max<Offset>(0, std::min(removedLength, _oldLength - _edit.offset));
+            _edit.removed = _tree->collectPieces(_edit.offset, _edit.offset + _edit.removedLength);
+        }
+        _tree->_editDepth++;
+    }
+
+    ~PersistentEditScope() {
+        _tree->_editDepth--;
+        if (_recording) {
+            _tree->_historyPaused = false;
+        }
+    }
+
+    /**
+     * Call once the edit is done
+     */
+    void commit() {
+        // an edit nested in another one is done, and logged, as part of it
+        if (!_outermost) {
+            return;
+        }
+        Offset lengthDelta = _tree->getLength() - _oldLength;
+        if (lengthDelta != 0) {
+            _tree->_lineCache.edit(_offset, std::max<Offset>(-lengthDelta, 0), lengthDelta,
+                                   _tree->getLineCount() - _oldLineCount);
+        }
+        if (_tree->_pieceMerging) {
+            Offset inserted = lengthDelta;
+            _tree->mergePiecesAt(_offset);
+            if (inserted > 0) {
+                _tree->mergePiecesAt(_offset + inserted);
+            }
+        }
+        if (_tree->_persistentSnapshots) {
+            _tree->syncPersistentTree(_offset, _oldLength);
+        }
+        if (_recording) {
+            _tree->_historyPaused = false;
+            _edit.insertedLength = lengthDelta + _edit.removedLength;
+            if (_edit.insertedLength > 0 || _edit.removedLength > 0) {
+                _edit.inserted = _tree->collectPieces(_edit.offset, _edit.offset + _edit.insertedLength);
+                _tree->recordHistory(std::move(_edit));
+            }
+        }
+        _tree->compactIfNeeded();
+        _tree->recordEdit(_offset, std::max<Offset>(-lengthDelta, 0), std::max<Offset>(lengthDelta, 0));
+    }
+
+private:
+    PieceTreeBase* _tree;
+    Offset _offset;
+    Offset _oldLength;
+    Offset _oldLineCount;
+    bool _outermost;
+    bool _recording;
+    HistoryEdit _edit;  // for the undo history
+};
+
 } // namespace textbuffer 
\ No newline at end of file
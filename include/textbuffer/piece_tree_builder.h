@@ -24,6 +24,20 @@ enum class DefaultEndOfLine {
     CR = 3
 };
 
+/**
+ * Tree used to index the pieces of a document
+ */
+enum class PieceTreeBackend {
+    /**
+     * Red-black tree with one piece per node.
+     */
+    RedBlackTree = 1,
+    /**
+     * B+-tree with up to 16 pieces per leaf, see BTreePieceTree.
+     */
+    BTree = 2
+};
+
 /**
  * Factory for creating PieceTreeBase instances
  */
@@ -31,9 +45,9 @@ class PieceTreeTextBufferFactory {
 private:
     std::vector<StringBuffer> _chunks;
     std::string _bom;
-    int32_t _cr;
-    int32_t _lf;
-    int32_t _crlf;
+    Offset _cr;
+    Offset _lf;
+    Offset _crlf;
     bool _normalizeEOL;
 
 public:
@@ -43,9 +57,9 @@ public:
     PieceTreeTextBufferFactory(
         std::vector<StringBuffer> chunks,
         const std::string& bom,
-        int32_t cr,
-        int32_t lf,
-        int32_t crlf,
+        Offset cr,
+        Offset lf,
+        Offset crlf,
         bool normalizeEOL
     );
 
@@ -57,29 +71,43 @@ public:
     /**
      * Create a PieceTreeBase instance
      */
-    std::unique_ptr<PieceTreeBase> create(DefaultEndOfLine defaultEOL);
+    std::unique_ptr<PieceTreeBase> create(DefaultEndOfLine defaultEOL,
+                                          PieceTreeBackend backend = PieceTreeBackend::RedBlackTree);
 
     /**
      * Get the first line text limited to a specified length
      */
-    std::string getFirstLineText(int32_t lengthLimit);
+    std::string getFirstLineText(Offset lengthLimit);
 };
 
 /**
  * Builder for PieceTreeTextBuffer
  */
 class PieceTreeTextBufferBuilder {
+public:
+    // Size of the buffers a mapped file is split into, so that buffer offsets
+    // stay small and line starts can be scanned and released window by window
+    static constexpr size_t MappedChunkSize = 64 * 1024 * 1024;
+
+    // Parallel builds cut the chunks into segments of about this size, each
+    // scanned by one thread, so that a few large chunks still spread out
+    static constexpr size_t ParallelScanSegment = 4 * 1024 * 1024;
+
 private:
     std::vector<StringBuffer> chunks;
     std::string BOM;
 
     bool _hasPreviousChar;
     uint32_t _previousChar;
-    std::vector<int32_t> _tmpLineStarts;
+    std::vector<Offset> _tmpLineStarts;
+
+    unsigned _scanThreads;
+    std::vector<size_t> _unscanned;  // chunks whose line starts are scanned in finish
+    bool _deferLineStarts;
 
-    int32_t cr;
-    int32_t lf;
-    int32_t crlf;
+    Offset cr;
+    Offset lf;
+    Offset crlf;
 
     /**
      * Accept a chunk with a possible preceding character
@@ -91,6 +119,11 @@ private:
      */
     void _acceptChunk2(const std::string& chunk);
 
+    /**
+     * Scan the line starts of the unscanned chunks on _scanThreads threads
+     */
+    void _scanUnscanned();
+
     /**
      * Finish accumulating chunks
      */
@@ -102,11 +135,39 @@ public:
      */
     PieceTreeTextBufferBuilder();
 
+    /**
+     * Create a builder that scans line starts on scanThreads threads, 0 for
+     * one per hardware thread. With more than one thread the chunks are only
+     * stored as they arrive, where a \r or high surrogate at a chunk end is
+     * still carried into the next chunk, and finish() scans them all at once.
+     * The result is the same as with one thread, which scans every chunk as
+     * it arrives.
+     */
+    explicit PieceTreeTextBufferBuilder(unsigned scanThreads);
+
+    /**
+     * Only count the line breaks of the chunks while building, and leave the
+     * line starts of each original buffer to be scanned when the tree first
+     * needs them, see StringBuffer::deferLineStarts. Opening is faster and the
+     * line starts of the parts that are never looked at take no memory.
+     */
+    void setDeferLineStarts(bool defer) { _deferLineStarts = defer; }
+
     /**
      * Accept a chunk of text
      */
     void acceptChunk(const std::string& chunk);
 
+    /**
+     * Accept the whole content of a file without copying it. The file is
+     * mapped read-only and the original buffers point into the mapping, so
+     * only the pages that are read stay resident; edits go to the change
+     * buffer as usual. The file must not be modified while the tree uses it.
+     * EOL normalization, when it applies, copies the text into memory.
+     * Throws std::runtime_error if the file cannot be opened.
+     */
+    void acceptFile(const std::string& path);
+
     /**
      * Finish building and return a factory
      */
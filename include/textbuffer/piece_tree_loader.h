@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include "piece_tree_builder.h"
+
+namespace textbuffer {
+
+/**
+ * How far a background load has come
+ */
+struct LoadProgress {
+    size_t totalBytes = 0;    // size of the file
+    size_t bytesRead = 0;
+    size_t bytesScanned = 0;  // bytes whose line starts are known
+    Offset linesFound = 0;    // line breaks found so far
+};
+
+/**
+ * Settings of a background load
+ */
+struct LoadOptions {
+    DefaultEndOfLine defaultEOL = DefaultEndOfLine::LF;
+    PieceTreeBackend backend = PieceTreeBackend::RedBlackTree;
+    bool normalizeEOL = true;
+    size_t chunkSize = 4 * 1024 * 1024;  // bytes per read, and per original buffer
+    unsigned workers = 0;                // line scanning threads, 0 for one less than the hardware threads
+    bool deferLineStarts = false;        // only count line breaks, see PieceTreeTextBufferBuilder::setDeferLineStarts
+};
+
+/**
+ * Loads a file into a piece tree off the calling thread.
+ * One thread reads the file chunk by chunk and hands every chunk to a pool
+ * of workers that scan its line starts, so reading and scanning overlap.
+ * When all chunks are scanned, the loader thread builds the tree the same way
+ * PieceTreeTextBufferBuilder and PieceTreeTextBufferFactory do and delivers it.
+ * A loader runs one load at a time; destroying it cancels a running load.
+ */
+class PieceTreeLoader {
+public:
+    /**
+     * Called on the loader thread whenever a chunk has been read or scanned
+     */
+    using ProgressCallback = std::function<void(const LoadProgress&)>;
+
+    /**
+     * Called on the loader thread with either the tree or the error
+     */
+    using CompletionCallback = std::function<void(std::unique_ptr<PieceTreeBase> tree, std::exception_ptr error)>;
+
+    explicit PieceTreeLoader(LoadOptions options = LoadOptions());
+    ~PieceTreeLoader();
+    PieceTreeLoader(const PieceTreeLoader&) = delete;
+    PieceTreeLoader& operator=(const PieceTreeLoader&) = delete;
+
+    /**
+     * Start loading path. The future holds the tree, or the exception that
+     * stopped the load: the file could not be read, or cancel() was called.
+     * Throws std::runtime_error if a load is still running.
+     */
+    std::future<std::unique_ptr<PieceTreeBase>> load(const std::string& path, ProgressCallback onProgress = nullptr);
+
+    /**
+     * Start loading path and hand the result to onDone instead of a future
+     */
+    void load(const std::string& path, CompletionCallback onDone, ProgressCallback onProgress);
+
+    /**
+     * Progress of the current or last load, readable from any thread
+     */
+    LoadProgress progress() const;
+
+    /**
+     * Stop the running load as soon as possible. Its result becomes an error.
+     */
+    void cancel();
+
+    /**
+     * Block until the running load, if any, has delivered its result
+     */
+    void wait();
+
+    bool isRunning() const { return _running.load(); }
+
+private:
+    LoadOptions _options;
+    std::thread _thread;
+    std::atomic<bool> _running;
+    std::atomic<bool> _cancelled;
+    std::atomic<size_t> _totalBytes;
+    std::atomic<size_t> _bytesRead;
+    std::atomic<size_t> _bytesScanned;
+    std::atomic<Offset> _linesFound;
+
+    void start(const std::string& path, CompletionCallback onDone, ProgressCallback onProgress);
+    std::unique_ptr<PieceTreeBase> run(const std::string& path, const ProgressCallback& onProgress);
+};
+
+} // namespace textbuffer
@@ -8,24 +8,64 @@ namespace textbuffer {
 
 /**
  * Readonly snapshot for piece tree.
- * In a real multiple thread environment, to make snapshot reading always work correctly, we need to
- * 1. Make TreeNode.piece immutable, then reading and writing can run in parallel.
- * 2. TreeNode/Buffers normalization should not happen during snapshot reading.
+ * The pieces are copied together with the buffers they point into, and the
+ * change buffer is frozen if they reach into it: the tree's next edit starts
+ * a fresh one. Nothing the snapshot reads is modified afterwards, so edits,
+ * compaction and EOL normalization of the tree do not affect it, and it can
+ * be read from another thread once taken.
+ * Copies share the pieces and read on from where the original was.
  */
 class PieceTreeSnapshot : public ITextSnapshot {
 private:
-    std::vector<Piece*> _pieces;
+    std::shared_ptr<const std::vector<SharedPiece>> _pieces;
     size_t _index;
-    PieceTreeBase* _tree;
     std::string _BOM;
 
 public:
     PieceTreeSnapshot(PieceTreeBase* tree, const std::string& BOM = "");
-    
+
     /**
      * Read the next chunk from the snapshot
      */
     std::string read() override;
 };
 
+/**
+ * Snapshot of one version of a persistent piece tree.
+ * Taking it is O(1), and since neither the nodes nor the buffers it reaches
+ * are modified afterwards, it can be read from any thread while the tree
+ * it came from keeps being edited.
+ */
+class PersistentPieceTreeSnapshot : public ITextSnapshot {
+private:
+    PersistentPieceTree _tree;
+    std::vector<const PersistentNode*> _stack;  // in-order traversal state
+    const PersistentNode* _next;
+    bool _started;
+    std::string _BOM;
+
+public:
+    PersistentPieceTreeSnapshot(PersistentPieceTree tree, const std::string& BOM = "");
+
+    /**
+     * Read the next chunk from the snapshot
+     */
+    std::string read() override;
+
+    /**
+     * Text length of the snapshot, excluding the BOM
+     */
+    Offset getLength() const { return _tree.getLength(); }
+
+    /**
+     * Number of lines in the snapshot
+     */
+    Offset getLineCount() const { return _tree.getLineCount(); }
+
+    /**
+     * Whole text of the snapshot, excluding the BOM
+     */
+    std::string getValue() const { return _tree.getValue(); }
+};
+
 } // namespace textbuffer 
\ No newline at end of file
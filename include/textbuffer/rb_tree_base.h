@@ -1,12 +1,14 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <vector>
+#include "piece.h"
 
 namespace textbuffer {
 
 // Forward declarations
-class Piece;
 class PieceTreeBase;
 
 /**
@@ -27,25 +29,25 @@ public:
     TreeNode* right;
     NodeColor color;
 
-    // Piece data
-    Piece* piece;
-    int32_t size_left;  // size of the left subtree (not inorder)
-    int32_t lf_left;    // line feeds count in the left subtree (not in order)
+    // Piece data, stored inline so a node is a single allocation
+    Piece piece;
+    Offset size_left;  // size of the left subtree (not inorder)
+    Offset lf_left;    // line feeds count in the left subtree (not in order)
 
     /**
      * Create a new tree node
      */
-    TreeNode(Piece* piece, NodeColor color);
+    TreeNode(const Piece& piece, NodeColor color);
 
     /**
-     * Get the next node in order
+     * Get the next node in order, or sentinel if this is the last one
      */
-    TreeNode* next();
+    TreeNode* next(TreeNode* sentinel);
 
     /**
-     * Get the previous node in order
+     * Get the previous node in order, or sentinel if this is the first one
      */
-    TreeNode* prev();
+    TreeNode* prev(TreeNode* sentinel);
 
     /**
      * Detach this node (set parent, left, right to null)
@@ -54,39 +56,93 @@ public:
 };
 
 /**
- * Sentinel node for the RB tree (null node)
+ * Slab allocator for the nodes of one tree.
+ * Nodes are carved out of contiguous blocks and recycled through a free list,
+ * so steady-state editing does not hit the heap, and tearing a tree down
+ * releases whole blocks instead of freeing nodes one by one.
  */
-extern TreeNode* SENTINEL;
+class TreeNodeAllocator {
+public:
+    static constexpr size_t NodesPerBlock = 1024;
 
-/**
- * Initialize the SENTINEL node
- */
-void initializeSentinel();
+    TreeNodeAllocator();
+    TreeNodeAllocator(const TreeNodeAllocator&) = delete;
+    TreeNodeAllocator& operator=(const TreeNodeAllocator&) = delete;
+    TreeNodeAllocator(TreeNodeAllocator&& other) noexcept;
+    TreeNodeAllocator& operator=(TreeNodeAllocator&& other) noexcept;
+
+    /**
+     * Construct a node, reusing a released slot when one is available
+     */
+    TreeNode* allocate(const Piece& piece, NodeColor color);
+
+    /**
+     * Return a node to the free list
+     */
+    void deallocate(TreeNode* node);
+
+    /**
+     * Drop every node at once; blocks are kept for reuse
+     */
+    void reset();
+
+    /**
+     * Drop every node and give all blocks back to the heap
+     */
+    void releaseAll();
+
+    /**
+     * Number of nodes currently handed out
+     */
+    size_t liveCount() const { return _liveCount; }
+
+    /**
+     * Number of blocks currently owned
+     */
+    size_t blockCount() const { return _blocks.size(); }
+
+    /**
+     * Number of heap allocations made for blocks since construction
+     */
+    size_t blockAllocations() const { return _blockAllocations; }
+
+private:
+    struct alignas(TreeNode) Slot {
+        unsigned char bytes[sizeof(TreeNode)];
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> _blocks;
+    size_t _currentBlock;   // block the bump pointer is carving from
+    size_t _nextSlot;       // next unused slot in the current block
+    TreeNode* _freeList;    // released nodes, chained through parent
+    size_t _liveCount;
+    size_t _blockAllocations;
+};
 
 /**
  * Get the leftmost node in a subtree
  */
-TreeNode* leftest(TreeNode* node);
+TreeNode* leftest(TreeNode* node, TreeNode* sentinel);
 
 /**
  * Get the rightmost node in a subtree
  */
-TreeNode* righttest(TreeNode* node);
+TreeNode* righttest(TreeNode* node, TreeNode* sentinel);
 
 /**
  * Calculate the size of a subtree
  */
-int32_t calculateSize(TreeNode* node);
+Offset calculateSize(TreeNode* node, TreeNode* sentinel);
 
 /**
  * Calculate the line feed count of a subtree
  */
-int32_t calculateLF(TreeNode* node);
+Offset calculateLF(TreeNode* node, TreeNode* sentinel);
 
 /**
- * Reset the SENTINEL node parent
+ * Reset the parent of the tree's sentinel node
  */
-void resetSentinel();
+void resetSentinel(PieceTreeBase* tree);
 
 /**
  * Left rotate a node in the RB tree
@@ -111,7 +167,7 @@ void fixInsert(PieceTreeBase* tree, TreeNode* x);
 /**
  * Update the tree metadata (size_left, lf_left) for a node and its ancestors
  */
-void updateTreeMetadata(PieceTreeBase* tree, TreeNode* x, int32_t delta, int32_t lineFeedCntDelta);
+void updateTreeMetadata(PieceTreeBase* tree, TreeNode* x, Offset delta, Offset lineFeedCntDelta);
 
 /**
  * Recompute the tree metadata for a node
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "piece_tree_base.h"
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace textbuffer {
+
+/**
+ * Finger into a piece tree for sequential navigation.
+ * The cursor keeps the piece it stands in together with the offset and line
+ * that piece starts at, so moving to a neighbouring line, byte or piece only
+ * looks at the pieces in between instead of descending from the root; a scan
+ * over the whole document costs amortized O(1) per step.
+ * Edits made through the tree while a cursor is alive are detected by the tree
+ * version: the cursor carries its offset over them and seeks again on its next use.
+ */
+class TextCursor {
+public:
+    /**
+     * Cursor at offset of the tree, clamped to the text
+     */
+    explicit TextCursor(PieceTreeBase& tree, Offset offset = 0);
+
+    /**
+     * Document offset of the cursor
+     */
+    Offset offset();
+
+    /**
+     * 0-based line of the cursor
+     */
+    Offset lineNumber();
+
+    /**
+     * Bytes between the start of the line and the cursor
+     */
+    Offset column();
+
+    /**
+     * Whether the tree was changed since the cursor last looked at it
+     */
+    bool isStale() const { return _version != _tree->getVersion(); }
+
+    /**
+     * Jump to an offset, clamped to the text. O(log n).
+     */
+    void moveToOffset(Offset offset);
+
+    /**
+     * Jump to the start of a line, clamped to the existing lines. O(log n).
+     */
+    void moveToLine(Offset lineNumber);
+
+    /**
+     * Move to the start of the next line. False on the last line, where the cursor stays.
+     */
+    bool nextLine();
+
+    /**
+     * Move to the start of the previous line. False on the first line, where the cursor stays.
+     */
+    bool prevLine();
+
+    /**
+     * Move by delta lines, landing at a line start. False if the first or last
+     * line was hit before all of them were moved.
+     */
+    bool moveLines(Offset delta);
+
+    /**
+     * Move by delta bytes. False if the move was cut short at either end of the text.
+     */
+    bool moveBytes(Offset delta);
+
+    /**
+     * Move to the start of the next piece. False at the last piece, where the cursor stays.
+     */
+    bool nextPiece();
+
+    /**
+     * Move to the start of the previous piece. False at the first piece, where the cursor stays.
+     */
+    bool prevPiece();
+
+    /**
+     * Piece holding the cursor, the end iterator at the end of the text
+     */
+    const PieceIterator& piece();
+
+    /**
+     * Content of the cursor's line without its line break
+     */
+    std::string lineContent();
+
+    /**
+     * Content of the cursor's line without its line break, as views into the
+     * buffers. Valid until the tree is edited.
+     */
+    std::vector<std::string_view> lineViews();
+
+private:
+    PieceTreeBase* _tree;
+    uint64_t _version;
+    PieceIterator _it;  // piece holding _offset, skipping empty pieces
+    Offset _offset;
+    Offset _lineNumber;
+    Offset _lineStart;
+    std::vector<std::string_view> _views;  // scratch for lineContent
+
+    /**
+     * Fill views with the pieces of the cursor's line, without its line break
+     */
+    void collectLineViews(std::vector<std::string_view>& views);
+
+    /**
+     * Seek again if the tree changed since the last use
+     */
+    void sync();
+
+    /**
+     * Reset the cursor to offset by a descent from the root
+     */
+    void seek(Offset offset);
+
+    /**
+     * Move to offset by stepping the piece iterator from where the cursor is
+     */
+    void stepTo(Offset offset);
+
+    /**
+     * Advance it from a piece starting at or before offset to the one holding offset
+     */
+    void settle(PieceIterator& it, Offset offset) const;
+
+    /**
+     * Start of the line holding offset, found by walking back from the piece
+     * it holds offset. it is left at the piece the line starts in.
+     */
+    Offset findLineStart(PieceIterator& it, Offset offset) const;
+
+    /**
+     * Number of line breaks of a piece ending at or before its byte remainder
+     */
+    Offset breaksUpTo(const Piece& piece, Offset remainder) const;
+
+    /**
+     * Position inside a piece right after its k-th line break, 1 <= k <= lineFeedCnt
+     */
+    Offset lineStartInPiece(const Piece& piece, Offset k) const;
+};
+
+} // namespace textbuffer
@@ -54,14 +54,14 @@ public:
      * 
      * @return The length of the buffer
      */
-    int32_t getLength() const;
+    Offset getLength() const;
 
     /**
      * Get the number of lines in the buffer
      * 
      * @return The number of lines
      */
-    int32_t getLineCount() const;
+    Offset getLineCount() const;
 
     /**
      * Get the content of a specific line
@@ -69,7 +69,64 @@ public:
      * @param lineNumber The zero-based line number
      * @return The content of the specified line
      */
-    std::string getLineContent(int32_t lineNumber) const;
+    std::string getLineContent(Offset lineNumber) const;
+
+    /**
+     * Get the content of a specific line without copying it
+     * 
+     * @param lineNumber The zero-based line number
+     * @return Views of the line text in the buffer, valid until the next edit
+     */
+    std::vector<std::string_view> getLineViews(Offset lineNumber) const;
+
+    /**
+     * Get the text between two offsets without copying it
+     * 
+     * @param start The first character offset
+     * @param end The offset past the last character
+     * @return Views of the text in the buffer, valid until the next edit
+     */
+    std::vector<std::string_view> getRangeViews(Offset start, Offset end) const;
+
+    /**
+     * Stream the text between two offsets to a callback without copying it
+     * 
+     * @param start The first character offset
+     * @param end The offset past the last character
+     * @param callback Gets one view per piece; returning false stops the walk
+     * @return False if the callback stopped early
+     */
+    bool forEachChunk(Offset start, Offset end, const std::function<bool(std::string_view)>& callback) const;
+
+    /**
+     * Stream the text in a range to a callback without copying it
+     * 
+     * @param range The range to visit
+     * @param callback Gets one view per piece; returning false stops the walk
+     * @return False if the callback stopped early
+     */
+    bool forEachChunk(const common::Range& range, const std::function<bool(std::string_view)>& callback) const;
+
+    /**
+     * Copy the text between two offsets into a caller-provided buffer
+     * 
+     * @param start The first character offset
+     * @param end The offset past the last character
+     * @param dst The buffer to copy into
+     * @param capacity The most bytes to copy
+     * @return The number of bytes copied
+     */
+    size_t copyRange(Offset start, Offset end, char* dst, size_t capacity) const;
+
+    /**
+     * Copy the text in a range into a caller-provided buffer
+     * 
+     * @param range The range to copy
+     * @param dst The buffer to copy into
+     * @param capacity The most bytes to copy
+     * @return The number of bytes copied
+     */
+    size_t copyRange(const common::Range& range, char* dst, size_t capacity) const;
 
     /**
      * Get the length of a specific line
@@ -77,7 +134,7 @@ public:
      * @param lineNumber The zero-based line number
      * @return The length of the specified line
      */
-    int32_t getLineLength(int32_t lineNumber) const;
+    Offset getLineLength(Offset lineNumber) const;
 
     /**
      * Get the end-of-line sequence used by this buffer
@@ -99,7 +156,7 @@ public:
      * @param offset The character offset in the buffer
      * @return The position (line and column)
      */
-    common::Position getPositionAt(int32_t offset) const;
+    common::Position getPositionAt(Offset offset) const;
 
     /**
      * Get the offset for a specific position
@@ -108,7 +165,7 @@ public:
      * @param column The column (zero-based)
      * @return The character offset in the buffer
      */
-    int32_t getOffsetAt(int32_t lineNumber, int32_t column) const;
+    Offset getOffsetAt(Offset lineNumber, Offset column) const;
 
     /**
      * Insert text at the specified offset
@@ -117,7 +174,7 @@ public:
      * @param text The text to insert
      * @param eolNormalized Whether the text's EOL is already normalized
      */
-    void insert(int32_t offset, const std::string& text, bool eolNormalized = false);
+    void insert(Offset offset, const std::string& text, bool eolNormalized = false);
 
     /**
      * Delete text at the specified offset
@@ -125,16 +182,82 @@ public:
      * @param offset The character offset to delete from
      * @param count The number of characters to delete
      */
-    void deleteText(int32_t offset, int32_t count);
+    void deleteText(Offset offset, Offset count);
+
+    /**
+     * Apply a batch of non-overlapping edits in one pass
+     * 
+     * @param edits The edits, all in offsets of the current text
+     * @param eolNormalized Whether the EOLs of the inserted texts are already normalized
+     * @return The edits undoing the batch, in offsets of the new text
+     */
+    std::vector<TextEdit> applyEdits(std::vector<TextEdit> edits, bool eolNormalized = false);
 
     /**
      * Create a snapshot of the buffer
      * 
+     * The snapshot can be read from another thread while this buffer keeps
+     * being edited.
+     * 
      * @param BOM The byte order mark to include (if any)
      * @return A unique_ptr to an ITextSnapshot
      */
     std::unique_ptr<ITextSnapshot> createSnapshot(const std::string& BOM = "") const;
 
+    /**
+     * Switch persistent snapshots on or off
+     * 
+     * While on, createSnapshot is O(1) instead of copying every piece.
+     * 
+     * @param enabled Whether to keep a persistent copy of the tree
+     */
+    void setPersistentSnapshots(bool enabled);
+
+    /**
+     * Switch the undo history on or off
+     * 
+     * The history records the pieces each edit removed and inserted rather
+     * than their text, so undoing even a huge delete copies no bytes.
+     * 
+     * @param enabled Whether to record edits for undo and redo
+     */
+    void setUndoHistory(bool enabled);
+
+    /**
+     * Bound the undo history
+     * 
+     * @param maxSteps The most steps kept; the oldest are dropped first
+     * @param maxBytes The most bytes of text the kept steps may reference
+     */
+    void setUndoLimits(size_t maxSteps, size_t maxBytes);
+
+    /**
+     * Start grouping edits into one undo step, up to the matching endTransaction
+     */
+    void beginTransaction();
+
+    /**
+     * Close the step opened by the matching beginTransaction
+     */
+    void endTransaction();
+
+    /**
+     * Revert the latest undo step
+     * 
+     * @return Whether there was a step to undo
+     */
+    bool undo();
+
+    /**
+     * Make the latest undone step again
+     * 
+     * @return Whether there was a step to redo
+     */
+    bool redo();
+
+    bool canUndo() const;
+    bool canRedo() const;
+
 private:
     std::unique_ptr<PieceTreeBase> _buffer;
 };
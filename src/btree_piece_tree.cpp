@@ -0,0 +1,839 @@
+#include "textbuffer/btree_piece_tree.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace textbuffer {
+
+namespace {
+
+constexpr int32_t MinFill = 4;
+
+} // namespace
+
+BTreePieceTree::BTreePieceTree() : _root(newLeaf()), _height(1), _pieceCount(0) {
+    _firstLeaf = static_cast<Leaf*>(_root);
+}
+
+BTreePieceTree::~BTreePieceTree() {
+    freeNode(_root);
+}
+
+BTreePieceTree::Leaf* BTreePieceTree::newLeaf() {
+    Leaf* leaf = new Leaf();
+    leaf->isLeaf = true;
+    leaf->count = 0;
+    leaf->prev = nullptr;
+    leaf->next = nullptr;
+    return leaf;
+}
+
+BTreePieceTree::Inner* BTreePieceTree::newInner() {
+    Inner* inner = new Inner();
+    inner->isLeaf = false;
+    inner->count = 0;
+    return inner;
+}
+
+void BTreePieceTree::freeNode(Node* node) {
+    if (node->isLeaf) {
+        delete static_cast<Leaf*>(node);
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for (int32_t i = 0; i < inner->count; i++) {
+        freeNode(inner->children[i]);
+    }
+    delete inner;
+}
+
+void BTreePieceTree::nodeSums(const Node* node, Offset& length, Offset& lineFeeds) {
+    length = 0;
+    lineFeeds = 0;
+    if (node->isLeaf) {
+        const Leaf* leaf = static_cast<const Leaf*>(node);
+        for (int32_t i = 0; i < leaf->count; i++) {
+            length += leaf->pieces[i].length;
+            lineFeeds += leaf->pieces[i].lineFeedCnt;
+        }
+        return;
+    }
+    const Inner* inner = static_cast<const Inner*>(node);
+    for (int32_t i = 0; i < inner->count; i++) {
+        length += inner->lengths[i];
+        lineFeeds += inner->lineFeeds[i];
+    }
+}
+
+void BTreePieceTree::create(std::vector<StringBuffer> chunks, const std::string& eol, bool eolNormalized) {
+    Offset oldLength = getLength();
+    _buffers = {std::make_shared<StringBuffer>("", std::vector<Offset>{0})};
+    _changeBufferIndex = 0;
+    _changeBufferFrozen = false;
+    _lastChangeBufferPos = {0, 0};
+    _EOL = eol;
+    _EOLLength = eol.length();
+    _EOLNormalized = eolNormalized;
+
+    std::vector<Piece> pieces;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (chunks[i].text().empty()) {
+            continue;
+        }
+        StringBuffer& chunk = chunks[i];
+        if (!chunk.isLineIndexDeferred() && !chunk.isLineIndexCompact() && chunk.lineStarts.empty()) {
+            chunk.lineStarts = createLineStartsFast(chunk.text());
+        }
+        chunk.compactLineStarts();
+        // a deferred buffer is not scanned here, its counts give the end
+        Offset lineBreaks = chunk.getLineBreakCount();
+        pieces.push_back(Piece(
+            _buffers.size(),
+            {0, 0},
+            {lineBreaks, static_cast<Offset>(chunk.text().length() - chunk.getLastLineStart())},
+            lineBreaks,
+            chunk.text().length()
+        ));
+        _buffers.push_back(std::make_shared<StringBuffer>(std::move(chunk)));
+    }
+    _originalBufferEnd = _buffers.size();
+
+    replacePieces(pieces);
+
+    if (_persistentSnapshots) {
+        rebuildPersistentTree();
+    }
+    if (_history) {
+        // the steps are about a document that is gone
+        _history->clear();
+    }
+    recordEdit(0, oldLength, _length);
+}
+
+void BTreePieceTree::replacePieces(const std::vector<Piece>& pieces) {
+    // Build bottom-up, spreading entries evenly so that no node starts underfull
+    freeNode(_root);
+    std::vector<Node*> level;
+    size_t leafCount = std::max<size_t>(1, (pieces.size() + MaxPieces - 1) / MaxPieces);
+    Leaf* prevLeaf = nullptr;
+    size_t next = 0;
+    for (size_t i = 0; i < leafCount; i++) {
+        Leaf* leaf = newLeaf();
+        size_t end = pieces.size() * (i + 1) / leafCount;
+        for (; next < end; next++) {
+            leaf->pieces[leaf->count++] = pieces[next];
+        }
+        leaf->prev = prevLeaf;
+        if (prevLeaf) {
+            prevLeaf->next = leaf;
+        }
+        prevLeaf = leaf;
+        level.push_back(leaf);
+    }
+    _firstLeaf = static_cast<Leaf*>(level.front());
+    _height = 1;
+
+    while (level.size() > 1) {
+        std::vector<Node*> parents;
+        int32_t parentCount = (level.size() + MaxChildren - 1) / MaxChildren;
+        next = 0;
+        for (int32_t i = 0; i < parentCount; i++) {
+            Inner* inner = newInner();
+            size_t end = level.size() * (i + 1) / parentCount;
+            for (; next < end; next++) {
+                nodeSums(level[next], inner->lengths[inner->count], inner->lineFeeds[inner->count]);
+                inner->children[inner->count++] = level[next];
+            }
+            parents.push_back(inner);
+        }
+        level.swap(parents);
+        _height++;
+    }
+
+    _root = level.front();
+    _pieceCount = pieces.size();
+    Offset lineFeeds;
+    nodeSums(_root, _length, lineFeeds);
+    _lineCnt = lineFeeds + 1;
+    _lineCache.clear();
+}
+
+void BTreePieceTree::locate(Offset offset, bool preferNext, Location& loc) const {
+    loc.depth = 0;
+    loc.pieceStart = 0;
+    loc.lineFeedsBefore = 0;
+
+    Node* node = _root;
+    while (!node->isLeaf) {
+        Inner* inner = static_cast<Inner*>(node);
+        int32_t i = 0;
+        while (i < inner->count - 1 &&
+               (offset > inner->lengths[i] || (preferNext && offset == inner->lengths[i]))) {
+            offset -= inner->lengths[i];
+            loc.pieceStart += inner->lengths[i];
+            loc.lineFeedsBefore += inner->lineFeeds[i];
+            i++;
+        }
+        loc.path[loc.depth++] = {inner, i};
+        node = inner->children[i];
+    }
+
+    Leaf* leaf = static_cast<Leaf*>(node);
+    int32_t i = 0;
+    while (i < leaf->count - 1 &&
+           (offset > leaf->pieces[i].length || (preferNext && offset == leaf->pieces[i].length))) {
+        offset -= leaf->pieces[i].length;
+        loc.pieceStart += leaf->pieces[i].length;
+        loc.lineFeedsBefore += leaf->pieces[i].lineFeedCnt;
+        i++;
+    }
+    loc.leaf = leaf;
+    loc.index = i;
+    loc.remainder = offset;
+}
+
+Offset BTreePieceTree::lineStartOffset(Offset lineNumber) const {
+    if (lineNumber <= 0) {
+        return 0;
+    }
+    if (lineNumber >= _lineCnt) {
+        return _length;
+    }
+
+    // lineNumber is the number of line feeds still to pass
+    Offset offset = 0;
+    const Node* node = _root;
+    while (!node->isLeaf) {
+        const Inner* inner = static_cast<const Inner*>(node);
+        int32_t i = 0;
+        while (i < inner->count - 1 && inner->lineFeeds[i] < lineNumber) {
+            lineNumber -= inner->lineFeeds[i];
+            offset += inner->lengths[i];
+            i++;
+        }
+        node = inner->children[i];
+    }
+
+    const Leaf* leaf = static_cast<const Leaf*>(node);
+    int32_t i = 0;
+    while (i < leaf->count - 1 && leaf->pieces[i].lineFeedCnt < lineNumber) {
+        lineNumber -= leaf->pieces[i].lineFeedCnt;
+        offset += leaf->pieces[i].length;
+        i++;
+    }
+
+    const Piece& piece = leaf->pieces[i];
+    LineStartsView lineStarts = _buffers[piece.bufferIndex]->getLineStarts();
+    Offset pieceStart = lineStarts[piece.start.line] + piece.start.column;
+    // a piece ending on a lone '\r' owns the break, the line starts right after it
+    Offset inPiece = std::min(lineStarts[piece.start.line + lineNumber] - pieceStart, piece.length);
+    return offset + inPiece;
+}
+
+void BTreePieceTree::addToPath(Location& loc, Offset lengthDelta, Offset lineFeedsDelta) {
+    for (int32_t level = 0; level < loc.depth; level++) {
+        loc.path[level].node->lengths[loc.path[level].index] += lengthDelta;
+        loc.path[level].node->lineFeeds[loc.path[level].index] += lineFeedsDelta;
+    }
+    _length += lengthDelta;
+    _lineCnt += lineFeedsDelta;
+}
+
+void BTreePieceTree::replacePiece(Location& loc, const Piece& piece) {
+    Piece& old = loc.leaf->pieces[loc.index];
+    Offset lengthDelta = piece.length - old.length;
+    Offset lineFeedsDelta = piece.lineFeedCnt - old.lineFeedCnt;
+    old = piece;
+    addToPath(loc, lengthDelta, lineFeedsDelta);
+}
+
+void BTreePieceTree::insertIntoLeaf(Location& loc, int32_t index, const Piece& piece) {
+    Leaf* leaf = loc.leaf;
+    _pieceCount++;
+
+    if (leaf->count < MaxPieces) {
+        std::memmove(&leaf->pieces[index + 1], &leaf->pieces[index], (leaf->count - index) * sizeof(Piece));
+        leaf->pieces[index] = piece;
+        leaf->count++;
+        addToPath(loc, piece.length, piece.lineFeedCnt);
+        return;
+    }
+
+    // full: move the upper half into a new right sibling first
+    Leaf* right = newLeaf();
+    int32_t half = MaxPieces / 2;
+    std::memcpy(right->pieces, &leaf->pieces[half], (MaxPieces - half) * sizeof(Piece));
+    right->count = MaxPieces - half;
+    leaf->count = half;
+    right->next = leaf->next;
+    if (right->next) {
+        right->next->prev = right;
+    }
+    right->prev = leaf;
+    leaf->next = right;
+
+    Leaf* target = index <= half ? leaf : right;
+    int32_t at = index <= half ? index : index - half;
+    std::memmove(&target->pieces[at + 1], &target->pieces[at], (target->count - at) * sizeof(Piece));
+    target->pieces[at] = piece;
+    target->count++;
+
+    insertSibling(loc, loc.depth - 1, leaf, right);
+}
+
+void BTreePieceTree::insertSibling(Location& loc, int32_t level, Node* left, Node* right) {
+    Node* child = left;
+    Node* sibling = right;
+    for (; level >= 0; level--) {
+        Inner* parent = loc.path[level].node;
+        int32_t i = loc.path[level].index;
+        nodeSums(child, parent->lengths[i], parent->lineFeeds[i]);
+
+        if (sibling) {
+            Inner* target = parent;
+            int32_t at = i + 1;
+            Node* split = nullptr;
+            if (parent->count == MaxChildren) {
+                Inner* upper = newInner();
+                int32_t half = MaxChildren / 2;
+                upper->count = MaxChildren - half;
+                std::memcpy(upper->lengths, &parent->lengths[half], upper->count * sizeof(Offset));
+                std::memcpy(upper->lineFeeds, &parent->lineFeeds[half], upper->count * sizeof(Offset));
+                std::memcpy(upper->children, &parent->children[half], upper->count * sizeof(Node*));
+                parent->count = half;
+                if (at > half) {
+                    target = upper;
+                    at -= half;
+                }
+                split = upper;
+            }
+            int32_t moved = target->count - at;
+            std::memmove(&target->lengths[at + 1], &target->lengths[at], moved * sizeof(Offset));
+            std::memmove(&target->lineFeeds[at + 1], &target->lineFeeds[at], moved * sizeof(Offset));
+            std::memmove(&target->children[at + 1], &target->children[at], moved * sizeof(Node*));
+            nodeSums(sibling, target->lengths[at], target->lineFeeds[at]);
+            target->children[at] = sibling;
+            target->count++;
+            sibling = split;
+        }
+        child = parent;
+    }
+
+    if (sibling) {
+        Inner* root = newInner();
+        root->count = 2;
+        root->children[0] = child;
+        root->children[1] = sibling;
+        nodeSums(child, root->lengths[0], root->lineFeeds[0]);
+        nodeSums(sibling, root->lengths[1], root->lineFeeds[1]);
+        _root = root;
+        _height++;
+    }
+
+    Offset lineFeeds;
+    nodeSums(_root, _length, lineFeeds);
+    _lineCnt = lineFeeds + 1;
+}
+
+void BTreePieceTree::removeFromLeaf(Location& loc, int32_t index, int32_t count) {
+    Leaf* leaf = loc.leaf;
+    Offset length = 0;
+    Offset lineFeeds = 0;
+    for (int32_t i = index; i < index + count; i++) {
+        length += leaf->pieces[i].length;
+        lineFeeds += leaf->pieces[i].lineFeedCnt;
+    }
+    std::memmove(&leaf->pieces[index], &leaf->pieces[index + count],
+                 (leaf->count - index - count) * sizeof(Piece));
+    leaf->count -= count;
+    _pieceCount -= count;
+
+    if (leaf->count >= MinFill || loc.depth == 0) {
+        addToPath(loc, -length, -lineFeeds);
+        return;
+    }
+    rebalance(loc, loc.depth - 1);
+}
+
+void BTreePieceTree::rebalance(Location& loc, int32_t level) {
+    Node* child = loc.leaf;
+    for (; level >= 0; level--) {
+        Inner* parent = loc.path[level].node;
+        int32_t i = loc.path[level].index;
+        nodeSums(child, parent->lengths[i], parent->lineFeeds[i]);
+
+        if (child->count < MinFill && parent->count > 1) {
+            int32_t l = i > 0 ? i - 1 : i;
+            int32_t r = l + 1;
+            Node* left = parent->children[l];
+            Node* right = parent->children[r];
+            int32_t capacity = left->isLeaf ? MaxPieces : MaxChildren;
+
+            if (left->count + right->count <= capacity) {
+                // merge the right node into the left one
+                left->count += right->count;
+                if (left->isLeaf) {
+                    Leaf* a = static_cast<Leaf*>(left);
+                    Leaf* b = static_cast<Leaf*>(right);
+                    std::memcpy(&a->pieces[a->count - b->count], b->pieces, b->count * sizeof(Piece));
+                    a->next = b->next;
+                    if (a->next) {
+                        a->next->prev = a;
+                    }
+                } else {
+                    Inner* a = static_cast<Inner*>(left);
+                    Inner* b = static_cast<Inner*>(right);
+                    int32_t at = a->count - b->count;
+                    std::memcpy(&a->lengths[at], b->lengths, b->count * sizeof(Offset));
+                    std::memcpy(&a->lineFeeds[at], b->lineFeeds, b->count * sizeof(Offset));
+                    std::memcpy(&a->children[at], b->children, b->count * sizeof(Node*));
+                    b->count = 0;  // the children moved, only free the node itself
+                }
+                freeNode(right);
+
+                int32_t moved = parent->count - r - 1;
+                std::memmove(&parent->lengths[r], &parent->lengths[r + 1], moved * sizeof(Offset));
+                std::memmove(&parent->lineFeeds[r], &parent->lineFeeds[r + 1], moved * sizeof(Offset));
+                std::memmove(&parent->children[r], &parent->children[r + 1], moved * sizeof(Node*));
+                parent->count--;
+                nodeSums(left, parent->lengths[l], parent->lineFeeds[l]);
+            } else {
+                // borrow: split the entries of both nodes evenly
+                int32_t total = left->count + right->count;
+                int32_t leftCount = total / 2;
+                if (left->isLeaf) {
+                    Leaf* a = static_cast<Leaf*>(left);
+                    Leaf* b = static_cast<Leaf*>(right);
+                    Piece all[MaxPieces * 2];
+                    std::memcpy(all, a->pieces, a->count * sizeof(Piece));
+                    std::memcpy(&all[a->count], b->pieces, b->count * sizeof(Piece));
+                    std::memcpy(a->pieces, all, leftCount * sizeof(Piece));
+                    std::memcpy(b->pieces, &all[leftCount], (total - leftCount) * sizeof(Piece));
+                } else {
+                    Inner* a = static_cast<Inner*>(left);
+                    Inner* b = static_cast<Inner*>(right);
+                    Offset lengths[MaxChildren * 2];
+                    Offset lineFeeds[MaxChildren * 2];
+                    Node* children[MaxChildren * 2];
+                    std::memcpy(lengths, a->lengths, a->count * sizeof(Offset));
+                    std::memcpy(&lengths[a->count], b->lengths, b->count * sizeof(Offset));
+                    std::memcpy(lineFeeds, a->lineFeeds, a->count * sizeof(Offset));
+                    std::memcpy(&lineFeeds[a->count], b->lineFeeds, b->count * sizeof(Offset));
+                    std::memcpy(children, a->children, a->count * sizeof(Node*));
+                    std::memcpy(&children[a->count], b->children, b->count * sizeof(Node*));
+                    std::memcpy(a->lengths, lengths, leftCount * sizeof(Offset));
+                    std::memcpy(a->lineFeeds, lineFeeds, leftCount * sizeof(Offset));
+                    std::memcpy(a->children, children, leftCount * sizeof(Node*));
+                    std::memcpy(b->lengths, &lengths[leftCount], (total - leftCount) * sizeof(Offset));
+                    std::memcpy(b->lineFeeds, &lineFeeds[leftCount], (total - leftCount) * sizeof(Offset));
+                    std::memcpy(b->children, &children[leftCount], (total - leftCount) * sizeof(Node*));
+                }
+                left->count = leftCount;
+                right->count = total - leftCount;
+                nodeSums(left, parent->lengths[l], parent->lineFeeds[l]);
+                nodeSums(right, parent->lengths[r], parent->lineFeeds[r]);
+            }
+        }
+        child = parent;
+    }
+
+    while (!_root->isLeaf && _root->count == 1) {
+        Inner* old = static_cast<Inner*>(_root);
+        _root = old->children[0];
+        old->count = 0;
+        freeNode(old);
+        _height--;
+    }
+
+    Offset lineFeeds;
+    nodeSums(_root, _length, lineFeeds);
+    _lineCnt = lineFeeds + 1;
+}
+
+std::pair<Piece, Piece> BTreePieceTree::splitPiece(const Piece& piece, Offset remainder) const {
+    return PersistentPieceTree::splitPiece(*_buffers[piece.bufferIndex], piece, remainder);
+}
+
+void BTreePieceTree::splitAt(Offset offset) {
+    if (offset <= 0 || offset >= _length) {
+        return;
+    }
+    Location loc;
+    locate(offset, false, loc);
+    if (loc.remainder == loc.leaf->pieces[loc.index].length) {
+        return;
+    }
+    std::pair<Piece, Piece> parts = splitPiece(loc.leaf->pieces[loc.index], loc.remainder);
+    replacePiece(loc, parts.first);
+    insertIntoLeaf(loc, loc.index + 1, parts.second);
+}
+
+void BTreePieceTree::insertPieceAt(Offset offset, const Piece& piece) {
+    Location loc;
+    locate(offset, true, loc);
+    // the caller split the pieces at offset, so it is either at a piece head or at the very end
+    insertIntoLeaf(loc, loc.remainder == 0 ? loc.index : loc.index + 1, piece);
+}
+
+void BTreePieceTree::removeRange(Offset start, Offset end) {
+    splitAt(start);
+    splitAt(end);
+    Offset remaining = end - start;
+    while (remaining > 0) {
+        Location loc;
+        locate(start, true, loc);
+        int32_t count = 0;
+        Offset removed = 0;
+        while (loc.index + count < loc.leaf->count && removed < remaining) {
+            removed += loc.leaf->pieces[loc.index + count].length;
+            count++;
+        }
+        removeFromLeaf(loc, loc.index, count);
+        remaining -= removed;
+    }
+}
+
+void BTreePieceTree::validateCRLF(Offset offset) {
+    if (!shouldCheckCRLF() || offset <= 0 || offset >= _length) {
+        return;
+    }
+    if (getCharCode(offset - 1) != '\r' || getCharCode(offset) != '\n') {
+        return;
+    }
+    Location loc;
+    locate(offset, false, loc);
+    if (loc.remainder != loc.leaf->pieces[loc.index].length) {
+        return;  // the pair already sits inside one piece
+    }
+
+    // the pair is split over two pieces: give it a piece of its own
+    removeRange(offset - 1, offset + 1);
+    std::vector<Piece> pieces = createNewPieces("\r\n");
+    insertPieceAt(offset - 1, pieces[0]);
+}
+
+void BTreePieceTree::insert(Offset offset, const std::string& value, bool eolNormalized) {
+    PersistentEditScope persistentScope(this, offset);
+    insertValue(offset, value, eolNormalized);
+    persistentScope.commit();
+}
+
+void BTreePieceTree::insertValue(Offset offset, const std::string& value, bool eolNormalized) {
+    if (value.empty()) {
+        return;
+    }
+
+    _EOLNormalized = _EOLNormalized && eolNormalized;
+    offset = std::max<Offset>(0, std::min(offset, _length));
+
+    std::vector<Piece> pieces = createNewPieces(value);
+
+    // typing appends to the change buffer, so the new text usually continues the piece before it
+    if (pieces.size() == 1 && offset > 0) {
+        Location loc;
+        locate(offset, false, loc);
+        const Piece& prev = loc.leaf->pieces[loc.index];
+        const Piece& piece = pieces[0];
+        if (loc.remainder == prev.length && prev.bufferIndex == piece.bufferIndex && prev.end == piece.start) {
+            Piece merged(prev.bufferIndex, prev.start, piece.end,
+                         getLineFeedCnt(prev.bufferIndex, prev.start, piece.end), prev.length + piece.length);
+            replacePiece(loc, merged);
+            validateCRLF(offset);
+            validateCRLF(offset + piece.length);
+            return;
+        }
+    }
+
+    splitAt(offset);
+    Offset at = offset;
+    for (const Piece& piece : pieces) {
+        insertPieceAt(at, piece);
+        at += piece.length;
+    }
+    validateCRLF(offset);
+    validateCRLF(at);
+}
+
+void BTreePieceTree::insertPieces(Offset offset, const std::vector<Piece>& pieces) {
+    PersistentEditScope persistentScope(this, offset);
+    offset = std::max<Offset>(0, std::min(offset, _length));
+    splitAt(offset);
+    Offset at = offset;
+    for (const Piece& piece : pieces) {
+        if (piece.length > 0) {
+            insertPieceAt(at, piece);
+            at += piece.length;
+        }
+    }
+    validateCRLF(offset);
+    validateCRLF(at);
+    persistentScope.commit();
+}
+
+void BTreePieceTree::delete_(Offset offset, Offset count) {
+    deleteText(offset, count);
+}
+
+void BTreePieceTree::deleteText(Offset offset, Offset count) {
+    PersistentEditScope persistentScope(this, offset, count);
+    offset = std::max<Offset>(0, offset);
+    count = std::min(count, _length - offset);
+    if (count > 0) {
+        removeRange(offset, offset + count);
+        validateCRLF(offset);
+    }
+    persistentScope.commit();
+}
+
+std::string BTreePieceTree::getText(Offset start, Offset end) const {
+    std::string result;
+    start = std::max<Offset>(0, start);
+    end = std::min(end, _length);
+    if (start >= end) {
+        return result;
+    }
+    result.reserve(end - start);
+
+    Location loc;
+    locate(start, true, loc);
+    const Leaf* leaf = loc.leaf;
+    int32_t index = loc.index;
+    Offset remainder = loc.remainder;
+    Offset remaining = end - start;
+    while (leaf && remaining > 0) {
+        for (; index < leaf->count && remaining > 0; index++) {
+            const Piece& piece = leaf->pieces[index];
+            Offset take = std::min(piece.length - remainder, remaining);
+            Offset bufferOffset = offsetInBuffer(piece.bufferIndex, piece.start) + remainder;
+            result.append(_buffers[piece.bufferIndex]->text(), bufferOffset, take);
+            remaining -= take;
+            remainder = 0;
+        }
+        leaf = leaf->next;
+        index = 0;
+    }
+    return result;
+}
+
+std::string BTreePieceTree::getValue() {
+    std::string result;
+    result.reserve(_length);
+    for (const Leaf* leaf = _firstLeaf; leaf; leaf = leaf->next) {
+        for (int32_t i = 0; i < leaf->count; i++) {
+            const Piece& piece = leaf->pieces[i];
+            result.append(_buffers[piece.bufferIndex]->text(), offsetInBuffer(piece.bufferIndex, piece.start),
+                          piece.length);
+        }
+    }
+    return result;
+}
+
+std::string BTreePieceTree::getLinesRawContent() {
+    return getValue();
+}
+
+std::string BTreePieceTree::getLineRawContent(Offset lineNumber, Offset endOffset) {
+    // lineNumber is 1-based here
+    Offset start = lineStartOffset(lineNumber - 1);
+    Offset end = lineStartOffset(lineNumber);
+    if (lineNumber < _lineCnt) {
+        end -= endOffset;
+    }
+    return getText(start, end);
+}
+
+PieceIterator BTreePieceTree::pieceBegin() const {
+    if (_pieceCount == 0) {
+        return pieceEnd();
+    }
+    return PieceIterator(this, _firstLeaf, 0, &_firstLeaf->pieces[0], 0, 0);
+}
+
+PieceIterator BTreePieceTree::pieceAt(Offset offset) const {
+    if (offset >= getLength()) {
+        return pieceEnd();
+    }
+    Location loc;
+    locate(std::max<Offset>(offset, 0), true, loc);
+    PieceIterator it(this, loc.leaf, loc.index, &loc.leaf->pieces[loc.index], loc.pieceStart, loc.lineFeedsBefore);
+    if (loc.remainder >= it->length) {
+        // an empty piece sits at the border
+        ++it;
+    }
+    return it;
+}
+
+void BTreePieceTree::stepPiece(PieceIterator& it, bool forward) const {
+    Leaf* leaf = static_cast<Leaf*>(it._node);
+    int32_t index = it._index;
+    if (forward) {
+        if (!leaf) {
+            return;
+        }
+        it._offset += leaf->pieces[index].length;
+        it._lineNumber += leaf->pieces[index].lineFeedCnt;
+        if (++index == leaf->count) {
+            leaf = leaf->next;
+            index = 0;
+        }
+    } else {
+        if (!leaf) {
+            if (_pieceCount == 0) {
+                return;
+            }
+            Node* node = _root;
+            while (!node->isLeaf) {
+                Inner* inner = static_cast<Inner*>(node);
+                node = inner->children[inner->count - 1];
+            }
+            leaf = static_cast<Leaf*>(node);
+            index = leaf->count;
+        }
+        if (--index < 0) {
+            leaf = leaf->prev;
+            index = leaf ? leaf->count - 1 : 0;
+        }
+        if (leaf) {
+            it._offset -= leaf->pieces[index].length;
+            it._lineNumber -= leaf->pieces[index].lineFeedCnt;
+        }
+    }
+
+    if (!leaf) {
+        it = pieceEnd();
+        return;
+    }
+    it._node = leaf;
+    it._index = index;
+    it._piece = &leaf->pieces[index];
+}
+
+void BTreePieceTree::remapPieces(const std::function<void(Piece&)>& callback) {
+    for (Leaf* leaf = _firstLeaf; leaf; leaf = leaf->next) {
+        for (int32_t i = 0; i < leaf->count; i++) {
+            callback(leaf->pieces[i]);
+        }
+    }
+}
+
+bool BTreePieceTree::mergePiecesAt(Offset offset) {
+    if (offset <= 0 || offset >= _length) {
+        return false;
+    }
+
+    Location loc;
+    locate(offset, false, loc);
+    if (loc.remainder != loc.leaf->pieces[loc.index].length) {
+        return false;
+    }
+    Location next;
+    locate(offset, true, next);
+    Piece merged;
+    if (!mergePieces(loc.leaf->pieces[loc.index], next.leaf->pieces[next.index], merged)) {
+        return false;
+    }
+
+    // removing may rebalance the leaves, so look the left piece up again after it
+    removeFromLeaf(next, next.index, 1);
+    locate(offset, false, loc);
+    replacePiece(loc, merged);
+    return true;
+}
+
+std::vector<SharedPiece> BTreePieceTree::collectPieces(Offset start, Offset end) {
+    std::vector<SharedPiece> pieces;
+    if (start >= end || _length == 0) {
+        return pieces;
+    }
+
+    Location loc;
+    locate(start, true, loc);
+    const Leaf* leaf = loc.leaf;
+    int32_t index = loc.index;
+    Offset remainder = loc.remainder;
+    Offset remaining = end - start;
+    while (leaf && remaining > 0) {
+        for (; index < leaf->count && remaining > 0; index++) {
+            Piece piece = leaf->pieces[index];
+            Offset take = std::min(piece.length - remainder, remaining);
+            if (take <= 0) {
+                continue;
+            }
+            if (remainder > 0) {
+                piece = splitPiece(piece, remainder).second;
+            }
+            if (take < piece.length) {
+                piece = splitPiece(piece, take).first;
+            }
+            pieces.push_back({piece, _buffers[piece.bufferIndex]});
+            remaining -= take;
+            remainder = 0;
+        }
+        leaf = leaf->next;
+        index = 0;
+    }
+    return pieces;
+}
+
+uint32_t BTreePieceTree::getCharCode(Offset offset) {
+    if (offset < 0 || offset >= _length) {
+        return 0;
+    }
+    Location loc;
+    locate(offset, true, loc);
+    const Piece& piece = loc.leaf->pieces[loc.index];
+    Offset bufferOffset = offsetInBuffer(piece.bufferIndex, piece.start) + loc.remainder;
+    return static_cast<unsigned char>(_buffers[piece.bufferIndex]->text()[bufferOffset]);
+}
+
+Offset BTreePieceTree::getOffsetAt(Offset lineNumber, Offset column) {
+    return lineStartOffset(lineNumber) + column;
+}
+
+common::Position BTreePieceTree::getPositionAt(Offset offset) {
+    offset = std::max<Offset>(0, std::min(offset, _length));
+    if (_length == 0) {
+        return common::Position(0, 0);
+    }
+
+    Location loc;
+    locate(offset, false, loc);
+    const Piece& piece = loc.leaf->pieces[loc.index];
+    Offset lineNumber = loc.lineFeedsBefore;
+    if (loc.remainder == piece.length) {
+        // also right for a piece ending on a '\r' whose '\n' was cut off in the buffer
+        lineNumber += piece.lineFeedCnt;
+    } else {
+        lineNumber += positionInBuffer(piece, loc.remainder).line - piece.start.line;
+    }
+    return common::Position(lineNumber, offset - lineStartOffset(lineNumber));
+}
+
+uint32_t BTreePieceTree::getLineCharCode(Offset lineNumber, Offset index) {
+    return getCharCode(lineStartOffset(lineNumber) + index);
+}
+
+Offset BTreePieceTree::getLineLength(Offset lineNumber) {
+    Offset start = lineStartOffset(lineNumber);
+    Offset end = lineStartOffset(lineNumber + 1);
+    if (end > start && getCharCode(end - 1) == '\n') {
+        end--;
+    }
+    if (end > start && getCharCode(end - 1) == '\r') {
+        end--;
+    }
+    return end - start;
+}
+
+std::string BTreePieceTree::getValueInRange(const common::Range& range, const std::string& eol) {
+    Offset start = getOffsetAt(range.startLineNumber(), range.startColumn());
+    Offset end = getOffsetAt(range.endLineNumber(), range.endColumn());
+    std::string value = getText(start, end);
+    if (eol.empty() || (eol == _EOL && _EOLNormalized)) {
+        return value;
+    }
+
+    return textbuffer::normalizeEOL(value, eol);
+}
+
+} // namespace textbuffer
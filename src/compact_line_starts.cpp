@@ -0,0 +1,77 @@
+#include "textbuffer/compact_line_starts.h"
+#include "textbuffer/piece_tree_base.h"
+#include <algorithm>
+
+namespace textbuffer {
+
+CompactLineStarts::CompactLineStarts(const std::vector<Offset>& lineStarts) : _size(lineStarts.size()) {
+    if (lineStarts.empty()) {
+        return;
+    }
+    if (lineStarts.back() <= UINT16_MAX) {
+        _narrow = createUintArray<uint16_t>(lineStarts);
+        return;
+    }
+
+    // Blocks whose starts are all within 64 KB of the first one keep the
+    // distances, the few others keep the starts
+    const size_t blockCount = (_size + BlockSize - 1) / BlockSize;
+    _blocks.reserve(blockCount);
+    _deltas.reserve(_size);
+    for (size_t first = 0; first < _size; first += BlockSize) {
+        size_t last = std::min(first + BlockSize, _size);
+        Offset base = lineStarts[first];
+        if (lineStarts[last - 1] - base <= UINT16_MAX) {
+            _blocks.push_back({base, static_cast<uint32_t>(_deltas.size()), false});
+            for (size_t i = first; i < last; i++) {
+                _deltas.push_back(static_cast<uint16_t>(lineStarts[i] - base));
+            }
+        } else {
+            _blocks.push_back({base, static_cast<uint32_t>(_wide.size()), true});
+            _wide.insert(_wide.end(), lineStarts.begin() + first, lineStarts.begin() + last);
+        }
+    }
+    _deltas.shrink_to_fit();
+    _wide.shrink_to_fit();
+}
+
+size_t CompactLineStarts::upperBound(size_t first, size_t last, Offset value) const {
+    if (first >= last) {
+        return last;
+    }
+    auto above = [](Offset value, Offset start) { return value < start; };
+    if (_narrow) {
+        return std::upper_bound(_narrow.get() + first, _narrow.get() + last, value, above) - _narrow.get();
+    }
+
+    // The last block in range starting at or before value holds the answer,
+    // or ends right before it
+    auto firstBlock = _blocks.begin() + (first >> BlockShift);
+    auto lastBlock = _blocks.begin() + ((last - 1) >> BlockShift) + 1;
+    auto next = std::upper_bound(firstBlock, lastBlock, value,
+                                 [](Offset value, const Block& block) { return value < block.base; });
+    if (next == firstBlock) {
+        return first;
+    }
+    size_t blockStart = static_cast<size_t>(next - 1 - _blocks.begin()) << BlockShift;
+    const Block& block = *(next - 1);
+    size_t from = std::max(first, blockStart);
+    size_t to = std::min(last, blockStart + BlockSize);
+    size_t index = block.index + (from - blockStart);
+    if (block.wide) {
+        const Offset* starts = _wide.data() + index;
+        return from + (std::upper_bound(starts, starts + (to - from), value) - starts);
+    }
+    const uint16_t* deltas = _deltas.data() + index;
+    return from + (std::upper_bound(deltas, deltas + (to - from), value - block.base, above) - deltas);
+}
+
+size_t CompactLineStarts::memoryBytes() const {
+    if (_narrow) {
+        return _size * sizeof(uint16_t);
+    }
+    return _blocks.capacity() * sizeof(Block) + _deltas.capacity() * sizeof(uint16_t) +
+           _wide.capacity() * sizeof(Offset);
+}
+
+} // namespace textbuffer
@@ -0,0 +1,99 @@
+#include "textbuffer/edit_history.h"
+
+namespace textbuffer {
+
+EditHistory::EditHistory(size_t maxSteps, size_t maxBytes)
+    : _bytes(0), _maxSteps(maxSteps), _maxBytes(maxBytes), _transactionDepth(0), _stepOpen(false) {}
+
+void EditHistory::beginTransaction() {
+    if (_transactionDepth++ == 0) {
+        _stepOpen = false;
+    }
+}
+
+void EditHistory::endTransaction() {
+    if (_transactionDepth > 0 && --_transactionDepth == 0) {
+        _stepOpen = false;
+    }
+}
+
+void EditHistory::record(HistoryEdit edit) {
+    for (const HistoryStep& step : _redo) {
+        _bytes -= step.bytes;
+    }
+    _redo.clear();
+
+    if (!_stepOpen || _undo.empty()) {
+        _undo.emplace_back();
+        _stepOpen = _transactionDepth > 0;
+    }
+    size_t bytes = editBytes(edit);
+    _undo.back().edits.push_back(std::move(edit));
+    _undo.back().bytes += bytes;
+    _bytes += bytes;
+    trim();
+}
+
+HistoryStep EditHistory::takeUndo() {
+    HistoryStep step = std::move(_undo.back());
+    _undo.pop_back();
+    _bytes -= step.bytes;
+    _stepOpen = false;
+    return step;
+}
+
+HistoryStep EditHistory::takeRedo() {
+    HistoryStep step = std::move(_redo.back());
+    _redo.pop_back();
+    _bytes -= step.bytes;
+    return step;
+}
+
+void EditHistory::pushUndo(HistoryStep step) {
+    _bytes += step.bytes;
+    _undo.push_back(std::move(step));
+    _stepOpen = false;
+    trim();
+}
+
+void EditHistory::pushRedo(HistoryStep step) {
+    _bytes += step.bytes;
+    _redo.push_back(std::move(step));
+}
+
+void EditHistory::clear() {
+    _undo.clear();
+    _redo.clear();
+    _bytes = 0;
+    _stepOpen = false;
+}
+
+void EditHistory::setLimits(size_t maxSteps, size_t maxBytes) {
+    _maxSteps = maxSteps;
+    _maxBytes = maxBytes;
+    trim();
+}
+
+EditHistoryStats EditHistory::stats() const {
+    EditHistoryStats stats;
+    stats.undoSteps = _undo.size();
+    stats.redoSteps = _redo.size();
+    stats.bytes = _bytes;
+    stats.maxSteps = _maxSteps;
+    stats.maxBytes = _maxBytes;
+    return stats;
+}
+
+size_t EditHistory::editBytes(const HistoryEdit& edit) {
+    return sizeof(HistoryEdit) + (edit.removed.size() + edit.inserted.size()) * sizeof(SharedPiece) +
+           edit.removedLength + edit.insertedLength;
+}
+
+void EditHistory::trim() {
+    while (_undo.size() > 1 && (_undo.size() + _redo.size() > _maxSteps || _bytes > _maxBytes)) {
+        _bytes -= _undo.front().bytes;
+        _undo.pop_front();
+    }
+}
+
+} // namespace textbuffer
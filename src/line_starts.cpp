@@ -1,64 +1,475 @@
 #include "textbuffer/piece_tree_base.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <vector>
 #include <string>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TEXTBUFFER_X86_KERNELS 1
+#else
+#define TEXTBUFFER_X86_KERNELS 0
+#endif
+
 namespace textbuffer {
 
-std::vector<int32_t> createLineStartsFast(const std::string& str) {
-    std::vector<int32_t> result;
-    result.push_back(0);
+namespace {
+
+/**
+ * Counts of one scan. Every \n is counted in lfTotal, also the one of a \r\n.
+ */
+struct ScanResult {
+    Offset cr = 0;
+    Offset lfTotal = 0;
+    Offset crlf = 0;
+    bool isBasicASCII = true;
+};
 
-    for (size_t i = 0; i < str.length(); i++) {
-        char ch = str[i];
-        if (ch == '\r') {
-            if (i + 1 < str.length() && str[i + 1] == '\n') {
-                result.push_back(i + 2);
-                i++;
+// Besides the printable characters, basic ASCII text only has tabs and line breaks
+inline bool isBasicASCIIByte(uint8_t chr) {
+    return (chr >= 32 && chr <= 126) || chr == '\t' || chr == '\n' || chr == '\r';
+}
+
+// A line starts after every \n, and after every \r that no \n follows. Each
+// \r looks at the byte after it, so no state is carried between blocks.
+void scanScalar(std::string_view str, size_t from, std::vector<Offset>* starts, ScanResult& result, bool checkASCII) {
+    const char* data = str.data();
+    const size_t len = str.size();
+    for (size_t i = from; i < len; i++) {
+        const char chr = data[i];
+        if (chr == '\n') {
+            result.lfTotal++;
+            if (starts) {
+                starts->push_back(static_cast<Offset>(i + 1));
+            }
+        } else if (chr == '\r') {
+            if (i + 1 < len && data[i + 1] == '\n') {
+                result.crlf++;
             } else {
-                result.push_back(i + 1);
+                result.cr++;
+                if (starts) {
+                    starts->push_back(static_cast<Offset>(i + 1));
+                }
+            }
+        } else if (checkASCII && !isBasicASCIIByte(static_cast<uint8_t>(chr))) {
+            result.isBasicASCII = false;
+            checkASCII = false;
+        }
+    }
+}
+
+#if TEXTBUFFER_X86_KERNELS
+
+/**
+ * Appends line starts to a vector that is grown ahead, so that a block can
+ * write its starts without a size check per start
+ */
+class StartWriter {
+public:
+    explicit StartWriter(std::vector<Offset>* starts) : _starts(starts), _used(starts ? starts->size() : 0) {}
+
+    bool enabled() const { return _starts != nullptr; }
+
+    // room for the up to 32 starts of one block
+    Offset* reserveBlock() {
+        if (_starts->size() < _used + 32) {
+            _starts->resize(std::max(_used + 32, _starts->size() * 2));
+        }
+        return _starts->data() + _used;
+    }
+
+    void commit(size_t count) { _used += count; }
+
+    void finish() {
+        if (_starts) {
+            _starts->resize(_used);
+        }
+    }
+
+private:
+    std::vector<Offset>* _starts;
+    size_t _used;
+};
+
+/**
+ * Account for the \r and \n of the 32 bytes at base, given as bit masks
+ */
+inline void scanBlock(const char* data, size_t len, size_t base, uint32_t cr, uint32_t lf,
+                      StartWriter& writer, ScanResult& result) {
+    if ((cr | lf) == 0) {
+        return;
+    }
+    // bit i: the byte after byte i is \n, the last one looks past the block
+    uint32_t lfNext = (lf >> 1) | ((base + 32 < len && data[base + 32] == '\n') ? 0x80000000u : 0u);
+    uint32_t crlf = cr & lfNext;
+    result.crlf += __builtin_popcount(crlf);
+    result.cr += __builtin_popcount(cr) - __builtin_popcount(crlf);
+    result.lfTotal += __builtin_popcount(lf);
+    if (!writer.enabled()) {
+        return;
+    }
+    uint32_t breaks = lf | (cr & ~crlf);
+    Offset* out = writer.reserveBlock();
+    writer.commit(__builtin_popcount(breaks));
+    while (breaks) {
+        *out++ = static_cast<Offset>(base + __builtin_ctz(breaks) + 1);
+        breaks &= breaks - 1;
+    }
+}
+
+__attribute__((target("sse2")))
+void scanSSE2(std::string_view str, std::vector<Offset>* starts, ScanResult& result, bool checkASCII) {
+    const char* data = str.data();
+    const size_t len = str.size();
+    const __m128i crs = _mm_set1_epi8('\r');
+    const __m128i lfs = _mm_set1_epi8('\n');
+    const __m128i tabs = _mm_set1_epi8('\t');
+    const __m128i spaces = _mm_set1_epi8(32);
+    const __m128i deletes = _mm_set1_epi8(127);
+
+    StartWriter writer(starts);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16));
+        __m128i crLow = _mm_cmpeq_epi8(low, crs);
+        __m128i crHigh = _mm_cmpeq_epi8(high, crs);
+        __m128i lfLow = _mm_cmpeq_epi8(low, lfs);
+        __m128i lfHigh = _mm_cmpeq_epi8(high, lfs);
+        uint32_t cr = static_cast<uint32_t>(_mm_movemask_epi8(crLow)) |
+                      (static_cast<uint32_t>(_mm_movemask_epi8(crHigh)) << 16);
+        uint32_t lf = static_cast<uint32_t>(_mm_movemask_epi8(lfLow)) |
+                      (static_cast<uint32_t>(_mm_movemask_epi8(lfHigh)) << 16);
+
+        if (checkASCII) {
+            // a signed compare with 32 also catches the bytes from 128 up
+            __m128i badLow = _mm_or_si128(_mm_cmplt_epi8(low, spaces), _mm_cmpeq_epi8(low, deletes));
+            __m128i badHigh = _mm_or_si128(_mm_cmplt_epi8(high, spaces), _mm_cmpeq_epi8(high, deletes));
+            __m128i allowedLow = _mm_or_si128(_mm_or_si128(crLow, lfLow), _mm_cmpeq_epi8(low, tabs));
+            __m128i allowedHigh = _mm_or_si128(_mm_or_si128(crHigh, lfHigh), _mm_cmpeq_epi8(high, tabs));
+            __m128i bad = _mm_or_si128(_mm_andnot_si128(allowedLow, badLow), _mm_andnot_si128(allowedHigh, badHigh));
+            if (_mm_movemask_epi8(bad) != 0) {
+                result.isBasicASCII = false;
+                checkASCII = false;
+            }
+        }
+        scanBlock(data, len, i, cr, lf, writer, result);
+    }
+    writer.finish();
+    scanScalar(str, i, starts, result, checkASCII);
+}
+
+__attribute__((target("avx2")))
+void scanAVX2(std::string_view str, std::vector<Offset>* starts, ScanResult& result, bool checkASCII) {
+    const char* data = str.data();
+    const size_t len = str.size();
+    const __m256i crs = _mm256_set1_epi8('\r');
+    const __m256i lfs = _mm256_set1_epi8('\n');
+    const __m256i tabs = _mm256_set1_epi8('\t');
+    const __m256i spaces = _mm256_set1_epi8(32);
+    const __m256i deletes = _mm256_set1_epi8(127);
+
+    StartWriter writer(starts);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i crMask = _mm256_cmpeq_epi8(bytes, crs);
+        __m256i lfMask = _mm256_cmpeq_epi8(bytes, lfs);
+        uint32_t cr = static_cast<uint32_t>(_mm256_movemask_epi8(crMask));
+        uint32_t lf = static_cast<uint32_t>(_mm256_movemask_epi8(lfMask));
+
+        if (checkASCII) {
+            // a signed compare with 32 also catches the bytes from 128 up
+            __m256i bad = _mm256_or_si256(_mm256_cmpgt_epi8(spaces, bytes), _mm256_cmpeq_epi8(bytes, deletes));
+            __m256i allowed = _mm256_or_si256(_mm256_or_si256(crMask, lfMask), _mm256_cmpeq_epi8(bytes, tabs));
+            bad = _mm256_andnot_si256(allowed, bad);
+            if (!_mm256_testz_si256(bad, bad)) {
+                result.isBasicASCII = false;
+                checkASCII = false;
+            }
+        }
+        scanBlock(data, len, i, cr, lf, writer, result);
+    }
+    writer.finish();
+    scanScalar(str, i, starts, result, checkASCII);
+}
+
+/**
+ * Calls onBreak(i) for every \r and \n of data, in order
+ */
+template <typename OnBreak>
+__attribute__((target("sse2")))
+void findBreaksSSE2(const char* data, size_t len, OnBreak& onBreak) {
+    const __m128i crs = _mm_set1_epi8('\r');
+    const __m128i lfs = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        uint32_t breaks = static_cast<uint32_t>(
+            _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, crs), _mm_cmpeq_epi8(bytes, lfs))));
+        while (breaks) {
+            onBreak(i + __builtin_ctz(breaks));
+            breaks &= breaks - 1;
+        }
+    }
+    for (; i < len; i++) {
+        if (data[i] == '\r' || data[i] == '\n') {
+            onBreak(i);
+        }
+    }
+}
+
+template <typename OnBreak>
+__attribute__((target("avx2")))
+void findBreaksAVX2(const char* data, size_t len, OnBreak& onBreak) {
+    const __m256i crs = _mm256_set1_epi8('\r');
+    const __m256i lfs = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        uint32_t breaks = static_cast<uint32_t>(
+            _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, crs), _mm256_cmpeq_epi8(bytes, lfs))));
+        while (breaks) {
+            onBreak(i + __builtin_ctz(breaks));
+            breaks &= breaks - 1;
+        }
+    }
+    for (; i < len; i++) {
+        if (data[i] == '\r' || data[i] == '\n') {
+            onBreak(i);
+        }
+    }
+}
+
+#endif
+
+LineScanKernel detectKernel() {
+#if TEXTBUFFER_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return LineScanKernel::AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return LineScanKernel::SSE2;
+    }
+#endif
+    return LineScanKernel::Scalar;
+}
+
+std::atomic<LineScanKernel>& currentKernel() {
+    static std::atomic<LineScanKernel> kernel(detectKernel());
+    return kernel;
+}
+
+void scan(std::string_view str, std::vector<Offset>* starts, ScanResult& result, bool checkASCII) {
+    switch (currentKernel().load(std::memory_order_relaxed)) {
+#if TEXTBUFFER_X86_KERNELS
+    case LineScanKernel::AVX2:
+        scanAVX2(str, starts, result, checkASCII);
+        return;
+    case LineScanKernel::SSE2:
+        scanSSE2(str, starts, result, checkASCII);
+        return;
+#endif
+    default:
+        scanScalar(str, 0, starts, result, checkASCII);
+        return;
+    }
+}
+
+template <typename OnBreak>
+void findBreaks(const char* data, size_t len, OnBreak& onBreak) {
+    switch (currentKernel().load(std::memory_order_relaxed)) {
+#if TEXTBUFFER_X86_KERNELS
+    case LineScanKernel::AVX2:
+        findBreaksAVX2(data, len, onBreak);
+        return;
+    case LineScanKernel::SSE2:
+        findBreaksSSE2(data, len, onBreak);
+        return;
+#endif
+    default:
+        for (size_t i = 0; i < len; i++) {
+            if (data[i] == '\r' || data[i] == '\n') {
+                onBreak(i);
             }
-        } else if (ch == '\n') {
-            result.push_back(i + 1);
         }
+        return;
+    }
+}
+
+} // namespace
+
+bool isLineScanKernelSupported(LineScanKernel kernel) {
+    switch (kernel) {
+    case LineScanKernel::Scalar:
+        return true;
+#if TEXTBUFFER_X86_KERNELS
+    case LineScanKernel::SSE2:
+        return __builtin_cpu_supports("sse2");
+    case LineScanKernel::AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+LineScanKernel getLineScanKernel() {
+    return currentKernel().load();
+}
+
+bool setLineScanKernel(LineScanKernel kernel) {
+    if (!isLineScanKernelSupported(kernel)) {
+        return false;
     }
+    currentKernel().store(kernel);
+    return true;
+}
 
+std::vector<Offset> createLineStartsFast(std::string_view str) {
+    std::vector<Offset> result;
+    result.push_back(0);
+    ScanResult counts;
+    scan(str, &result, counts, false);
     return result;
 }
 
-LineStarts createLineStarts(const std::string& str) {
-    std::vector<int32_t> lineStarts;
+LineStarts createLineStarts(std::string_view str) {
+    std::vector<Offset> lineStarts;
     lineStarts.push_back(0);
-    int32_t cr = 0;
-    int32_t lf = 0;
-    int32_t crlf = 0;
-    bool isBasicASCII = true;
+    ScanResult counts;
+    scan(str, &lineStarts, counts, true);
+    return LineStarts(std::move(lineStarts), counts.cr, counts.lfTotal - counts.crlf, counts.crlf, counts.isBasicASCII);
+}
 
-    for (size_t i = 0; i < str.length(); i++) {
-        unsigned char ch = static_cast<unsigned char>(str[i]);
-        
-        if (ch == 0x0D /* \r */) {
-            // Carriage return
-            if (i + 1 < str.length() && static_cast<unsigned char>(str[i + 1]) == 0x0A /* \n */) {
-                // \r\n
-                crlf++;
-                lineStarts.push_back(i + 2);
-                i++;
-            } else {
-                // \r
-                cr++;
-                lineStarts.push_back(i + 1);
+LineStarts countLineBreaks(std::string_view str) {
+    ScanResult counts;
+    scan(str, nullptr, counts, true);
+    return LineStarts({}, counts.cr, counts.lfTotal - counts.crlf, counts.crlf, counts.isBasicASCII);
+}
+
+void StringBuffer::deferLineStarts() {
+    if (_deferred) {
+        return;
+    }
+    std::vector<Offset>().swap(lineStarts);
+    _compact.reset();
+    _deferred = std::make_shared<DeferredLineStarts>();
+}
+
+void StringBuffer::compactLineStarts() {
+    if (_deferred || _compact) {
+        return;
+    }
+    _compact = std::make_shared<const CompactLineStarts>(lineStarts);
+    std::vector<Offset>().swap(lineStarts);
+}
+
+size_t StringBuffer::getLineStartBytes() const {
+    if (_compact) {
+        return _compact->memoryBytes();
+    }
+    if (!_deferred) {
+        return lineStarts.capacity() * sizeof(Offset);
+    }
+    return hasLineStarts() ? _deferred->lineStarts.memoryBytes() : 0;
+}
+
+void StringBuffer::indexLineStarts() const {
+    std::lock_guard<std::mutex> lock(_deferred->mutex);
+    if (_deferred->ready.load(std::memory_order_relaxed)) {
+        return;
+    }
+    std::string_view content = text();
+    _deferred->lineStarts = CompactLineStarts(createLineStartsFast(content));
+    if (mapping) {
+        // the scan touched every page, keep only those that are read
+        mapping->release(content.data() - mapping->data(), content.size());
+    }
+    _deferred->ready.store(true, std::memory_order_release);
+}
+
+Offset StringBuffer::getLastLineStart() const {
+    if (hasLineStarts()) {
+        return getLineStarts().back();
+    }
+    size_t lastBreak = text().find_last_of("\r\n");
+    return lastBreak == std::string_view::npos ? 0 : static_cast<Offset>(lastBreak + 1);
+}
+
+void EOLNormalizer::append(std::string_view text, std::string& out, std::vector<Offset>* lineStarts) {
+    if (text.empty()) {
+        return;
+    }
+    const char* data = text.data();
+    const size_t len = text.size();
+    const size_t eolLength = _eol.size();
+
+    // Grow out once: a one byte EOL never makes the text longer, a longer one
+    // adds at most eolLength - 1 bytes per line break
+    size_t bound = len + (_pendingCR ? eolLength : 0);
+    if (eolLength > 1) {
+        LineStarts counts = countLineBreaks(text);
+        bound += static_cast<size_t>(counts.cr + counts.lf + counts.crlf) * (eolLength - 1);
+    }
+    // Appends within the reserved room, without zero filling it first
+    out.reserve(out.size() + bound);
+
+    auto writeEOL = [&]() {
+        out.append(_eol);
+        if (lineStarts) {
+            lineStarts->push_back(static_cast<Offset>(out.size()));
+        }
+    };
+
+    size_t copyFrom = 0;  // text before this is written
+    if (_pendingCR) {
+        _pendingCR = false;
+        if (data[0] == '\n') {
+            copyFrom = 1;
+        }
+        writeEOL();
+    }
+    auto onBreak = [&](size_t i) {
+        if (i < copyFrom) {
+            // the \n of a \r\n
+            return;
+        }
+        out.append(data + copyFrom, i - copyFrom);
+        copyFrom = i + 1;
+        if (data[i] == '\r') {
+            if (i + 1 == len) {
+                _pendingCR = true;
+                return;
+            }
+            if (data[i + 1] == '\n') {
+                copyFrom = i + 2;
             }
-        } else if (ch == 0x0A /* \n */) {
-            // Line feed
-            lf++;
-            lineStarts.push_back(i + 1);
-        } else if (ch >= 128) {
-            // Not basic ASCII
-            isBasicASCII = false;
+        }
+        writeEOL();
+    };
+    findBreaks(data, len, onBreak);
+    out.append(data + copyFrom, len - copyFrom);
+}
+
+void EOLNormalizer::finish(std::string& out, std::vector<Offset>* lineStarts) {
+    if (_pendingCR) {
+        _pendingCR = false;
+        out += _eol;
+        if (lineStarts) {
+            lineStarts->push_back(static_cast<Offset>(out.size()));
         }
     }
+}
 
-    return LineStarts(lineStarts, cr, lf, crlf, isBasicASCII);
+std::string normalizeEOL(std::string_view text, const std::string& eol) {
+    std::string result;
+    EOLNormalizer normalizer(eol);
+    normalizer.append(text, result);
+    normalizer.finish(result);
+    return result;
 }
 
-} // namespace textbuffer 
\ No newline at end of file
+} // namespace textbuffer
@@ -0,0 +1,84 @@
+#include "textbuffer/mapped_file.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TEXTBUFFER_HAS_MMAP 1
+#else
+#define TEXTBUFFER_HAS_MMAP 0
+#endif
+
+namespace textbuffer {
+
+MappedFile::MappedFile(const char* data, size_t size, bool mapped) : _data(data), _size(size), _mapped(mapped) {}
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& path) {
+#if TEXTBUFFER_HAS_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot stat " + path);
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    if (size == 0) {
+        ::close(fd);
+        return std::shared_ptr<MappedFile>(new MappedFile(nullptr, 0, false));
+    }
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file referenced on its own
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("Cannot map " + path);
+    }
+    return std::shared_ptr<MappedFile>(new MappedFile(static_cast<const char*>(data), size, true));
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    std::shared_ptr<MappedFile> result(new MappedFile(nullptr, 0, false));
+    result->_contents = contents.str();
+    result->_data = result->_contents.data();
+    result->_size = result->_contents.size();
+    return result;
+#endif
+}
+
+MappedFile::~MappedFile() {
+#if TEXTBUFFER_HAS_MMAP
+    if (_mapped) {
+        ::munmap(const_cast<char*>(_data), _size);
+    }
+#endif
+}
+
+void MappedFile::release(size_t offset, size_t length) const {
+#if TEXTBUFFER_HAS_MMAP
+    if (!_mapped || offset >= _size) {
+        return;
+    }
+    // madvise works on whole pages; keep the partial ones at both ends
+    size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t begin = (offset + page - 1) / page * page;
+    size_t end = std::min(offset + length, _size) / page * page;
+    if (begin < end) {
+        ::madvise(const_cast<char*>(_data) + begin, end - begin, MADV_DONTNEED);
+    }
+#else
+    (void)offset;
+    (void)length;
+#endif
+}
+
+} // namespace textbuffer
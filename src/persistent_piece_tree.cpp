@@ -0,0 +1,234 @@
+#include "textbuffer/persistent_piece_tree.h"
+#include "textbuffer/piece_tree_base.h"
+
+namespace textbuffer {
+
+namespace {
+
+// Priorities are a hash of the piece, so equal inputs always give the same shape.
+uint64_t piecePriority(const StringBuffer* buffer, const Piece& piece) {
+    uint64_t x = reinterpret_cast<uintptr_t>(buffer);
+    x ^= (static_cast<uint64_t>(piece.start.line) << 32) ^ static_cast<uint32_t>(piece.start.column);
+    x += 0x9e3779b97f4a7c15ULL * (static_cast<uint64_t>(piece.length) + 1);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+PersistentNodePtr makeNode(const Piece& piece, const std::shared_ptr<const StringBuffer>& buffer, uint64_t priority,
+                           PersistentNodePtr left, PersistentNodePtr right) {
+    auto node = std::make_shared<PersistentNode>();
+    node->piece = piece;
+    node->buffer = buffer;
+    node->priority = priority;
+    node->totalLength = piece.length;
+    node->totalLineFeeds = piece.lineFeedCnt;
+    if (left) {
+        node->totalLength += left->totalLength;
+        node->totalLineFeeds += left->totalLineFeeds;
+    }
+    if (right) {
+        node->totalLength += right->totalLength;
+        node->totalLineFeeds += right->totalLineFeeds;
+    }
+    node->left = std::move(left);
+    node->right = std::move(right);
+    return node;
+}
+
+PersistentNodePtr withChildren(const PersistentNode& node, PersistentNodePtr left, PersistentNodePtr right) {
+    return makeNode(node.piece, node.buffer, node.priority, std::move(left), std::move(right));
+}
+
+PersistentNodePtr merge(const PersistentNodePtr& a, const PersistentNodePtr& b) {
+    if (!a) {
+        return b;
+    }
+    if (!b) {
+        return a;
+    }
+    if (a->priority >= b->priority) {
+        return withChildren(*a, a->left, merge(a->right, b));
+    }
+    return withChildren(*b, merge(a, b->left), b->right);
+}
+
+// Split into the first `offset` characters and the rest, copying only the search path.
+std::pair<PersistentNodePtr, PersistentNodePtr> split(const PersistentNodePtr& node, Offset offset) {
+    if (!node) {
+        return {nullptr, nullptr};
+    }
+
+    Offset leftLength = node->left ? node->left->totalLength : 0;
+    if (offset <= leftLength) {
+        auto parts = split(node->left, offset);
+        return {std::move(parts.first), withChildren(*node, std::move(parts.second), node->right)};
+    }
+
+    Offset pieceEnd = leftLength + node->piece.length;
+    if (offset >= pieceEnd) {
+        auto parts = split(node->right, offset - pieceEnd);
+        return {withChildren(*node, node->left, std::move(parts.first)), std::move(parts.second)};
+    }
+
+    // The cut falls inside this piece. Both halves keep the node's priority,
+    // which is still no lower than anything below them.
+    auto pieces = PersistentPieceTree::splitPiece(*node->buffer, node->piece, offset - leftLength);
+    return {makeNode(pieces.first, node->buffer, node->priority, node->left, nullptr),
+            makeNode(pieces.second, node->buffer, node->priority, nullptr, node->right)};
+}
+
+BufferCursor cursorAt(const StringBuffer& buffer, const Piece& piece, Offset remainder) {
+    LineStartsView lineStarts = buffer.getLineStarts();
+    Offset offset = lineStarts[piece.start.line] + piece.start.column + remainder;
+
+    Offset line = static_cast<Offset>(lineStarts.upperBound(piece.start.line + 1, piece.end.line + 1, offset)) - 1;
+    return {line, offset - lineStarts[line]};
+}
+
+Offset lineFeedCount(const StringBuffer& buffer, const BufferCursor& start, const BufferCursor& end) {
+    LineStartsView lineStarts = buffer.getLineStarts();
+    if (end.column == 0 || end.line == static_cast<Offset>(lineStarts.size()) - 1) {
+        return end.line - start.line;
+    }
+
+    // a piece ending between '\r' and '\n' still owns that line break
+    Offset endOffset = lineStarts[end.line] + end.column;
+    if (lineStarts[end.line + 1] == endOffset + 1 && buffer.text()[endOffset - 1] == '\r') {
+        return end.line - start.line + 1;
+    }
+    return end.line - start.line;
+}
+
+} // namespace
+
+PersistentPieceTree PersistentPieceTree::build(const std::vector<SharedPiece>& pieces) {
+    // Cartesian tree construction: keep the right spine on a stack.
+    std::vector<std::shared_ptr<PersistentNode>> spine;
+    std::vector<std::shared_ptr<PersistentNode>> nodes;
+    nodes.reserve(pieces.size());
+
+    for (const SharedPiece& item : pieces) {
+        if (item.piece.length == 0) {
+            continue;
+        }
+        auto node = std::make_shared<PersistentNode>();
+        node->piece = item.piece;
+        node->buffer = item.buffer;
+        node->priority = piecePriority(item.buffer.get(), item.piece);
+
+        std::shared_ptr<PersistentNode> lastPopped;
+        while (!spine.empty() && spine.back()->priority < node->priority) {
+            lastPopped = spine.back();
+            spine.pop_back();
+        }
+        node->left = lastPopped;
+        if (!spine.empty()) {
+            spine.back()->right = node;
+        }
+        spine.push_back(node);
+        nodes.push_back(node);
+    }
+
+    if (nodes.empty()) {
+        return PersistentPieceTree();
+    }
+
+    // Children are final now, fill in the subtree totals bottom-up.
+    struct Frame {
+        PersistentNode* node;
+        bool expanded;
+    };
+    std::vector<Frame> stack{{spine.front().get(), false}};
+    while (!stack.empty()) {
+        Frame frame = stack.back();
+        stack.pop_back();
+        PersistentNode* node = frame.node;
+        if (!frame.expanded) {
+            stack.push_back({node, true});
+            if (node->left) {
+                stack.push_back({const_cast<PersistentNode*>(node->left.get()), false});
+            }
+            if (node->right) {
+                stack.push_back({const_cast<PersistentNode*>(node->right.get()), false});
+            }
+            continue;
+        }
+        node->totalLength = node->piece.length;
+        node->totalLineFeeds = node->piece.lineFeedCnt;
+        if (node->left) {
+            node->totalLength += node->left->totalLength;
+            node->totalLineFeeds += node->left->totalLineFeeds;
+        }
+        if (node->right) {
+            node->totalLength += node->right->totalLength;
+            node->totalLineFeeds += node->right->totalLineFeeds;
+        }
+    }
+
+    return PersistentPieceTree(spine.front());
+}
+
+PersistentPieceTree PersistentPieceTree::replaceRange(Offset start, Offset end,
+                                                      const PersistentPieceTree& replacement) const {
+    auto head = split(_root, start);
+    auto tail = split(head.second, end - start);
+    return PersistentPieceTree(merge(merge(head.first, replacement._root), tail.second));
+}
+
+Offset PersistentPieceTree::getPieceCount() const {
+    Offset count = 0;
+    std::vector<const PersistentNode*> stack;
+    if (_root) {
+        stack.push_back(_root.get());
+    }
+    while (!stack.empty()) {
+        const PersistentNode* node = stack.back();
+        stack.pop_back();
+        count++;
+        if (node->left) {
+            stack.push_back(node->left.get());
+        }
+        if (node->right) {
+            stack.push_back(node->right.get());
+        }
+    }
+    return count;
+}
+
+std::string PersistentPieceTree::getValue() const {
+    std::string result;
+    result.reserve(getLength());
+
+    std::vector<const PersistentNode*> stack;
+    const PersistentNode* node = _root.get();
+    while (node || !stack.empty()) {
+        while (node) {
+            stack.push_back(node);
+            node = node->left.get();
+        }
+        node = stack.back();
+        stack.pop_back();
+        LineStartsView lineStarts = node->buffer->getLineStarts();
+        Offset startOffset = lineStarts[node->piece.start.line] + node->piece.start.column;
+        result.append(node->buffer->text(), startOffset, node->piece.length);
+        node = node->right.get();
+    }
+    return result;
+}
+
+std::string PersistentPieceTree::getPieceContent(const PersistentNode& node) {
+    LineStartsView lineStarts = node.buffer->getLineStarts();
+    Offset startOffset = lineStarts[node.piece.start.line] + node.piece.start.column;
+    return std::string(node.buffer->text().substr(startOffset, node.piece.length));
+}
+
+std::pair<Piece, Piece> PersistentPieceTree::splitPiece(const StringBuffer& buffer, const Piece& piece,
+                                                        Offset remainder) {
+    BufferCursor pos = cursorAt(buffer, piece, remainder);
+    return {Piece(piece.bufferIndex, piece.start, pos, lineFeedCount(buffer, piece.start, pos), remainder),
+            Piece(piece.bufferIndex, pos, piece.end, lineFeedCount(buffer, pos, piece.end),
+                  piece.length - remainder)};
+}
+
+} // namespace textbuffer
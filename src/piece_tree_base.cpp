@@ -4,89 +4,146 @@
 #include "textbuffer/common/position.h"
 #include "textbuffer/common/range.h"
 #include <algorithm>
+#include <cstring>
 #include <stdexcept>
 
 namespace textbuffer {
 
 void PieceTreeBase::deleteTree(TreeNode* node) {
-    if (node != SENTINEL) {
+    if (node == root) {
+        // the whole tree goes away, release the slabs in bulk
+        _nodeAllocator.reset();
+        root = _sentinel;
+        return;
+    }
+
+    if (node != _sentinel) {
         deleteTree(node->left);
         deleteTree(node->right);
-        delete node->piece;
-        delete node;
+        _nodeAllocator.deallocate(node);
     }
 }
 
-void PieceTreeBase::create(const std::vector<StringBuffer>& chunks, const std::string& eol, bool eolNormalized) {
-    _buffers = {StringBuffer("", {0})};
+void PieceTreeBase::create(std::vector<StringBuffer> chunks, const std::string& eol, bool eolNormalized) {
+    Offset oldLength = _length;
+    _buffers = {std::make_shared<StringBuffer>("", std::vector<Offset>{0})};
+    _changeBufferIndex = 0;
+    _changeBufferFrozen = false;
     _lastChangeBufferPos = {0, 0};
-    root = SENTINEL;
     _lineCnt = 1;
     _length = 0;
     _EOL = eol;
     _EOLLength = eol.length();
     _EOLNormalized = eolNormalized;
 
-    TreeNode* lastNode = nullptr;
+    std::vector<Piece> pieces;
+    pieces.reserve(chunks.size());
     for (size_t i = 0; i < chunks.size(); i++) {
-        if (!chunks[i].buffer.empty()) {
-            StringBuffer chunk = chunks[i];
-            if (chunk.lineStarts.empty()) {
-                chunk.lineStarts = createLineStartsFast(chunk.buffer);
+        if (!chunks[i].text().empty()) {
+            StringBuffer& chunk = chunks[i];
+            if (!chunk.isLineIndexDeferred() && !chunk.isLineIndexCompact() && chunk.lineStarts.empty()) {
+                chunk.lineStarts = createLineStartsFast(chunk.text());
             }
+            chunk.compactLineStarts();
 
-            auto piece = new Piece(
-                i + 1,
+            // a deferred buffer is not scanned here, its counts give the end
+            Offset lineBreaks = chunk.getLineBreakCount();
+            pieces.push_back(Piece(
+                _buffers.size(),
                 {0, 0},
-                {static_cast<int32_t>(chunk.lineStarts.size() - 1), 
-                 static_cast<int32_t>(chunk.buffer.length() - chunk.lineStarts[chunk.lineStarts.size() - 1])},
-                chunk.lineStarts.size() - 1,
-                chunk.buffer.length()
-            );
-            _buffers.push_back(chunk);
-            lastNode = rbInsertRight(lastNode, piece);
+                {lineBreaks, static_cast<Offset>(chunk.text().length() - chunk.getLastLineStart())},
+                lineBreaks,
+                chunk.text().length()
+            ));
+            _buffers.push_back(std::make_shared<StringBuffer>(std::move(chunk)));
         }
     }
+    _originalBufferEnd = _buffers.size();
+    replacePieces(pieces);
 
-    _searchCache = std::make_unique<PieceTreeSearchCache>(1);
-    _lastVisitedLine = {0, ""};
+    if (_persistentSnapshots) {
+        rebuildPersistentTree();
+    }
+    if (_history) {
+        // the steps are about a document that is gone
+        _history->clear();
+    }
+    recordEdit(0, oldLength, _length);
+}
+
+void PieceTreeBase::replacePieces(const std::vector<Piece>& pieces) {
+    buildBalancedTree(pieces);
+    _searchCache->clear();
+    _lineCache.clear();
     computeBufferMetadata();
 }
 
+void PieceTreeBase::buildBalancedTree(const std::vector<Piece>& pieces) {
+    deleteTree(root);
+
+    // Every path from the root passes the full levels of a median-split tree;
+    // only the last level can be incomplete. Colouring exactly that level red
+    // gives every path the same number of black nodes.
+    int32_t fullLevels = 0;
+    while ((size_t(2) << fullLevels) - 1 <= pieces.size()) {
+        fullLevels++;
+    }
+    Offset length = 0;
+    Offset lineFeeds = 0;
+    root = buildSubtree(pieces, 0, pieces.size(), 0, fullLevels, _sentinel, length, lineFeeds);
+}
+
+TreeNode* PieceTreeBase::buildSubtree(const std::vector<Piece>& pieces, size_t begin, size_t end, int32_t depth,
+                                      int32_t redDepth, TreeNode* parent, Offset& length, Offset& lineFeeds) {
+    if (begin == end) {
+        length = 0;
+        lineFeeds = 0;
+        return _sentinel;
+    }
+
+    size_t mid = begin + (end - begin) / 2;
+    TreeNode* node = _nodeAllocator.allocate(pieces[mid], depth == redDepth ? NodeColor::Red : NodeColor::Black);
+    node->parent = parent;
+
+    Offset rightLength;
+    Offset rightLineFeeds;
+    node->left = buildSubtree(pieces, begin, mid, depth + 1, redDepth, node, node->size_left, node->lf_left);
+    node->right = buildSubtree(pieces, mid + 1, end, depth + 1, redDepth, node, rightLength, rightLineFeeds);
+    length = node->size_left + pieces[mid].length + rightLength;
+    lineFeeds = node->lf_left + pieces[mid].lineFeedCnt + rightLineFeeds;
+    return node;
+}
+
 void PieceTreeBase::normalizeEOL(const std::string& eol) {
-    int32_t averageBufferSize = AverageBufferSize;
-    int32_t min = averageBufferSize - averageBufferSize / 3;
-    int32_t max = min * 2;
+    Offset averageBufferSize = AverageBufferSize;
+    Offset min = averageBufferSize - averageBufferSize / 3;
+    Offset max = min * 2;
 
+    // One normalizer for all pieces, so a \r\n split between two of them
+    // still becomes one eol
+    EOLNormalizer normalizer(eol);
     std::string tempChunk;
-    int32_t tempChunkLen = 0;
+    std::vector<Offset> tempLineStarts = {0};
     std::vector<StringBuffer> chunks;
 
-    iterate(root, [&](TreeNode* node) {
-        std::string str = getNodeContent(node);
-        int32_t len = str.length();
-        if (tempChunkLen <= min || tempChunkLen + len < max) {
-            tempChunk += str;
-            tempChunkLen += len;
-            return true;
+    for (const Piece& piece : pieces()) {
+        std::string str = getPieceContent(piece);
+        Offset tempChunkLen = tempChunk.length();
+        if (tempChunkLen > min && tempChunkLen + static_cast<Offset>(str.length()) >= max) {
+            // flush anyways
+            chunks.push_back(StringBuffer(std::move(tempChunk), std::move(tempLineStarts)));
+            tempChunk.clear();
+            tempLineStarts = {0};
         }
+        normalizer.append(str, tempChunk, &tempLineStarts);
+    }
 
-        // flush anyways
-        std::string text = tempChunk;
-        std::replace(text.begin(), text.end(), '\r', '\n');
-        chunks.push_back(StringBuffer(text, createLineStartsFast(text)));
-        tempChunk = str;
-        tempChunkLen = len;
-        return true;
-    });
-
-    if (tempChunkLen > 0) {
-        std::string text = tempChunk;
-        std::replace(text.begin(), text.end(), '\r', '\n');
-        chunks.push_back(StringBuffer(text, createLineStartsFast(text)));
+    normalizer.finish(tempChunk, &tempLineStarts);
+    if (!tempChunk.empty()) {
+        chunks.push_back(StringBuffer(std::move(tempChunk), std::move(tempLineStarts)));
     }
 
-    create(chunks, eol, true);
+    create(std::move(chunks), eol, true);
 }
 
 std::string PieceTreeBase::getEOL() const {
@@ -100,9 +157,416 @@ void PieceTreeBase::setEOL(const std::string& newEOL) {
 }
 
 std::unique_ptr<ITextSnapshot> PieceTreeBase::createSnapshot(const std::string& BOM) const {
+    if (_persistentSnapshots) {
+        // the snapshot now shares the change buffer, so it must not grow any more
+        _changeBufferFrozen = true;
+        return std::make_unique<PersistentPieceTreeSnapshot>(_persistentTree, BOM);
+    }
     return std::make_unique<PieceTreeSnapshot>(const_cast<PieceTreeBase*>(this), BOM);
 }
 
+void PieceTreeBase::setPersistentSnapshots(bool enabled) {
+    if (enabled == _persistentSnapshots) {
+        return;
+    }
+    _persistentSnapshots = enabled;
+    if (enabled) {
+        rebuildPersistentTree();
+    } else {
+        _persistentTree = PersistentPieceTree();
+    }
+}
+
+void PieceTreeBase::thawChangeBuffer() {
+    if (!_changeBufferFrozen) {
+        return;
+    }
+    const StringBuffer& frozen = *_buffers[_changeBufferIndex];
+    if (frozen.buffer.size() < static_cast<size_t>(AverageBufferSize)) {
+        // Snapshots keep the frozen buffer and the tree appends to a copy with
+        // the same text, so its pieces stay where they are and typing after a
+        // snapshot still extends the last piece
+        _buffers[_changeBufferIndex] = std::make_shared<StringBuffer>(frozen);
+        _changeBufferFrozen = false;
+        return;
+    }
+    _buffers.push_back(std::make_shared<StringBuffer>("", std::vector<Offset>{0}));
+    _changeBufferIndex = _buffers.size() - 1;
+    _lastChangeBufferPos = {0, 0};
+    _changeBufferFrozen = false;
+}
+
+void PieceTreeBase::rebuildPersistentTree() {
+    std::vector<SharedPiece> pieces;
+    for (const Piece& piece : this->pieces()) {
+        pieces.push_back({piece, _buffers[piece.bufferIndex]});
+    }
+    _persistentTree = PersistentPieceTree::build(pieces);
+}
+
+void PieceTreeBase::syncPersistentTree(Offset offset, Offset oldLength) {
+    Offset newLength = getLength();
+    Offset delta = newLength - oldLength;
+
+    // An edit only changes text around [offset, offset + inserted); CRLF fixes
+    // reach one character further on each side. Everything outside the window
+    // is identical in both versions, so only the window is replaced.
+    offset = std::max<Offset>(0, std::min(offset, newLength));
+    Offset start = std::max<Offset>(0, offset - 2);
+    Offset end = std::min(newLength, offset + std::max<Offset>(delta, 0) + 2);
+
+    // never leave a "\r\n" pair split over the window border
+    if (start > 0 && getCharCode(start) == 10 && getCharCode(start - 1) == 13) {
+        start--;
+    }
+    if (end > 0 && end < newLength && getCharCode(end) == 10 && getCharCode(end - 1) == 13) {
+        end++;
+    }
+
+    PersistentPieceTree replacement = PersistentPieceTree::build(collectPieces(start, end));
+    _persistentTree = _persistentTree.replaceRange(start, end - delta, replacement);
+}
+
+std::vector<SharedPiece> PieceTreeBase::collectPieces(Offset start, Offset end) {
+    std::vector<SharedPiece> pieces;
+    if (start >= end || root == _sentinel) {
+        return pieces;
+    }
+
+    NodePosition startPos = nodeAt(start);
+    TreeNode* node = startPos.node;
+    Offset remainder = startPos.remainder;
+    Offset remaining = end - start;
+    while (node != _sentinel && remaining > 0) {
+        Offset take = std::min(node->piece.length - remainder, remaining);
+        if (take > 0) {
+            Piece piece = node->piece;
+            const StringBuffer& buffer = *_buffers[piece.bufferIndex];
+            if (remainder > 0) {
+                piece = PersistentPieceTree::splitPiece(buffer, piece, remainder).second;
+            }
+            if (take < piece.length) {
+                piece = PersistentPieceTree::splitPiece(buffer, piece, take).first;
+            }
+            pieces.push_back({piece, _buffers[piece.bufferIndex]});
+            remaining -= take;
+        }
+        node = node->next(_sentinel);
+        remainder = 0;
+    }
+    return pieces;
+}
+
+void PieceTreeBase::remapPieces(const std::function<void(Piece&)>& callback) {
+    for (TreeNode* node = leftest(root); node != _sentinel; node = node->next(_sentinel)) {
+        callback(node->piece);
+    }
+}
+
+PieceIterator PieceTreeBase::pieceBegin() const {
+    if (root == _sentinel) {
+        return pieceEnd();
+    }
+    TreeNode* node = leftest(root);
+    return PieceIterator(this, node, 0, &node->piece, 0, 0);
+}
+
+PieceIterator PieceTreeBase::pieceAt(Offset offset) const {
+    offset = std::max<Offset>(offset, 0);
+    Offset pieceStart = 0;
+    Offset lineFeeds = 0;
+    TreeNode* node = root;
+    while (node != _sentinel) {
+        if (offset < node->size_left) {
+            node = node->left;
+        } else if (offset < node->size_left + node->piece.length) {
+            return PieceIterator(this, node, 0, &node->piece, pieceStart + node->size_left, lineFeeds + node->lf_left);
+        } else {
+            offset -= node->size_left + node->piece.length;
+            pieceStart += node->size_left + node->piece.length;
+            lineFeeds += node->lf_left + node->piece.lineFeedCnt;
+            node = node->right;
+        }
+    }
+    return pieceEnd();
+}
+
+void PieceTreeBase::stepPiece(PieceIterator& it, bool forward) const {
+    TreeNode* node = static_cast<TreeNode*>(it._node);
+    if (forward) {
+        if (!node) {
+            return;
+        }
+        it._offset += node->piece.length;
+        it._lineNumber += node->piece.lineFeedCnt;
+        node = node->next(_sentinel);
+    } else {
+        node = node ? node->prev(_sentinel) : rightest(root);
+        if (node != _sentinel) {
+            it._offset -= node->piece.length;
+            it._lineNumber -= node->piece.lineFeedCnt;
+        }
+    }
+
+    if (node == _sentinel) {
+        it = pieceEnd();
+        return;
+    }
+    it._node = node;
+    it._piece = &node->piece;
+}
+
+size_t PieceTreeBase::collectLiveBytes(std::vector<size_t>& liveBytes) const {
+    liveBytes.assign(_buffers.size(), 0);
+    size_t pieceCount = 0;
+    for (const Piece& piece : pieces()) {
+        liveBytes[piece.bufferIndex] += piece.length;
+        pieceCount++;
+    }
+    return pieceCount;
+}
+
+BufferMemoryStats PieceTreeBase::bufferMemoryStats(const std::vector<size_t>& liveBytes) const {
+    BufferMemoryStats stats;
+    for (size_t i = 0; i < _buffers.size(); i++) {
+        size_t size = _buffers[i]->text().size();
+        stats.totalBytes += size;
+        if (_buffers[i]->isMapped()) {
+            stats.mappedBytes += size;
+        }
+        if (_buffers[i]->hasLineStarts()) {
+            stats.lineStartBytes += _buffers[i]->getLineStartBytes();
+            stats.lineStarts += _buffers[i]->getLineStarts().size();
+        } else {
+            stats.unindexedBuffers++;
+        }
+        if (isEditBuffer(i)) {
+            stats.editBytes += size;
+            stats.deadBytes += size - std::min(size, liveBytes[i]);
+        }
+    }
+    return stats;
+}
+
+BufferMemoryStats PieceTreeBase::getBufferMemoryStats() const {
+    std::vector<size_t> liveBytes;
+    collectLiveBytes(liveBytes);
+    return bufferMemoryStats(liveBytes);
+}
+
+std::future<void> PieceTreeBase::indexLineStartsInBackground() const {
+    std::vector<std::shared_ptr<const StringBuffer>> pending;
+    for (int32_t i = 1; i < _originalBufferEnd; i++) {
+        if (!_buffers[i]->hasLineStarts()) {
+            pending.push_back(_buffers[i]);
+        }
+    }
+    return std::async(std::launch::async, [pending = std::move(pending)]() {
+        for (const std::shared_ptr<const StringBuffer>& buffer : pending) {
+            buffer->getLineStarts();
+        }
+    });
+}
+
+size_t PieceTreeBase::compactBuffers() {
+    std::vector<size_t> liveBytes;
+    collectLiveBytes(liveBytes);
+    BufferMemoryStats before = bufferMemoryStats(liveBytes);
+
+    // Copy the live edit text in document order. A '_' goes between a '\r' and a
+    // '\n' of two different pieces, so that they are not read as one line break.
+    std::string text;
+    text.reserve(before.editBytes - before.deadBytes);
+    std::vector<Offset> pieceStarts;
+    for (const Piece& piece : pieces()) {
+        if (!isEditBuffer(piece.bufferIndex) || piece.length == 0) {
+            continue;
+        }
+        std::string_view source = _buffers[piece.bufferIndex]->text();
+        Offset offset = offsetInBuffer(piece.bufferIndex, piece.start);
+        if (!text.empty() && text.back() == '\r' && source[offset] == '\n') {
+            text += '_';
+        }
+        pieceStarts.push_back(text.size());
+        text.append(source, offset, piece.length);
+    }
+
+    std::vector<Offset> lineStarts = createLineStartsFast(text);
+    auto cursorAt = [&](Offset offset) {
+        Offset line = std::upper_bound(lineStarts.begin(), lineStarts.end(), offset) - lineStarts.begin() - 1;
+        return BufferCursor(line, offset - lineStarts[line]);
+    };
+
+    // The text of every piece is unchanged, so are the tree's sums and caches
+    size_t next = 0;
+    remapPieces([&](Piece& piece) {
+        if (piece.length == 0) {
+            // an empty piece may point into a buffer that is about to be released
+            piece = Piece(_changeBufferIndex, {0, 0}, {0, 0}, 0, 0);
+            return;
+        }
+        if (!isEditBuffer(piece.bufferIndex)) {
+            return;
+        }
+        Offset start = pieceStarts[next++];
+        piece.bufferIndex = _changeBufferIndex;
+        piece.start = cursorAt(start);
+        piece.end = cursorAt(start + piece.length);
+    });
+
+    _lastChangeBufferPos = cursorAt(text.size());
+    _buffers[_changeBufferIndex] = std::make_shared<StringBuffer>(std::move(text), std::move(lineStarts));
+    // the live edit text has moved, so every other edit buffer is unreferenced now
+    for (size_t i = 0; i < _buffers.size(); i++) {
+        if (static_cast<int32_t>(i) != _changeBufferIndex && (isEditBuffer(i) || liveBytes[i] == 0) &&
+            !_buffers[i]->text().empty()) {
+            _buffers[i] = std::make_shared<StringBuffer>("", std::vector<Offset>{0});
+        }
+    }
+    // nothing has seen the new change buffer yet
+    _changeBufferFrozen = false;
+    // neighbouring edit pieces are contiguous in the new buffer now
+    if (_pieceMerging) {
+        defragment();
+    }
+    if (_persistentSnapshots) {
+        rebuildPersistentTree();
+    }
+    recordEdit(0, 0, 0);
+
+    size_t bytesAfter = 0;
+    for (const auto& buffer : _buffers) {
+        bytesAfter += buffer->text().size();
+    }
+    size_t reclaimed = before.totalBytes > bytesAfter ? before.totalBytes - bytesAfter : 0;
+    _reclaimedBytes += reclaimed;
+    return reclaimed;
+}
+
+void PieceTreeBase::setCompactionThreshold(double deadRatio, size_t minDeadBytes) {
+    _compactionThreshold = deadRatio;
+    _compactionMinBytes = minDeadBytes;
+    _editsUntilCompactionCheck = 0;
+}
+
+void PieceTreeBase::compactIfNeeded() {
+    if (_compactionThreshold <= 0 || --_editsUntilCompactionCheck > 0) {
+        return;
+    }
+
+    // A check walks every piece, so checks are spaced out by a fraction of the
+    // piece count; that costs about 16 piece visits per edit on average
+    std::vector<size_t> liveBytes;
+    size_t pieceCount = collectLiveBytes(liveBytes);
+    _editsUntilCompactionCheck = std::max<size_t>(pieceCount / 16, 64);
+
+    BufferMemoryStats stats = bufferMemoryStats(liveBytes);
+    if (stats.deadBytes >= _compactionMinBytes && stats.deadRatio() > _compactionThreshold) {
+        compactBuffers();
+    }
+}
+
+bool PieceTreeBase::mergePieces(const Piece& left, const Piece& right, Piece& merged) {
+    if (left.bufferIndex != right.bufferIndex || left.length == 0 || right.length == 0 ||
+        offsetInBuffer(left.bufferIndex, left.end) != offsetInBuffer(right.bufferIndex, right.start)) {
+        return false;
+    }
+    // a "\r" and "\n" split over the two pieces would count as one line feed less
+    Offset lineFeedCnt = getLineFeedCnt(left.bufferIndex, left.start, right.end);
+    if (lineFeedCnt != left.lineFeedCnt + right.lineFeedCnt) {
+        return false;
+    }
+    merged = Piece(left.bufferIndex, left.start, right.end, lineFeedCnt, left.length + right.length);
+    return true;
+}
+
+bool PieceTreeBase::mergePiecesAt(Offset offset) {
+    if (offset <= 0 || offset >= getLength()) {
+        return false;
+    }
+
+    NodePosition position = nodeAt(offset);
+    TreeNode* left = position.node;
+    if (!left) {
+        return false;
+    }
+    if (position.remainder == 0) {
+        left = left->prev(_sentinel);
+    } else if (position.remainder != left->piece.length) {
+        return false;
+    }
+    TreeNode* right = left->next(_sentinel);
+    Piece merged;
+    if (left == _sentinel || right == _sentinel || !mergePieces(left->piece, right->piece, merged)) {
+        return false;
+    }
+
+    // grow the left node over the right one, then drop the right one
+    updateTreeMetadata(this, left, right->piece.length, right->piece.lineFeedCnt);
+    left->piece = merged;
+    removeNode(right);
+    return true;
+}
+
+size_t PieceTreeBase::defragment() {
+    // merging leaves every offset in place, so the borders can be gathered first
+    std::vector<Offset> borders;
+    Offset offset = 0;
+    bool hasPrev = false;
+    Piece prev;
+    for (const Piece& piece : pieces()) {
+        if (hasPrev && piece.bufferIndex == prev.bufferIndex &&
+            offsetInBuffer(prev.bufferIndex, prev.end) == offsetInBuffer(piece.bufferIndex, piece.start)) {
+            borders.push_back(offset);
+        }
+        offset += piece.length;
+        prev = piece;
+        hasPrev = true;
+    }
+
+    size_t merged = 0;
+    for (Offset border : borders) {
+        if (mergePiecesAt(border)) {
+            merged++;
+        }
+    }
+    if (merged > 0) {
+        recordEdit(0, 0, 0);
+    }
+    return merged;
+}
+
+void PieceTreeBase::recordEdit(Offset offset, Offset removedLength, Offset insertedLength) {
+    _editLog[_version % EditLogSize] = {offset, removedLength, insertedLength};
+    _version++;
+}
+
+bool PieceTreeBase::mapOffset(uint64_t version, Offset& offset) const {
+    if (version > _version || _version - version > EditLogSize) {
+        return false;
+    }
+    for (; version < _version; version++) {
+        const EditRecord& edit = _editLog[version % EditLogSize];
+        if (offset >= edit.offset + edit.removedLength) {
+            offset += edit.insertedLength - edit.removedLength;
+        } else if (offset > edit.offset) {
+            offset = edit.offset;
+        }
+    }
+    return true;
+}
+
+Offset PieceTreeBase::getPieceCount() const {
+    return _nodeAllocator.liveCount();
+}
+
+int32_t PieceTreeBase::getHeight() const {
+    std::function<int32_t(const TreeNode*)> height = [&](const TreeNode* node) -> int32_t {
+        return node == _sentinel ? 0 : 1 + std::max(height(node->left), height(node->right));
+    };
+    return height(root);
+}
+
 bool PieceTreeBase::equal(const PieceTreeBase& other) const {
     if (getLength() != other.getLength()) {
         return false;
@@ -111,52 +575,67 @@ bool PieceTreeBase::equal(const PieceTreeBase& other) const {
         return false;
     }
 
-    int32_t offset = 0;
-    bool ret = iterate(root, [&](TreeNode* node) {
-        if (node == SENTINEL) {
-            return true;
+    // walk both piece sequences side by side, comparing the bytes they cover
+    PieceIterator otherIt = other.pieceBegin();
+    Offset otherRemainder = 0;
+    for (const Piece& piece : pieces()) {
+        const char* text = _buffers[piece.bufferIndex]->text().data() + offsetInBuffer(piece.bufferIndex, piece.start);
+        Offset pos = 0;
+        while (pos < piece.length) {
+            const Piece& otherPiece = *otherIt;
+            const char* otherText = other._buffers[otherPiece.bufferIndex]->text().data() +
+                                    other.offsetInBuffer(otherPiece.bufferIndex, otherPiece.start);
+            Offset len = std::min(piece.length - pos, otherPiece.length - otherRemainder);
+            if (std::char_traits<char>::compare(text + pos, otherText + otherRemainder, len) != 0) {
+                return false;
+            }
+            pos += len;
+            otherRemainder += len;
+            if (otherRemainder == otherPiece.length) {
+                ++otherIt;
+                otherRemainder = 0;
+            }
         }
-        std::string str = getNodeContent(node);
-        int32_t len = str.length();
-        NodePosition startPosition = const_cast<PieceTreeBase&>(other).nodeAt(offset);
-        NodePosition endPosition = const_cast<PieceTreeBase&>(other).nodeAt(offset + len);
-        std::string val = const_cast<PieceTreeBase&>(other).getValueInRange2(startPosition, endPosition);
-
-        return str == val;
-    });
-
-    return ret;
+    }
+    return true;
 }
 
-int32_t PieceTreeBase::getOffsetAt(int32_t lineNumber, int32_t column) {
+Offset PieceTreeBase::getOffsetAt(Offset lineNumber, Offset column) {
     // Line numbers in the buffer are 0-based
     if (lineNumber <= 0) {
         // First line starts at offset 0
         return column;
     }
 
-    int32_t leftLen = 0; // inorder
+    if (CacheEntry* cache = _searchCache->getByLine(lineNumber)) {
+        Offset lineIndex = lineNumber - cache->nodeStartLineNumber - 1;
+        return cache->nodeStartOffset + getAccumulatedValue(cache->node, lineIndex) + column;
+    }
+
+    const Offset originalLineNumber = lineNumber;
+    Offset leftLen = 0; // inorder
     TreeNode* x = root;
 
-    while (x != SENTINEL) {
-        if (x->left != SENTINEL && x->lf_left >= lineNumber) {
+    while (x != _sentinel) {
+        if (x->left != _sentinel && x->lf_left >= lineNumber) {
             // If left subtree contains enough line feeds, go left
             x = x->left;
-        } else if (x->lf_left + x->piece->lineFeedCnt >= lineNumber) {
+        } else if (x->lf_left + x->piece.lineFeedCnt >= lineNumber) {
             // Line is in this node
             leftLen += x->size_left;
-            
+            _searchCache->set(CacheEntry(x, leftLen, originalLineNumber - lineNumber + x->lf_left));
+
             // Calculate the accumulated value up to the line we're looking for
             // Note: we want the start of the line, not the newline character
-            int32_t prevLineIndex = lineNumber - 1;
-            int32_t prevAccumulatedValue = getAccumulatedValue(x, prevLineIndex - x->lf_left);
+            Offset prevLineIndex = lineNumber - 1;
+            Offset prevAccumulatedValue = getAccumulatedValue(x, prevLineIndex - x->lf_left);
             
             // Return the offset at the start of the line
             return leftLen + prevAccumulatedValue + column;
         } else {
             // Line is in right subtree
-            lineNumber -= x->lf_left + x->piece->lineFeedCnt;
-            leftLen += x->size_left + x->piece->length;
+            lineNumber -= x->lf_left + x->piece.lineFeedCnt;
+            leftLen += x->size_left + x->piece.length;
             x = x->right;
         }
     }
@@ -164,36 +643,44 @@ int32_t PieceTreeBase::getOffsetAt(int32_t lineNumber, int32_t column) {
     return leftLen + column;
 }
 
-common::Position PieceTreeBase::getPositionAt(int32_t offset) {
-    offset = std::max(0, offset);
+common::Position PieceTreeBase::getPositionAt(Offset offset) {
+    offset = std::max<Offset>(0, offset);
 
     TreeNode* x = root;
-    int32_t lfCnt = 0;
-    int32_t originalOffset = offset;
+    Offset lfCnt = 0;
+    Offset originalOffset = offset;
+
+    auto positionInNode = [&](TreeNode* node, Offset nodeStartOffset, Offset nodeStartLineNumber) {
+        auto out = getIndexOf(node, originalOffset - nodeStartOffset);
+        Offset lineFeeds = nodeStartLineNumber + out.first;
+        if (out.first == 0) {
+            Offset lineStartOffset = getOffsetAt(lineFeeds + 1, 1);
+            Offset column = originalOffset - lineStartOffset;
+            return common::Position(lineFeeds + 1, column + 1);
+        }
+        return common::Position(lineFeeds + 1, out.second + 1);
+    };
+
+    // a node holding offset strictly inside is the one the descent would find
+    if (CacheEntry* cache = _searchCache->get(offset, true)) {
+        return positionInNode(cache->node, cache->nodeStartOffset, cache->nodeStartLineNumber);
+    }
 
-    while (x != SENTINEL) {
+    while (x != _sentinel) {
         if (x->size_left != 0 && x->size_left >= offset) {
             x = x->left;
-        } else if (x->size_left + x->piece->length >= offset) {
-            auto out = getIndexOf(x, offset - x->size_left);
-
-            lfCnt += x->lf_left + out.first;
-
-            if (out.first == 0) {
-                int32_t lineStartOffset = getOffsetAt(lfCnt + 1, 1);
-                int32_t column = originalOffset - lineStartOffset;
-                return common::Position(lfCnt + 1, column + 1);
-            }
-
-            return common::Position(lfCnt + 1, out.second + 1);
+        } else if (x->size_left + x->piece.length >= offset) {
+            Offset nodeStartOffset = originalOffset - offset + x->size_left;
+            _searchCache->set(CacheEntry(x, nodeStartOffset, lfCnt + x->lf_left));
+            return positionInNode(x, nodeStartOffset, lfCnt + x->lf_left);
         } else {
-            offset -= x->size_left + x->piece->length;
-            lfCnt += x->lf_left + x->piece->lineFeedCnt;
+            offset -= x->size_left + x->piece.length;
+            lfCnt += x->lf_left + x->piece.lineFeedCnt;
 
-            if (x->right == SENTINEL) {
+            if (x->right == _sentinel) {
                 // last node
-                int32_t lineStartOffset = getOffsetAt(lfCnt + 1, 1);
-                int32_t column = originalOffset - offset - lineStartOffset;
+                Offset lineStartOffset = getOffsetAt(lfCnt + 1, 1);
+                Offset column = originalOffset - offset - lineStartOffset;
                 return common::Position(lfCnt + 1, column + 1);
             } else {
                 x = x->right;
@@ -213,43 +700,8 @@ std::string PieceTreeBase::getValueInRange(const common::Range& range, const std
     NodePosition endPosition = nodeAt2(range.endLineNumber(), range.endColumn());
 
     std::string value = getValueInRange2(startPosition, endPosition);
-    if (!eol.empty()) {
-        if (eol != _EOL || !_EOLNormalized) {
-            std::string result = value;
-            size_t pos = 0;
-            while ((pos = result.find("\r\n", pos)) != std::string::npos) {
-                result.replace(pos, 2, eol);
-                pos += eol.length();
-            }
-            while ((pos = result.find("\r", pos)) != std::string::npos) {
-                result.replace(pos, 1, eol);
-                pos += eol.length();
-            }
-            while ((pos = result.find("\n", pos)) != std::string::npos) {
-                result.replace(pos, 1, eol);
-                pos += eol.length();
-            }
-            return result;
-        }
-
-        if (eol == getEOL() && _EOLNormalized) {
-            return value;
-        }
-        std::string result = value;
-        size_t pos = 0;
-        while ((pos = result.find("\r\n", pos)) != std::string::npos) {
-            result.replace(pos, 2, eol);
-            pos += eol.length();
-        }
-        while ((pos = result.find("\r", pos)) != std::string::npos) {
-            result.replace(pos, 1, eol);
-            pos += eol.length();
-        }
-        while ((pos = result.find("\n", pos)) != std::string::npos) {
-            result.replace(pos, 1, eol);
-            pos += eol.length();
-        }
-        return result;
+    if (!eol.empty() && (eol != _EOL || !_EOLNormalized)) {
+        return textbuffer::normalizeEOL(value, eol);
     }
     return value;
 }
@@ -257,39 +709,43 @@ std::string PieceTreeBase::getValueInRange(const common::Range& range, const std
 std::string PieceTreeBase::getValueInRange2(const NodePosition& startPosition, const NodePosition& endPosition) {
     if (startPosition.node == endPosition.node) {
         TreeNode* node = startPosition.node;
-        std::string buffer = _buffers[node->piece->bufferIndex].buffer;
-        int32_t startOffset = offsetInBuffer(node->piece->bufferIndex, node->piece->start);
-        return buffer.substr(startOffset + startPosition.remainder, 
-                           endPosition.remainder - startPosition.remainder);
+        std::string_view buffer = _buffers[node->piece.bufferIndex]->text();
+        Offset startOffset = offsetInBuffer(node->piece.bufferIndex, node->piece.start);
+        return std::string(buffer.substr(startOffset + startPosition.remainder, 
+                           endPosition.remainder - startPosition.remainder));
     }
 
     TreeNode* x = startPosition.node;
-    std::string buffer = _buffers[x->piece->bufferIndex].buffer;
-    int32_t startOffset = offsetInBuffer(x->piece->bufferIndex, x->piece->start);
-    std::string ret = buffer.substr(startOffset + startPosition.remainder, 
-                                  startOffset + x->piece->length - (startOffset + startPosition.remainder));
+    std::string_view buffer = _buffers[x->piece.bufferIndex]->text();
+    Offset startOffset = offsetInBuffer(x->piece.bufferIndex, x->piece.start);
+    std::string ret;
+    ret.reserve(std::clamp<Offset>(endPosition.nodeStartOffset + endPosition.remainder -
+                                       startPosition.nodeStartOffset - startPosition.remainder,
+                                   0, getLength()));
+    ret.append(buffer, startOffset + startPosition.remainder, x->piece.length - startPosition.remainder);
 
-    x = x->next();
-    while (x != SENTINEL) {
-        std::string buffer = _buffers[x->piece->bufferIndex].buffer;
-        int32_t startOffset = offsetInBuffer(x->piece->bufferIndex, x->piece->start);
+    x = x->next(_sentinel);
+    while (x != _sentinel) {
+        std::string_view buffer = _buffers[x->piece.bufferIndex]->text();
+        Offset startOffset = offsetInBuffer(x->piece.bufferIndex, x->piece.start);
 
         if (x == endPosition.node) {
-            ret += buffer.substr(startOffset, startOffset + endPosition.remainder - startOffset);
+            ret.append(buffer, startOffset, endPosition.remainder);
             break;
         } else {
-            ret += buffer.substr(startOffset, x->piece->length);
+            ret.append(buffer, startOffset, x->piece.length);
         }
 
-        x = x->next();
+        x = x->next(_sentinel);
     }
 
     return ret;
 }
 
 std::vector<std::string> PieceTreeBase::getLinesContent() {
-    std::string content = getContentOfSubTree(root);
+    std::string content = getValue();
     std::vector<std::string> lines;
+    lines.reserve(getLineCount());
     size_t start = 0;
     size_t end = content.find_first_of("\r\n");
     
@@ -309,82 +765,139 @@ std::vector<std::string> PieceTreeBase::getLinesContent() {
     return lines;
 }
 
-int32_t PieceTreeBase::getLength() const {
+Offset PieceTreeBase::getLength() const {
     return _length;
 }
 
-int32_t PieceTreeBase::getLineCount() const {
+Offset PieceTreeBase::getLineCount() const {
     return _lineCnt;
 }
 
-std::string PieceTreeBase::getLineContent(int32_t lineNumber) {
+std::string PieceTreeBase::getLineContent(Offset lineNumber) {
     if (lineNumber < 0 || lineNumber >= getLineCount()) {
         throw std::out_of_range("Invalid line number");
     }
 
-    // If cache is available, return cached result
-    if (lineNumber == _lastVisitedLine.first) {
-        return _lastVisitedLine.second;
+    if (const std::string* cached = _lineCache.get(lineNumber)) {
+        return *cached;
     }
-
-    // Update cache line number
-    _lastVisitedLine.first = lineNumber;
-
-    if (root == SENTINEL) {
-        _lastVisitedLine.second = "";
-        return "";
+    Offset start = getOffsetAt(lineNumber, 0);
+    Offset end = lineNumber + 1 < getLineCount() ? getOffsetAt(lineNumber + 1, 0) : getLength();
+    std::string content;
+    content.reserve(end - start);
+    for (std::string_view view : getRangeViews(start, end)) {
+        content.append(view.data(), view.size());
     }
-    
-    // Important: adjust lineNumber to work with getLineRawContent which uses 1-based indexing
-    int32_t adjustedLineNumber = lineNumber + 1;
-    
-    // The rest of the implementation uses the adjusted lineNumber
-    if (adjustedLineNumber == getLineCount()) {
-        _lastVisitedLine.second = getLineRawContent(adjustedLineNumber);
-    } else if (_EOLNormalized) {
-        _lastVisitedLine.second = getLineRawContent(adjustedLineNumber, _EOLLength);
-    } else {
-        std::string content = getLineRawContent(adjustedLineNumber);
-        // Remove trailing line endings
-        if (!content.empty()) {
-            if (content.size() >= 2 && 
-                content[content.size() - 2] == '\r' && 
-                content[content.size() - 1] == '\n') {
-                content = content.substr(0, content.size() - 2);
-            } else if (content.back() == '\n' || content.back() == '\r') {
-                content = content.substr(0, content.size() - 1);
-            }
-        }
-        _lastVisitedLine.second = content;
+    if (!content.empty() && content.back() == '\n') {
+        content.pop_back();
     }
-    
-    return _lastVisitedLine.second;
+    if (!content.empty() && content.back() == '\r') {
+        content.pop_back();
+    }
+    _lineCache.set(lineNumber, start, end, content);
+    return content;
 }
 
-uint32_t PieceTreeBase::getLineCharCode(int32_t lineNumber, int32_t index) {
+uint32_t PieceTreeBase::getLineCharCode(Offset lineNumber, Offset index) {
     NodePosition nodePos = nodeAt2(lineNumber, index + 1);
-    if (nodePos.remainder == nodePos.node->piece->length) {
+    if (!nodePos.node) {
+        // past the end of the last line
+        return 0;
+    }
+    if (nodePos.remainder == nodePos.node->piece.length) {
         // the char we want to fetch is at the head of next node.
-        TreeNode* matchingNode = nodePos.node->next();
-        if (!matchingNode) {
+        TreeNode* matchingNode = nodePos.node->next(_sentinel);
+        if (matchingNode == _sentinel) {
             return 0;
         }
 
-        std::string buffer = _buffers[matchingNode->piece->bufferIndex].buffer;
-        int32_t startOffset = offsetInBuffer(matchingNode->piece->bufferIndex, matchingNode->piece->start);
+        std::string_view buffer = _buffers[matchingNode->piece.bufferIndex]->text();
+        Offset startOffset = offsetInBuffer(matchingNode->piece.bufferIndex, matchingNode->piece.start);
         return static_cast<unsigned char>(buffer[startOffset]);
     } else {
-        std::string buffer = _buffers[nodePos.node->piece->bufferIndex].buffer;
-        int32_t startOffset = offsetInBuffer(nodePos.node->piece->bufferIndex, nodePos.node->piece->start);
-        int32_t targetOffset = startOffset + nodePos.remainder;
+        std::string_view buffer = _buffers[nodePos.node->piece.bufferIndex]->text();
+        Offset startOffset = offsetInBuffer(nodePos.node->piece.bufferIndex, nodePos.node->piece.start);
+        Offset targetOffset = startOffset + nodePos.remainder;
 
         return static_cast<unsigned char>(buffer[targetOffset]);
     }
 }
 
-int32_t PieceTreeBase::getLineLength(int32_t lineNumber) {
+std::vector<std::string_view> PieceTreeBase::getRangeViews(Offset start, Offset end) const {
+    std::vector<std::string_view> views;
+    forEachChunk(start, end, [&](std::string_view chunk) {
+        views.push_back(chunk);
+        return true;
+    });
+    return views;
+}
+
+bool PieceTreeBase::forEachChunk(Offset start, Offset end, const std::function<bool(std::string_view)>& callback) const {
+    start = std::max<Offset>(start, 0);
+    end = std::min(end, getLength());
+    for (auto it = pieceAt(start); it != pieceEnd() && it.offset() < end; ++it) {
+        Offset from = std::max(start, it.offset()) - it.offset();
+        Offset to = std::min(end, it.offset() + it->length) - it.offset();
+        if (from < to) {
+            std::string_view buffer = _buffers[it->bufferIndex]->text();
+            if (!callback(std::string_view(buffer.data() + offsetInBuffer(it->bufferIndex, it->start) + from,
+                                           to - from))) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool PieceTreeBase::forEachChunk(const common::Range& range, const std::function<bool(std::string_view)>& callback) {
+    Offset start = getOffsetAt(range.startLineNumber(), range.startColumn());
+    Offset end = getOffsetAt(range.endLineNumber(), range.endColumn());
+    return forEachChunk(start, end, callback);
+}
+
+size_t PieceTreeBase::copyRange(Offset start, Offset end, char* dst, size_t capacity) const {
+    size_t copied = 0;
+    start = std::max<Offset>(start, 0);
+    if (end > start && static_cast<size_t>(end - start) > capacity) {
+        end = start + static_cast<Offset>(capacity);
+    }
+    forEachChunk(start, end, [&](std::string_view chunk) {
+        std::memcpy(dst + copied, chunk.data(), chunk.size());
+        copied += chunk.size();
+        return true;
+    });
+    return copied;
+}
+
+size_t PieceTreeBase::copyRange(const common::Range& range, char* dst, size_t capacity) {
+    Offset start = getOffsetAt(range.startLineNumber(), range.startColumn());
+    Offset end = getOffsetAt(range.endLineNumber(), range.endColumn());
+    return copyRange(start, end, dst, capacity);
+}
+
+std::vector<std::string_view> PieceTreeBase::getLineViews(Offset lineNumber) {
+    if (lineNumber < 0 || lineNumber >= getLineCount()) {
+        throw std::out_of_range("Invalid line number");
+    }
+    Offset start = getOffsetAt(lineNumber, 0);
+    Offset end = lineNumber + 1 < getLineCount() ? getOffsetAt(lineNumber + 1, 0) : getLength();
+    std::vector<std::string_view> views = getRangeViews(start, end);
+
+    // drop the line break, a "\r\n" may be split over two pieces
+    for (char eol : {'\n', '\r'}) {
+        if (!views.empty() && views.back().back() == eol) {
+            views.back().remove_suffix(1);
+            if (views.back().empty()) {
+                views.pop_back();
+            }
+        }
+    }
+    return views;
+}
+
+Offset PieceTreeBase::getLineLength(Offset lineNumber) {
     if (lineNumber == getLineCount()) {
-        int32_t startOffset = getOffsetAt(lineNumber, 1);
+        Offset startOffset = getOffsetAt(lineNumber, 1);
         return getLength() - startOffset;
     }
     return getOffsetAt(lineNumber + 1, 1) - getOffsetAt(lineNumber, 1) - _EOLLength;
@@ -394,41 +907,71 @@ std::string PieceTreeBase::getValue() {
     return getContentOfSubTree(root);
 }
 
-void PieceTreeBase::insert(int32_t offset, const std::string& value, bool eolNormalized) {
+uint32_t PieceTreeBase::getCharCode(Offset offset) {
+    if (offset < 0 || offset >= getLength()) {
+        return 0;
+    }
+    NodePosition nodePos = nodeAt(offset);
+    TreeNode* node = nodePos.node;
+    Offset remainder = nodePos.remainder;
+    if (remainder == node->piece.length) {
+        // the char is at the head of the next node
+        node = node->next(_sentinel);
+        remainder = 0;
+    }
+    Offset bufferOffset = offsetInBuffer(node->piece.bufferIndex, node->piece.start) + remainder;
+    return static_cast<unsigned char>(_buffers[node->piece.bufferIndex]->text()[bufferOffset]);
+}
+
+bool PieceTreeBase::forEachPiece(const std::function<bool(const Piece&)>& callback) const {
+    for (const Piece& piece : pieces()) {
+        if (!callback(piece)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PieceTreeBase::insert(Offset offset, const std::string& value, bool eolNormalized) {
+    PersistentEditScope persistentScope(this, offset);
+    insertValue(offset, value, eolNormalized);
+    persistentScope.commit();
+}
+
+void PieceTreeBase::insertValue(Offset offset, const std::string& value, bool eolNormalized) {
     // Don't proceed if value is empty
     if (value.empty()) {
         return;
     }
     
     _EOLNormalized = _EOLNormalized && eolNormalized;
-    _lastVisitedLine.first = 0;
-    _lastVisitedLine.second = "";
+    _searchCache->validate(offset);
 
-    int32_t currentLength = getLength();
+    Offset currentLength = getLength();
     if (offset > currentLength) {
         // If offset is beyond the end, just append to the end
         offset = currentLength;
     }
 
-    if (root != SENTINEL) {
+    if (root != _sentinel) {
         auto nodePosition = nodeAt(offset);
         TreeNode* node = nodePosition.node;
-        int32_t remainder = nodePosition.remainder;
-        int32_t nodeStartOffset = nodePosition.nodeStartOffset;
+        Offset remainder = nodePosition.remainder;
+        Offset nodeStartOffset = nodePosition.nodeStartOffset;
         
         if (!node) {
             // If somehow nodeAt failed (shouldn't happen with the checks), just return
             return;
         }
         
-        Piece* piece = node->piece;
-        int32_t bufferIndex = piece->bufferIndex;
+        Piece piece = node->piece;
+        int32_t bufferIndex = piece.bufferIndex;
         BufferCursor insertPosInBuffer = positionInBuffer(node, remainder);
         
-        if (node->piece->bufferIndex == 0 &&
-            piece->end.line == _lastChangeBufferPos.line &&
-            piece->end.column == _lastChangeBufferPos.column &&
-            (nodeStartOffset + piece->length == offset) &&
+        if (node->piece.bufferIndex == _changeBufferIndex &&
+            piece.end.line == _lastChangeBufferPos.line &&
+            piece.end.column == _lastChangeBufferPos.column &&
+            (nodeStartOffset + piece.length == offset) &&
             value.length() < AverageBufferSize) {
             // changed buffer
             appendToNode(node, value);
@@ -439,38 +982,35 @@ void PieceTreeBase::insert(int32_t offset, const std::string& value, bool eolNor
         if (nodeStartOffset == offset) {
             insertContentToNodeLeft(value, node);
             _searchCache->validate(offset);
-        } else if (nodeStartOffset + node->piece->length > offset) {
+        } else if (nodeStartOffset + node->piece.length > offset) {
             // we are inserting into the middle of a node.
             std::vector<TreeNode*> nodesToDel;
-            auto newRightPiece = new Piece(
-                piece->bufferIndex,
+            Piece newRightPiece(
+                piece.bufferIndex,
                 insertPosInBuffer,
-                piece->end,
-                getLineFeedCnt(piece->bufferIndex, insertPosInBuffer, piece->end),
-                offsetInBuffer(bufferIndex, piece->end) - offsetInBuffer(bufferIndex, insertPosInBuffer)
+                piece.end,
+                getLineFeedCnt(piece.bufferIndex, insertPosInBuffer, piece.end),
+                offsetInBuffer(bufferIndex, piece.end) - offsetInBuffer(bufferIndex, insertPosInBuffer)
             );
 
             if (shouldCheckCRLF() && endWithCR(value)) {
-                int32_t headOfRight = nodeCharCodeAt(node, remainder);
+                Offset headOfRight = nodeCharCodeAt(node, remainder);
 
                 if (headOfRight == 10) { // \n
                     // Adjust the right piece to start after the \n
-                    BufferCursor newStart{newRightPiece->start.line + 1, 0};
-                    delete newRightPiece; // Delete the old piece to avoid memory leak
-                    newRightPiece = new Piece(
-                        piece->bufferIndex,
+                    BufferCursor newStart{newRightPiece.start.line + 1, 0};
+                    newRightPiece = Piece(
+                        piece.bufferIndex,
                         newStart,
-                        piece->end,
-                        getLineFeedCnt(piece->bufferIndex, newStart, piece->end),
-                        offsetInBuffer(bufferIndex, piece->end) - offsetInBuffer(bufferIndex, newStart)
+                        piece.end,
+                        getLineFeedCnt(piece.bufferIndex, newStart, piece.end),
+                        offsetInBuffer(bufferIndex, piece.end) - offsetInBuffer(bufferIndex, newStart)
                     );
 
                     std::string newValue = value + '\n';
                     insertContentToNodeLeft(newValue, node);
-                    if (newRightPiece->length > 0) {
+                    if (newRightPiece.length > 0) {
                         rbInsertRight(node, newRightPiece);
-                    } else {
-                        delete newRightPiece; // Prevent memory leak
                     }
                     computeBufferMetadata();
                     return;
@@ -479,27 +1019,25 @@ void PieceTreeBase::insert(int32_t offset, const std::string& value, bool eolNor
 
             // reuse node for content before insertion point.
             if (shouldCheckCRLF() && startWithLF(value)) {
-                int32_t tailOfLeft = nodeCharCodeAt(node, remainder - 1);
+                Offset tailOfLeft = nodeCharCodeAt(node, remainder - 1);
                 if (tailOfLeft == 13) { // \r
                     BufferCursor previousPos = positionInBuffer(node, remainder - 1);
                     deleteNodeTail(node, previousPos);
                     std::string newValue = '\r' + value;
 
-                    if (node->piece->length == 0) {
+                    if (node->piece.length == 0) {
                         nodesToDel.push_back(node);
                     }
                     
-                    std::vector<Piece*> newPieces = createNewPieces(newValue);
+                    std::vector<Piece> newPieces = createNewPieces(newValue);
                     TreeNode* tmpNode = node;
-                    for (Piece* p : newPieces) {
+                    for (const Piece& p : newPieces) {
                         tmpNode = rbInsertRight(tmpNode, p);
                     }
                     
                     // Insert right piece after new pieces
-                    if (newRightPiece->length > 0) {
+                    if (newRightPiece.length > 0) {
                         rbInsertRight(tmpNode, newRightPiece);
-                    } else {
-                        delete newRightPiece; // Prevent memory leak
                     }
                     
                     deleteNodes(nodesToDel);
@@ -512,19 +1050,17 @@ void PieceTreeBase::insert(int32_t offset, const std::string& value, bool eolNor
                 deleteNodeTail(node, insertPosInBuffer);
             }
 
-            std::vector<Piece*> newPieces = createNewPieces(value);
+            std::vector<Piece> newPieces = createNewPieces(value);
             
             // Insert pieces between left and right part
             TreeNode* tmpNode = node;
-            for (Piece* p : newPieces) {
+            for (const Piece& p : newPieces) {
                 tmpNode = rbInsertRight(tmpNode, p);
             }
             
             // Insert right part after new pieces
-            if (newRightPiece->length > 0) {
+            if (newRightPiece.length > 0) {
                 rbInsertRight(tmpNode, newRightPiece);
-            } else {
-                delete newRightPiece; // Prevent memory leak
             }
             
             deleteNodes(nodesToDel);
@@ -533,7 +1069,7 @@ void PieceTreeBase::insert(int32_t offset, const std::string& value, bool eolNor
         }
     } else {
         // insert new node
-        std::vector<Piece*> pieces = createNewPieces(value);
+        std::vector<Piece> pieces = createNewPieces(value);
         TreeNode* node = rbInsertLeft(nullptr, pieces[0]);
 
         for (size_t k = 1; k < pieces.size(); k++) {
@@ -544,16 +1080,381 @@ void PieceTreeBase::insert(int32_t offset, const std::string& value, bool eolNor
     computeBufferMetadata();
 }
 
-void PieceTreeBase::delete_(int32_t offset, int32_t count) {
-    _lastVisitedLine.first = 0;
-    _lastVisitedLine.second = "";
+void PieceTreeBase::insertPieces(Offset offset, const std::vector<Piece>& pieces) {
+    PersistentEditScope persistentScope(this, offset);
+    insertPiecesAt(offset, pieces);
+    persistentScope.commit();
+}
+
+void PieceTreeBase::insertPiecesAt(Offset offset, const std::vector<Piece>& pieces) {
+    Offset inserted = 0;
+    for (const Piece& piece : pieces) {
+        inserted += piece.length;
+    }
+    if (inserted == 0) {
+        return;
+    }
+    offset = std::max<Offset>(0, std::min(offset, getLength()));
+    _searchCache->validate(offset);
+
+    // the new pieces go right of node, or in front of everything while it is null
+    TreeNode* node = nullptr;
+    if (root != _sentinel) {
+        NodePosition position = nodeAt(offset);
+        node = position.node;
+        if (position.remainder == 0) {
+            node = node->prev(_sentinel);
+            if (node == _sentinel) {
+                node = nullptr;
+            }
+        } else if (position.remainder < node->piece.length) {
+            Piece piece = node->piece;
+            BufferCursor splitPos = positionInBuffer(node, position.remainder);
+            Piece rightPiece(piece.bufferIndex, splitPos, piece.end,
+                             getLineFeedCnt(piece.bufferIndex, splitPos, piece.end),
+                             piece.length - position.remainder);
+            deleteNodeTail(node, splitPos);
+            rbInsertRight(node, rightPiece);
+        }
+    }
+    for (const Piece& piece : pieces) {
+        if (piece.length == 0) {
+            continue;
+        }
+        if (node) {
+            node = rbInsertRight(node, piece);
+        } else {
+            node = rbInsertLeft(root == _sentinel ? nullptr : leftest(root), piece);
+        }
+    }
+    computeBufferMetadata();
+
+    validateCRLFAt(offset + inserted);
+    validateCRLFAt(offset);
+    _searchCache->validate(std::max<Offset>(0, offset - 1));
+    computeBufferMetadata();
+}
+
+void PieceTreeBase::validateCRLFAt(Offset offset) {
+    if (!shouldCheckCRLF() || offset <= 0 || offset >= getLength()) {
+        return;
+    }
+    NodePosition position = nodeAt(offset);
+    if (!position.node) {
+        return;
+    }
+    if (position.remainder == 0) {
+        validateCRLFWithPrevNode(position.node);
+    } else if (position.remainder == position.node->piece.length) {
+        validateCRLFWithNextNode(position.node);
+    }
+}
+
+std::vector<TextEdit> PieceTreeBase::applyEdits(std::vector<TextEdit> edits, bool eolNormalized) {
+    auto before = [](const TextEdit& a, const TextEdit& b) {
+        return a.offset != b.offset ? a.offset < b.offset : a.length == 0 && b.length > 0;
+    };
+    // replace-all and multi-cursor batches usually come in order already
+    if (!std::is_sorted(edits.begin(), edits.end(), before)) {
+        std::stable_sort(edits.begin(), edits.end(), before);
+    }
+    Offset length = getLength();
+    for (size_t i = 0; i < edits.size(); i++) {
+        TextEdit& edit = edits[i];
+        edit.offset = std::max<Offset>(0, std::min(edit.offset, length));
+        edit.length = std::max<Offset>(0, std::min(edit.length, length - edit.offset));
+        if (i > 0 && edits[i - 1].offset + edits[i - 1].length > edit.offset) {
+            throw std::invalid_argument("Overlapping edits");
+        }
+    }
+
+    // The inverse of each edit sits where the edit ends up once those before
+    // it are applied, and puts back the text it removed
+    std::vector<TextEdit> inverse;
+    inverse.reserve(edits.size());
+    Offset delta = 0;
+    auto addInverse = [&](const TextEdit& edit, std::string removed) {
+        inverse.emplace_back(edit.offset + delta, static_cast<Offset>(edit.text.size()), std::move(removed));
+        delta += static_cast<Offset>(edit.text.size()) - edit.length;
+    };
+
+    // A few edits are cheaper one by one than a pass over every piece.
+    // From the last to the first, no edit moves the offsets of those left.
+    if (edits.size() * BatchRebuildRatio < static_cast<size_t>(getPieceCount())) {
+        for (const TextEdit& edit : edits) {
+            std::string removed;
+            for (std::string_view view : getRangeViews(edit.offset, edit.offset + edit.length)) {
+                removed.append(view.data(), view.size());
+            }
+            addInverse(edit, std::move(removed));
+        }
+        beginTransaction();
+        for (auto edit = edits.rbegin(); edit != edits.rend(); ++edit) {
+            if (edit->length > 0) {
+                deleteText(edit->offset, edit->length);
+            }
+            if (!edit->text.empty()) {
+                insert(edit->offset, edit->text, eolNormalized);
+            }
+        }
+        endTransaction();
+        return inverse;
+    }
+
+    thawChangeBuffer();
+    bool checkCRLF = shouldCheckCRLF();
+    auto charAt = [&](const Piece& piece, Offset index) {
+        return _buffers[piece.bufferIndex]->text()[offsetInBuffer(piece.bufferIndex, piece.start) + index];
+    };
+    auto split = [&](const Piece& piece, Offset remainder) {
+        return PersistentPieceTree::splitPiece(*_buffers[piece.bufferIndex], piece, remainder);
+    };
+
+    // Splice the pieces into a new list. Only where an edit joined two pieces
+    // can a "\r\n" be split or two pieces be contiguous in one buffer.
+    std::vector<Piece> pieces;
+    pieces.reserve(getPieceCount() + 2 * edits.size() + 1);
+    bool atJoin = false;
+    auto push = [&](Piece piece) {
+        if (piece.length == 0) {
+            return;
+        }
+        if (atJoin && !pieces.empty()) {
+            Piece& last = pieces.back();
+            if (checkCRLF && charAt(last, last.length - 1) == '\r' && charAt(piece, 0) == '\n') {
+                // give the pair a piece of its own, as fixCRLF does
+                last = split(last, last.length - 1).first;
+                if (last.length == 0) {
+                    pieces.pop_back();
+                }
+                pieces.push_back(createNewPieces("\r\n")[0]);
+                piece = split(piece, 1).second;
+                if (piece.length == 0) {
+                    return;
+                }
+            }
+            Piece merged;
+            if (_pieceMerging && mergePieces(pieces.back(), piece, merged)) {
+                pieces.back() = merged;
+                atJoin = false;
+                return;
+            }
+        }
+        pieces.push_back(piece);
+        atJoin = false;
+    };
+
+    // the history gets the pieces of each edit, from left to right
+    bool recording = _history && !_historyPaused;
+    std::vector<HistoryEdit> historyEdits;
+
+    PieceIterator it = pieceBegin();
+    PieceIterator end = pieceEnd();
+    Piece piece;
+    Offset pieceStart = 0;
+    bool hasPiece = false;
+    auto next = [&]() {
+        hasPiece = it != end;
+        if (hasPiece) {
+            piece = *it;
+            pieceStart = it.offset();
+            ++it;
+        }
+    };
+    next();
+
+    for (const TextEdit& edit : edits) {
+        while (hasPiece && pieceStart + piece.length <= edit.offset) {
+            push(piece);
+            next();
+        }
+        if (hasPiece && pieceStart < edit.offset) {
+            std::pair<Piece, Piece> parts = split(piece, edit.offset - pieceStart);
+            push(parts.first);
+            piece = parts.second;
+            pieceStart = edit.offset;
+        }
+
+        // drop the removed range, keeping its text for the inverse
+        Offset removedEnd = edit.offset + edit.length;
+        std::string removed;
+        removed.reserve(edit.length);
+        HistoryEdit historyEdit;
+        while (hasPiece && pieceStart < removedEnd) {
+            Offset take = std::min(piece.length, removedEnd - pieceStart);
+            removed.append(_buffers[piece.bufferIndex]->text(), offsetInBuffer(piece.bufferIndex, piece.start), take);
+            if (recording) {
+                historyEdit.removed.push_back({take < piece.length ? split(piece, take).first : piece,
+                                               _buffers[piece.bufferIndex]});
+            }
+            if (take < piece.length) {
+                piece = split(piece, take).second;
+                pieceStart = removedEnd;
+            } else {
+                next();
+            }
+        }
+        if (recording) {
+            historyEdit.offset = edit.offset + delta;
+            historyEdit.removedLength = edit.length;
+            historyEdit.insertedLength = edit.text.size();
+        }
+        addInverse(edit, std::move(removed));
+
+        atJoin = true;
+        if (!edit.text.empty()) {
+            _EOLNormalized = _EOLNormalized && eolNormalized;
+            for (const Piece& inserted : createNewPieces(edit.text)) {
+                if (recording) {
+                    historyEdit.inserted.push_back({inserted, _buffers[inserted.bufferIndex]});
+                }
+                push(inserted);
+            }
+            atJoin = true;
+        }
+        if (recording && (edit.length > 0 || !edit.text.empty())) {
+            historyEdits.push_back(std::move(historyEdit));
+        }
+    }
+    while (hasPiece) {
+        push(piece);
+        next();
+    }
+
+    replacePieces(pieces);
+    if (_persistentSnapshots) {
+        rebuildPersistentTree();
+    }
+    for (size_t i = 0; i < edits.size(); i++) {
+        recordEdit(inverse[i].offset, edits[i].length, inverse[i].length);
+    }
+    beginTransaction();
+    for (HistoryEdit& historyEdit : historyEdits) {
+        recordHistory(std::move(historyEdit));
+    }
+    endTransaction();
+    compactIfNeeded();
+    return inverse;
+}
+
+void PieceTreeBase::setUndoHistory(bool enabled) {
+    if (!enabled) {
+        _history.reset();
+    } else if (!_history) {
+        _history = std::make_unique<EditHistory>();
+    }
+}
+
+void PieceTreeBase::setUndoLimits(size_t maxSteps, size_t maxBytes) {
+    if (_history) {
+        _history->setLimits(maxSteps, maxBytes);
+    }
+}
+
+void PieceTreeBase::beginTransaction() {
+    if (_history) {
+        _history->beginTransaction();
+    }
+}
+
+void PieceTreeBase::endTransaction() {
+    if (_history) {
+        _history->endTransaction();
+    }
+}
+
+void PieceTreeBase::clearUndoHistory() {
+    if (_history) {
+        _history->clear();
+    }
+}
+
+EditHistoryStats PieceTreeBase::getUndoHistoryStats() const {
+    return _history ? _history->stats() : EditHistoryStats();
+}
+
+bool PieceTreeBase::undo() {
+    if (!canUndo()) {
+        return false;
+    }
+    HistoryStep step = _history->takeUndo();
+    replayStep(step, true);
+    _history->pushRedo(std::move(step));
+    return true;
+}
+
+bool PieceTreeBase::redo() {
+    if (!canRedo()) {
+        return false;
+    }
+    HistoryStep step = _history->takeRedo();
+    replayStep(step, false);
+    _history->pushUndo(std::move(step));
+    return true;
+}
+
+void PieceTreeBase::recordHistory(HistoryEdit edit) {
+    if (_history && !_historyPaused) {
+        _history->record(std::move(edit));
+    }
+}
+
+void PieceTreeBase::replayStep(const HistoryStep& step, bool undo) {
+    _historyPaused = true;
+    size_t count = step.edits.size();
+    for (size_t i = 0; i < count; i++) {
+        const HistoryEdit& edit = step.edits[undo ? count - 1 - i : i];
+        Offset length = undo ? edit.insertedLength : edit.removedLength;
+        if (length > 0) {
+            deleteText(edit.offset, length);
+        }
+        insertPieces(edit.offset, adoptPieces(undo ? edit.removed : edit.inserted));
+    }
+    _historyPaused = false;
+}
+
+std::vector<Piece> PieceTreeBase::adoptPieces(const std::vector<SharedPiece>& pieces) {
+    std::vector<Piece> adopted;
+    adopted.reserve(pieces.size());
+    std::unordered_map<const StringBuffer*, int32_t> indices;
+    for (const SharedPiece& shared : pieces) {
+        Piece piece = shared.piece;
+        // usually the buffer is still where it was when the piece was recorded
+        if (piece.bufferIndex >= static_cast<int32_t>(_buffers.size()) ||
+            _buffers[piece.bufferIndex] != shared.buffer) {
+            if (indices.empty()) {
+                for (size_t i = 0; i < _buffers.size(); i++) {
+                    indices.emplace(_buffers[i].get(), i);
+                }
+            }
+            auto found = indices.find(shared.buffer.get());
+            if (found == indices.end()) {
+                // dropped by compaction, so the tree takes it back as an edit buffer
+                found = indices.emplace(shared.buffer.get(), _buffers.size()).first;
+                _buffers.push_back(std::const_pointer_cast<StringBuffer>(shared.buffer));
+            }
+            piece.bufferIndex = found->second;
+        }
+        adopted.push_back(piece);
+    }
+    return adopted;
+}
+
+void PieceTreeBase::delete_(Offset offset, Offset count) {
+    PersistentEditScope persistentScope(this, offset, count);
+    deleteRange(offset, count);
+    persistentScope.commit();
+}
+
+void PieceTreeBase::deleteRange(Offset offset, Offset count) {
+    _searchCache->validate(offset);
 
-    if (count <= 0 || root == SENTINEL) {
+    if (count <= 0 || root == _sentinel) {
         return;
     }
 
     // 确保不超出缓冲区长度
-    int32_t maxLength = getLength();
+    Offset maxLength = getLength();
     if (offset >= maxLength) {
         return; // 起始点超出缓冲区，不执行操作
     }
@@ -578,9 +1479,9 @@ void PieceTreeBase::delete_(int32_t offset, int32_t count) {
         BufferCursor endSplitPosInBuffer = positionInBuffer(startNode, endPosition.remainder);
 
         if (startPosition.nodeStartOffset == offset) {
-            if (count == startNode->piece->length) { // delete node
-                TreeNode* next = startNode->next();
-                rbDelete(this, startNode);
+            if (count == startNode->piece.length) { // delete node
+                TreeNode* next = startNode->next(_sentinel);
+                removeNode(startNode);
                 validateCRLFWithPrevNode(next);
                 computeBufferMetadata();
                 return;
@@ -592,7 +1493,7 @@ void PieceTreeBase::delete_(int32_t offset, int32_t count) {
             return;
         }
 
-        if (startPosition.nodeStartOffset + startNode->piece->length == offset + count) {
+        if (startPosition.nodeStartOffset + startNode->piece.length == offset + count) {
             deleteNodeTail(startNode, startSplitPosInBuffer);
             validateCRLFWithNextNode(startNode);
             computeBufferMetadata();
@@ -611,7 +1512,7 @@ void PieceTreeBase::delete_(int32_t offset, int32_t count) {
     BufferCursor startSplitPosInBuffer = positionInBuffer(startNode, startPosition.remainder);
     deleteNodeTail(startNode, startSplitPosInBuffer);
     _searchCache->validate(offset);
-    bool startNodeEmpty = (startNode->piece->length == 0);
+    bool startNodeEmpty = (startNode->piece.length == 0);
     if (startNodeEmpty) {
         nodesToDel.push_back(startNode);
     }
@@ -619,20 +1520,20 @@ void PieceTreeBase::delete_(int32_t offset, int32_t count) {
     // 处理结束节点
     BufferCursor endSplitPosInBuffer = positionInBuffer(endNode, endPosition.remainder);
     deleteNodeHead(endNode, endSplitPosInBuffer);
-    bool endNodeEmpty = (endNode->piece->length == 0);
+    bool endNodeEmpty = (endNode->piece.length == 0);
     if (endNodeEmpty) {
         nodesToDel.push_back(endNode);
     }
 
     // 删除中间的节点
     // 确保secondNode不是endNode，防止错误删除
-    TreeNode* secondNode = startNode->next();
-    for (TreeNode* node = secondNode; node != SENTINEL && node != endNode; node = node->next()) {
+    TreeNode* secondNode = startNode->next(_sentinel);
+    for (TreeNode* node = secondNode; node != _sentinel && node != endNode; node = node->next(_sentinel)) {
         nodesToDel.push_back(node);
     }
 
     // 获取要验证的前置节点 - 简化为VSCode的逻辑
-    TreeNode* prev = startNodeEmpty ? startNode->prev() : startNode;
+    TreeNode* prev = startNodeEmpty ? startNode->prev(_sentinel) : startNode;
     
     // 先删除需要删除的节点
     deleteNodes(nodesToDel);
@@ -645,7 +1546,7 @@ void PieceTreeBase::delete_(int32_t offset, int32_t count) {
 
 // 新增处理CRLF连接的辅助函数
 void PieceTreeBase::handleCRLFJoin(TreeNode* prevNode, TreeNode* nextNode) {
-    if (!prevNode || !nextNode || prevNode == SENTINEL || nextNode == SENTINEL) {
+    if (!prevNode || !nextNode || prevNode == _sentinel || nextNode == _sentinel) {
         return;
     }
     
@@ -656,55 +1557,53 @@ void PieceTreeBase::handleCRLFJoin(TreeNode* prevNode, TreeNode* nextNode) {
     std::vector<TreeNode*> nodesToDel;
     
     // 调整前节点删除最后的\r
-    const std::vector<int32_t>& lineStarts = _buffers[prevNode->piece->bufferIndex].lineStarts;
+    LineStartsView lineStarts = _buffers[prevNode->piece.bufferIndex]->getLineStarts();
     BufferCursor newEnd;
     
-    if (prevNode->piece->end.column == 0) {
+    if (prevNode->piece.end.column == 0) {
         // 行尾是 \r，而不是 \r\n
-        newEnd = {prevNode->piece->end.line - 1, 
-                 lineStarts[prevNode->piece->end.line] - lineStarts[prevNode->piece->end.line - 1] - 1};
+        newEnd = {prevNode->piece.end.line - 1, 
+                 lineStarts[prevNode->piece.end.line] - lineStarts[prevNode->piece.end.line - 1] - 1};
     } else {
         // \r\n
-        newEnd = {prevNode->piece->end.line, prevNode->piece->end.column - 1};
+        newEnd = {prevNode->piece.end.line, prevNode->piece.end.column - 1};
     }
     
-    const int32_t prevNewLength = prevNode->piece->length - 1;
-    const int32_t prevNewLFCnt = prevNode->piece->lineFeedCnt - 1;
+    const Offset prevNewLength = prevNode->piece.length - 1;
+    const Offset prevNewLFCnt = prevNode->piece.lineFeedCnt - 1;
     
-    Piece* newPrevPiece = new Piece(
-        prevNode->piece->bufferIndex,
-        prevNode->piece->start,
+    Piece newPrevPiece(
+        prevNode->piece.bufferIndex,
+        prevNode->piece.start,
         newEnd,
         prevNewLFCnt,
         prevNewLength
     );
     
-    delete prevNode->piece;
     prevNode->piece = newPrevPiece;
     
     updateTreeMetadata(this, prevNode, -1, -1);
-    if (prevNode->piece->length == 0) {
+    if (prevNode->piece.length == 0) {
         nodesToDel.push_back(prevNode);
     }
     
     // 调整后节点，删除开头的\n
-    BufferCursor newStart{nextNode->piece->start.line + 1, 0};
-    const int32_t newLength = nextNode->piece->length - 1;
-    const int32_t newLineFeedCnt = getLineFeedCnt(nextNode->piece->bufferIndex, newStart, nextNode->piece->end);
+    BufferCursor newStart{nextNode->piece.start.line + 1, 0};
+    const Offset newLength = nextNode->piece.length - 1;
+    const Offset newLineFeedCnt = getLineFeedCnt(nextNode->piece.bufferIndex, newStart, nextNode->piece.end);
     
-    Piece* newNextPiece = new Piece(
-        nextNode->piece->bufferIndex,
+    Piece newNextPiece(
+        nextNode->piece.bufferIndex,
         newStart,
-        nextNode->piece->end,
+        nextNode->piece.end,
         newLineFeedCnt,
         newLength
     );
     
-    delete nextNode->piece;
     nextNode->piece = newNextPiece;
     
     updateTreeMetadata(this, nextNode, -1, -1);
-    if (nextNode->piece->length == 0) {
+    if (nextNode->piece.length == 0) {
         nodesToDel.push_back(nextNode);
     }
     
@@ -714,29 +1613,28 @@ void PieceTreeBase::handleCRLFJoin(TreeNode* prevNode, TreeNode* nextNode) {
 void PieceTreeBase::insertContentToNodeLeft(const std::string& value, TreeNode* node) {
     std::vector<TreeNode*> nodesToDel;
     if (shouldCheckCRLF() && endWithCR(value) && startWithLF(node)) {
-        Piece* piece = node->piece;
-        BufferCursor newStart{piece->start.line + 1, 0};
-        Piece* nPiece = new Piece(
-            piece->bufferIndex,
+        Piece piece = node->piece;
+        BufferCursor newStart{piece.start.line + 1, 0};
+        Piece nPiece(
+            piece.bufferIndex,
             newStart,
-            piece->end,
-            getLineFeedCnt(piece->bufferIndex, newStart, piece->end),
-            piece->length - 1
+            piece.end,
+            getLineFeedCnt(piece.bufferIndex, newStart, piece.end),
+            piece.length - 1
         );
 
         node->piece = nPiece;
-        delete piece;
 
         std::string newValue = value + '\n';
         updateTreeMetadata(this, node, -1, -1);
 
-        if (node->piece->length == 0) {
+        if (node->piece.length == 0) {
             nodesToDel.push_back(node);
         }
 
-        std::vector<Piece*> newPieces = createNewPieces(newValue);
+        std::vector<Piece> newPieces = createNewPieces(newValue);
         TreeNode* newNode = rbInsertLeft(node, newPieces[newPieces.size() - 1]);
-        for (int32_t k = newPieces.size() - 2; k >= 0; k--) {
+        for (Offset k = newPieces.size() - 2; k >= 0; k--) {
             newNode = rbInsertLeft(newNode, newPieces[k]);
         }
         validateCRLFWithPrevNode(newNode);
@@ -744,9 +1642,9 @@ void PieceTreeBase::insertContentToNodeLeft(const std::string& value, TreeNode*
         return;
     }
 
-    std::vector<Piece*> newPieces = createNewPieces(value);
+    std::vector<Piece> newPieces = createNewPieces(value);
     TreeNode* newNode = rbInsertLeft(node, newPieces[newPieces.size() - 1]);
-    for (int32_t k = newPieces.size() - 2; k >= 0; k--) {
+    for (Offset k = newPieces.size() - 2; k >= 0; k--) {
         newNode = rbInsertLeft(newNode, newPieces[k]);
     }
     validateCRLFWithPrevNode(newNode);
@@ -759,7 +1657,7 @@ void PieceTreeBase::insertContentToNodeRight(const std::string& value, TreeNode*
         newValue += '\n';
     }
 
-    std::vector<Piece*> newPieces = createNewPieces(newValue);
+    std::vector<Piece> newPieces = createNewPieces(newValue);
     TreeNode* newNode = rbInsertRight(node, newPieces[0]);
     TreeNode* tmpNode = newNode;
 
@@ -770,61 +1668,39 @@ void PieceTreeBase::insertContentToNodeRight(const std::string& value, TreeNode*
     validateCRLFWithPrevNode(newNode);
 }
 
-BufferCursor PieceTreeBase::positionInBuffer(TreeNode* node, int32_t remainder) {
-    Piece* piece = node->piece;
-    int32_t bufferIndex = node->piece->bufferIndex;
-    const std::vector<int32_t>& lineStarts = _buffers[bufferIndex].lineStarts;
-
-    int32_t startOffset = lineStarts[piece->start.line] + piece->start.column;
-    int32_t offset = startOffset + remainder;
-
-    int32_t low = piece->start.line;
-    int32_t high = piece->end.line;
-
-    int32_t mid = 0;
-    int32_t midStop = 0;
-    int32_t midStart = 0;
-
-    while (low <= high) {
-        mid = low + ((high - low) / 2);
-        midStart = lineStarts[mid];
-
-        if (mid == high) {
-            break;
-        }
+BufferCursor PieceTreeBase::positionInBuffer(TreeNode* node, Offset remainder) {
+    return positionInBuffer(node->piece, remainder);
+}
 
-        midStop = lineStarts[mid + 1];
+BufferCursor PieceTreeBase::positionInBuffer(const Piece& piece, Offset remainder) const {
+    LineStartsView lineStarts = _buffers[piece.bufferIndex]->getLineStarts();
 
-        if (offset < midStart) {
-            high = mid - 1;
-        } else if (offset >= midStop) {
-            low = mid + 1;
-        } else {
-            break;
-        }
-    }
+    Offset startOffset = lineStarts[piece.start.line] + piece.start.column;
+    Offset offset = startOffset + remainder;
 
-    return {mid, offset - midStart};
+    // the last line of the piece starting at or before offset
+    Offset line = static_cast<Offset>(lineStarts.upperBound(piece.start.line + 1, piece.end.line + 1, offset)) - 1;
+    return {line, offset - lineStarts[line]};
 }
 
-int32_t PieceTreeBase::getLineFeedCnt(int32_t bufferIndex, const BufferCursor& start, const BufferCursor& end) {
+Offset PieceTreeBase::getLineFeedCnt(int32_t bufferIndex, const BufferCursor& start, const BufferCursor& end) {
     if (end.column == 0) {
         return end.line - start.line;
     }
 
-    const std::vector<int32_t>& lineStarts = _buffers[bufferIndex].lineStarts;
-    if (end.line == lineStarts.size() - 1) {
+    LineStartsView lineStarts = _buffers[bufferIndex]->getLineStarts();
+    if (static_cast<size_t>(end.line) == lineStarts.size() - 1) {
         return end.line - start.line;
     }
 
-    int32_t nextLineStartOffset = lineStarts[end.line + 1];
-    int32_t endOffset = lineStarts[end.line] + end.column;
+    Offset nextLineStartOffset = lineStarts[end.line + 1];
+    Offset endOffset = lineStarts[end.line] + end.column;
     if (nextLineStartOffset > endOffset + 1) {
         return end.line - start.line;
     }
 
-    int32_t previousCharOffset = endOffset - 1;
-    const std::string& buffer = _buffers[bufferIndex].buffer;
+    Offset previousCharOffset = endOffset - 1;
+    std::string_view buffer = _buffers[bufferIndex]->text();
 
     if (static_cast<unsigned char>(buffer[previousCharOffset]) == 13) {
         return end.line - start.line + 1;
@@ -833,25 +1709,25 @@ int32_t PieceTreeBase::getLineFeedCnt(int32_t bufferIndex, const BufferCursor& s
     }
 }
 
-int32_t PieceTreeBase::offsetInBuffer(int32_t bufferIndex, const BufferCursor& cursor) const {
-    const std::vector<int32_t>& lineStarts = _buffers[bufferIndex].lineStarts;
+Offset PieceTreeBase::offsetInBuffer(int32_t bufferIndex, const BufferCursor& cursor) const {
+    LineStartsView lineStarts = _buffers[bufferIndex]->getLineStarts();
     return lineStarts[cursor.line] + cursor.column;
 }
 
 void PieceTreeBase::deleteNodes(const std::vector<TreeNode*>& nodes) {
     for (TreeNode* node : nodes) {
-        rbDelete(this, node);
+        removeNode(node);
     }
 }
 
-std::vector<Piece*> PieceTreeBase::createNewPieces(const std::string& text) {
+std::vector<Piece> PieceTreeBase::createNewPieces(const std::string& text) {
     if (text.length() > AverageBufferSize) {
-        std::vector<Piece*> newPieces;
+        std::vector<Piece> newPieces;
         std::string remainingText = text;
         
         while (remainingText.length() > AverageBufferSize) {
             // 找到合适的分割点，避免切分UTF-8字符和CRLF
-            int32_t splitPos = AverageBufferSize - 1; // 从平均大小前一个字符开始检查
+            Offset splitPos = AverageBufferSize - 1; // 从平均大小前一个字符开始检查
             bool foundSplitPos = false;
             
             // 检查最后一个字符
@@ -863,99 +1739,101 @@ std::vector<Piece*> PieceTreeBase::createNewPieces(const std::string& text) {
             }
             
             // 确保分割点在合理范围内
-            splitPos = std::max(splitPos, 0);
+            splitPos = std::max<Offset>(splitPos, 0);
             
             std::string splitText = remainingText.substr(0, splitPos + 1);
             remainingText = remainingText.substr(splitPos + 1);
 
-            std::vector<int32_t> lineStarts = createLineStartsFast(splitText);
+            std::vector<Offset> lineStarts = createLineStartsFast(splitText);
             if (lineStarts.empty()) {
                 lineStarts.push_back(0);  // 确保至少有一个行起始位置
             }
             
-            newPieces.push_back(new Piece(
+            newPieces.push_back(Piece(
                 _buffers.size(),
                 {0, 0},
-                {static_cast<int32_t>(lineStarts.size() - 1), 
-                 static_cast<int32_t>(splitText.length() - lineStarts[lineStarts.size() - 1])},
+                {static_cast<Offset>(lineStarts.size() - 1), 
+                 static_cast<Offset>(splitText.length() - lineStarts[lineStarts.size() - 1])},
                 lineStarts.size() - 1,
                 splitText.length()
             ));
-            _buffers.push_back(StringBuffer(splitText, lineStarts));
+            _buffers.push_back(std::make_shared<StringBuffer>(splitText, lineStarts));
+            _buffers.back()->compactLineStarts();  // never appended to
         }
 
         // 处理剩余部分
         if (!remainingText.empty()) {
-            std::vector<int32_t> lineStarts = createLineStartsFast(remainingText);
+            std::vector<Offset> lineStarts = createLineStartsFast(remainingText);
             if (lineStarts.empty()) {
                 lineStarts.push_back(0);  // 确保至少有一个行起始位置
             }
             
-            newPieces.push_back(new Piece(
+            newPieces.push_back(Piece(
                 _buffers.size(),
                 {0, 0},
-                {static_cast<int32_t>(lineStarts.size() - 1), 
-                 static_cast<int32_t>(remainingText.length() - lineStarts[lineStarts.size() - 1])},
+                {static_cast<Offset>(lineStarts.size() - 1), 
+                 static_cast<Offset>(remainingText.length() - lineStarts[lineStarts.size() - 1])},
                 lineStarts.size() - 1,
                 remainingText.length()
             ));
-            _buffers.push_back(StringBuffer(remainingText, lineStarts));
+            _buffers.push_back(std::make_shared<StringBuffer>(remainingText, lineStarts));
+            _buffers.back()->compactLineStarts();  // never appended to
         }
 
         return newPieces;
     }
 
-    int32_t startOffset = _buffers[0].buffer.length();
-    std::vector<int32_t> lineStarts = createLineStartsFast(text);
+    Offset startOffset = _buffers[_changeBufferIndex]->buffer.length();
+    std::vector<Offset> lineStarts = createLineStartsFast(text);
     if (lineStarts.empty()) {
         lineStarts.push_back(0);  // 确保至少有一个行起始位置
     }
 
     BufferCursor start = _lastChangeBufferPos;
-    if (_buffers[0].lineStarts.size() > 0 && 
-        _buffers[0].lineStarts[_buffers[0].lineStarts.size() - 1] == startOffset
+    if (_buffers[_changeBufferIndex]->lineStarts.size() > 0 && 
+        _buffers[_changeBufferIndex]->lineStarts[_buffers[_changeBufferIndex]->lineStarts.size() - 1] == startOffset
         && startOffset != 0
         && startWithLF(text)
-        && endWithCR(_buffers[0].buffer)) {
+        && endWithCR(_buffers[_changeBufferIndex]->buffer)) {
         _lastChangeBufferPos = {_lastChangeBufferPos.line, _lastChangeBufferPos.column + 1};
         start = _lastChangeBufferPos;
         
         // 注意: VSCode实现在这里添加了一个特殊字符'_'，以确保缓冲区增加正确的偏移量
         // 我们也添加一个填充字符确保对齐
-        _buffers[0].buffer += '_' + text;
+        _buffers[_changeBufferIndex]->buffer += '_' + text;
         
         for (size_t i = 1; i < lineStarts.size(); i++) {
-            _buffers[0].lineStarts.push_back(lineStarts[i] + startOffset + 1); // +1 for the added '_'
+            _buffers[_changeBufferIndex]->lineStarts.push_back(lineStarts[i] + startOffset + 1); // +1 for the added '_'
         }
         
         startOffset += 1; // 考虑添加的填充字符
     } else {
-        _buffers[0].buffer += text;
+        _buffers[_changeBufferIndex]->buffer += text;
         for (size_t i = 1; i < lineStarts.size(); i++) {
-            _buffers[0].lineStarts.push_back(lineStarts[i] + startOffset);
+            _buffers[_changeBufferIndex]->lineStarts.push_back(lineStarts[i] + startOffset);
         }
     }
     
-    BufferCursor end{static_cast<int32_t>(_buffers[0].lineStarts.size() - 1), 
-                   static_cast<int32_t>(_buffers[0].buffer.length() - _buffers[0].lineStarts.back())};
+    BufferCursor end{static_cast<Offset>(_buffers[_changeBufferIndex]->lineStarts.size() - 1), 
+                   static_cast<Offset>(_buffers[_changeBufferIndex]->buffer.length() - _buffers[_changeBufferIndex]->lineStarts.back())};
     _lastChangeBufferPos = end;
     
-    Piece* piece = new Piece(0, start, end, end.line - start.line, _buffers[0].buffer.length() - startOffset);
+    Piece piece(_changeBufferIndex, start, end, end.line - start.line, _buffers[_changeBufferIndex]->buffer.length() - startOffset);
     return {piece};
 }
 
-TreeNode* PieceTreeBase::rbInsertLeft(TreeNode* node, Piece* piece) {
-    TreeNode* z = new TreeNode(piece, NodeColor::Red);
-    z->left = SENTINEL;
-    z->right = SENTINEL;
-    z->parent = SENTINEL;
+TreeNode* PieceTreeBase::rbInsertLeft(TreeNode* node, const Piece& piece) {
+    TreeNode* z = _nodeAllocator.allocate(piece, NodeColor::Red);
+    z->left = _sentinel;
+    z->right = _sentinel;
+    z->parent = _sentinel;
     z->size_left = 0;
     z->lf_left = 0;
 
-    if (root == SENTINEL) {
+    if (root == _sentinel) {
         root = z;
         z->color = NodeColor::Black;
-    } else if (node->left == SENTINEL) {
+    } else if (node->left == _sentinel) {
         node->left = z;
         z->parent = node;
     } else {
@@ -968,18 +1846,18 @@ TreeNode* PieceTreeBase::rbInsertLeft(TreeNode* node, Piece* piece) {
     return z;
 }
 
-TreeNode* PieceTreeBase::rbInsertRight(TreeNode* node, Piece* piece) {
-    TreeNode* z = new TreeNode(piece, NodeColor::Red);
-    z->left = SENTINEL;
-    z->right = SENTINEL;
-    z->parent = SENTINEL;
+TreeNode* PieceTreeBase::rbInsertRight(TreeNode* node, const Piece& piece) {
+    TreeNode* z = _nodeAllocator.allocate(piece, NodeColor::Red);
+    z->left = _sentinel;
+    z->right = _sentinel;
+    z->parent = _sentinel;
     z->size_left = 0;
     z->lf_left = 0;
 
-    if (root == SENTINEL) {
+    if (root == _sentinel) {
         root = z;
         z->color = NodeColor::Black;
-    } else if (node->right == SENTINEL) {
+    } else if (node->right == _sentinel) {
         node->right = z;
         z->parent = node;
     } else {
@@ -996,106 +1874,106 @@ std::string PieceTreeBase::getLinesRawContent() {
     return getContentOfSubTree(root);
 }
 
-std::string PieceTreeBase::getLineRawContent(int32_t lineNumber, int32_t endOffset) {
+std::string PieceTreeBase::getLineRawContent(Offset lineNumber, Offset endOffset) {
     TreeNode* x = root;
     std::string ret;
-    CacheEntry* cache = _searchCache->get2(lineNumber);
+    // lineNumber is 1-based here, the cache counts lines from 0
+    CacheEntry* cache = _searchCache->getByLine(lineNumber - 1);
     
     if (cache) {
         x = cache->node;
-        int32_t prevAccumualtedValue = getAccumulatedValue(x, lineNumber - cache->nodeStartLineNumber - 1);
-        std::string buffer = _buffers[x->piece->bufferIndex].buffer;
-        int32_t startOffset = offsetInBuffer(x->piece->bufferIndex, x->piece->start);
+        Offset prevAccumualtedValue = getAccumulatedValue(x, lineNumber - cache->nodeStartLineNumber - 2);
+        std::string_view buffer = _buffers[x->piece.bufferIndex]->text();
+        Offset startOffset = offsetInBuffer(x->piece.bufferIndex, x->piece.start);
         
-        if (cache->nodeStartLineNumber + x->piece->lineFeedCnt == lineNumber) {
+        if (cache->nodeStartLineNumber + x->piece.lineFeedCnt == lineNumber - 1) {
             ret = buffer.substr(startOffset + prevAccumualtedValue, 
-                              startOffset + x->piece->length - (startOffset + prevAccumualtedValue));
+                              startOffset + x->piece.length - (startOffset + prevAccumualtedValue));
         } else {
-            int32_t accumualtedValue = getAccumulatedValue(x, lineNumber - cache->nodeStartLineNumber);
-            return buffer.substr(startOffset + prevAccumualtedValue, 
-                               startOffset + accumualtedValue - endOffset - (startOffset + prevAccumualtedValue));
+            Offset accumualtedValue = getAccumulatedValue(x, lineNumber - cache->nodeStartLineNumber - 1);
+            return std::string(buffer.substr(startOffset + prevAccumualtedValue, 
+                               startOffset + accumualtedValue - endOffset - (startOffset + prevAccumualtedValue)));
         }
     } else {
-        int32_t nodeStartOffset = 0;
-        const int32_t originalLineNumber = lineNumber;
+        Offset nodeStartOffset = 0;
+        const Offset originalLineNumber = lineNumber;
         
-        while (x != SENTINEL) {
-            if (x->left != SENTINEL && x->lf_left >= lineNumber - 1) {
+        while (x != _sentinel) {
+            if (x->left != _sentinel && x->lf_left >= lineNumber - 1) {
                 x = x->left;
-            } else if (x->lf_left + x->piece->lineFeedCnt > lineNumber - 1) {
-                int32_t prevAccumualtedValue = getAccumulatedValue(x, lineNumber - x->lf_left - 2);
-                int32_t accumualtedValue = getAccumulatedValue(x, lineNumber - x->lf_left - 1);
-                std::string buffer = _buffers[x->piece->bufferIndex].buffer;
-                int32_t startOffset = offsetInBuffer(x->piece->bufferIndex, x->piece->start);
+            } else if (x->lf_left + x->piece.lineFeedCnt > lineNumber - 1) {
+                Offset prevAccumualtedValue = getAccumulatedValue(x, lineNumber - x->lf_left - 2);
+                Offset accumualtedValue = getAccumulatedValue(x, lineNumber - x->lf_left - 1);
+                std::string_view buffer = _buffers[x->piece.bufferIndex]->text();
+                Offset startOffset = offsetInBuffer(x->piece.bufferIndex, x->piece.start);
                 nodeStartOffset += x->size_left;
                 
-                _searchCache->set(CacheEntry(x, nodeStartOffset, 
-                    originalLineNumber - (lineNumber - 1 - x->lf_left)));
+                _searchCache->set(CacheEntry(x, nodeStartOffset, originalLineNumber - lineNumber + x->lf_left));
                 
-                return buffer.substr(startOffset + prevAccumualtedValue, 
-                                   startOffset + accumualtedValue - endOffset - (startOffset + prevAccumualtedValue));
-            } else if (x->lf_left + x->piece->lineFeedCnt == lineNumber - 1) {
-                int32_t prevAccumualtedValue = getAccumulatedValue(x, lineNumber - x->lf_left - 2);
-                std::string buffer = _buffers[x->piece->bufferIndex].buffer;
-                int32_t startOffset = offsetInBuffer(x->piece->bufferIndex, x->piece->start);
+                return std::string(buffer.substr(startOffset + prevAccumualtedValue, 
+                                   startOffset + accumualtedValue - endOffset - (startOffset + prevAccumualtedValue)));
+            } else if (x->lf_left + x->piece.lineFeedCnt == lineNumber - 1) {
+                Offset prevAccumualtedValue = getAccumulatedValue(x, lineNumber - x->lf_left - 2);
+                std::string_view buffer = _buffers[x->piece.bufferIndex]->text();
+                Offset startOffset = offsetInBuffer(x->piece.bufferIndex, x->piece.start);
                 
                 ret = buffer.substr(startOffset + prevAccumualtedValue, 
-                                  startOffset + x->piece->length - (startOffset + prevAccumualtedValue));
+                                  startOffset + x->piece.length - (startOffset + prevAccumualtedValue));
                 break;
             } else {
-                lineNumber -= x->lf_left + x->piece->lineFeedCnt;
-                nodeStartOffset += x->size_left + x->piece->length;
+                lineNumber -= x->lf_left + x->piece.lineFeedCnt;
+                nodeStartOffset += x->size_left + x->piece.length;
                 x = x->right;
             }
         }
     }
 
-    x = x->next();
-    while (x != SENTINEL) {
-        std::string buffer = _buffers[x->piece->bufferIndex].buffer;
+    x = x->next(_sentinel);
+    while (x != _sentinel) {
+        std::string_view buffer = _buffers[x->piece.bufferIndex]->text();
 
-        if (x->piece->lineFeedCnt > 0) {
-            int32_t accumualtedValue = getAccumulatedValue(x, 0);
-            int32_t startOffset = offsetInBuffer(x->piece->bufferIndex, x->piece->start);
+        if (x->piece.lineFeedCnt > 0) {
+            Offset accumualtedValue = getAccumulatedValue(x, 0);
+            Offset startOffset = offsetInBuffer(x->piece.bufferIndex, x->piece.start);
             
             ret += buffer.substr(startOffset, startOffset + accumualtedValue - endOffset - startOffset);
             return ret;
         } else {
-            int32_t startOffset = offsetInBuffer(x->piece->bufferIndex, x->piece->start);
-            ret += buffer.substr(startOffset, x->piece->length);
+            Offset startOffset = offsetInBuffer(x->piece.bufferIndex, x->piece.start);
+            ret += buffer.substr(startOffset, x->piece.length);
         }
 
-        x = x->next();
+        x = x->next(_sentinel);
     }
 
     return ret;
 }
 
 void PieceTreeBase::computeBufferMetadata() {
-    _lineCnt = 1;
-    _length = 0;
+    // The totals of the whole tree live on the right spine: every node on it
+    // contributes its left subtree (size_left/lf_left) plus its own piece.
+    TreeNode* x = root;
+    Offset lfCnt = 1;
+    Offset len = 0;
 
-    for (TreeNode* node = minimum(root); node != SENTINEL; node = node->next()) {
-        Piece* piece = node->piece;
-        if (piece) {
-            _length += piece->length;
-            _lineCnt += piece->lineFeedCnt;
-        }
+    while (x != _sentinel) {
+        lfCnt += x->lf_left + x->piece.lineFeedCnt;
+        len += x->size_left + x->piece.length;
+        x = x->right;
     }
-    
-    // 确保_lineCnt和_length始终为非负值
-    if (_lineCnt < 1) _lineCnt = 1;
-    if (_length < 0) _length = 0;
+
+    _lineCnt = lfCnt;
+    _length = len;
 }
 
-std::pair<int32_t, int32_t> PieceTreeBase::getIndexOf(TreeNode* node, int32_t accumulatedValue) {
-    Piece* piece = node->piece;
+std::pair<Offset, Offset> PieceTreeBase::getIndexOf(TreeNode* node, Offset accumulatedValue) {
+    Piece piece = node->piece;
     BufferCursor pos = positionInBuffer(node, accumulatedValue);
-    int32_t lineCnt = pos.line - piece->start.line;
+    Offset lineCnt = pos.line - piece.start.line;
 
-    if (offsetInBuffer(piece->bufferIndex, piece->end) - 
-        offsetInBuffer(piece->bufferIndex, piece->start) == accumulatedValue) {
-        int32_t realLineCnt = getLineFeedCnt(node->piece->bufferIndex, piece->start, pos);
+    if (offsetInBuffer(piece.bufferIndex, piece.end) - 
+        offsetInBuffer(piece.bufferIndex, piece.start) == accumulatedValue) {
+        Offset realLineCnt = getLineFeedCnt(node->piece.bufferIndex, piece.start, pos);
         if (realLineCnt != lineCnt) {
             return {realLineCnt, 0};
         }
@@ -1104,93 +1982,87 @@ std::pair<int32_t, int32_t> PieceTreeBase::getIndexOf(TreeNode* node, int32_t ac
     return {lineCnt, pos.column};
 }
 
-int32_t PieceTreeBase::getAccumulatedValue(TreeNode* node, int32_t index) {
+Offset PieceTreeBase::getAccumulatedValue(TreeNode* node, Offset index) {
     if (index < 0) {
         return 0;
     }
-    Piece* piece = node->piece;
-    const std::vector<int32_t>& lineStarts = _buffers[piece->bufferIndex].lineStarts;
-    int32_t expectedLineStartIndex = piece->start.line + index + 1;
-    if (expectedLineStartIndex > piece->end.line) {
-        return lineStarts[piece->end.line] + piece->end.column - 
-               lineStarts[piece->start.line] - piece->start.column;
+    Piece piece = node->piece;
+    LineStartsView lineStarts = _buffers[piece.bufferIndex]->getLineStarts();
+    Offset expectedLineStartIndex = piece.start.line + index + 1;
+    if (expectedLineStartIndex > piece.end.line) {
+        return lineStarts[piece.end.line] + piece.end.column - 
+               lineStarts[piece.start.line] - piece.start.column;
     } else {
         return lineStarts[expectedLineStartIndex] - 
-               lineStarts[piece->start.line] - piece->start.column;
+               lineStarts[piece.start.line] - piece.start.column;
     }
 }
 
 void PieceTreeBase::deleteNodeTail(TreeNode* node, const BufferCursor& pos) {
-    Piece* piece = node->piece;
-    int32_t originalLFCnt = piece->lineFeedCnt;
-    int32_t originalEndOffset = offsetInBuffer(piece->bufferIndex, piece->end);
+    Piece piece = node->piece;
+    Offset originalLFCnt = piece.lineFeedCnt;
+    Offset originalEndOffset = offsetInBuffer(piece.bufferIndex, piece.end);
 
     const BufferCursor& newEnd = pos;
-    int32_t newEndOffset = offsetInBuffer(piece->bufferIndex, newEnd);
-    int32_t newLineFeedCnt = getLineFeedCnt(piece->bufferIndex, piece->start, newEnd);
+    Offset newEndOffset = offsetInBuffer(piece.bufferIndex, newEnd);
+    Offset newLineFeedCnt = getLineFeedCnt(piece.bufferIndex, piece.start, newEnd);
 
-    int32_t lf_delta = newLineFeedCnt - originalLFCnt;
-    int32_t size_delta = newEndOffset - originalEndOffset;
-    int32_t newLength = piece->length + size_delta;
+    Offset lf_delta = newLineFeedCnt - originalLFCnt;
+    Offset size_delta = newEndOffset - originalEndOffset;
+    Offset newLength = piece.length + size_delta;
 
-    Piece* newPiece = new Piece(
-        piece->bufferIndex,
-        piece->start,
+    Piece newPiece(
+        piece.bufferIndex,
+        piece.start,
         newEnd,
         newLineFeedCnt,
         newLength
     );
 
-    delete node->piece;
     node->piece = newPiece;
 
     updateTreeMetadata(this, node, size_delta, lf_delta);
 }
 
 void PieceTreeBase::deleteNodeHead(TreeNode* node, const BufferCursor& pos) {
-    Piece* piece = node->piece;
-    int32_t originalLFCnt = piece->lineFeedCnt;
-    int32_t originalStartOffset = offsetInBuffer(piece->bufferIndex, piece->start);
+    Piece piece = node->piece;
+    Offset originalLFCnt = piece.lineFeedCnt;
+    Offset originalStartOffset = offsetInBuffer(piece.bufferIndex, piece.start);
 
     const BufferCursor& newStart = pos;
-    int32_t newLineFeedCnt = getLineFeedCnt(piece->bufferIndex, newStart, piece->end);
-    int32_t newStartOffset = offsetInBuffer(piece->bufferIndex, newStart);
-    int32_t lf_delta = newLineFeedCnt - originalLFCnt;
-    int32_t size_delta = originalStartOffset - newStartOffset;
-    int32_t newLength = piece->length + size_delta;
-
-    Piece* newPiece = new Piece(
-        piece->bufferIndex,
+    Offset newLineFeedCnt = getLineFeedCnt(piece.bufferIndex, newStart, piece.end);
+    Offset newStartOffset = offsetInBuffer(piece.bufferIndex, newStart);
+    Offset lf_delta = newLineFeedCnt - originalLFCnt;
+    Offset size_delta = originalStartOffset - newStartOffset;
+    Offset newLength = piece.length + size_delta;
+
+    Piece newPiece(
+        piece.bufferIndex,
         newStart,
-        piece->end,
+        piece.end,
         newLineFeedCnt,
         newLength
     );
 
-    delete node->piece;
     node->piece = newPiece;
 
     updateTreeMetadata(this, node, size_delta, lf_delta);
 }
 
-// 优化shrinkNode方法，确保在处理大文本时不会发生内存泄漏
 void PieceTreeBase::shrinkNode(TreeNode* node, const BufferCursor& start, const BufferCursor& end) {
-    if (!node || node == SENTINEL) {
+    if (!node || node == _sentinel) {
         return;
     }
     
-    Piece* piece = node->piece;
-    if (!piece) {
-        return;
-    }
+    Piece piece = node->piece;
 
     // 计算新的左侧片段
-    int32_t startOffset = offsetInBuffer(piece->bufferIndex, piece->start);
-    int32_t midStartOffset = offsetInBuffer(piece->bufferIndex, start);
-    int32_t midEndOffset = offsetInBuffer(piece->bufferIndex, end);
-    int32_t endOffset = offsetInBuffer(piece->bufferIndex, piece->end);
+    Offset startOffset = offsetInBuffer(piece.bufferIndex, piece.start);
+    Offset midStartOffset = offsetInBuffer(piece.bufferIndex, start);
+    Offset midEndOffset = offsetInBuffer(piece.bufferIndex, end);
+    Offset endOffset = offsetInBuffer(piece.bufferIndex, piece.end);
     
-    int32_t leftLength = midStartOffset - startOffset;
+    Offset leftLength = midStartOffset - startOffset;
     if (leftLength <= 0) {
         // 如果左侧长度为0或负数，只保留右侧部分
         deleteNodeHead(node, end);
@@ -1198,7 +2070,7 @@ void PieceTreeBase::shrinkNode(TreeNode* node, const BufferCursor& start, const
     }
 
     // 计算新的右侧片段
-    int32_t rightLength = endOffset - midEndOffset;
+    Offset rightLength = endOffset - midEndOffset;
     if (rightLength <= 0) {
         // 如果右侧长度为0或负数，只保留左侧部分
         deleteNodeTail(node, start);
@@ -1206,39 +2078,38 @@ void PieceTreeBase::shrinkNode(TreeNode* node, const BufferCursor& start, const
     }
 
     // 需要分割节点，左侧保留在原节点，右侧创建新节点
-    int32_t totalLF = piece->lineFeedCnt;
-    int32_t leftLFCnt = getLineFeedCnt(piece->bufferIndex, piece->start, start);
-    int32_t middleLFCnt = getLineFeedCnt(piece->bufferIndex, start, end);
-    int32_t rightLFCnt = totalLF - leftLFCnt - middleLFCnt;
+    Offset totalLF = piece.lineFeedCnt;
+    Offset leftLFCnt = getLineFeedCnt(piece.bufferIndex, piece.start, start);
+    Offset middleLFCnt = getLineFeedCnt(piece.bufferIndex, start, end);
+    Offset rightLFCnt = totalLF - leftLFCnt - middleLFCnt;
     
     // 为确保计算正确，防御性检查
     if (rightLFCnt < 0) rightLFCnt = 0;
     
     // 创建右侧片段
-    Piece* rightPiece = new Piece(
-        piece->bufferIndex,
+    Piece rightPiece(
+        piece.bufferIndex,
         end,
-        piece->end,
+        piece.end,
         rightLFCnt,
         rightLength
     );
     
     // 更新左侧片段（当前节点）
-    Piece* leftPiece = new Piece(
-        piece->bufferIndex,
-        piece->start,
+    Piece leftPiece(
+        piece.bufferIndex,
+        piece.start,
         start,
         leftLFCnt,
         leftLength
     );
     
     // 清理原来的piece，防止内存泄漏
-    delete piece;
     node->piece = leftPiece;
     
     // 更新树元数据
-    int32_t sizeDelta = -(rightLength + (midEndOffset - midStartOffset));
-    int32_t lfDelta = -(rightLFCnt + middleLFCnt);
+    Offset sizeDelta = -(rightLength + (midEndOffset - midStartOffset));
+    Offset lfDelta = -(rightLFCnt + middleLFCnt);
     updateTreeMetadata(this, node, sizeDelta, lfDelta);
     
     // 插入右侧节点
@@ -1255,50 +2126,49 @@ void PieceTreeBase::appendToNode(TreeNode* node, const std::string& value) {
     }
 
     const bool hitCRLF = shouldCheckCRLF() && startWithLF(newValue) && endWithCR(node);
-    const int32_t startOffset = _buffers[0].buffer.length();
-    _buffers[0].buffer += newValue;
-    std::vector<int32_t> lineStarts = createLineStartsFast(newValue);
+    const Offset startOffset = _buffers[_changeBufferIndex]->buffer.length();
+    _buffers[_changeBufferIndex]->buffer += newValue;
+    std::vector<Offset> lineStarts = createLineStartsFast(newValue);
     
     for (size_t i = 0; i < lineStarts.size(); i++) {
         lineStarts[i] += startOffset;
     }
     
     if (hitCRLF) {
-        int32_t prevStartOffset = _buffers[0].lineStarts[_buffers[0].lineStarts.size() - 2];
-        _buffers[0].lineStarts.pop_back();
+        Offset prevStartOffset = _buffers[_changeBufferIndex]->lineStarts[_buffers[_changeBufferIndex]->lineStarts.size() - 2];
+        _buffers[_changeBufferIndex]->lineStarts.pop_back();
         _lastChangeBufferPos = {_lastChangeBufferPos.line - 1, 
                               startOffset - prevStartOffset};
     }
 
-    _buffers[0].lineStarts.insert(_buffers[0].lineStarts.end(), 
+    _buffers[_changeBufferIndex]->lineStarts.insert(_buffers[_changeBufferIndex]->lineStarts.end(), 
                                 lineStarts.begin() + 1, lineStarts.end());
     
-    const int32_t endIndex = _buffers[0].lineStarts.size() - 1;
-    const int32_t endColumn = _buffers[0].buffer.length() - _buffers[0].lineStarts[endIndex];
+    const Offset endIndex = _buffers[_changeBufferIndex]->lineStarts.size() - 1;
+    const Offset endColumn = _buffers[_changeBufferIndex]->buffer.length() - _buffers[_changeBufferIndex]->lineStarts[endIndex];
     const BufferCursor newEnd{endIndex, endColumn};
-    const int32_t newLength = node->piece->length + newValue.length();
-    const int32_t oldLineFeedCnt = node->piece->lineFeedCnt;
-    const int32_t newLineFeedCnt = getLineFeedCnt(0, node->piece->start, newEnd);
-    const int32_t lf_delta = newLineFeedCnt - oldLineFeedCnt;
-
-    Piece* newPiece = new Piece(
-        node->piece->bufferIndex,
-        node->piece->start,
+    const Offset newLength = node->piece.length + newValue.length();
+    const Offset oldLineFeedCnt = node->piece.lineFeedCnt;
+    const Offset newLineFeedCnt = getLineFeedCnt(_changeBufferIndex, node->piece.start, newEnd);
+    const Offset lf_delta = newLineFeedCnt - oldLineFeedCnt;
+
+    Piece newPiece(
+        node->piece.bufferIndex,
+        node->piece.start,
         newEnd,
         newLineFeedCnt,
         newLength
     );
 
-    delete node->piece;
     node->piece = newPiece;
 
     _lastChangeBufferPos = newEnd;
     updateTreeMetadata(this, node, newValue.length(), lf_delta);
 }
 
-NodePosition PieceTreeBase::nodeAt(int32_t offset) {
+NodePosition PieceTreeBase::nodeAt(Offset offset) {
     // Safety check - if the offset is out of bounds, return last node
-    int32_t currentLength = getLength();
+    Offset currentLength = getLength();
     if (offset > currentLength) {
         offset = currentLength;
     }
@@ -1310,19 +2180,22 @@ NodePosition PieceTreeBase::nodeAt(int32_t offset) {
         return NodePosition(cache->node, offset - cache->nodeStartOffset, cache->nodeStartOffset);
     }
 
-    int32_t nodeStartOffset = 0;
+    Offset nodeStartOffset = 0;
+    Offset nodeStartLineNumber = 0;
 
-    while (x != SENTINEL) {
+    while (x != _sentinel) {
         if (x->size_left > offset) {
             x = x->left;
-        } else if (x->size_left + x->piece->length >= offset) {
+        } else if (x->size_left + x->piece.length >= offset) {
             nodeStartOffset += x->size_left;
+            nodeStartLineNumber += x->lf_left;
             NodePosition ret(x, offset - x->size_left, nodeStartOffset);
-            _searchCache->set(CacheEntry(x, nodeStartOffset));
+            _searchCache->set(CacheEntry(x, nodeStartOffset, nodeStartLineNumber));
             return ret;
         } else {
-            offset -= x->size_left + x->piece->length;
-            nodeStartOffset += x->size_left + x->piece->length;
+            offset -= x->size_left + x->piece.length;
+            nodeStartOffset += x->size_left + x->piece.length;
+            nodeStartLineNumber += x->lf_left + x->piece.lineFeedCnt;
             x = x->right;
         }
     }
@@ -1330,85 +2203,96 @@ NodePosition PieceTreeBase::nodeAt(int32_t offset) {
     return NodePosition();
 }
 
-NodePosition PieceTreeBase::nodeAt2(int32_t lineNumber, int32_t column) {
+NodePosition PieceTreeBase::nodeAt2(Offset lineNumber, Offset column) {
     // Line numbers in the buffer are 0-based
     TreeNode* x = root;
-    int32_t nodeStartOffset = 0;
+    Offset nodeStartOffset = 0;
+
+    // a node holding the whole line is the one the descent would find
+    if (CacheEntry* cache = _searchCache->getByLine(lineNumber, true)) {
+        Offset lineIndex = lineNumber - cache->nodeStartLineNumber;
+        Offset prevAccumulatedValue = getAccumulatedValue(cache->node, lineIndex - 1);
+        Offset accumualtedValue = getAccumulatedValue(cache->node, lineIndex);
+        return NodePosition(cache->node, std::min(prevAccumulatedValue + column, accumualtedValue),
+                            cache->nodeStartOffset);
+    }
 
-    while (x != SENTINEL) {
-        if (x->left != SENTINEL && x->lf_left >= lineNumber) {
+    const Offset originalLineNumber = lineNumber;
+    while (x != _sentinel) {
+        if (x->left != _sentinel && x->lf_left >= lineNumber) {
             // Line is in left subtree
             x = x->left;
-        } else if (x->lf_left + x->piece->lineFeedCnt > lineNumber) {
+        } else if (x->lf_left + x->piece.lineFeedCnt > lineNumber) {
             // Line is in this node
-            int32_t prevLineIndex = lineNumber - 1;
-            int32_t prevAccumulatedValue = (prevLineIndex >= x->lf_left) ? 
+            Offset prevLineIndex = lineNumber - 1;
+            Offset prevAccumulatedValue = (prevLineIndex >= x->lf_left) ? 
                                           getAccumulatedValue(x, prevLineIndex - x->lf_left) : 0;
-            int32_t accumualtedValue = getAccumulatedValue(x, lineNumber - x->lf_left);
+            Offset accumualtedValue = getAccumulatedValue(x, lineNumber - x->lf_left);
             nodeStartOffset += x->size_left;
+            _searchCache->set(CacheEntry(x, nodeStartOffset, originalLineNumber - lineNumber + x->lf_left));
             
             return NodePosition(x, 
                 std::min(prevAccumulatedValue + column, accumualtedValue),
                 nodeStartOffset);
-        } else if (x->lf_left + x->piece->lineFeedCnt == lineNumber) {
+        } else if (x->lf_left + x->piece.lineFeedCnt == lineNumber) {
             // This node ends exactly at the line we want
-            int32_t prevLineIndex = lineNumber - 1;
-            int32_t prevAccumulatedValue = (prevLineIndex >= x->lf_left) ? 
+            Offset prevLineIndex = lineNumber - 1;
+            Offset prevAccumulatedValue = (prevLineIndex >= x->lf_left) ? 
                                           getAccumulatedValue(x, prevLineIndex - x->lf_left) : 0;
             nodeStartOffset += x->size_left;
             
-            if (prevAccumulatedValue + column <= x->piece->length) {
+            if (prevAccumulatedValue + column <= x->piece.length) {
                 return NodePosition(x, prevAccumulatedValue + column, nodeStartOffset);
             } else {
-                column -= x->piece->length - prevAccumulatedValue;
+                column -= x->piece.length - prevAccumulatedValue;
                 break;
             }
         } else {
             // Line is in right subtree
-            lineNumber -= x->lf_left + x->piece->lineFeedCnt;
-            nodeStartOffset += x->size_left + x->piece->length;
+            lineNumber -= x->lf_left + x->piece.lineFeedCnt;
+            nodeStartOffset += x->size_left + x->piece.length;
             x = x->right;
         }
     }
 
-    x = x->next();
-    while (x != SENTINEL) {
-        if (x->piece->lineFeedCnt > 0) {
-            int32_t accumualtedValue = getAccumulatedValue(x, 0);
-            int32_t nodeStartOffset = offsetOfNode(x);
+    x = x->next(_sentinel);
+    while (x != _sentinel) {
+        if (x->piece.lineFeedCnt > 0) {
+            Offset accumualtedValue = getAccumulatedValue(x, 0);
+            Offset nodeStartOffset = offsetOfNode(x);
             return NodePosition(x, std::min(column, accumualtedValue), nodeStartOffset);
         } else {
-            if (x->piece->length >= column) {
-                int32_t nodeStartOffset = offsetOfNode(x);
+            if (x->piece.length >= column) {
+                Offset nodeStartOffset = offsetOfNode(x);
                 return NodePosition(x, column, nodeStartOffset);
             } else {
-                column -= x->piece->length;
+                column -= x->piece.length;
             }
         }
 
-        x = x->next();
+        x = x->next(_sentinel);
     }
 
     return NodePosition();
 }
 
-uint32_t PieceTreeBase::nodeCharCodeAt(TreeNode* node, int32_t offset) {
-    if (node->piece->lineFeedCnt < 1) {
+uint32_t PieceTreeBase::nodeCharCodeAt(TreeNode* node, Offset offset) {
+    if (node->piece.lineFeedCnt < 1) {
         return 0;
     }
-    const std::string& buffer = _buffers[node->piece->bufferIndex].buffer;
-    int32_t newOffset = offsetInBuffer(node->piece->bufferIndex, node->piece->start) + offset;
+    std::string_view buffer = _buffers[node->piece.bufferIndex]->text();
+    Offset newOffset = offsetInBuffer(node->piece.bufferIndex, node->piece.start) + offset;
     return static_cast<unsigned char>(buffer[newOffset]);
 }
 
-int32_t PieceTreeBase::offsetOfNode(TreeNode* node) {
+Offset PieceTreeBase::offsetOfNode(TreeNode* node) {
     if (!node) {
         return 0;
     }
-    int32_t pos = node->size_left;
+    Offset pos = node->size_left;
     while (node != root) {
         if (node->parent->right == node) {
-            pos += node->parent->size_left + node->parent->piece->length;
+            pos += node->parent->size_left + node->parent->piece.length;
         }
         node = node->parent;
     }
@@ -1427,17 +2311,20 @@ bool PieceTreeBase::startWithLF(const std::string& val) {
 }
 
 bool PieceTreeBase::startWithLF(TreeNode* val) const {
-    if (!val || val == SENTINEL || !val->piece) {
+    if (!val || val == _sentinel) {
         return false;
     }
 
-    BufferCursor start = val->piece->start;
-    if (start.line >= _buffers[val->piece->bufferIndex].lineStarts.size()) {
+    const StringBuffer& buffer = *_buffers[val->piece.bufferIndex];
+    LineStartsView lineStarts = buffer.getLineStarts();
+    BufferCursor start = val->piece.start;
+    if (static_cast<size_t>(start.line) >= lineStarts.size()) {
         return false;
     }
 
-    int32_t pos = _buffers[val->piece->bufferIndex].lineStarts[start.line] + start.column;
-    return pos < _buffers[val->piece->bufferIndex].buffer.length() && _buffers[val->piece->bufferIndex].buffer[pos] == '\n';
+    Offset pos = lineStarts[start.line] + start.column;
+    std::string_view text = buffer.text();
+    return static_cast<size_t>(pos) < text.length() && text[pos] == '\n';
 }
 
 bool PieceTreeBase::endWithCR(const std::string& val) {
@@ -1448,27 +2335,30 @@ bool PieceTreeBase::endWithCR(const std::string& val) {
 }
 
 bool PieceTreeBase::endWithCR(TreeNode* val) const {
-    if (!val || val == SENTINEL || !val->piece) {
+    if (!val || val == _sentinel) {
         return false;
     }
 
-    BufferCursor end = val->piece->end;
-    if (end.line >= _buffers[val->piece->bufferIndex].lineStarts.size()) {
+    const StringBuffer& buffer = *_buffers[val->piece.bufferIndex];
+    LineStartsView lineStarts = buffer.getLineStarts();
+    BufferCursor end = val->piece.end;
+    if (static_cast<size_t>(end.line) >= lineStarts.size()) {
         return false;
     }
 
-    int32_t pos = _buffers[val->piece->bufferIndex].lineStarts[end.line] + end.column;
-    return pos > 0 && pos <= _buffers[val->piece->bufferIndex].buffer.length() && _buffers[val->piece->bufferIndex].buffer[pos - 1] == '\r';
+    Offset pos = lineStarts[end.line] + end.column;
+    std::string_view text = buffer.text();
+    return pos > 0 && static_cast<size_t>(pos) <= text.length() && text[pos - 1] == '\r';
 }
 
 // 验证与前一个节点的CRLF连接
 void PieceTreeBase::validateCRLFWithPrevNode(TreeNode* node) {
-    if (!node || node == SENTINEL || !shouldCheckCRLF()) {
+    if (!node || node == _sentinel || !shouldCheckCRLF()) {
         return;
     }
 
-    TreeNode* prev = node->prev();
-    if (prev == SENTINEL) {
+    TreeNode* prev = node->prev(_sentinel);
+    if (prev == _sentinel) {
         return;
     }
 
@@ -1480,12 +2370,12 @@ void PieceTreeBase::validateCRLFWithPrevNode(TreeNode* node) {
 
 // 验证与后一个节点的CRLF连接
 void PieceTreeBase::validateCRLFWithNextNode(TreeNode* node) {
-    if (!node || node == SENTINEL || !shouldCheckCRLF()) {
+    if (!node || node == _sentinel || !shouldCheckCRLF()) {
         return;
     }
 
-    TreeNode* next = node->next();
-    if (next == SENTINEL) {
+    TreeNode* next = node->next(_sentinel);
+    if (next == _sentinel) {
         return;
     }
 
@@ -1498,86 +2388,81 @@ void PieceTreeBase::validateCRLFWithNextNode(TreeNode* node) {
 void PieceTreeBase::fixCRLF(TreeNode* prev, TreeNode* next) {
     std::vector<TreeNode*> nodesToDel;
     
-    const std::vector<int32_t>& lineStarts = _buffers[prev->piece->bufferIndex].lineStarts;
+    LineStartsView lineStarts = _buffers[prev->piece.bufferIndex]->getLineStarts();
     BufferCursor newEnd;
     
-    if (prev->piece->end.column == 0) {
-        newEnd = {prev->piece->end.line - 1, 
-                 lineStarts[prev->piece->end.line] - lineStarts[prev->piece->end.line - 1] - 1};
+    if (prev->piece.end.column == 0) {
+        newEnd = {prev->piece.end.line - 1, 
+                 lineStarts[prev->piece.end.line] - lineStarts[prev->piece.end.line - 1] - 1};
     } else {
-        newEnd = {prev->piece->end.line, prev->piece->end.column - 1};
+        newEnd = {prev->piece.end.line, prev->piece.end.column - 1};
     }
 
-    const int32_t prevNewLength = prev->piece->length - 1;
-    const int32_t prevNewLFCnt = prev->piece->lineFeedCnt - 1;
+    const Offset prevNewLength = prev->piece.length - 1;
+    const Offset prevNewLFCnt = prev->piece.lineFeedCnt - 1;
     
-    Piece* newPrevPiece = new Piece(
-        prev->piece->bufferIndex,
-        prev->piece->start,
+    Piece newPrevPiece(
+        prev->piece.bufferIndex,
+        prev->piece.start,
         newEnd,
         prevNewLFCnt,
         prevNewLength
     );
 
-    delete prev->piece;
     prev->piece = newPrevPiece;
 
     updateTreeMetadata(this, prev, -1, -1);
-    if (prev->piece->length == 0) {
+    if (prev->piece.length == 0) {
         nodesToDel.push_back(prev);
     }
 
-    BufferCursor newStart{next->piece->start.line + 1, 0};
-    const int32_t newLength = next->piece->length - 1;
-    const int32_t newLineFeedCnt = getLineFeedCnt(next->piece->bufferIndex, newStart, next->piece->end);
+    BufferCursor newStart{next->piece.start.line + 1, 0};
+    const Offset newLength = next->piece.length - 1;
+    const Offset newLineFeedCnt = getLineFeedCnt(next->piece.bufferIndex, newStart, next->piece.end);
     
-    Piece* newNextPiece = new Piece(
-        next->piece->bufferIndex,
+    Piece newNextPiece(
+        next->piece.bufferIndex,
         newStart,
-        next->piece->end,
+        next->piece.end,
         newLineFeedCnt,
         newLength
     );
 
-    delete next->piece;
     next->piece = newNextPiece;
 
     updateTreeMetadata(this, next, -1, -1);
-    if (next->piece->length == 0) {
+    if (next->piece.length == 0) {
         nodesToDel.push_back(next);
     }
 
-    std::vector<Piece*> pieces = createNewPieces("\r\n");
+    std::vector<Piece> pieces = createNewPieces("\r\n");
     rbInsertRight(prev, pieces[0]);
 
-    for (TreeNode* node : nodesToDel) {
-        rbDelete(this, node);
-    }
+    deleteNodes(nodesToDel);
 }
 
 bool PieceTreeBase::adjustCarriageReturnFromNext(const std::string& value, TreeNode* node) {
     if (shouldCheckCRLF() && endWithCR(value)) {
-        TreeNode* nextNode = node->next();
+        TreeNode* nextNode = node->next(_sentinel);
         if (startWithLF(nextNode)) {
             std::string newValue = value + '\n';
 
-            if (nextNode->piece->length == 1) {
-                rbDelete(this, nextNode);
+            if (nextNode->piece.length == 1) {
+                removeNode(nextNode);
             } else {
-                Piece* piece = nextNode->piece;
-                BufferCursor newStart{piece->start.line + 1, 0};
-                const int32_t newLength = piece->length - 1;
-                const int32_t newLineFeedCnt = getLineFeedCnt(piece->bufferIndex, newStart, piece->end);
+                Piece piece = nextNode->piece;
+                BufferCursor newStart{piece.start.line + 1, 0};
+                const Offset newLength = piece.length - 1;
+                const Offset newLineFeedCnt = getLineFeedCnt(piece.bufferIndex, newStart, piece.end);
                 
-                Piece* newPiece = new Piece(
-                    piece->bufferIndex,
+                Piece newPiece(
+                    piece.bufferIndex,
                     newStart,
-                    piece->end,
+                    piece.end,
                     newLineFeedCnt,
                     newLength
                 );
 
-                delete nextNode->piece;
                 nextNode->piece = newPiece;
 
                 updateTreeMetadata(this, nextNode, -1, -1);
@@ -1589,45 +2474,32 @@ bool PieceTreeBase::adjustCarriageReturnFromNext(const std::string& value, TreeN
     return false;
 }
 
-bool PieceTreeBase::iterate(TreeNode* node, const std::function<bool(TreeNode*)>& callback) const {
-    if (node == SENTINEL) {
-        return callback(SENTINEL);
-    }
-
-    bool leftRet = iterate(node->left, callback);
-    if (!leftRet) {
-        return leftRet;
-    }
-
-    return callback(node) && iterate(node->right, callback);
-}
-
 std::string PieceTreeBase::getNodeContent(TreeNode* node) const {
-    if (node == SENTINEL) {
+    if (node == _sentinel) {
         return "";
     }
-    const std::string& buffer = _buffers[node->piece->bufferIndex].buffer;
-    int32_t startOffset = offsetInBuffer(node->piece->bufferIndex, node->piece->start);
-    int32_t endOffset = offsetInBuffer(node->piece->bufferIndex, node->piece->end);
-    return buffer.substr(startOffset, endOffset - startOffset);
+    std::string_view buffer = _buffers[node->piece.bufferIndex]->text();
+    Offset startOffset = offsetInBuffer(node->piece.bufferIndex, node->piece.start);
+    Offset endOffset = offsetInBuffer(node->piece.bufferIndex, node->piece.end);
+    return std::string(buffer.substr(startOffset, endOffset - startOffset));
 }
 
-std::string PieceTreeBase::getPieceContent(Piece* piece) const {
-    const std::string& buffer = _buffers[piece->bufferIndex].buffer;
-    int32_t startOffset = offsetInBuffer(piece->bufferIndex, piece->start);
-    int32_t endOffset = offsetInBuffer(piece->bufferIndex, piece->end);
-    return buffer.substr(startOffset, endOffset - startOffset);
+std::string PieceTreeBase::getPieceContent(const Piece& piece) const {
+    std::string_view buffer = _buffers[piece.bufferIndex]->text();
+    Offset startOffset = offsetInBuffer(piece.bufferIndex, piece.start);
+    Offset endOffset = offsetInBuffer(piece.bufferIndex, piece.end);
+    return std::string(buffer.substr(startOffset, endOffset - startOffset));
 }
 
-int32_t PieceTreeBase::countLineFeedsInNode(TreeNode* node, int32_t startOffset, int32_t endOffset) {
-    if (node->piece->lineFeedCnt < 1) {
+Offset PieceTreeBase::countLineFeedsInNode(TreeNode* node, Offset startOffset, Offset endOffset) {
+    if (node->piece.lineFeedCnt < 1) {
         return 0;
     }
-    const std::string& buffer = _buffers[node->piece->bufferIndex].buffer;
-    int32_t start = offsetInBuffer(node->piece->bufferIndex, node->piece->start) + startOffset;
-    int32_t end = offsetInBuffer(node->piece->bufferIndex, node->piece->start) + endOffset;
-    int32_t count = 0;
-    for (int32_t i = start; i < end; i++) {
+    std::string_view buffer = _buffers[node->piece.bufferIndex]->text();
+    Offset start = offsetInBuffer(node->piece.bufferIndex, node->piece.start) + startOffset;
+    Offset end = offsetInBuffer(node->piece.bufferIndex, node->piece.start) + endOffset;
+    Offset count = 0;
+    for (Offset i = start; i < end; i++) {
         if (static_cast<unsigned char>(buffer[i]) == 10) {
             count++;
         }
@@ -1635,25 +2507,25 @@ int32_t PieceTreeBase::countLineFeedsInNode(TreeNode* node, int32_t startOffset,
     return count;
 }
 
-void PieceTreeBase::deleteNodeRange(TreeNode* node, int32_t startOffset, int32_t endOffset) {
+void PieceTreeBase::deleteNodeRange(TreeNode* node, Offset startOffset, Offset endOffset) {
     if (startOffset == 0) {
         deleteNodeHead(node, positionInBuffer(node, endOffset));
-    } else if (endOffset == node->piece->length) {
+    } else if (endOffset == node->piece.length) {
         deleteNodeTail(node, positionInBuffer(node, startOffset));
     } else {
         shrinkNode(node, positionInBuffer(node, startOffset), positionInBuffer(node, endOffset));
     }
 }
 
-TreeNode* PieceTreeBase::leftest(TreeNode* node) {
-    while (node->left != SENTINEL) {
+TreeNode* PieceTreeBase::leftest(TreeNode* node) const {
+    while (node->left != _sentinel) {
         node = node->left;
     }
     return node;
 }
 
-TreeNode* PieceTreeBase::rightest(TreeNode* node) {
-    while (node->right != SENTINEL) {
+TreeNode* PieceTreeBase::rightest(TreeNode* node) const {
+    while (node->right != _sentinel) {
         node = node->right;
     }
     return node;
@@ -1661,33 +2533,52 @@ TreeNode* PieceTreeBase::rightest(TreeNode* node) {
 
 std::string PieceTreeBase::getContentOfSubTree(TreeNode* node) {
     std::string str;
-    iterate(node, [&](TreeNode* node) {
-        str += getNodeContent(node);
-        return true;
-    });
+    if (node == _sentinel) {
+        return str;
+    }
+    // the right spine adds up the length of the whole subtree
+    Offset length = 0;
+    for (TreeNode* n = node; n != _sentinel; n = n->right) {
+        length += n->size_left + n->piece.length;
+    }
+    str.reserve(length);
+
+    TreeNode* last = rightest(node);
+    for (TreeNode* n = leftest(node);; n = n->next(_sentinel)) {
+        const Piece& piece = n->piece;
+        str.append(_buffers[piece.bufferIndex]->text(), offsetInBuffer(piece.bufferIndex, piece.start), piece.length);
+        if (n == last) {
+            break;
+        }
+    }
     return str;
 }
 
 void PieceTreeBase::initializeSentinel() {
-    SENTINEL->color = NodeColor::Black;
-    SENTINEL->parent = nullptr;
-    SENTINEL->left = nullptr;
-    SENTINEL->right = nullptr;
-    SENTINEL->piece = nullptr;
-    SENTINEL->size_left = 0;
-    SENTINEL->lf_left = 0;
+    _sentinel->color = NodeColor::Black;
+    _sentinel->parent = _sentinel;
+    _sentinel->left = _sentinel;
+    _sentinel->right = _sentinel;
+    _sentinel->piece = Piece();
+    _sentinel->size_left = 0;
+    _sentinel->lf_left = 0;
+}
+
+void PieceTreeBase::deleteText(Offset offset, Offset count) {
+    PersistentEditScope persistentScope(this, offset, count);
+    deleteTextRange(offset, count);
+    persistentScope.commit();
 }
 
-void PieceTreeBase::deleteText(int32_t offset, int32_t count) {
-    _lastVisitedLine.first = 0;
-    _lastVisitedLine.second = "";
+void PieceTreeBase::deleteTextRange(Offset offset, Offset count) {
+    _searchCache->validate(offset);
 
-    if (count <= 0 || root == SENTINEL) {
+    if (count <= 0 || root == _sentinel) {
         return;
     }
 
     // Ensure offset is within bounds
-    int32_t maxLength = getLength();
+    Offset maxLength = getLength();
     if (offset >= maxLength) {
         return; // Offset is beyond the buffer
     }
@@ -1698,21 +2589,21 @@ void PieceTreeBase::deleteText(int32_t offset, int32_t count) {
     }
 
     // For very large deletions, use chunked approach
-    const int32_t CHUNK_SIZE = AverageBufferSize / 2;
+    const Offset CHUNK_SIZE = AverageBufferSize / 2;
     if (count > CHUNK_SIZE && count > maxLength / 10) { // Only chunk if large enough
-        int32_t remaining = count;
-        int32_t currentOffset = offset;
+        Offset remaining = count;
+        Offset currentOffset = offset;
         
         while (remaining > 0) {
-            int32_t deleteSize = std::min(CHUNK_SIZE, remaining);
-            // Handle each chunk with a separate delete operation
-            delete_(currentOffset, deleteSize);
+            Offset deleteSize = std::min(CHUNK_SIZE, remaining);
+            // Handle each chunk with a separate delete, all inside this edit
+            deleteRange(currentOffset, deleteSize);
             
             remaining -= deleteSize;
             // Note: currentOffset doesn't change because content shifts left after deletion
         }
         
-        return; // Already computed buffer metadata in each delete_ call
+        return; // Already computed buffer metadata in each deleteRange call
     }
 
     // Normal deletion flow
@@ -1731,9 +2622,9 @@ void PieceTreeBase::deleteText(int32_t offset, int32_t count) {
         BufferCursor endSplitPosInBuffer = positionInBuffer(startNode, endPosition.remainder);
 
         if (startPosition.nodeStartOffset == offset) {
-            if (count == startNode->piece->length) { // delete entire node
-                TreeNode* next = startNode->next();
-                rbDelete(this, startNode);
+            if (count == startNode->piece.length) { // delete entire node
+                TreeNode* next = startNode->next(_sentinel);
+                removeNode(startNode);
                 validateCRLFWithPrevNode(next);
                 computeBufferMetadata();
                 return;
@@ -1745,7 +2636,7 @@ void PieceTreeBase::deleteText(int32_t offset, int32_t count) {
             return;
         }
 
-        if (startPosition.nodeStartOffset + startNode->piece->length == offset + count) {
+        if (startPosition.nodeStartOffset + startNode->piece.length == offset + count) {
             deleteNodeTail(startNode, startSplitPosInBuffer);
             validateCRLFWithNextNode(startNode);
             computeBufferMetadata();
@@ -1764,7 +2655,7 @@ void PieceTreeBase::deleteText(int32_t offset, int32_t count) {
     BufferCursor startSplitPosInBuffer = positionInBuffer(startNode, startPosition.remainder);
     deleteNodeTail(startNode, startSplitPosInBuffer);
     _searchCache->validate(offset);
-    bool startNodeEmpty = (startNode->piece->length == 0);
+    bool startNodeEmpty = (startNode->piece.length == 0);
     if (startNodeEmpty) {
         nodesToDel.push_back(startNode);
     }
@@ -1772,276 +2663,44 @@ void PieceTreeBase::deleteText(int32_t offset, int32_t count) {
     // Handle end node
     BufferCursor endSplitPosInBuffer = positionInBuffer(endNode, endPosition.remainder);
     deleteNodeHead(endNode, endSplitPosInBuffer);
-    bool endNodeEmpty = (endNode->piece->length == 0);
+    bool endNodeEmpty = (endNode->piece.length == 0);
     if (endNodeEmpty) {
         nodesToDel.push_back(endNode);
     }
 
     // Delete all nodes between start and end (exclusive)
-    TreeNode* secondNode = startNode->next();
-    for (TreeNode* node = secondNode; node != SENTINEL && node != endNode; node = node->next()) {
+    TreeNode* secondNode = startNode->next(_sentinel);
+    for (TreeNode* node = secondNode; node != _sentinel && node != endNode; node = node->next(_sentinel)) {
         nodesToDel.push_back(node);
     }
 
     // Determine nodes for CRLF validation
-    TreeNode* prevNode = startNodeEmpty ? startNode->prev() : startNode;
-    TreeNode* nextNode = endNodeEmpty ? endNode->next() : endNode;
+    TreeNode* prevNode = startNodeEmpty ? startNode->prev(_sentinel) : startNode;
+    TreeNode* nextNode = endNodeEmpty ? endNode->next(_sentinel) : endNode;
     
     // First delete nodes
     deleteNodes(nodesToDel);
     
     // Then handle CRLF connections
-    if (prevNode && prevNode != SENTINEL && nextNode && nextNode != SENTINEL) {
+    if (prevNode && prevNode != _sentinel && nextNode && nextNode != _sentinel) {
         // Check if we need to handle CRLF split across nodes
         if (shouldCheckCRLF() && endWithCR(prevNode) && startWithLF(nextNode)) {
             // Handle the CR+LF sequence
             fixCRLF(prevNode, nextNode);
         }
-    } else if (nextNode && nextNode != SENTINEL) {
+    } else if (nextNode && nextNode != _sentinel) {
         validateCRLFWithPrevNode(nextNode);
-    } else if (prevNode && prevNode != SENTINEL) {
+    } else if (prevNode && prevNode != _sentinel) {
         validateCRLFWithNextNode(prevNode);
     }
     
     computeBufferMetadata();
 }
 
-void PieceTreeBase::fixInsert(PieceTreeBase* tree, TreeNode* x) {
-    while (x != tree->root && x->parent->color == NodeColor::Red) {
-        if (x->parent == x->parent->parent->left) {
-            TreeNode* y = x->parent->parent->right;
-            if (y->color == NodeColor::Red) {
-                x->parent->color = NodeColor::Black;
-                y->color = NodeColor::Black;
-                x->parent->parent->color = NodeColor::Red;
-                x = x->parent->parent;
-            } else {
-                if (x == x->parent->right) {
-                    x = x->parent;
-                    rotateLeft(tree, x);
-                }
-                x->parent->color = NodeColor::Black;
-                x->parent->parent->color = NodeColor::Red;
-                rotateRight(tree, x->parent->parent);
-            }
-        } else {
-            TreeNode* y = x->parent->parent->left;
-            if (y->color == NodeColor::Red) {
-                x->parent->color = NodeColor::Black;
-                y->color = NodeColor::Black;
-                x->parent->parent->color = NodeColor::Red;
-                x = x->parent->parent;
-            } else {
-                if (x == x->parent->left) {
-                    x = x->parent;
-                    rotateRight(tree, x);
-                }
-                x->parent->color = NodeColor::Black;
-                x->parent->parent->color = NodeColor::Red;
-                rotateLeft(tree, x->parent->parent);
-            }
-        }
-    }
-    tree->root->color = NodeColor::Black;
-}
-
-void PieceTreeBase::fixDelete(PieceTreeBase* tree, TreeNode* x) {
-    while (x != tree->root && x->color == NodeColor::Black) {
-        if (x == x->parent->left) {
-            TreeNode* w = x->parent->right;
-            if (w->color == NodeColor::Red) {
-                w->color = NodeColor::Black;
-                x->parent->color = NodeColor::Red;
-                rotateLeft(tree, x->parent);
-                w = x->parent->right;
-            }
-            if (w->left->color == NodeColor::Black && w->right->color == NodeColor::Black) {
-                w->color = NodeColor::Red;
-                x = x->parent;
-            } else {
-                if (w->right->color == NodeColor::Black) {
-                    w->left->color = NodeColor::Black;
-                    w->color = NodeColor::Red;
-                    rotateRight(tree, w);
-                    w = x->parent->right;
-                }
-                w->color = x->parent->color;
-                x->parent->color = NodeColor::Black;
-                w->right->color = NodeColor::Black;
-                rotateLeft(tree, x->parent);
-                x = tree->root;
-            }
-        } else {
-            TreeNode* w = x->parent->left;
-            if (w->color == NodeColor::Red) {
-                w->color = NodeColor::Black;
-                x->parent->color = NodeColor::Red;
-                rotateRight(tree, x->parent);
-                w = x->parent->left;
-            }
-            if (w->right->color == NodeColor::Black && w->left->color == NodeColor::Black) {
-                w->color = NodeColor::Red;
-                x = x->parent;
-            } else {
-                if (w->left->color == NodeColor::Black) {
-                    w->right->color = NodeColor::Black;
-                    w->color = NodeColor::Red;
-                    rotateLeft(tree, w);
-                    w = x->parent->left;
-                }
-                w->color = x->parent->color;
-                x->parent->color = NodeColor::Black;
-                w->left->color = NodeColor::Black;
-                rotateRight(tree, x->parent);
-                x = tree->root;
-            }
-        }
-    }
-    x->color = NodeColor::Black;
-}
-
-void PieceTreeBase::rotateLeft(PieceTreeBase* tree, TreeNode* x) {
-    TreeNode* y = x->right;
-    x->right = y->left;
-    if (y->left != SENTINEL) {
-        y->left->parent = x;
-    }
-    y->parent = x->parent;
-    if (x->parent == SENTINEL) {
-        tree->root = y;
-    } else if (x == x->parent->left) {
-        x->parent->left = y;
-    } else {
-        x->parent->right = y;
-    }
-    y->left = x;
-    x->parent = y;
-
-    // 更新metadata - 修复用于计算节点大小和行数的逻辑
-    // 旧代码: y->size_left = x->size_left + x->left->size_left + x->left->piece->length;
-    // 旧代码: y->lf_left = x->lf_left + x->left->lf_left + x->left->piece->lineFeedCnt;
-    
-    // x成为y的左子节点，所以y的左侧大小现在包括x的大小
-    y->size_left = x->size_left + (x->left != SENTINEL ? x->left->size_left + x->left->piece->length : 0) + x->piece->length;
-    y->lf_left = x->lf_left + (x->left != SENTINEL ? x->left->lf_left + x->left->piece->lineFeedCnt : 0) + x->piece->lineFeedCnt;
-    
-    // x的右子节点变了，需要重新计算x的metadata
-    // x现在的右子节点是y的原左子节点
-    x->size_left = (x->left != SENTINEL ? x->left->size_left + x->left->piece->length : 0);
-    x->lf_left = (x->left != SENTINEL ? x->left->lf_left + x->left->piece->lineFeedCnt : 0);
-}
-
-void PieceTreeBase::rotateRight(PieceTreeBase* tree, TreeNode* y) {
-    TreeNode* x = y->left;
-    y->left = x->right;
-    if (x->right != SENTINEL) {
-        x->right->parent = y;
-    }
-    x->parent = y->parent;
-    if (y->parent == SENTINEL) {
-        tree->root = x;
-    } else if (y == y->parent->right) {
-        y->parent->right = x;
-    } else {
-        y->parent->left = x;
-    }
-    x->right = y;
-    y->parent = x;
-
-    // 更新metadata - 修复用于计算节点大小和行数的逻辑
-    // 旧代码: y->size_left = y->left->size_left + y->left->piece->length;
-    // 旧代码: y->lf_left = y->left->lf_left + y->left->piece->lineFeedCnt;
-    
-    // 更新y的左子树metadata - y的左子节点变成了x的右子节点
-    y->size_left = (y->left != SENTINEL ? y->left->size_left + y->left->piece->length : 0);
-    y->lf_left = (y->left != SENTINEL ? y->left->lf_left + y->left->piece->lineFeedCnt : 0);
-    
-    // 更新x的右子树metadata - x的右子节点变成了y
-    // x原来的右子节点变成了y的左子节点
-    x->size_left = x->left != SENTINEL ? x->left->size_left + x->left->piece->length : 0;
-    x->lf_left = x->left != SENTINEL ? x->left->lf_left + x->left->piece->lineFeedCnt : 0;
-}
-
-void PieceTreeBase::rbDelete(PieceTreeBase* tree, TreeNode* z) {
-    // Adapted from "Introduction to Algorithms" by Cormen et al.
-    TreeNode* y = z;
-    TreeNode* x;
-    NodeColor y_original_color = y->color;
-
-    if (z->left == SENTINEL) {
-        x = z->right;
-        transplant(tree, z, z->right);
-        updateTreeMetadata(tree, x, -z->piece->length, -z->piece->lineFeedCnt);
-    } else if (z->right == SENTINEL) {
-        x = z->left;
-        transplant(tree, z, z->left);
-        updateTreeMetadata(tree, x, -z->piece->length, -z->piece->lineFeedCnt);
-    } else {
-        y = minimum(z->right);
-        y_original_color = y->color;
-        x = y->right;
-
-        if (y->parent == z) {
-            x->parent = y;
-        } else {
-            transplant(tree, y, y->right);
-            y->right = z->right;
-            y->right->parent = y;
-        }
-
-        transplant(tree, z, y);
-        y->left = z->left;
-        y->left->parent = y;
-        y->color = z->color;
-        y->size_left = z->size_left;
-        y->lf_left = z->lf_left;
-    }
-
-    delete z->piece;
-    delete z;
-
-    if (y_original_color == NodeColor::Black) {
-        fixDelete(tree, x);
-    }
-}
-
-TreeNode* PieceTreeBase::minimum(TreeNode* node) {
-    while (node->left != SENTINEL) {
-        node = node->left;
-    }
-    return node;
-}
-
-void PieceTreeBase::transplant(PieceTreeBase* tree, TreeNode* u, TreeNode* v) {
-    if (u->parent == SENTINEL) {
-        tree->root = v;
-    } else if (u == u->parent->left) {
-        u->parent->left = v;
-    } else {
-        u->parent->right = v;
-    }
-    v->parent = u->parent;
-}
-
-void PieceTreeBase::updateMetadata(TreeNode* node) {
-    node->size_left = node->left->size_left + node->left->piece->length;
-    node->lf_left = node->left->lf_left + node->left->piece->lineFeedCnt;
-}
-
-void PieceTreeBase::updateTreeMetadata(PieceTreeBase* tree, TreeNode* x, int32_t lengthDeltaLeft, int32_t lfDeltaLeft) {
-    if (x == SENTINEL) {
-        return;
-    }
-
-    if (lengthDeltaLeft != 0 || lfDeltaLeft != 0) {
-        // Update size_left and lf_left of all nodes in the path to the root
-        TreeNode* node = x;
-        while (node != SENTINEL) {
-            node->size_left += lengthDeltaLeft;
-            node->lf_left += lfDeltaLeft;
-            node = node->parent;
-        }
-    }
+void PieceTreeBase::removeNode(TreeNode* node) {
+    _searchCache->remove(node);
+    rbDelete(this, node);
+    _nodeAllocator.deallocate(node);
 }
 
 int PieceTreeBase::countLineFeeds(const std::string& content) {
@@ -1,17 +1,63 @@
 #include "textbuffer/piece_tree_builder.h"
-#include <regex>
+#include "textbuffer/btree_piece_tree.h"
 #include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
 
 namespace textbuffer {
 
+namespace {
+
+/**
+ * Run body(0) .. body(count - 1) on up to threads threads, the calling one
+ * included. Every index runs once; the first exception is rethrown at the end.
+ */
+template <typename Body>
+void parallelFor(size_t count, unsigned threads, const Body& body) {
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::atomic<bool> failed(false);
+    auto work = [&](std::exception_ptr& myError) {
+        try {
+            for (size_t i = next++; i < count && !failed; i = next++) {
+                body(i);
+            }
+        } catch (...) {
+            myError = std::current_exception();
+            failed = true;
+        }
+    };
+
+    size_t helperCount = std::min<size_t>(threads, count);
+    helperCount = helperCount > 0 ? helperCount - 1 : 0;
+    std::vector<std::exception_ptr> errors(helperCount + 1);
+    std::vector<std::thread> helpers;
+    helpers.reserve(helperCount);
+    for (size_t i = 0; i < helperCount; i++) {
+        helpers.emplace_back(work, std::ref(errors[i + 1]));
+    }
+    work(errors[0]);
+    for (std::thread& helper : helpers) {
+        helper.join();
+    }
+    for (const std::exception_ptr& e : errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+
+} // namespace
+
 // Factory implementation
 
 PieceTreeTextBufferFactory::PieceTreeTextBufferFactory(
     std::vector<StringBuffer> chunks,
     const std::string& bom,
-    int32_t cr,
-    int32_t lf,
-    int32_t crlf,
+    Offset cr,
+    Offset lf,
+    Offset crlf,
     bool normalizeEOL
 ) : _chunks(std::move(chunks)),
     _bom(bom),
@@ -22,8 +68,8 @@ PieceTreeTextBufferFactory::PieceTreeTextBufferFactory(
 }
 
 std::string PieceTreeTextBufferFactory::getEOL(DefaultEndOfLine defaultEOL) {
-    const int32_t totalEOLCount = _cr + _lf + _crlf;
-    const int32_t totalCRCount = _cr + _crlf;
+    const Offset totalEOLCount = _cr + _lf + _crlf;
+    const Offset totalCRCount = _cr + _crlf;
     
     if (totalEOLCount == 0) {
         // This is an empty file or a file with precisely one line
@@ -39,53 +85,73 @@ std::string PieceTreeTextBufferFactory::getEOL(DefaultEndOfLine defaultEOL) {
     return "\n";
 }
 
-std::unique_ptr<PieceTreeBase> PieceTreeTextBufferFactory::create(DefaultEndOfLine defaultEOL) {
+std::unique_ptr<PieceTreeBase> PieceTreeTextBufferFactory::create(DefaultEndOfLine defaultEOL,
+                                                                 PieceTreeBackend backend) {
     std::string eol = getEOL(defaultEOL);
-    std::vector<StringBuffer> chunks = _chunks;
+    std::vector<StringBuffer> chunks;
 
     if (_normalizeEOL &&
         ((eol == "\r\n" && (_cr > 0 || _lf > 0)) ||
          (eol == "\n" && (_cr > 0 || _crlf > 0)))
     ) {
-        // Normalize pieces
-        for (size_t i = 0; i < chunks.size(); i++) {
-            std::string str = chunks[i].buffer;
-            std::regex newlinePattern("\r\n|\r|\n");
-            str = std::regex_replace(str, newlinePattern, eol);
-            std::vector<int32_t> newLineStart = createLineStartsFast(str);
-            chunks[i] = StringBuffer(str, newLineStart);
+        // Normalize pieces in one pass each, leaving those whose line breaks
+        // are all eol already as they are. A \r\n split between two chunks
+        // would still become one eol.
+        chunks.reserve(_chunks.size());
+        EOLNormalizer normalizer(eol);
+        for (size_t i = 0; i < _chunks.size(); i++) {
+            const StringBuffer& chunk = _chunks[i];
+            bool normalized = eol == "\n" ? chunk.cr == 0 && chunk.crlf == 0 : chunk.cr == 0 && chunk.lf == 0;
+            if (normalized && !normalizer.hasPendingCR()) {
+                chunks.push_back(chunk);
+                continue;
+            }
+            std::string str;
+            std::vector<Offset> lineStarts = {0};
+            normalizer.append(chunk.text(), str, &lineStarts);
+            if (i + 1 == _chunks.size()) {
+                normalizer.finish(str, &lineStarts);
+            }
+            Offset breaks = static_cast<Offset>(lineStarts.size() - 1);
+            chunks.emplace_back(std::move(str), LineStarts(std::move(lineStarts), 0, eol == "\n" ? breaks : 0,
+                                                           eol == "\n" ? 0 : breaks, chunk.isBasicASCII));
         }
+    } else {
+        chunks = _chunks;
     }
 
-    auto result = std::make_unique<PieceTreeBase>();
-    result->create(chunks, eol, _normalizeEOL);
+    std::unique_ptr<PieceTreeBase> result;
+    if (backend == PieceTreeBackend::BTree) {
+        result = std::make_unique<BTreePieceTree>();
+    } else {
+        result = std::make_unique<PieceTreeBase>();
+    }
+    result->create(std::move(chunks), eol, _normalizeEOL);
     return result;
 }
 
-std::string PieceTreeTextBufferFactory::getFirstLineText(int32_t lengthLimit) {
-    if (_chunks.empty() || _chunks[0].buffer.empty()) {
+std::string PieceTreeTextBufferFactory::getFirstLineText(Offset lengthLimit) {
+    if (_chunks.empty() || _chunks[0].text().empty()) {
         return "";
     }
     
-    std::string text = _chunks[0].buffer.substr(0, std::min(lengthLimit, static_cast<int32_t>(_chunks[0].buffer.length())));
-    
-    // Split by any newline and take the first part
-    std::regex pattern("\r\n|\r|\n");
-    std::sregex_token_iterator iter(text.begin(), text.end(), pattern, -1);
-    std::sregex_token_iterator end;
-    
-    if (iter != end) {
-        return *iter;
-    }
-    
-    return text;
+    std::string_view first = _chunks[0].text().substr(0, static_cast<size_t>(lengthLimit));
+    // Up to the first line break
+    return std::string(first.substr(0, first.find_first_of("\r\n")));
 }
 
 // Builder implementation
 
-PieceTreeTextBufferBuilder::PieceTreeTextBufferBuilder()
-    : _hasPreviousChar(false), _previousChar(0), cr(0), lf(0), crlf(0) {
+PieceTreeTextBufferBuilder::PieceTreeTextBufferBuilder() : PieceTreeTextBufferBuilder(1) {
+}
+
+PieceTreeTextBufferBuilder::PieceTreeTextBufferBuilder(unsigned scanThreads)
+    : _hasPreviousChar(false), _previousChar(0), _scanThreads(scanThreads), _deferLineStarts(false), cr(0), lf(0),
+      crlf(0) {
     BOM = "";
+    if (_scanThreads == 0) {
+        _scanThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
 }
 
 void PieceTreeTextBufferBuilder::acceptChunk(const std::string& chunk) {
@@ -93,27 +159,82 @@ void PieceTreeTextBufferBuilder::acceptChunk(const std::string& chunk) {
         return;
     }
 
-    if (chunks.empty()) {
-        if (Unicode::startsWithUTF8BOM(chunk)) {
-            BOM = Unicode::UTF8_BOM_CHARACTER;
-            _acceptChunk1(chunk.substr(3), false); // Skip BOM
-        } else {
-            _acceptChunk1(chunk, false);
-        }
+    size_t start = 0;
+    if (chunks.empty() && !_hasPreviousChar && Unicode::startsWithUTF8BOM(chunk)) {
+        BOM = Unicode::UTF8_BOM_CHARACTER;
+        start = 3; // Skip BOM
+    }
+
+    const uint32_t lastChar = chunk[chunk.length() - 1];
+    if (lastChar == static_cast<uint32_t>(common::CharCode::CarriageReturn) || 
+        (lastChar >= 0xD800 && lastChar <= 0xDBFF)) {
+        // Last character is \r or a high surrogate => keep it back, also in the
+        // first chunk, so that a \n starting the next chunk joins it. A chunk of
+        // just that character still flushes the one held back before it.
+        _acceptChunk1(chunk.substr(start, chunk.length() - 1 - start), _hasPreviousChar);
+        _hasPreviousChar = true;
+        _previousChar = lastChar;
     } else {
-        const uint32_t lastChar = chunk[chunk.length() - 1];
-        
-        if (lastChar == static_cast<uint32_t>(common::CharCode::CarriageReturn) || 
-            (lastChar >= 0xD800 && lastChar <= 0xDBFF)) {
-            // Last character is \r or a high surrogate => keep it back
-            _acceptChunk1(chunk.substr(0, chunk.length() - 1), false);
+        _acceptChunk1(chunk.substr(start), false);
+        _hasPreviousChar = false;
+        _previousChar = lastChar;
+    }
+}
+
+void PieceTreeTextBufferBuilder::acceptFile(const std::string& path) {
+    std::shared_ptr<MappedFile> file = MappedFile::open(path);
+    std::string_view text = file->text();
+    if (text.empty()) {
+        return;
+    }
+
+    if (chunks.empty() && !_hasPreviousChar && text.compare(0, 3, Unicode::UTF8_BOM_CHARACTER) == 0) {
+        BOM = Unicode::UTF8_BOM_CHARACTER;
+        text.remove_prefix(3);
+    }
+    if (_hasPreviousChar && !text.empty()) {
+        // The held back \r of the previous chunk goes into a small chunk of its
+        // own, together with the \n it may form a line break with
+        size_t head = (_previousChar == static_cast<uint32_t>(common::CharCode::CarriageReturn) && text[0] == '\n') ? 1 : 0;
+        _acceptChunk1(std::string(text.substr(0, head)), true);
+        _hasPreviousChar = false;
+        text.remove_prefix(head);
+    }
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = std::min(text.size(), pos + MappedChunkSize);
+        if (end < text.size() && text[end - 1] == '\r' && text[end] == '\n') {
+            // never split a \r\n between two buffers
+            end++;
+        }
+        std::string_view window = text.substr(pos, end - pos);
+        pos = end;
+
+        _hasPreviousChar = false;
+        if (pos == text.size() && window.back() == '\r') {
+            // keep it back like acceptChunk does, a following chunk may start with \n
+            window.remove_suffix(1);
             _hasPreviousChar = true;
-            _previousChar = lastChar;
-        } else {
-            _acceptChunk1(chunk, false);
-            _hasPreviousChar = false;
-            _previousChar = lastChar;
+            _previousChar = static_cast<uint32_t>(common::CharCode::CarriageReturn);
+        }
+        if (window.empty()) {
+            continue;
+        }
+        if (_scanThreads > 1) {
+            // scanned and released in finish
+            _unscanned.push_back(chunks.size());
+            chunks.emplace_back(file, window, LineStarts({}, 0, 0, 0, true));
+            continue;
         }
+
+        LineStarts lineStarts = _deferLineStarts ? countLineBreaks(window) : createLineStarts(window);
+        cr += lineStarts.cr;
+        lf += lineStarts.lf;
+        crlf += lineStarts.crlf;
+        chunks.emplace_back(file, window, std::move(lineStarts));
+        // the scan touched every page of the window, let them go again
+        file->release(window.data() - file->data(), window.size());
     }
 }
 
@@ -134,16 +255,113 @@ void PieceTreeTextBufferBuilder::_acceptChunk1(const std::string& chunk, bool al
 }
 
 void PieceTreeTextBufferBuilder::_acceptChunk2(const std::string& chunk) {
-    LineStarts lineStarts = createLineStarts(chunk);
-    
-    chunks.emplace_back(chunk, lineStarts.lineStarts);
+    if (_scanThreads > 1) {
+        _unscanned.push_back(chunks.size());
+        chunks.emplace_back(chunk, LineStarts({}, 0, 0, 0, true));
+        return;
+    }
+
+    LineStarts lineStarts = _deferLineStarts ? countLineBreaks(chunk) : createLineStarts(chunk);
     cr += lineStarts.cr;
     lf += lineStarts.lf;
     crlf += lineStarts.crlf;
+    // the scan has the counts already, no need to count again
+    chunks.emplace_back(chunk, std::move(lineStarts));
+}
+
+void PieceTreeTextBufferBuilder::_scanUnscanned() {
+    if (_unscanned.empty()) {
+        return;
+    }
+
+    // Cut every chunk into segments, never between the \r and \n of a \r\n,
+    // so that each segment scans to exactly the line starts it has in the chunk
+    struct Segment {
+        size_t chunk;
+        size_t begin;
+        size_t end;
+        size_t output;  // where its line starts go in the chunk's line starts
+    };
+    std::vector<Segment> segments;
+    for (size_t index : _unscanned) {
+        std::string_view text = chunks[index].text();
+        size_t pos = 0;
+        do {
+            size_t end = std::min(text.size(), pos + ParallelScanSegment);
+            if (end < text.size() && text[end - 1] == '\r' && text[end] == '\n') {
+                end++;
+            }
+            segments.push_back({index, pos, end, 0});
+            pos = end;
+        } while (pos < text.size());
+    }
+
+    std::vector<LineStarts> results(segments.size(), LineStarts({}, 0, 0, 0, true));
+    parallelFor(segments.size(), _scanThreads, [&](size_t i) {
+        const Segment& segment = segments[i];
+        const StringBuffer& chunk = chunks[segment.chunk];
+        std::string_view text = chunk.text().substr(segment.begin, segment.end - segment.begin);
+        results[i] = _deferLineStarts ? countLineBreaks(text) : createLineStarts(text);
+        if (chunk.isMapped()) {
+            // the scan touched every page of the segment, let them go again
+            chunk.mapping->release(text.data() - chunk.mapping->data(), text.size());
+        }
+    });
+
+    // Add up the counts in chunk order and lay out the merged line starts
+    std::vector<size_t> copies;
+    for (size_t i = 0; i < segments.size();) {
+        StringBuffer& chunk = chunks[segments[i].chunk];
+        size_t first = i;
+        size_t starts = 1;
+        chunk.cr = chunk.lf = chunk.crlf = 0;
+        chunk.isBasicASCII = true;
+        for (; i < segments.size() && segments[i].chunk == segments[first].chunk; i++) {
+            segments[i].output = starts;
+            starts += results[i].lineStarts.size() - 1;
+            chunk.cr += results[i].cr;
+            chunk.lf += results[i].lf;
+            chunk.crlf += results[i].crlf;
+            chunk.isBasicASCII = chunk.isBasicASCII && results[i].isBasicASCII;
+        }
+        cr += chunk.cr;
+        lf += chunk.lf;
+        crlf += chunk.crlf;
+        if (_deferLineStarts) {
+            continue;
+        }
+        if (i - first == 1) {
+            chunk.lineStarts = std::move(results[first].lineStarts);
+        } else {
+            chunk.lineStarts.assign(starts, 0);
+            for (size_t j = first; j < i; j++) {
+                copies.push_back(j);
+            }
+        }
+    }
+
+    // Segments after the first start at an offset inside their chunk
+    parallelFor(copies.size(), _scanThreads, [&](size_t i) {
+        const Segment& segment = segments[copies[i]];
+        std::vector<Offset>& part = results[copies[i]].lineStarts;
+        Offset* out = chunks[segment.chunk].lineStarts.data() + segment.output;
+        const Offset base = static_cast<Offset>(segment.begin);
+        for (size_t j = 1; j < part.size(); j++) {
+            *out++ = base + part[j];
+        }
+        std::vector<Offset>().swap(part);
+    });
+    _unscanned.clear();
 }
 
 PieceTreeTextBufferFactory PieceTreeTextBufferBuilder::finish(bool normalizeEOL) {
     _finish();
+    _scanUnscanned();
+    if (_deferLineStarts) {
+        for (StringBuffer& chunk : chunks) {
+            chunk.deferLineStarts();
+        }
+    }
     return PieceTreeTextBufferFactory(
         chunks,
         BOM,
@@ -163,75 +381,29 @@ void PieceTreeTextBufferBuilder::_finish() {
         _hasPreviousChar = false;
         // Recreate last chunk
         StringBuffer& lastChunk = chunks[chunks.size() - 1];
-        lastChunk.buffer.push_back(static_cast<char>(_previousChar));
-        std::vector<int32_t> newLineStarts = createLineStartsFast(lastChunk.buffer);
-        lastChunk.lineStarts = newLineStarts;
-        
-        if (_previousChar == static_cast<uint32_t>(common::CharCode::CarriageReturn)) {
-            cr++;
-        }
-    }
-}
-
-// Helper functions implementation
-
-std::vector<int32_t> createLineStartsFast(const std::string& str) {
-    std::vector<int32_t> r = {0};
-
-    for (size_t i = 0, len = str.length(); i < len; i++) {
-        const auto chr = static_cast<uint8_t>(str[i]);
-
-        if (chr == static_cast<uint8_t>(common::CharCode::CarriageReturn)) {
-            if (i + 1 < len && static_cast<uint8_t>(str[i + 1]) == static_cast<uint8_t>(common::CharCode::LineFeed)) {
-                // \r\n case
-                r.push_back(static_cast<int32_t>(i + 2));
-                i++; // skip \n
-            } else {
-                // \r case
-                r.push_back(static_cast<int32_t>(i + 1));
-            }
-        } else if (chr == static_cast<uint8_t>(common::CharCode::LineFeed)) {
-            // \n case
-            r.push_back(static_cast<int32_t>(i + 1));
-        }
-    }
-
-    return r;
-}
-
-LineStarts createLineStarts(const std::string& str) {
-    std::vector<int32_t> r = {0};
-    int32_t cr = 0, lf = 0, crlf = 0;
-    bool isBasicASCII = true;
-
-    for (size_t i = 0, len = str.length(); i < len; i++) {
-        const auto chr = static_cast<uint8_t>(str[i]);
-
-        if (chr == static_cast<uint8_t>(common::CharCode::CarriageReturn)) {
-            if (i + 1 < len && static_cast<uint8_t>(str[i + 1]) == static_cast<uint8_t>(common::CharCode::LineFeed)) {
-                // \r\n case
-                crlf++;
-                r.push_back(static_cast<int32_t>(i + 2));
-                i++; // skip \n
-            } else {
-                // \r case
+        if (lastChunk.isMapped()) {
+            // mapped text is read-only, the character becomes a chunk of its own
+            std::string tail(1, static_cast<char>(_previousChar));
+            chunks.emplace_back(tail, createLineStartsFast(tail));
+            if (_previousChar == static_cast<uint32_t>(common::CharCode::CarriageReturn)) {
                 cr++;
-                r.push_back(static_cast<int32_t>(i + 1));
             }
-        } else if (chr == static_cast<uint8_t>(common::CharCode::LineFeed)) {
-            // \n case
-            lf++;
-            r.push_back(static_cast<int32_t>(i + 1));
-        } else {
-            if (isBasicASCII) {
-                if (chr != static_cast<uint8_t>(common::CharCode::Tab) && (chr < 32 || chr > 126)) {
-                    isBasicASCII = false;
-                }
+            return;
+        }
+        lastChunk.buffer.push_back(static_cast<char>(_previousChar));
+        if (!_unscanned.empty() && _unscanned.back() == chunks.size() - 1) {
+            // counted by the scan in finish
+            return;
+        }
+        if (_previousChar == static_cast<uint32_t>(common::CharCode::CarriageReturn)) {
+            // nothing follows it, so it is a line break of its own
+            if (!_deferLineStarts) {
+                lastChunk.lineStarts.push_back(static_cast<Offset>(lastChunk.buffer.size()));
             }
+            lastChunk.cr++;
+            cr++;
         }
     }
-
-    return LineStarts(r, cr, lf, crlf, isBasicASCII);
 }
 
 } // namespace textbuffer 
\ No newline at end of file
@@ -0,0 +1,285 @@
+#include "textbuffer/piece_tree_loader.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace textbuffer {
+
+namespace {
+
+struct ScannedChunk {
+    std::string text;
+    std::unique_ptr<LineStarts> lineStarts;
+};
+
+/**
+ * Threads that scan the line starts of the chunks pushed to them
+ */
+class ScanPool {
+public:
+    ScanPool(unsigned threads, std::function<void(ScannedChunk&)> scan) : _scan(std::move(scan)), _pending(0), _closed(false) {
+        for (unsigned i = 0; i < threads; i++) {
+            _threads.emplace_back([this]() { work(); });
+        }
+    }
+
+    ~ScanPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closed = true;
+        }
+        _jobReady.notify_all();
+        for (std::thread& thread : _threads) {
+            thread.join();
+        }
+    }
+
+    // the chunk must stay where it is until it is scanned
+    void push(ScannedChunk* chunk) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _jobs.push_back(chunk);
+            _pending++;
+        }
+        _jobReady.notify_one();
+    }
+
+    /**
+     * Wait until every pushed chunk is scanned, calling onScanned after each
+     */
+    void waitIdle(const std::function<void()>& onScanned) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (_pending > 0) {
+            size_t before = _pending;
+            _chunkScanned.wait(lock, [&]() { return _pending < before; });
+            lock.unlock();
+            onScanned();
+            lock.lock();
+        }
+        if (_error) {
+            std::rethrow_exception(_error);
+        }
+    }
+
+private:
+    std::function<void(ScannedChunk&)> _scan;
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _jobReady;
+    std::condition_variable _chunkScanned;
+    std::deque<ScannedChunk*> _jobs;
+    size_t _pending;
+    bool _closed;
+    std::exception_ptr _error;
+
+    void work() {
+        for (;;) {
+            ScannedChunk* chunk;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _jobReady.wait(lock, [this]() { return !_jobs.empty() || _closed; });
+                if (_jobs.empty()) {
+                    return;
+                }
+                chunk = _jobs.front();
+                _jobs.pop_front();
+            }
+            std::exception_ptr error;
+            try {
+                _scan(*chunk);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (error && !_error) {
+                    _error = error;
+                }
+                _pending--;
+            }
+            _chunkScanned.notify_all();
+        }
+    }
+};
+
+} // namespace
+
+PieceTreeLoader::PieceTreeLoader(LoadOptions options)
+    : _options(options), _running(false), _cancelled(false), _totalBytes(0), _bytesRead(0), _bytesScanned(0),
+      _linesFound(0) {}
+
+PieceTreeLoader::~PieceTreeLoader() {
+    cancel();
+    wait();
+}
+
+std::future<std::unique_ptr<PieceTreeBase>> PieceTreeLoader::load(const std::string& path, ProgressCallback onProgress) {
+    auto promise = std::make_shared<std::promise<std::unique_ptr<PieceTreeBase>>>();
+    std::future<std::unique_ptr<PieceTreeBase>> future = promise->get_future();
+    start(path, [promise](std::unique_ptr<PieceTreeBase> tree, std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value(std::move(tree));
+        }
+    }, std::move(onProgress));
+    return future;
+}
+
+void PieceTreeLoader::load(const std::string& path, CompletionCallback onDone, ProgressCallback onProgress) {
+    start(path, std::move(onDone), std::move(onProgress));
+}
+
+LoadProgress PieceTreeLoader::progress() const {
+    LoadProgress progress;
+    progress.totalBytes = _totalBytes.load();
+    progress.bytesRead = _bytesRead.load();
+    progress.bytesScanned = _bytesScanned.load();
+    progress.linesFound = _linesFound.load();
+    return progress;
+}
+
+void PieceTreeLoader::cancel() {
+    _cancelled = true;
+}
+
+void PieceTreeLoader::wait() {
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+void PieceTreeLoader::start(const std::string& path, CompletionCallback onDone, ProgressCallback onProgress) {
+    if (_running) {
+        throw std::runtime_error("A load is already running");
+    }
+    wait();
+    _cancelled = false;
+    _totalBytes = 0;
+    _bytesRead = 0;
+    _bytesScanned = 0;
+    _linesFound = 0;
+    _running = true;
+    _thread = std::thread([this, path, onDone = std::move(onDone), onProgress = std::move(onProgress)]() {
+        std::unique_ptr<PieceTreeBase> tree;
+        std::exception_ptr error;
+        try {
+            tree = run(path, onProgress);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        _running = false;
+        onDone(std::move(tree), error);
+    });
+}
+
+std::unique_ptr<PieceTreeBase> PieceTreeLoader::run(const std::string& path, const ProgressCallback& onProgress) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    _totalBytes = static_cast<size_t>(file.tellg());
+    file.seekg(0);
+
+    auto report = [&]() {
+        if (onProgress) {
+            onProgress(progress());
+        }
+    };
+    auto checkCancelled = [&]() {
+        if (_cancelled) {
+            throw std::runtime_error("Loading " + path + " was cancelled");
+        }
+    };
+
+    unsigned workers = _options.workers;
+    if (workers == 0) {
+        unsigned hardwareThreads = std::thread::hardware_concurrency();
+        workers = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+    const size_t chunkSize = std::max<size_t>(_options.chunkSize, 1024);
+
+    // a deque keeps the chunks in place while the workers scan them
+    std::deque<ScannedChunk> chunks;
+    std::string bom;
+    {
+        ScanPool pool(workers, [this](ScannedChunk& chunk) {
+            if (_cancelled) {
+                return;
+            }
+            chunk.lineStarts = std::make_unique<LineStarts>(
+                _options.deferLineStarts ? countLineBreaks(chunk.text) : createLineStarts(chunk.text));
+            _bytesScanned += chunk.text.size();
+            _linesFound += chunk.lineStarts->cr + chunk.lineStarts->lf + chunk.lineStarts->crlf;
+        });
+
+        std::string carry;  // a \r at the end of a chunk waits for a \n in the next one
+        bool first = true;
+        for (;;) {
+            checkCancelled();
+            std::string text = std::move(carry);
+            carry.clear();
+            size_t kept = text.size();
+            text.resize(kept + chunkSize);
+            file.read(&text[kept], static_cast<std::streamsize>(chunkSize));
+            size_t got = static_cast<size_t>(file.gcount());
+            text.resize(kept + got);
+            _bytesRead += got;
+            bool atEnd = got < chunkSize;
+
+            if (first) {
+                first = false;
+                if (Unicode::startsWithUTF8BOM(text)) {
+                    bom = Unicode::UTF8_BOM_CHARACTER;
+                    text.erase(0, 3);
+                }
+            }
+            if (!atEnd && !text.empty() && text.back() == '\r') {
+                carry = "\r";
+                text.pop_back();
+            }
+            if (!text.empty()) {
+                chunks.emplace_back();
+                chunks.back().text = std::move(text);
+                pool.push(&chunks.back());
+            }
+            report();
+            if (atEnd) {
+                break;
+            }
+        }
+        if (file.bad()) {
+            throw std::runtime_error("Cannot read " + path);
+        }
+        pool.waitIdle(report);
+    }
+    checkCancelled();
+
+    // Same as PieceTreeTextBufferBuilder::finish, with the line starts already known
+    std::vector<StringBuffer> buffers;
+    buffers.reserve(chunks.size() + 1);
+    Offset cr = 0;
+    Offset lf = 0;
+    Offset crlf = 0;
+    for (ScannedChunk& chunk : chunks) {
+        cr += chunk.lineStarts->cr;
+        lf += chunk.lineStarts->lf;
+        crlf += chunk.lineStarts->crlf;
+        buffers.emplace_back(std::move(chunk.text), std::move(*chunk.lineStarts));
+        if (_options.deferLineStarts) {
+            buffers.back().deferLineStarts();
+        }
+    }
+    chunks.clear();
+    if (buffers.empty()) {
+        buffers.emplace_back("", std::vector<Offset>{0});
+    }
+    PieceTreeTextBufferFactory factory(std::move(buffers), bom, cr, lf, crlf, _options.normalizeEOL);
+    return factory.create(_options.defaultEOL, _options.backend);
+}
+
+} // namespace textbuffer
@@ -2,21 +2,33 @@
 
 namespace textbuffer {
 
+namespace {
+
+std::string getSharedPieceContent(const SharedPiece& shared) {
+    const Piece& piece = shared.piece;
+    Offset start = shared.buffer->getLineStarts()[piece.start.line] + piece.start.column;
+    return std::string(shared.buffer->text().substr(start, piece.length));
+}
+
+} // namespace
+
 PieceTreeSnapshot::PieceTreeSnapshot(PieceTreeBase* tree, const std::string& BOM)
-    : _index(0), _tree(tree), _BOM(BOM) {
-    
-    if (tree->root != SENTINEL) {
-        tree->iterate(tree->root, [&](TreeNode* node) {
-            if (node != SENTINEL) {
-                _pieces.push_back(node->piece);
-            }
-            return true;
-        });
+    : _index(0), _BOM(BOM) {
+    auto pieces = std::make_shared<std::vector<SharedPiece>>(tree->collectPieces(0, tree->getLength()));
+    // appending would move the text and line starts the pieces read from
+    const std::shared_ptr<StringBuffer>& changeBuffer = tree->_buffers[tree->_changeBufferIndex];
+    for (const SharedPiece& shared : *pieces) {
+        if (shared.buffer == changeBuffer) {
+            tree->_changeBufferFrozen = true;
+            break;
+        }
     }
+    _pieces = std::move(pieces);
 }
 
 std::string PieceTreeSnapshot::read() {
-    if (_pieces.empty()) {
+    const std::vector<SharedPiece>& pieces = *_pieces;
+    if (pieces.empty()) {
         if (_index == 0) {
             _index++;
             return _BOM;
@@ -25,15 +37,39 @@ std::string PieceTreeSnapshot::read() {
         }
     }
 
-    if (_index > _pieces.size() - 1) {
+    if (_index > pieces.size() - 1) {
         return "";
     }
 
     if (_index == 0) {
-        return _BOM + _tree->getPieceContent(_pieces[_index++]);
+        return _BOM + getSharedPieceContent(pieces[_index++]);
     }
     
-    return _tree->getPieceContent(_pieces[_index++]);
+    return getSharedPieceContent(pieces[_index++]);
+}
+
+PersistentPieceTreeSnapshot::PersistentPieceTreeSnapshot(PersistentPieceTree tree, const std::string& BOM)
+    : _tree(std::move(tree)), _next(_tree.root().get()), _started(false), _BOM(BOM) {}
+
+std::string PersistentPieceTreeSnapshot::read() {
+    std::string prefix;
+    if (!_started) {
+        _started = true;
+        prefix = _BOM;
+    }
+
+    while (_next) {
+        _stack.push_back(_next);
+        _next = _next->left.get();
+    }
+    if (_stack.empty()) {
+        return prefix;
+    }
+
+    const PersistentNode* node = _stack.back();
+    _stack.pop_back();
+    _next = node->right.get();
+    return prefix + PersistentPieceTree::getPieceContent(*node);
 }
 
-} // namespace textbuffer 
\ No newline at end of file
+} // namespace textbuffer
@@ -1,22 +1,10 @@
 #include "textbuffer/rb_tree_base.h"
 #include "textbuffer/piece_tree_base.h"
+#include <new>
 
 namespace textbuffer {
 
-// Initialize the sentinel node
-static TreeNode _SENTINEL_INSTANCE(nullptr, NodeColor::Black);
-TreeNode* SENTINEL = &_SENTINEL_INSTANCE;
-
-void initializeSentinel() {
-    SENTINEL->parent = SENTINEL;
-    SENTINEL->left = SENTINEL;
-    SENTINEL->right = SENTINEL;
-    SENTINEL->color = NodeColor::Black;
-    SENTINEL->size_left = 0;
-    SENTINEL->lf_left = 0;
-}
-
-TreeNode::TreeNode(Piece* piece, NodeColor color) : piece(piece), color(color) {
+TreeNode::TreeNode(const Piece& piece, NodeColor color) : color(color), piece(piece) {
     size_left = 0;
     lf_left = 0;
     parent = this;
@@ -24,14 +12,14 @@ TreeNode::TreeNode(Piece* piece, NodeColor color) : piece(piece), color(color) {
     right = this;
 }
 
-TreeNode* TreeNode::next() {
-    if (right != SENTINEL) {
-        return leftest(right);
+TreeNode* TreeNode::next(TreeNode* sentinel) {
+    if (right != sentinel) {
+        return leftest(right, sentinel);
     }
 
     TreeNode* node = this;
 
-    while (node->parent != SENTINEL) {
+    while (node->parent != sentinel) {
         if (node->parent->left == node) {
             break;
         }
@@ -39,21 +27,21 @@ TreeNode* TreeNode::next() {
         node = node->parent;
     }
 
-    if (node->parent == SENTINEL) {
-        return SENTINEL;
+    if (node->parent == sentinel) {
+        return sentinel;
     } else {
         return node->parent;
     }
 }
 
-TreeNode* TreeNode::prev() {
-    if (left != SENTINEL) {
-        return righttest(left);
+TreeNode* TreeNode::prev(TreeNode* sentinel) {
+    if (left != sentinel) {
+        return righttest(left, sentinel);
     }
 
     TreeNode* node = this;
 
-    while (node->parent != SENTINEL) {
+    while (node->parent != sentinel) {
         if (node->parent->right == node) {
             break;
         }
@@ -61,8 +49,8 @@ TreeNode* TreeNode::prev() {
         node = node->parent;
     }
 
-    if (node->parent == SENTINEL) {
-        return SENTINEL;
+    if (node->parent == sentinel) {
+        return sentinel;
     } else {
         return node->parent;
     }
@@ -74,133 +62,173 @@ void TreeNode::detach() {
     right = nullptr;
 }
 
-TreeNode* leftest(TreeNode* node) {
-    while (node->left != SENTINEL) {
+TreeNodeAllocator::TreeNodeAllocator()
+    : _currentBlock(0), _nextSlot(NodesPerBlock), _freeList(nullptr), _liveCount(0), _blockAllocations(0) {}
+
+TreeNodeAllocator::TreeNodeAllocator(TreeNodeAllocator&& other) noexcept
+    : _blocks(std::move(other._blocks)),
+      _currentBlock(other._currentBlock),
+      _nextSlot(other._nextSlot),
+      _freeList(other._freeList),
+      _liveCount(other._liveCount),
+      _blockAllocations(other._blockAllocations) {
+    other.releaseAll();
+}
+
+TreeNodeAllocator& TreeNodeAllocator::operator=(TreeNodeAllocator&& other) noexcept {
+    if (this != &other) {
+        _blocks = std::move(other._blocks);
+        _currentBlock = other._currentBlock;
+        _nextSlot = other._nextSlot;
+        _freeList = other._freeList;
+        _liveCount = other._liveCount;
+        _blockAllocations = other._blockAllocations;
+        other.releaseAll();
+    }
+    return *this;
+}
+
+TreeNode* TreeNodeAllocator::allocate(const Piece& piece, NodeColor color) {
+    void* slot;
+    if (_freeList) {
+        slot = _freeList;
+        _freeList = _freeList->parent;
+    } else {
+        if (_nextSlot == NodesPerBlock) {
+            if (_blocks.empty() || _currentBlock + 1 >= _blocks.size()) {
+                _blocks.emplace_back(new Slot[NodesPerBlock]);
+                _blockAllocations++;
+                _currentBlock = _blocks.size() - 1;
+            } else {
+                _currentBlock++;
+            }
+            _nextSlot = 0;
+        }
+        slot = &_blocks[_currentBlock][_nextSlot++];
+    }
+
+    _liveCount++;
+    return new (slot) TreeNode(piece, color);
+}
+
+void TreeNodeAllocator::deallocate(TreeNode* node) {
+    // TreeNode is trivially destructible, the slot is simply chained up.
+    node->parent = _freeList;
+    _freeList = node;
+    _liveCount--;
+}
+
+void TreeNodeAllocator::reset() {
+    _currentBlock = 0;
+    _nextSlot = _blocks.empty() ? NodesPerBlock : 0;
+    _freeList = nullptr;
+    _liveCount = 0;
+}
+
+void TreeNodeAllocator::releaseAll() {
+    _blocks.clear();
+    reset();
+}
+
+TreeNode* leftest(TreeNode* node, TreeNode* sentinel) {
+    while (node->left != sentinel) {
         node = node->left;
     }
     return node;
 }
 
-TreeNode* righttest(TreeNode* node) {
-    while (node->right != SENTINEL) {
+TreeNode* righttest(TreeNode* node, TreeNode* sentinel) {
+    while (node->right != sentinel) {
         node = node->right;
     }
     return node;
 }
 
-int32_t calculateSize(TreeNode* node) {
-    if (node == SENTINEL) {
-        return 0;
+Offset calculateSize(TreeNode* node, TreeNode* sentinel) {
+    Offset size = 0;
+    while (node != sentinel) {
+        size += node->size_left + node->piece.length;
+        node = node->right;
     }
-    return node->size_left + node->piece->length + calculateSize(node->right);
+    return size;
 }
 
-int32_t calculateLF(TreeNode* node) {
-    if (node == SENTINEL) {
-        return 0;
+Offset calculateLF(TreeNode* node, TreeNode* sentinel) {
+    Offset lf = 0;
+    while (node != sentinel) {
+        lf += node->lf_left + node->piece.lineFeedCnt;
+        node = node->right;
     }
-    return node->lf_left + node->piece->lineFeedCnt + calculateLF(node->right);
+    return lf;
 }
 
-void resetSentinel() {
-    SENTINEL->parent = SENTINEL;
+void resetSentinel(PieceTreeBase* tree) {
+    TreeNode* sentinel = tree->sentinel();
+    sentinel->parent = sentinel;
 }
 
 void leftRotate(PieceTreeBase* tree, TreeNode* x) {
-    if (!x || x == SENTINEL || x->right == SENTINEL) {
-        return;  // 防御性检查
-    }
-
+    TreeNode* sentinel = tree->sentinel();
     TreeNode* y = x->right;
 
-    // 保存旧的元数据值用于后续更新
-    int32_t oldSizeLeftX = x->size_left;
-    int32_t oldLFLeftX = x->lf_left;
-    int32_t nodeSizeX = (x->piece ? x->piece->length : 0);
-    int32_t nodeLFX = (x->piece ? x->piece->lineFeedCnt : 0);
-    
-    // 执行旋转
+    // fix size_left
+    y->size_left += x->size_left + x->piece.length;
+    y->lf_left += x->lf_left + x->piece.lineFeedCnt;
     x->right = y->left;
-    if (y->left != SENTINEL) {
+
+    if (y->left != sentinel) {
         y->left->parent = x;
     }
-    
     y->parent = x->parent;
-    if (x->parent == SENTINEL) {
+    if (x->parent == sentinel) {
         tree->root = y;
     } else if (x->parent->left == x) {
         x->parent->left = y;
     } else {
         x->parent->right = y;
     }
-    
     y->left = x;
     x->parent = y;
-    
-    // 更新元数据
-    // 旋转后，y节点左侧的size和lf需要包含x和x的左子树
-    y->size_left = oldSizeLeftX + nodeSizeX;
-    y->lf_left = oldLFLeftX + nodeLFX;
-    
-    // 重新计算x的子树元数据
-    recomputeTreeMetadata(tree, x);
 }
 
 void rightRotate(PieceTreeBase* tree, TreeNode* y) {
-    if (!y || y == SENTINEL || y->left == SENTINEL) {
-        return;  // 防御性检查
-    }
-
+    TreeNode* sentinel = tree->sentinel();
     TreeNode* x = y->left;
-    
-    // 保存旧的元数据值用于后续更新
-    int32_t oldSizeLeftY = y->size_left;
-    int32_t oldLFLeftY = y->lf_left;
-    int32_t nodeSizeX = (x->piece ? x->piece->length : 0);
-    int32_t nodeLFX = (x->piece ? x->piece->lineFeedCnt : 0);
-    int32_t rightTreeSizeX = calculateSize(x->right);
-    int32_t rightTreeLFX = calculateLF(x->right);
-    
-    // 执行旋转
     y->left = x->right;
-    if (x->right != SENTINEL) {
+    if (x->right != sentinel) {
         x->right->parent = y;
     }
-    
     x->parent = y->parent;
-    if (y->parent == SENTINEL) {
+
+    // fix size_left
+    y->size_left -= x->size_left + x->piece.length;
+    y->lf_left -= x->lf_left + x->piece.lineFeedCnt;
+
+    if (y->parent == sentinel) {
         tree->root = x;
-    } else if (y->parent->right == y) {
+    } else if (y == y->parent->right) {
         y->parent->right = x;
     } else {
         y->parent->left = x;
     }
-    
+
     x->right = y;
     y->parent = x;
-    
-    // 更新元数据
-    // 旋转后，y的左子树只包含x的右子树
-    y->size_left = rightTreeSizeX;
-    y->lf_left = rightTreeLFX;
-    
-    // 重新计算x的子树元数据
-    recomputeTreeMetadata(tree, y);
-    recomputeTreeMetadata(tree, x);
 }
 
 void rbDelete(PieceTreeBase* tree, TreeNode* z) {
+    TreeNode* sentinel = tree->sentinel();
     TreeNode* x;
     TreeNode* y;
 
-    if (z->left == SENTINEL) {
+    if (z->left == sentinel) {
         y = z;
         x = y->right;
-    } else if (z->right == SENTINEL) {
+    } else if (z->right == sentinel) {
         y = z;
         x = y->left;
     } else {
-        y = leftest(z->right);
+        y = leftest(z->right, sentinel);
         x = y->right;
     }
 
@@ -210,8 +238,8 @@ void rbDelete(PieceTreeBase* tree, TreeNode* z) {
         // if x is null, we are removing the only node
         x->color = NodeColor::Black;
         z->detach();
-        resetSentinel();
-        tree->root->parent = SENTINEL;
+        resetSentinel(tree);
+        tree->root->parent = sentinel;
 
         return;
     }
@@ -252,10 +280,10 @@ void rbDelete(PieceTreeBase* tree, TreeNode* z) {
             }
         }
 
-        if (y->left != SENTINEL) {
+        if (y->left != sentinel) {
             y->left->parent = y;
         }
-        if (y->right != SENTINEL) {
+        if (y->right != sentinel) {
             y->right->parent = y;
         }
         // update metadata
@@ -268,11 +296,11 @@ void rbDelete(PieceTreeBase* tree, TreeNode* z) {
     z->detach();
 
     if (x->parent->left == x) {
-        int32_t newSizeLeft = calculateSize(x);
-        int32_t newLFLeft = calculateLF(x);
+        Offset newSizeLeft = calculateSize(x, sentinel);
+        Offset newLFLeft = calculateLF(x, sentinel);
         if (newSizeLeft != x->parent->size_left || newLFLeft != x->parent->lf_left) {
-            int32_t delta = newSizeLeft - x->parent->size_left;
-            int32_t lf_delta = newLFLeft - x->parent->lf_left;
+            Offset delta = newSizeLeft - x->parent->size_left;
+            Offset lf_delta = newLFLeft - x->parent->lf_left;
             x->parent->size_left = newSizeLeft;
             x->parent->lf_left = newLFLeft;
             updateTreeMetadata(tree, x->parent, delta, lf_delta);
@@ -282,7 +310,7 @@ void rbDelete(PieceTreeBase* tree, TreeNode* z) {
     recomputeTreeMetadata(tree, x->parent);
 
     if (yWasRed) {
-        resetSentinel();
+        resetSentinel(tree);
         return;
     }
 
@@ -346,7 +374,7 @@ void rbDelete(PieceTreeBase* tree, TreeNode* z) {
         }
     }
     x->color = NodeColor::Black;
-    resetSentinel();
+    resetSentinel(tree);
 }
 
 void fixInsert(PieceTreeBase* tree, TreeNode* x) {
@@ -394,31 +422,54 @@ void fixInsert(PieceTreeBase* tree, TreeNode* x) {
     tree->root->color = NodeColor::Black;
 }
 
-void updateTreeMetadata(PieceTreeBase* tree, TreeNode* x, int32_t delta, int32_t lineFeedCntDelta) {
-    // Walk up the tree and update metadata
-    while (x != SENTINEL) {
-        if (delta != 0) {
-            x->size_left += delta;
-        }
-        
-        if (lineFeedCntDelta != 0) {
-            x->lf_left += lineFeedCntDelta;
+void updateTreeMetadata(PieceTreeBase* tree, TreeNode* x, Offset delta, Offset lineFeedCntDelta) {
+    TreeNode* sentinel = tree->sentinel();
+    // node length change or line feed count change
+    while (x != tree->root && x != sentinel) {
+        if (x->parent->left == x) {
+            x->parent->size_left += delta;
+            x->parent->lf_left += lineFeedCntDelta;
         }
-        
+
         x = x->parent;
     }
 }
 
 void recomputeTreeMetadata(PieceTreeBase* tree, TreeNode* x) {
-    if (x == SENTINEL) {
+    TreeNode* sentinel = tree->sentinel();
+    Offset delta = 0;
+    Offset lf_delta = 0;
+    if (x == tree->root) {
         return;
     }
-    
-    x->size_left = (x->left != SENTINEL ? x->left->size_left + x->left->piece->length + calculateSize(x->left->right) : 0);
-    x->lf_left = (x->left != SENTINEL ? x->left->lf_left + x->left->piece->lineFeedCnt + calculateLF(x->left->right) : 0);
-    
-    // Recursively recompute for the parent node
-    recomputeTreeMetadata(tree, x->parent);
+
+    // go upwards till the node whose left subtree is changed.
+    while (x != tree->root && x == x->parent->right) {
+        x = x->parent;
+    }
+
+    if (x == tree->root) {
+        // well, it means we add a node to the end (inorder)
+        return;
+    }
+
+    // x is the node whose right subtree is changed.
+    x = x->parent;
+
+    delta = calculateSize(x->left, sentinel) - x->size_left;
+    lf_delta = calculateLF(x->left, sentinel) - x->lf_left;
+    x->size_left += delta;
+    x->lf_left += lf_delta;
+
+    // go upwards till root. O(logN)
+    while (x != tree->root && (delta != 0 || lf_delta != 0)) {
+        if (x->parent->left == x) {
+            x->parent->size_left += delta;
+            x->parent->lf_left += lf_delta;
+        }
+
+        x = x->parent;
+    }
 }
 
 } // namespace textbuffer 
\ No newline at end of file
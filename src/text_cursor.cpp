@@ -0,0 +1,270 @@
+#include "textbuffer/text_cursor.h"
+
+namespace textbuffer {
+
+TextCursor::TextCursor(PieceTreeBase& tree, Offset offset)
+    : _tree(&tree), _version(tree.getVersion()), _offset(0), _lineNumber(0), _lineStart(0) {
+    seek(offset);
+}
+
+Offset TextCursor::offset() {
+    sync();
+    return _offset;
+}
+
+Offset TextCursor::lineNumber() {
+    sync();
+    return _lineNumber;
+}
+
+Offset TextCursor::column() {
+    sync();
+    return _offset - _lineStart;
+}
+
+const PieceIterator& TextCursor::piece() {
+    sync();
+    return _it;
+}
+
+void TextCursor::moveToOffset(Offset offset) {
+    seek(offset);
+}
+
+void TextCursor::moveToLine(Offset lineNumber) {
+    _version = _tree->getVersion();
+    _lineNumber = std::clamp<Offset>(lineNumber, 0, _tree->getLineCount() - 1);
+    _offset = _lineStart = _tree->getOffsetAt(_lineNumber, 0);
+    _it = _tree->pieceAt(_offset);
+    settle(_it, _offset);
+}
+
+bool TextCursor::nextLine() {
+    sync();
+    return _lineNumber + 1 < _tree->getLineCount() && moveLines(1);
+}
+
+bool TextCursor::prevLine() {
+    sync();
+    return _lineNumber > 0 && moveLines(-1);
+}
+
+bool TextCursor::moveLines(Offset delta) {
+    sync();
+    Offset target = std::clamp<Offset>(_lineNumber + delta, 0, _tree->getLineCount() - 1);
+    bool complete = target == _lineNumber + delta;
+    PieceIterator end = _tree->pieceEnd();
+    PieceIterator it = _it;
+    Offset lineStart = 0;
+    if (target == 0) {
+        it = _tree->pieceBegin();
+    } else {
+        // find the piece holding the line break the target line starts after
+        if (target > _lineNumber) {
+            while (it != end && target > it.lineNumber() + it->lineFeedCnt) {
+                ++it;
+            }
+        } else {
+            while (it.lineNumber() >= target && it.offset() > 0) {
+                --it;
+            }
+        }
+        lineStart = it == end ? it.offset() : it.offset() + lineStartInPiece(*it, target - it.lineNumber());
+    }
+    settle(it, lineStart);
+
+    _it = it;
+    _offset = _lineStart = lineStart;
+    _lineNumber = target;
+    return complete;
+}
+
+bool TextCursor::moveBytes(Offset delta) {
+    sync();
+    Offset target = std::clamp<Offset>(_offset + delta, 0, _tree->getLength());
+    bool complete = target == _offset + delta;
+    stepTo(target);
+    return complete;
+}
+
+bool TextCursor::nextPiece() {
+    sync();
+    PieceIterator end = _tree->pieceEnd();
+    if (_it == end) {
+        return false;
+    }
+    PieceIterator it = _it;
+    ++it;
+    settle(it, it.offset());
+    if (it == end) {
+        return false;
+    }
+    stepTo(it.offset());
+    return true;
+}
+
+bool TextCursor::prevPiece() {
+    sync();
+    if (_it.offset() == 0) {
+        return false;
+    }
+    // a non-empty piece lies before any piece not starting the text
+    PieceIterator it = _it;
+    do {
+        --it;
+    } while (it->length == 0);
+    stepTo(it.offset());
+    return true;
+}
+
+std::string TextCursor::lineContent() {
+    collectLineViews(_views);
+    size_t length = 0;
+    for (std::string_view view : _views) {
+        length += view.size();
+    }
+    std::string content;
+    content.reserve(length);
+    for (std::string_view view : _views) {
+        content.append(view.data(), view.size());
+    }
+    return content;
+}
+
+std::vector<std::string_view> TextCursor::lineViews() {
+    std::vector<std::string_view> views;
+    collectLineViews(views);
+    return views;
+}
+
+void TextCursor::collectLineViews(std::vector<std::string_view>& views) {
+    sync();
+    views.clear();
+    PieceIterator end = _tree->pieceEnd();
+    PieceIterator it = _it;
+    while (it.offset() > _lineStart) {
+        --it;
+    }
+    settle(it, _lineStart);
+
+    // the piece holding the line start has exactly the breaks of the lines before it
+    Offset remainder = _lineStart - it.offset();
+    Offset breaks = _lineNumber - it.lineNumber();
+    for (; it != end; ++it, remainder = 0, breaks = 0) {
+        const Piece& piece = *it;
+        bool lineEnds = breaks < piece.lineFeedCnt;
+        Offset stop = lineEnds ? lineStartInPiece(piece, breaks + 1) : piece.length;
+        if (stop > remainder) {
+            std::string_view buffer = _tree->_buffers[piece.bufferIndex]->text();
+            Offset start = _tree->offsetInBuffer(piece.bufferIndex, piece.start) + remainder;
+            views.emplace_back(buffer.data() + start, stop - remainder);
+        }
+        if (lineEnds) {
+            break;
+        }
+    }
+
+    // drop the line break, a "\r\n" may be split over two pieces
+    for (char eol : {'\n', '\r'}) {
+        if (!views.empty() && views.back().back() == eol) {
+            views.back().remove_suffix(1);
+            if (views.back().empty()) {
+                views.pop_back();
+            }
+        }
+    }
+}
+
+void TextCursor::sync() {
+    if (_version == _tree->getVersion()) {
+        return;
+    }
+    Offset offset = _offset;
+    _tree->mapOffset(_version, offset);
+    seek(offset);
+}
+
+void TextCursor::seek(Offset offset) {
+    _version = _tree->getVersion();
+    _offset = std::clamp<Offset>(offset, 0, _tree->getLength());
+    _it = _tree->pieceAt(_offset);
+    settle(_it, _offset);
+    _lineNumber = _it.lineNumber();
+    if (_it != _tree->pieceEnd()) {
+        _lineNumber += breaksUpTo(*_it, _offset - _it.offset());
+    }
+    _lineStart = _tree->getOffsetAt(_lineNumber, 0);
+}
+
+void TextCursor::stepTo(Offset offset) {
+    PieceIterator it = _it;
+    while (it.offset() > offset) {
+        --it;
+    }
+    settle(it, offset);
+
+    Offset lineNumber = it.lineNumber();
+    if (it != _tree->pieceEnd()) {
+        lineNumber += breaksUpTo(*it, offset - it.offset());
+    }
+    if (lineNumber != _lineNumber) {
+        PieceIterator lineIt = it;
+        _lineStart = findLineStart(lineIt, offset);
+    }
+    _it = it;
+    _offset = offset;
+    _lineNumber = lineNumber;
+}
+
+void TextCursor::settle(PieceIterator& it, Offset offset) const {
+    PieceIterator end = _tree->pieceEnd();
+    while (it != end && offset >= it.offset() + it->length) {
+        ++it;
+    }
+}
+
+Offset TextCursor::findLineStart(PieceIterator& it, Offset offset) const {
+    PieceIterator end = _tree->pieceEnd();
+    Offset remainder = offset - it.offset();
+    while (true) {
+        if (it != end) {
+            Offset breaks = breaksUpTo(*it, remainder);
+            if (breaks > 0) {
+                return it.offset() + lineStartInPiece(*it, breaks);
+            }
+        }
+        if (it.offset() == 0) {
+            return 0;
+        }
+        --it;
+        remainder = it->length;
+    }
+}
+
+Offset TextCursor::breaksUpTo(const Piece& piece, Offset remainder) const {
+    if (piece.lineFeedCnt == 0 || remainder <= 0) {
+        return 0;
+    }
+    if (remainder >= piece.length) {
+        return piece.lineFeedCnt;
+    }
+    // the k-th break of the piece ends at line start start.line + k of its buffer
+    LineStartsView lineStarts = _tree->_buffers[piece.bufferIndex]->getLineStarts();
+    Offset start = lineStarts[piece.start.line] + piece.start.column;
+    size_t first = piece.start.line + 1;
+    size_t last = first + std::min<size_t>(piece.lineFeedCnt, lineStarts.size() - first);
+    return lineStarts.upperBound(first, last, start + remainder) - first;
+}
+
+Offset TextCursor::lineStartInPiece(const Piece& piece, Offset k) const {
+    LineStartsView lineStarts = _tree->_buffers[piece.bufferIndex]->getLineStarts();
+    size_t index = piece.start.line + k;
+    if (index >= lineStarts.size()) {
+        return piece.length;
+    }
+    // a piece may end between the '\r' and '\n' of its buffer
+    Offset start = lineStarts[piece.start.line] + piece.start.column;
+    return std::min<Offset>(lineStarts[index] - start, piece.length);
+}
+
+} // namespace textbuffer
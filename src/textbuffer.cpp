@@ -29,19 +29,43 @@ std::string TextBuffer::getValueInRange(const common::Range& range) const {
     return _buffer->getValueInRange(range);
 }
 
-int32_t TextBuffer::getLength() const {
+Offset TextBuffer::getLength() const {
     return _buffer->getLength();
 }
 
-int32_t TextBuffer::getLineCount() const {
+Offset TextBuffer::getLineCount() const {
     return _buffer->getLineCount();
 }
 
-std::string TextBuffer::getLineContent(int32_t lineNumber) const {
+std::string TextBuffer::getLineContent(Offset lineNumber) const {
     return _buffer->getLineContent(lineNumber);
 }
 
-int32_t TextBuffer::getLineLength(int32_t lineNumber) const {
+std::vector<std::string_view> TextBuffer::getLineViews(Offset lineNumber) const {
+    return _buffer->getLineViews(lineNumber);
+}
+
+std::vector<std::string_view> TextBuffer::getRangeViews(Offset start, Offset end) const {
+    return _buffer->getRangeViews(start, end);
+}
+
+bool TextBuffer::forEachChunk(Offset start, Offset end, const std::function<bool(std::string_view)>& callback) const {
+    return _buffer->forEachChunk(start, end, callback);
+}
+
+bool TextBuffer::forEachChunk(const common::Range& range, const std::function<bool(std::string_view)>& callback) const {
+    return _buffer->forEachChunk(range, callback);
+}
+
+size_t TextBuffer::copyRange(Offset start, Offset end, char* dst, size_t capacity) const {
+    return _buffer->copyRange(start, end, dst, capacity);
+}
+
+size_t TextBuffer::copyRange(const common::Range& range, char* dst, size_t capacity) const {
+    return _buffer->copyRange(range, dst, capacity);
+}
+
+Offset TextBuffer::getLineLength(Offset lineNumber) const {
     return _buffer->getLineLength(lineNumber);
 }
 
@@ -53,24 +77,64 @@ void TextBuffer::setEOL(const std::string& eol) {
     _buffer->setEOL(eol);
 }
 
-common::Position TextBuffer::getPositionAt(int32_t offset) const {
+common::Position TextBuffer::getPositionAt(Offset offset) const {
     return _buffer->getPositionAt(offset);
 }
 
-int32_t TextBuffer::getOffsetAt(int32_t lineNumber, int32_t column) const {
+Offset TextBuffer::getOffsetAt(Offset lineNumber, Offset column) const {
     return _buffer->getOffsetAt(lineNumber, column);
 }
 
-void TextBuffer::insert(int32_t offset, const std::string& text, bool eolNormalized) {
+void TextBuffer::insert(Offset offset, const std::string& text, bool eolNormalized) {
     _buffer->insert(offset, text, eolNormalized);
 }
 
-void TextBuffer::deleteText(int32_t offset, int32_t count) {
+void TextBuffer::deleteText(Offset offset, Offset count) {
     _buffer->deleteText(offset, count);
 }
 
+std::vector<TextEdit> TextBuffer::applyEdits(std::vector<TextEdit> edits, bool eolNormalized) {
+    return _buffer->applyEdits(std::move(edits), eolNormalized);
+}
+
 std::unique_ptr<ITextSnapshot> TextBuffer::createSnapshot(const std::string& BOM) const {
     return _buffer->createSnapshot(BOM);
 }
 
+void TextBuffer::setPersistentSnapshots(bool enabled) {
+    _buffer->setPersistentSnapshots(enabled);
+}
+
+void TextBuffer::setUndoHistory(bool enabled) {
+    _buffer->setUndoHistory(enabled);
+}
+
+void TextBuffer::setUndoLimits(size_t maxSteps, size_t maxBytes) {
+    _buffer->setUndoLimits(maxSteps, maxBytes);
+}
+
+void TextBuffer::beginTransaction() {
+    _buffer->beginTransaction();
+}
+
+void TextBuffer::endTransaction() {
+    _buffer->endTransaction();
+}
+
+bool TextBuffer::undo() {
+    return _buffer->undo();
+}
+
+bool TextBuffer::redo() {
+    return _buffer->redo();
+}
+
+bool TextBuffer::canUndo() const {
+    return _buffer->canUndo();
+}
+
+bool TextBuffer::canRedo() const {
+    return _buffer->canRedo();
+}
+
 } // namespace textbuffer 
\ No newline at end of file